@@ -327,6 +327,29 @@ static inline int pte_hidden(pte_t pte)
 	return pte_flags(pte) & _PAGE_HIDDEN;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Only meaningful in VMAs that allow some kind of access, a PROT_NONE
+ * mapping uses the same encoding.
+ */
+static inline int pte_numa(pte_t pte)
+{
+	return (pte_flags(pte) & (_PAGE_NUMA | _PAGE_PRESENT)) == _PAGE_NUMA;
+}
+
+static inline pte_t pte_mknuma(pte_t pte)
+{
+	pte = pte_set_flags(pte, _PAGE_NUMA);
+	return pte_clear_flags(pte, _PAGE_PRESENT);
+}
+
+static inline pte_t pte_mknonnuma(pte_t pte)
+{
+	pte = pte_clear_flags(pte, _PAGE_NUMA);
+	return pte_set_flags(pte, _PAGE_PRESENT | _PAGE_ACCESSED);
+}
+#endif
+
 static inline int pmd_present(pmd_t pmd)
 {
 	return pmd_flags(pmd) & _PAGE_PRESENT;
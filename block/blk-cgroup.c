@@ -67,12 +67,13 @@ static inline void blkio_policy_delete_node(struct blkio_policy_node *pn)
 
 /* Must be called with blkcg->lock held */
 static struct blkio_policy_node *
-blkio_policy_search_node(const struct blkio_cgroup *blkcg, dev_t dev)
+blkio_policy_search_node(const struct blkio_cgroup *blkcg, dev_t dev,
+			 enum blkio_policy_id plid, int fileid)
 {
 	struct blkio_policy_node *pn;
 
 	list_for_each_entry(pn, &blkcg->policy_list, node) {
-		if (pn->dev == dev)
+		if (pn->dev == dev && pn->plid == plid && pn->fileid == fileid)
 			return pn;
 	}
 
@@ -341,7 +342,8 @@ void blkiocg_update_io_merged_stats(struct blkio_group *blkg, bool direction,
 EXPORT_SYMBOL_GPL(blkiocg_update_io_merged_stats);
 
 void blkiocg_add_blkio_group(struct blkio_cgroup *blkcg,
-			struct blkio_group *blkg, void *key, dev_t dev)
+			struct blkio_group *blkg, void *key, dev_t dev,
+			enum blkio_policy_id plid)
 {
 	unsigned long flags;
 
@@ -349,6 +351,7 @@ void blkiocg_add_blkio_group(struct blkio_cgroup *blkcg,
 	spin_lock_init(&blkg->stats_lock);
 	rcu_assign_pointer(blkg->key, key);
 	blkg->blkcg_id = css_id(&blkcg->css);
+	blkg->plid = plid;
 	hlist_add_head_rcu(&blkg->blkcg_node, &blkcg->blkg_list);
 	spin_unlock_irqrestore(&blkcg->lock, flags);
 	/* Need to take css reference ? */
@@ -439,14 +442,20 @@ blkiocg_weight_write(struct cgroup *cgroup, struct cftype *cftype, u64 val)
 	blkcg->weight = (unsigned int)val;
 
 	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {
-		pn = blkio_policy_search_node(blkcg, blkg->dev);
+		if (blkg->plid != BLKIO_POLICY_PROP)
+			continue;
 
+		pn = blkio_policy_search_node(blkcg, blkg->dev,
+				BLKIO_POLICY_PROP, BLKIO_PROP_weight_device);
 		if (pn)
 			continue;
 
-		list_for_each_entry(blkiop, &blkio_list, list)
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid != BLKIO_POLICY_PROP)
+				continue;
 			blkiop->ops.blkio_update_group_weight_fn(blkg,
 					blkcg->weight);
+		}
 	}
 	spin_unlock_irq(&blkcg->lock);
 	spin_unlock(&blkio_list_lock);
@@ -593,7 +602,7 @@ static uint64_t blkio_get_stat(struct blkio_group *blkg,
 	return disk_total;
 }
 
-#define SHOW_FUNCTION_PER_GROUP(__VAR, type, show_total)		\
+#define SHOW_FUNCTION_PER_GROUP(__VAR, __plid, type, show_total)	\
 static int blkiocg_##__VAR##_read(struct cgroup *cgroup,		\
 		struct cftype *cftype, struct cgroup_map_cb *cb)	\
 {									\
@@ -608,7 +617,7 @@ static int blkiocg_##__VAR##_read(struct cgroup *cgroup,		\
 	blkcg = cgroup_to_blkio_cgroup(cgroup);				\
 	rcu_read_lock();						\
 	hlist_for_each_entry_rcu(blkg, n, &blkcg->blkg_list, blkcg_node) {\
-		if (blkg->dev) {					\
+		if (blkg->dev && blkg->plid == __plid) {		\
 			spin_lock_irq(&blkg->stats_lock);		\
 			cgroup_total += blkio_get_stat(blkg, cb,	\
 						blkg->dev, type);	\
@@ -622,20 +631,32 @@ static int blkiocg_##__VAR##_read(struct cgroup *cgroup,		\
 	return 0;							\
 }
 
-SHOW_FUNCTION_PER_GROUP(time, BLKIO_STAT_TIME, 0);
-SHOW_FUNCTION_PER_GROUP(sectors, BLKIO_STAT_SECTORS, 0);
-SHOW_FUNCTION_PER_GROUP(io_service_bytes, BLKIO_STAT_SERVICE_BYTES, 1);
-SHOW_FUNCTION_PER_GROUP(io_serviced, BLKIO_STAT_SERVICED, 1);
-SHOW_FUNCTION_PER_GROUP(io_service_time, BLKIO_STAT_SERVICE_TIME, 1);
-SHOW_FUNCTION_PER_GROUP(io_wait_time, BLKIO_STAT_WAIT_TIME, 1);
-SHOW_FUNCTION_PER_GROUP(io_merged, BLKIO_STAT_MERGED, 1);
-SHOW_FUNCTION_PER_GROUP(io_queued, BLKIO_STAT_QUEUED, 1);
+SHOW_FUNCTION_PER_GROUP(time, BLKIO_POLICY_PROP, BLKIO_STAT_TIME, 0);
+SHOW_FUNCTION_PER_GROUP(sectors, BLKIO_POLICY_PROP, BLKIO_STAT_SECTORS, 0);
+SHOW_FUNCTION_PER_GROUP(io_service_bytes, BLKIO_POLICY_PROP,
+			BLKIO_STAT_SERVICE_BYTES, 1);
+SHOW_FUNCTION_PER_GROUP(io_serviced, BLKIO_POLICY_PROP, BLKIO_STAT_SERVICED, 1);
+SHOW_FUNCTION_PER_GROUP(io_service_time, BLKIO_POLICY_PROP,
+			BLKIO_STAT_SERVICE_TIME, 1);
+SHOW_FUNCTION_PER_GROUP(io_wait_time, BLKIO_POLICY_PROP,
+			BLKIO_STAT_WAIT_TIME, 1);
+SHOW_FUNCTION_PER_GROUP(io_merged, BLKIO_POLICY_PROP, BLKIO_STAT_MERGED, 1);
+SHOW_FUNCTION_PER_GROUP(io_queued, BLKIO_POLICY_PROP, BLKIO_STAT_QUEUED, 1);
+#ifdef CONFIG_BLK_DEV_THROTTLING
+SHOW_FUNCTION_PER_GROUP(throtl_io_service_bytes, BLKIO_POLICY_THROTL,
+			BLKIO_STAT_SERVICE_BYTES, 1);
+SHOW_FUNCTION_PER_GROUP(throtl_io_serviced, BLKIO_POLICY_THROTL,
+			BLKIO_STAT_SERVICED, 1);
+#endif
 #ifdef CONFIG_DEBUG_BLK_CGROUP
-SHOW_FUNCTION_PER_GROUP(dequeue, BLKIO_STAT_DEQUEUE, 0);
-SHOW_FUNCTION_PER_GROUP(avg_queue_size, BLKIO_STAT_AVG_QUEUE_SIZE, 0);
-SHOW_FUNCTION_PER_GROUP(group_wait_time, BLKIO_STAT_GROUP_WAIT_TIME, 0);
-SHOW_FUNCTION_PER_GROUP(idle_time, BLKIO_STAT_IDLE_TIME, 0);
-SHOW_FUNCTION_PER_GROUP(empty_time, BLKIO_STAT_EMPTY_TIME, 0);
+SHOW_FUNCTION_PER_GROUP(dequeue, BLKIO_POLICY_PROP, BLKIO_STAT_DEQUEUE, 0);
+SHOW_FUNCTION_PER_GROUP(avg_queue_size, BLKIO_POLICY_PROP,
+			BLKIO_STAT_AVG_QUEUE_SIZE, 0);
+SHOW_FUNCTION_PER_GROUP(group_wait_time, BLKIO_POLICY_PROP,
+			BLKIO_STAT_GROUP_WAIT_TIME, 0);
+SHOW_FUNCTION_PER_GROUP(idle_time, BLKIO_POLICY_PROP, BLKIO_STAT_IDLE_TIME, 0);
+SHOW_FUNCTION_PER_GROUP(empty_time, BLKIO_POLICY_PROP,
+			BLKIO_STAT_EMPTY_TIME, 0);
 #endif
 #undef SHOW_FUNCTION_PER_GROUP
 
@@ -656,7 +677,8 @@ static int blkio_policy_parse_and_set(char *buf,
 {
 	char *s[4], *p, *major_s = NULL, *minor_s = NULL;
 	int ret;
-	unsigned long major, minor, temp;
+	unsigned long major, minor;
+	unsigned long long temp;
 	int i = 0;
 	dev_t dev;
 
@@ -705,12 +727,24 @@ static int blkio_policy_parse_and_set(char *buf,
 	if (s[1] == NULL)
 		return -EINVAL;
 
-	ret = strict_strtoul(s[1], 10, &temp);
-	if (ret || (temp < BLKIO_WEIGHT_MIN && temp > 0) ||
-	    temp > BLKIO_WEIGHT_MAX)
+	ret = strict_strtoull(s[1], 10, &temp);
+	if (ret)
 		return -EINVAL;
 
-	newpn->weight =  temp;
+	switch (newpn->plid) {
+	case BLKIO_POLICY_PROP:
+		if ((temp < BLKIO_WEIGHT_MIN && temp > 0) ||
+		    temp > BLKIO_WEIGHT_MAX)
+			return -EINVAL;
+		newpn->val.weight = temp;
+		break;
+	case BLKIO_POLICY_THROTL:
+		/* 0 removes the rule, so it cannot be a limit */
+		newpn->val.limit = temp;
+		break;
+	default:
+		BUG();
+	}
 
 	return 0;
 }
@@ -720,26 +754,91 @@ unsigned int blkcg_get_weight(struct blkio_cgroup *blkcg,
 {
 	struct blkio_policy_node *pn;
 
-	pn = blkio_policy_search_node(blkcg, dev);
+	pn = blkio_policy_search_node(blkcg, dev, BLKIO_POLICY_PROP,
+				      BLKIO_PROP_weight_device);
 	if (pn)
-		return pn->weight;
+		return pn->val.weight;
 	else
 		return blkcg->weight;
 }
 EXPORT_SYMBOL_GPL(blkcg_get_weight);
 
+/*
+ * Returns the throttling limit of @fileid on @dev, or BLKIO_LIMIT_NONE if
+ * the cgroup has no such rule.
+ */
+u64 blkcg_get_limit(struct blkio_cgroup *blkcg, dev_t dev, int fileid)
+{
+	struct blkio_policy_node *pn;
+	unsigned long flags;
+	u64 limit = BLKIO_LIMIT_NONE;
+
+	spin_lock_irqsave(&blkcg->lock, flags);
+	pn = blkio_policy_search_node(blkcg, dev, BLKIO_POLICY_THROTL, fileid);
+	if (pn)
+		limit = pn->val.limit;
+	spin_unlock_irqrestore(&blkcg->lock, flags);
+
+	return limit;
+}
+EXPORT_SYMBOL_GPL(blkcg_get_limit);
+
+/*
+ * cftype->private of the per-device rule files: the policy in the upper
+ * half, the rule (enum blkio_prop_file or blkio_throtl_file) in the lower.
+ */
+#define BLKIOFILE_PRIVATE(plid, fileid)	(((plid) << 16) | (fileid))
+#define BLKIOFILE_POLICY(private)	(((private) >> 16) & 0xffff)
+#define BLKIOFILE_ATTR(private)		((private) & 0xffff)
+
+/*
+ * Tell the policy owning @newpn about a changed rule, for every group of
+ * the cgroup on that device.  A zero value means the rule was removed.
+ */
+static void blkio_update_policy_rule(struct blkio_cgroup *blkcg,
+				     struct blkio_policy_node *newpn)
+{
+	struct blkio_group *blkg;
+	struct hlist_node *n;
+	struct blkio_policy_type *blkiop;
+
+	spin_lock(&blkio_list_lock);
+	spin_lock_irq(&blkcg->lock);
+
+	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {
+		if (newpn->dev != blkg->dev || newpn->plid != blkg->plid)
+			continue;
+
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid != blkg->plid)
+				continue;
+
+			if (newpn->plid == BLKIO_POLICY_PROP)
+				blkiop->ops.blkio_update_group_weight_fn(blkg,
+						newpn->val.weight ?
+						newpn->val.weight :
+						blkcg->weight);
+			else
+				blkiop->ops.blkio_update_group_limit_fn(
+						blkg->key, blkg, newpn->fileid,
+						newpn->val.limit ?
+						newpn->val.limit :
+						BLKIO_LIMIT_NONE);
+		}
+	}
+
+	spin_unlock_irq(&blkcg->lock);
+	spin_unlock(&blkio_list_lock);
+}
 
-static int blkiocg_weight_device_write(struct cgroup *cgrp, struct cftype *cft,
-				       const char *buffer)
+static int blkiocg_file_write(struct cgroup *cgrp, struct cftype *cft,
+			      const char *buffer)
 {
 	int ret = 0;
 	char *buf;
 	struct blkio_policy_node *newpn, *pn;
 	struct blkio_cgroup *blkcg;
-	struct blkio_group *blkg;
 	int keep_newpn = 0;
-	struct hlist_node *n;
-	struct blkio_policy_type *blkiop;
 
 	buf = kstrdup(buffer, GFP_KERNEL);
 	if (!buf)
@@ -751,6 +850,9 @@ static int blkiocg_weight_device_write(struct cgroup *cgrp, struct cftype *cft,
 		goto free_buf;
 	}
 
+	newpn->plid = BLKIOFILE_POLICY(cft->private);
+	newpn->fileid = BLKIOFILE_ATTR(cft->private);
+
 	ret = blkio_policy_parse_and_set(buf, newpn);
 	if (ret)
 		goto free_newpn;
@@ -759,43 +861,26 @@ static int blkiocg_weight_device_write(struct cgroup *cgrp, struct cftype *cft,
 
 	spin_lock_irq(&blkcg->lock);
 
-	pn = blkio_policy_search_node(blkcg, newpn->dev);
+	pn = blkio_policy_search_node(blkcg, newpn->dev, newpn->plid,
+				      newpn->fileid);
 	if (!pn) {
-		if (newpn->weight != 0) {
+		/*
+		 * A zero value deletes a specific rule.  newpn was zeroed
+		 * on allocation, so testing the limit covers a weight too.
+		 */
+		if (newpn->val.limit != 0) {
 			blkio_policy_insert_node(blkcg, newpn);
 			keep_newpn = 1;
 		}
-		spin_unlock_irq(&blkcg->lock);
-		goto update_io_group;
-	}
-
-	if (newpn->weight == 0) {
-		/* weight == 0 means deleteing a specific weight */
+	} else if (newpn->val.limit == 0) {
 		blkio_policy_delete_node(pn);
-		spin_unlock_irq(&blkcg->lock);
-		goto update_io_group;
+		kfree(pn);
+	} else {
+		pn->val = newpn->val;
 	}
 	spin_unlock_irq(&blkcg->lock);
 
-	pn->weight = newpn->weight;
-
-update_io_group:
-	/* update weight for each cfqg */
-	spin_lock(&blkio_list_lock);
-	spin_lock_irq(&blkcg->lock);
-
-	hlist_for_each_entry(blkg, n, &blkcg->blkg_list, blkcg_node) {
-		if (newpn->dev == blkg->dev) {
-			list_for_each_entry(blkiop, &blkio_list, list)
-				blkiop->ops.blkio_update_group_weight_fn(blkg,
-							 newpn->weight ?
-							 newpn->weight :
-							 blkcg->weight);
-		}
-	}
-
-	spin_unlock_irq(&blkcg->lock);
-	spin_unlock(&blkio_list_lock);
+	blkio_update_policy_rule(blkcg, newpn);
 
 free_newpn:
 	if (!keep_newpn)
@@ -805,20 +890,31 @@ free_buf:
 	return ret;
 }
 
-static int blkiocg_weight_device_read(struct cgroup *cgrp, struct cftype *cft,
-				      struct seq_file *m)
+static int blkiocg_file_read(struct cgroup *cgrp, struct cftype *cft,
+			     struct seq_file *m)
 {
 	struct blkio_cgroup *blkcg;
 	struct blkio_policy_node *pn;
+	enum blkio_policy_id plid = BLKIOFILE_POLICY(cft->private);
+	int fileid = BLKIOFILE_ATTR(cft->private);
 
-	seq_printf(m, "dev\tweight\n");
+	if (plid == BLKIO_POLICY_PROP)
+		seq_printf(m, "dev\tweight\n");
 
 	blkcg = cgroup_to_blkio_cgroup(cgrp);
 	if (!list_empty(&blkcg->policy_list)) {
 		spin_lock_irq(&blkcg->lock);
 		list_for_each_entry(pn, &blkcg->policy_list, node) {
-			seq_printf(m, "%u:%u\t%u\n", MAJOR(pn->dev),
-				   MINOR(pn->dev), pn->weight);
+			if (pn->plid != plid || pn->fileid != fileid)
+				continue;
+
+			if (plid == BLKIO_POLICY_PROP)
+				seq_printf(m, "%u:%u\t%u\n", MAJOR(pn->dev),
+					   MINOR(pn->dev), pn->val.weight);
+			else
+				seq_printf(m, "%u:%u\t%llu\n", MAJOR(pn->dev),
+					   MINOR(pn->dev),
+					   (unsigned long long)pn->val.limit);
 		}
 		spin_unlock_irq(&blkcg->lock);
 	}
@@ -829,8 +925,10 @@ static int blkiocg_weight_device_read(struct cgroup *cgrp, struct cftype *cft,
 struct cftype blkio_files[] = {
 	{
 		.name = "weight_device",
-		.read_seq_string = blkiocg_weight_device_read,
-		.write_string = blkiocg_weight_device_write,
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_PROP,
+					     BLKIO_PROP_weight_device),
+		.read_seq_string = blkiocg_file_read,
+		.write_string = blkiocg_file_write,
 		.max_write_len = 256,
 	},
 	{
@@ -874,6 +972,48 @@ struct cftype blkio_files[] = {
 		.name = "reset_stats",
 		.write_u64 = blkiocg_reset_stats,
 	},
+#ifdef CONFIG_BLK_DEV_THROTTLING
+	{
+		.name = "throttle.read_bps_device",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_THROTL,
+					     BLKIO_THROTL_read_bps_device),
+		.read_seq_string = blkiocg_file_read,
+		.write_string = blkiocg_file_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "throttle.write_bps_device",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_THROTL,
+					     BLKIO_THROTL_write_bps_device),
+		.read_seq_string = blkiocg_file_read,
+		.write_string = blkiocg_file_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "throttle.read_iops_device",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_THROTL,
+					     BLKIO_THROTL_read_iops_device),
+		.read_seq_string = blkiocg_file_read,
+		.write_string = blkiocg_file_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "throttle.write_iops_device",
+		.private = BLKIOFILE_PRIVATE(BLKIO_POLICY_THROTL,
+					     BLKIO_THROTL_write_iops_device),
+		.read_seq_string = blkiocg_file_read,
+		.write_string = blkiocg_file_write,
+		.max_write_len = 256,
+	},
+	{
+		.name = "throttle.io_service_bytes",
+		.read_map = blkiocg_throtl_io_service_bytes_read,
+	},
+	{
+		.name = "throttle.io_serviced",
+		.read_map = blkiocg_throtl_io_serviced_read,
+	},
+#endif
 #ifdef CONFIG_DEBUG_BLK_CGROUP
 	{
 		.name = "avg_queue_size",
@@ -931,14 +1071,15 @@ static void blkiocg_destroy(struct cgroup_subsys *subsys, struct cgroup *cgroup)
 
 		/*
 		 * This blkio_group is being unlinked as associated cgroup is
-		 * going away. Let all the IO controlling policies know about
-		 * this event. Currently this is static call to one io
-		 * controlling policy. Once we have more policies in place, we
-		 * need some dynamic registration of callback function.
+		 * going away. Let the IO controlling policy which owns the
+		 * group know about this event.
 		 */
 		spin_lock(&blkio_list_lock);
-		list_for_each_entry(blkiop, &blkio_list, list)
+		list_for_each_entry(blkiop, &blkio_list, list) {
+			if (blkiop->plid != blkg->plid)
+				continue;
 			blkiop->ops.blkio_unlink_group_fn(key, blkg);
+		}
 		spin_unlock(&blkio_list_lock);
 	} while (1);
 
@@ -964,10 +1105,6 @@ blkiocg_create(struct cgroup_subsys *subsys, struct cgroup *cgroup)
 		goto done;
 	}
 
-	/* Currently we do not support hierarchy deeper than two level (0,1) */
-	if (parent != cgroup->top_cgroup)
-		return ERR_PTR(-EPERM);
-
 	blkcg = kzalloc(sizeof(*blkcg), GFP_KERNEL);
 	if (!blkcg)
 		return ERR_PTR(-ENOMEM);
@@ -16,6 +16,7 @@
 #include <linux/backing-dev.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/highmem.h>
 #include <linux/mm.h>
 #include <linux/kernel_stat.h>
@@ -27,6 +28,7 @@
 #include <linux/writeback.h>
 #include <linux/task_io_accounting_ops.h>
 #include <linux/fault-inject.h>
+#include <linux/list_sort.h>
 
 #define CREATE_TRACE_POINTS
 #include <trace/events/block.h>
@@ -54,7 +56,7 @@ struct kmem_cache *blk_requestq_cachep;
  */
 static struct workqueue_struct *kblockd_workqueue;
 
-static void drive_stat_acct(struct request *rq, int new_io)
+void drive_stat_acct(struct request *rq, int new_io)
 {
 	struct hd_struct *part;
 	int rw = rq_data_dir(rq);
@@ -379,9 +381,15 @@ EXPORT_SYMBOL(blk_stop_queue);
  */
 void blk_sync_queue(struct request_queue *q)
 {
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
 	del_timer_sync(&q->unplug_timer);
 	del_timer_sync(&q->timeout);
 	cancel_work_sync(&q->unplug_work);
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		cancel_work_sync(&hctx->run_work);
 }
 EXPORT_SYMBOL(blk_sync_queue);
 
@@ -452,12 +460,17 @@ void blk_cleanup_queue(struct request_queue *q)
 	blk_sync_queue(q);
 
 	del_timer_sync(&q->backing_dev_info.laptop_mode_wb_timer);
+
+	blk_throtl_exit(q);
+
 	mutex_lock(&q->sysfs_lock);
 	queue_flag_set_unlocked(QUEUE_FLAG_DEAD, q);
 	mutex_unlock(&q->sysfs_lock);
 
 	if (q->elevator)
 		elevator_exit(q->elevator);
+	if (q->mq_ops)
+		blk_mq_free_queue(q);
 
 	blk_put_queue(q);
 }
@@ -527,6 +540,19 @@ struct request_queue *blk_alloc_queue_node(gfp_t gfp_mask, int node_id)
 	mutex_init(&q->sysfs_lock);
 	spin_lock_init(&q->__queue_lock);
 
+	/*
+	 * Throttling takes the queue lock before the driver got to set up
+	 * its own, start out with the internal one.
+	 */
+	q->queue_lock = &q->__queue_lock;
+	q->node = node_id;
+
+	if (blk_throtl_init(q)) {
+		bdi_destroy(&q->backing_dev_info);
+		kmem_cache_free(blk_requestq_cachep, q);
+		return NULL;
+	}
+
 	return q;
 }
 EXPORT_SYMBOL(blk_alloc_queue_node);
@@ -894,6 +920,9 @@ struct request *blk_get_request(struct request_queue *q, int rw, gfp_t gfp_mask)
 
 	BUG_ON(rw != READ && rw != WRITE);
 
+	if (q->mq_ops)
+		return blk_mq_alloc_request(q, rw, gfp_mask);
+
 	spin_lock_irq(q->queue_lock);
 	if (gfp_mask & __GFP_WAIT) {
 		rq = get_request_wait(q, rw, NULL);
@@ -1053,18 +1082,25 @@ static inline void add_request(struct request_queue *q, struct request *req)
 	__elv_add_request(q, req, ELEVATOR_INSERT_SORT, 0);
 }
 
+/*
+ * Plugged and blk-mq requests are accounted without the queue_lock, so
+ * only the caller which moves ->stamp on accounts the time since.
+ */
 static void part_round_stats_single(int cpu, struct hd_struct *part,
 				    unsigned long now)
 {
-	if (now == part->stamp)
+	unsigned long stamp = part->stamp;
+	int inflight;
+
+	if (now == stamp || cmpxchg(&part->stamp, stamp, now) != stamp)
 		return;
 
-	if (part_in_flight(part)) {
+	inflight = part_in_flight(part);
+	if (inflight) {
 		__part_stat_add(cpu, part, time_in_queue,
-				part_in_flight(part) * (now - part->stamp));
-		__part_stat_add(cpu, part, io_ticks, (now - part->stamp));
+				inflight * (now - stamp));
+		__part_stat_add(cpu, part, io_ticks, (now - stamp));
 	}
-	part->stamp = now;
 }
 
 /**
@@ -1103,6 +1139,13 @@ void __blk_put_request(struct request_queue *q, struct request *req)
 	if (unlikely(--req->ref_count))
 		return;
 
+	if (q->mq_ops) {
+		/* this is a bio leak */
+		WARN_ON(req->bio != NULL);
+		blk_mq_free_request(req);
+		return;
+	}
+
 	elv_completed_request(q, req);
 
 	/* this is a bio leak */
@@ -1192,8 +1235,55 @@ static inline bool queue_should_plug(struct request_queue *q)
 	return !(blk_queue_nonrot(q) && blk_queue_tagged(q));
 }
 
+/*
+ * Try to merge @bio into a request the task holds in its plug.  The plug
+ * is private to the task, so no lock is needed.
+ */
+static bool attempt_plug_merge(struct task_struct *tsk,
+			       struct request_queue *q, struct bio *bio)
+{
+	const unsigned long ff = bio->bi_rw & REQ_FAILFAST_MASK;
+	struct blk_plug *plug = tsk->plug;
+	struct request *req;
+
+	if (!plug)
+		return false;
+
+	list_for_each_entry_reverse(req, &plug->list, queuelist) {
+		if (req->q != q || !elv_rq_merge_ok(req, bio))
+			continue;
+
+		if (blk_rq_pos(req) + blk_rq_sectors(req) == bio->bi_sector) {
+			if (!ll_back_merge_fn(q, req, bio))
+				return false;
+			trace_block_bio_backmerge(q, bio);
+			req->biotail->bi_next = bio;
+			req->biotail = bio;
+		} else if (blk_rq_pos(req) - bio_sectors(bio) == bio->bi_sector) {
+			if (!ll_front_merge_fn(q, req, bio))
+				return false;
+			trace_block_bio_frontmerge(q, bio);
+			bio->bi_next = req->bio;
+			req->bio = bio;
+			req->buffer = bio_data(bio);
+			req->__sector = bio->bi_sector;
+		} else
+			continue;
+
+		if ((req->cmd_flags & REQ_FAILFAST_MASK) != ff)
+			blk_rq_set_mixed_merge(req);
+		req->__data_len += bio->bi_size;
+		req->ioprio = ioprio_best(req->ioprio, bio_prio(bio));
+		drive_stat_acct(req, 0);
+		return true;
+	}
+
+	return false;
+}
+
 static int __make_request(struct request_queue *q, struct bio *bio)
 {
+	struct blk_plug *plug;
 	struct request *req;
 	int el_ret;
 	unsigned int bytes = bio->bi_size;
@@ -1215,6 +1305,15 @@ static int __make_request(struct request_queue *q, struct bio *bio)
 	 */
 	blk_queue_bounce(q, &bio);
 
+	/*
+	 * A barrier must not pass the requests held in the plug, the
+	 * others can join them.
+	 */
+	if (unlikely(bio->bi_rw & REQ_HARDBARRIER))
+		blk_flush_plug(current);
+	else if (attempt_plug_merge(current, q, bio))
+		return 0;
+
 	spin_lock_irq(q->queue_lock);
 
 	if (unlikely((bio->bi_rw & REQ_HARDBARRIER)) || elv_queue_empty(q))
@@ -1308,6 +1407,22 @@ get_rq:
 	 */
 	init_request_from_bio(req, bio);
 
+	plug = current->plug;
+	if (plug && !(bio->bi_rw & REQ_HARDBARRIER)) {
+		if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
+		    bio_flagged(bio, BIO_CPU_AFFINE))
+			req->cpu = blk_cpu_to_group(raw_smp_processor_id());
+		if (!plug->should_sort && !list_empty(&plug->list)) {
+			struct request *last = list_entry_rq(plug->list.prev);
+
+			if (last->q != q)
+				plug->should_sort = 1;
+		}
+		list_add_tail(&req->queuelist, &plug->list);
+		drive_stat_acct(req, 1);
+		return 0;
+	}
+
 	spin_lock_irq(q->queue_lock);
 	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags) ||
 	    bio_flagged(bio, BIO_CPU_AFFINE))
@@ -1522,6 +1637,10 @@ static inline void __generic_make_request(struct bio *bio)
 			goto end_io;
 		}
 
+		/* Held back by the cgroup's limits, resubmitted later */
+		if (blk_throtl_bio(q, bio))
+			break;
+
 		trace_block_bio_queue(q, bio);
 
 		ret = q->make_request_fn(q, bio);
@@ -1765,7 +1884,7 @@ static void blk_account_io_completion(struct request *req, unsigned int bytes)
 	}
 }
 
-static void blk_account_io_done(struct request *req)
+void blk_account_io_done(struct request *req)
 {
 	/*
 	 * Account IO completion.  bar_rq isn't accounted as a normal
@@ -2579,6 +2698,98 @@ int kblockd_schedule_work(struct request_queue *q, struct work_struct *work)
 }
 EXPORT_SYMBOL(kblockd_schedule_work);
 
+int kblockd_schedule_delayed_work(struct request_queue *q,
+				  struct delayed_work *dwork,
+				  unsigned long delay)
+{
+	return queue_delayed_work(kblockd_workqueue, dwork, delay);
+}
+EXPORT_SYMBOL(kblockd_schedule_delayed_work);
+
+/**
+ * blk_start_plug - hold back the requests the task submits
+ * @plug:	the plug, on the stack of the caller
+ *
+ * Description:
+ *     Until blk_finish_plug(), requests made by __make_request() are
+ *     kept on @plug, where later bios can merge into them without taking
+ *     the queue lock.  They are added to their queues, and the queues
+ *     run, when the plug is finished or the task goes to sleep.
+ */
+void blk_start_plug(struct blk_plug *plug)
+{
+	struct task_struct *tsk = current;
+
+	INIT_LIST_HEAD(&plug->list);
+	plug->should_sort = 0;
+
+	/*
+	 * If this is a nested plug, don't actually assign it.  It will be
+	 * flushed on its own.
+	 */
+	if (!tsk->plug)
+		tsk->plug = plug;
+}
+EXPORT_SYMBOL(blk_start_plug);
+
+static int plug_rq_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	struct request *rqa = container_of(a, struct request, queuelist);
+	struct request *rqb = container_of(b, struct request, queuelist);
+
+	return !(rqa->q <= rqb->q);
+}
+
+/*
+ * Add the requests of @plug to their queues, taking the lock of each
+ * queue once.  The sort is stable, so the requests of one queue keep the
+ * order they were submitted in.
+ */
+void blk_flush_plug_list(struct blk_plug *plug)
+{
+	struct request_queue *q = NULL;
+	unsigned long flags;
+	struct request *rq;
+
+	if (list_empty(&plug->list))
+		return;
+
+	if (plug->should_sort)
+		list_sort(NULL, &plug->list, plug_rq_cmp);
+	plug->should_sort = 0;
+
+	local_irq_save(flags);
+	while (!list_empty(&plug->list)) {
+		rq = list_entry_rq(plug->list.next);
+		list_del_init(&rq->queuelist);
+
+		if (rq->q != q) {
+			if (q) {
+				__blk_run_queue(q);
+				spin_unlock(q->queue_lock);
+			}
+			q = rq->q;
+			spin_lock(q->queue_lock);
+		}
+		__elv_add_request(q, rq, ELEVATOR_INSERT_SORT, 0);
+	}
+	if (q) {
+		__blk_run_queue(q);
+		spin_unlock(q->queue_lock);
+	}
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(blk_flush_plug_list);
+
+void blk_finish_plug(struct blk_plug *plug)
+{
+	blk_flush_plug_list(plug);
+
+	if (plug == current->plug)
+		current->plug = NULL;
+}
+EXPORT_SYMBOL(blk_finish_plug);
+
 int __init blk_dev_init(void)
 {
 	BUILD_BUG_ON(__REQ_NR_BITS > 8 *
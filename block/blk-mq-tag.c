@@ -0,0 +1,150 @@
+/*
+ * Tag allocation for the multi-queue block layer
+ *
+ * Every hardware queue has a tag space of queue_depth tags; a tag indexes
+ * the preallocated request that goes with it.  The free tags are kept in
+ * a bitmap spread over several cache lines, and every software queue
+ * starts its search where it last found a free tag, so CPUs sharing a
+ * hardware queue mostly allocate and free in different cache lines and
+ * never take a lock to do so.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bitops.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+
+#include "blk-mq-tag.h"
+
+static int __blk_mq_get_tag_word(struct blk_align_bitmap *bm,
+				 unsigned int start)
+{
+	unsigned int nr = start;
+
+	for (;;) {
+		nr = find_next_zero_bit(&bm->word, bm->depth, nr);
+		if (nr >= bm->depth)
+			return -1;
+		if (!test_and_set_bit_lock(nr, &bm->word))
+			return nr;
+		nr++;
+	}
+}
+
+/*
+ * Grab a free tag, starting the search at *last_tag and moving the hint
+ * past the tag found.  Returns BLK_MQ_TAG_FAIL if all tags are in use.
+ */
+unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, unsigned int *last_tag)
+{
+	unsigned int hint = *last_tag, index, i;
+	int nr;
+
+	if (hint >= tags->nr_tags)
+		hint = 0;
+	index = hint / tags->bits_per_word;
+	nr = hint % tags->bits_per_word;
+
+	for (i = 0; i < tags->nr_words; i++) {
+		nr = __blk_mq_get_tag_word(&tags->map[index], nr);
+		if (nr != -1) {
+			hint = index * tags->bits_per_word + nr;
+			*last_tag = hint + 1;
+			return hint;
+		}
+
+		nr = 0;
+		if (++index >= tags->nr_words)
+			index = 0;
+	}
+
+	return BLK_MQ_TAG_FAIL;
+}
+
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	unsigned int index = tag / tags->bits_per_word;
+
+	BUG_ON(tag >= tags->nr_tags);
+
+	clear_bit_unlock(tag % tags->bits_per_word, &tags->map[index].word);
+
+	/* Pairs with the barrier of prepare_to_wait() in the sleeper */
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&tags->wait))
+		wake_up(&tags->wait);
+}
+
+bool blk_mq_has_free_tags(struct blk_mq_tags *tags)
+{
+	unsigned int i;
+
+	for (i = 0; i < tags->nr_words; i++) {
+		struct blk_align_bitmap *bm = &tags->map[i];
+
+		if (find_first_zero_bit(&bm->word, bm->depth) < bm->depth)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Sleep until a tag is put back.  The caller retries the allocation
+ * afterwards, and may lose the race for the tag to another CPU.
+ */
+void blk_mq_wait_for_tags(struct blk_mq_tags *tags)
+{
+	DEFINE_WAIT(wait);
+
+	prepare_to_wait(&tags->wait, &wait, TASK_UNINTERRUPTIBLE);
+	if (!blk_mq_has_free_tags(tags))
+		io_schedule();
+	finish_wait(&tags->wait, &wait);
+}
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node)
+{
+	struct blk_mq_tags *tags;
+	unsigned int shift, i, left;
+
+	tags = kzalloc_node(sizeof(*tags), GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	/*
+	 * Use fewer bits per word for small queues, so that even those
+	 * spread over a few cache lines.
+	 */
+	shift = ilog2(BITS_PER_LONG);
+	while (shift && (4U << shift) > nr_tags)
+		shift--;
+
+	tags->nr_tags = nr_tags;
+	tags->bits_per_word = 1U << shift;
+	tags->nr_words = DIV_ROUND_UP(nr_tags, tags->bits_per_word);
+	init_waitqueue_head(&tags->wait);
+
+	tags->map = kzalloc_node(tags->nr_words * sizeof(*tags->map),
+				 GFP_KERNEL, node);
+	if (!tags->map) {
+		kfree(tags);
+		return NULL;
+	}
+
+	left = nr_tags;
+	for (i = 0; i < tags->nr_words; i++) {
+		tags->map[i].depth = min(left, tags->bits_per_word);
+		left -= tags->map[i].depth;
+	}
+
+	return tags;
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	kfree(tags->map);
+	kfree(tags);
+}
@@ -0,0 +1,35 @@
+#ifndef BLK_MQ_TAG_H
+#define BLK_MQ_TAG_H
+
+#include <linux/wait.h>
+
+enum {
+	BLK_MQ_TAG_FAIL		= -1U,
+};
+
+/*
+ * The tag space is split into words that live in cache lines of their
+ * own, so CPUs allocating from different words do not contend.
+ */
+struct blk_align_bitmap {
+	unsigned long word;
+	unsigned long depth;
+} ____cacheline_aligned_in_smp;
+
+struct blk_mq_tags {
+	unsigned int nr_tags;
+	unsigned int bits_per_word;
+	unsigned int nr_words;
+	wait_queue_head_t wait;
+	struct blk_align_bitmap *map;
+};
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node);
+void blk_mq_free_tags(struct blk_mq_tags *tags);
+
+unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, unsigned int *last_tag);
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag);
+bool blk_mq_has_free_tags(struct blk_mq_tags *tags);
+void blk_mq_wait_for_tags(struct blk_mq_tags *tags);
+
+#endif
@@ -0,0 +1,878 @@
+/*
+ * Multi-queue block layer, see include/linux/blk-mq.h
+ *
+ * Submission never takes the queue_lock: a bio becomes a request with a
+ * tag of the hardware queue its CPU maps to, and is added to the
+ * software queue of that CPU.  Running a hardware queue moves the
+ * requests of all its software queues to the driver.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/hrtimer.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/workqueue.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-tag.h"
+
+static struct blk_mq_ctx *__blk_mq_get_ctx(struct request_queue *q,
+					   unsigned int cpu)
+{
+	return per_cpu_ptr(q->queue_ctx, cpu);
+}
+
+/*
+ * Software queue of this CPU.  Preemption stays disabled until
+ * blk_mq_put_ctx(), so the task keeps using the queue it got.
+ */
+static struct blk_mq_ctx *blk_mq_get_ctx(struct request_queue *q)
+{
+	return __blk_mq_get_ctx(q, get_cpu());
+}
+
+static void blk_mq_put_ctx(struct blk_mq_ctx *ctx)
+{
+	put_cpu();
+}
+
+/*
+ * Check if any of the ctx's have pending work in this hardware queue
+ */
+static bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	return !list_empty_careful(&hctx->dispatch) ||
+		find_first_bit(hctx->ctx_map, hctx->nr_ctx) < hctx->nr_ctx;
+}
+
+/*
+ * Mark this ctx as having pending work in this hardware queue
+ */
+static void blk_mq_hctx_mark_pending(struct blk_mq_hw_ctx *hctx,
+				     struct blk_mq_ctx *ctx)
+{
+	if (!test_bit(ctx->index_hw, hctx->ctx_map))
+		set_bit(ctx->index_hw, hctx->ctx_map);
+}
+
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static struct request *__blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx,
+					      struct blk_mq_ctx *ctx, int rw)
+{
+	struct request_queue *q = hctx->queue;
+	struct request *rq;
+	unsigned int tag;
+
+	tag = blk_mq_get_tag(hctx->tags, &ctx->last_tag);
+	if (tag == BLK_MQ_TAG_FAIL)
+		return NULL;
+
+	rq = hctx->rqs[tag];
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw;
+	/* Partition stats don't need the queue_lock, see part_round_stats() */
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+
+	return rq;
+}
+
+/*
+ * Allocate a request from the software queue of this CPU, sleeping for
+ * a free tag if @gfp allows it.  On success the software queue is
+ * returned in @ctxp and must be released with blk_mq_put_ctx().
+ */
+static struct request *blk_mq_alloc_request_pinned(struct request_queue *q,
+						   int rw, gfp_t gfp,
+						   struct blk_mq_ctx **ctxp)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	for (;;) {
+		ctx = blk_mq_get_ctx(q);
+		hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+		rq = __blk_mq_alloc_request(hctx, ctx, rw);
+		if (rq) {
+			*ctxp = ctx;
+			return rq;
+		}
+
+		blk_mq_put_ctx(ctx);
+		if (!(gfp & __GFP_WAIT))
+			return NULL;
+
+		/* Kick the queue so that it gives back tags */
+		blk_mq_run_hw_queue(hctx, false);
+		blk_mq_wait_for_tags(hctx->tags);
+	}
+}
+
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp)
+{
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+
+	rq = blk_mq_alloc_request_pinned(q, rw, gfp, &ctx);
+	if (rq)
+		blk_mq_put_ctx(ctx);
+
+	return rq;
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+void blk_mq_free_request(struct request *rq)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	rq->mq_ctx = NULL;
+	blk_mq_put_tag(hctx->tags, rq->tag);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+/*
+ * Fold the service time of a polled read into the mean of its queue.
+ * Completions race with each other here; a lost update only makes the
+ * mean a little staler.
+ */
+static void blk_mq_poll_account(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	unsigned long mean = q->poll_mean_ns;
+	u64 delta = ktime_to_ns(ktime_get()) - rq->poll_issue_ns;
+
+	if (!mean)
+		mean = delta;
+	else
+		mean = mean - mean / 8 + delta / 8;
+	q->poll_mean_ns = mean;
+}
+
+/**
+ * blk_mq_end_io - end I/O on a multi-queue request
+ * @rq:		the request being completed
+ * @error:	0 for success, < 0 for error
+ *
+ * Description:
+ *     Completes all bios of @rq and frees it, or hands it to its
+ *     ->end_io() handler if it has one.  Does not take any lock.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (rq->poll_issue_ns)
+		blk_mq_poll_account(rq);
+
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_account_io_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+#if defined(CONFIG_SMP) && defined(CONFIG_USE_GENERIC_SMP_HELPERS)
+static void __blk_mq_complete_request_remote(void *data)
+{
+	struct request *rq = data;
+
+	rq->q->mq_ops->complete(rq);
+}
+
+/*
+ * Run ->complete() on the CPU that submitted @rq, unless that CPU shares
+ * a cache with this one or is gone.  Returns false if the caller should
+ * complete @rq itself.
+ */
+static bool blk_mq_complete_remote(struct request *rq, int cpu)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct call_single_data *data = &rq->csd;
+
+	if (!test_bit(QUEUE_FLAG_SAME_COMP, &rq->q->queue_flags))
+		return false;
+	if (ctx->cpu == cpu || blk_cpu_to_group(ctx->cpu) == blk_cpu_to_group(cpu))
+		return false;
+	if (!cpu_online(ctx->cpu))
+		return false;
+
+	data->func = __blk_mq_complete_request_remote;
+	data->info = rq;
+	data->flags = 0;
+	__smp_call_function_single(ctx->cpu, data, 0);
+	return true;
+}
+#else
+static bool blk_mq_complete_remote(struct request *rq, int cpu)
+{
+	return false;
+}
+#endif
+
+/**
+ * blk_mq_complete_request - end I/O on a request, on the submitting CPU
+ * @rq:		the request being completed
+ *
+ * Description:
+ *     Called by drivers, typically from their interrupt handler, when
+ *     the hardware has finished @rq.  Calls ->complete() of the queue on
+ *     the CPU @rq was submitted from, whose caches still hold the data
+ *     of the I/O; that handler calls blk_mq_end_io().  Queues without a
+ *     ->complete() handler end @rq here with rq->errors.
+ */
+void blk_mq_complete_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	int cpu;
+
+	if (!q->mq_ops->complete) {
+		blk_mq_end_io(rq, rq->errors);
+		return;
+	}
+
+	cpu = get_cpu();
+	if (!blk_mq_complete_remote(rq, cpu))
+		q->mq_ops->complete(rq);
+	put_cpu();
+}
+EXPORT_SYMBOL(blk_mq_complete_request);
+
+/*
+ * Hand all requests of the software queues of @hctx, and those the
+ * driver turned down earlier, to ->queue_rq().  May run on several CPUs
+ * at once for the same hardware queue.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, ret;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	/*
+	 * Clear the bit before taking the requests: a request added after
+	 * that sets it again, so it is not missed.
+	 */
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		clear_bit(bit, hctx->ctx_map);
+		ctx = hctx->ctxs[bit];
+
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	/* Requests turned down before go first */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		trace_block_rq_issue(q, rq);
+		rq->cmd_flags |= REQ_STARTED;
+		if (blk_queue_poll(q) && rq_data_dir(rq) == READ)
+			rq->poll_issue_ns = ktime_to_ns(ktime_get());
+
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK)
+			continue;
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+
+		WARN_ON_ONCE(ret != BLK_MQ_RQ_QUEUE_ERROR);
+		rq->errors = -EIO;
+		blk_mq_end_io(rq, -EIO);
+	}
+
+	/*
+	 * The driver is busy: keep what is left for the next run, which
+	 * it triggers with blk_mq_start_stopped_hw_queues().
+	 */
+	if (!list_empty(&rq_list)) {
+		spin_lock(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+	}
+}
+
+/**
+ * blk_mq_run_hw_queue - start pending requests of a hardware queue
+ * @hctx:	the hardware queue
+ * @async:	leave the work to kblockd instead of doing it here
+ *
+ * Description:
+ *     Requests are started from the calling context only if @async is
+ *     false, which requires process context.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)) ||
+	    !blk_mq_hctx_has_pending(hctx))
+		return;
+
+	if (!async)
+		__blk_mq_run_hw_queue(hctx);
+	else
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/*
+ * A driver that cannot take more requests stops the hardware queue and
+ * returns BLK_MQ_RQ_QUEUE_BUSY; once it has room again it restarts the
+ * queue with blk_mq_start_stopped_hw_queues().
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+
+		clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+/*
+ * Never give up on polling before this long after the read was issued,
+ * even if the device has been faster so far.
+ */
+#define BLK_MQ_POLL_MIN_NS	(20 * NSEC_PER_USEC)
+
+/*
+ * Hybrid polling: with a poll delay set, sleep for the first part of the
+ * expected service time instead of burning the CPU on it.  Returns true
+ * if it slept.
+ */
+static bool blk_mq_poll_hybrid_sleep(struct request_queue *q, ktime_t issued)
+{
+	ktime_t expires;
+	u64 sleep_ns;
+
+	if (q->poll_delay < 0)
+		return false;
+	if (q->poll_delay > 0)
+		sleep_ns = (u64)q->poll_delay * NSEC_PER_USEC;
+	else
+		sleep_ns = q->poll_mean_ns / 2;
+	if (!sleep_ns)
+		return false;
+
+	expires = ktime_add_ns(issued, sleep_ns);
+	if (ktime_to_ns(ktime_get()) >= ktime_to_ns(expires))
+		return false;
+
+	q->poll_slept++;
+	schedule_hrtimeout(&expires, HRTIMER_MODE_ABS);
+	__set_current_state(TASK_RUNNING);
+	return true;
+}
+
+/**
+ * blk_poll - poll for the completion of a synchronous read
+ * @q:		the queue the read was submitted to
+ * @issued:	when it was submitted, from ktime_get()
+ *
+ * Description:
+ *     Called by a task about to sleep in TASK_UNINTERRUPTIBLE for a read
+ *     it submitted to @q, instead of waiting for the interrupt, softirq
+ *     and wakeup.  Spins on ->poll() of the hardware queue of the current
+ *     CPU until the task is woken, something completes, it needs to
+ *     reschedule, or twice the mean service time of the queue has gone
+ *     by since @issued.
+ *
+ *     Returns true if the caller should check again whether its I/O is
+ *     done, with the task back in TASK_RUNNING, and false if it should
+ *     go to sleep as it would have without polling.
+ */
+bool blk_poll(struct request_queue *q, ktime_t issued)
+{
+	struct blk_mq_hw_ctx *hctx;
+	u64 limit;
+	int ret;
+
+	if (!q->mq_ops || !q->mq_ops->poll || !blk_queue_poll(q))
+		return false;
+
+	q->poll_invoked++;
+	if (blk_mq_poll_hybrid_sleep(q, issued))
+		return true;
+
+	limit = ktime_to_ns(issued) + max_t(u64, 2 * q->poll_mean_ns,
+					    BLK_MQ_POLL_MIN_NS);
+	for (;;) {
+		hctx = q->mq_ops->map_queue(q, raw_smp_processor_id());
+		ret = q->mq_ops->poll(hctx);
+		if (ret > 0) {
+			q->poll_found++;
+			__set_current_state(TASK_RUNNING);
+			return true;
+		}
+
+		/* Completed from an interrupt after all */
+		if (current->state == TASK_RUNNING)
+			return true;
+
+		if (ret < 0 || need_resched() ||
+		    ktime_to_ns(ktime_get()) >= limit)
+			break;
+		cpu_relax();
+	}
+
+	q->poll_timeouts++;
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
+static void blk_mq_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct blk_mq_ctx *ctx,
+				    struct request *rq, bool at_head)
+{
+	trace_block_rq_insert(hctx->queue, rq);
+
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+	blk_mq_hctx_mark_pending(hctx, ctx);
+}
+
+/**
+ * blk_mq_insert_request - queue a request allocated with blk_get_request()
+ * @q:		the queue
+ * @rq:		the request
+ * @at_head:	insert in front of the pending requests
+ * @run_queue:	start the request right away
+ *
+ * Description:
+ *     Called from process context.
+ */
+void blk_mq_insert_request(struct request_queue *q, struct request *rq,
+			   bool at_head, bool run_queue)
+{
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	spin_lock(&ctx->lock);
+	__blk_mq_insert_request(hctx, ctx, rq, at_head);
+	spin_unlock(&ctx->lock);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, false);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+/*
+ * Try to add @bio to the end of the last request of the software queue.
+ * Requests already handed to the driver are off the list, so only those
+ * not yet started can grow.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	const unsigned long ff = bio->bi_rw & REQ_FAILFAST_MASK;
+	struct request *rq;
+	bool merged = false;
+
+	spin_lock(&ctx->lock);
+	if (list_empty(&ctx->rq_list))
+		goto out;
+
+	rq = list_entry(ctx->rq_list.prev, struct request, queuelist);
+	if (!elv_rq_merge_ok(rq, bio) ||
+	    (rq->cmd_flags & REQ_FAILFAST_MASK) != ff ||
+	    blk_rq_pos(rq) + blk_rq_sectors(rq) != bio->bi_sector ||
+	    !ll_back_merge_fn(q, rq, bio))
+		goto out;
+
+	trace_block_bio_backmerge(q, bio);
+
+	rq->biotail->bi_next = bio;
+	rq->biotail = bio;
+	rq->__data_len += bio->bi_size;
+	rq->ioprio = ioprio_best(rq->ioprio, bio_prio(bio));
+	drive_stat_acct(rq, 0);
+	merged = true;
+out:
+	spin_unlock(&ctx->lock);
+	return merged;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const bool sync = rw_is_sync(bio->bi_rw);
+	const bool unplug = !!(bio->bi_rw & REQ_UNPLUG);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	int rw_flags;
+
+	/*
+	 * There is no elevator to drain: without an ordered mode set by the
+	 * driver, and for now with one too, barriers are refused.
+	 */
+	if (bio->bi_rw & REQ_HARDBARRIER) {
+		bio_endio(bio, -EOPNOTSUPP);
+		return 0;
+	}
+
+	blk_queue_bounce(q, &bio);
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	if ((hctx->flags & BLK_MQ_F_SHOULD_MERGE) &&
+	    blk_mq_attempt_merge(q, ctx, bio)) {
+		blk_mq_put_ctx(ctx);
+		goto run_queue;
+	}
+
+	rw_flags = bio_data_dir(bio);
+	if (sync)
+		rw_flags |= REQ_SYNC;
+
+	trace_block_getrq(q, bio, rw_flags & 1);
+	rq = __blk_mq_alloc_request(hctx, ctx, rw_flags);
+	if (unlikely(!rq)) {
+		blk_mq_put_ctx(ctx);
+		trace_block_sleeprq(q, bio, rw_flags & 1);
+		rq = blk_mq_alloc_request_pinned(q, rw_flags, GFP_NOIO, &ctx);
+		hctx = q->mq_ops->map_queue(q, ctx->cpu);
+	}
+
+	init_request_from_bio(rq, bio);
+	drive_stat_acct(rq, 1);
+
+	spin_lock(&ctx->lock);
+	__blk_mq_insert_request(hctx, ctx, rq, false);
+	spin_unlock(&ctx->lock);
+	blk_mq_put_ctx(ctx);
+
+run_queue:
+	/*
+	 * Reads and sync writes are started right away, so a reader
+	 * polling for completion has something to find.  Async writes are
+	 * left to kblockd, which batches whatever else was queued in the
+	 * meantime.
+	 */
+	blk_mq_run_hw_queue(hctx, !sync && !unplug);
+	return 0;
+}
+
+static void blk_mq_unplug(struct request_queue *q)
+{
+	blk_mq_run_queues(q, false);
+}
+
+static void blk_mq_free_rq_map(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	if (hctx->rqs) {
+		for (i = 0; i < hctx->queue_depth; i++)
+			kfree(hctx->rqs[i]);
+		kfree(hctx->rqs);
+		hctx->rqs = NULL;
+	}
+	if (hctx->tags) {
+		blk_mq_free_tags(hctx->tags);
+		hctx->tags = NULL;
+	}
+}
+
+/*
+ * Preallocate the requests of a hardware queue, each followed by
+ * @cmd_size bytes for the driver, on the node of the queue.
+ */
+static int blk_mq_init_rq_map(struct blk_mq_hw_ctx *hctx,
+			      unsigned int cmd_size)
+{
+	unsigned int i;
+
+	hctx->tags = blk_mq_init_tags(hctx->queue_depth, hctx->numa_node);
+	if (!hctx->tags)
+		return -ENOMEM;
+
+	hctx->rqs = kzalloc_node(hctx->queue_depth * sizeof(struct request *),
+				 GFP_KERNEL, hctx->numa_node);
+	if (!hctx->rqs)
+		goto fail;
+
+	for (i = 0; i < hctx->queue_depth; i++) {
+		hctx->rqs[i] = kzalloc_node(sizeof(struct request) + cmd_size,
+					    GFP_KERNEL, hctx->numa_node);
+		if (!hctx->rqs[i])
+			goto fail;
+	}
+
+	return 0;
+fail:
+	blk_mq_free_rq_map(hctx);
+	return -ENOMEM;
+}
+
+static void blk_mq_free_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!hctx)
+			continue;
+		blk_mq_free_rq_map(hctx);
+		kfree(hctx->ctxs);
+		kfree(hctx->ctx_map);
+		kfree(hctx);
+	}
+
+	kfree(q->queue_hw_ctx);
+	free_percpu(q->queue_ctx);
+	kfree(q->mq_map);
+
+	q->queue_hw_ctx = NULL;
+	q->queue_ctx = NULL;
+	q->mq_map = NULL;
+	q->nr_hw_queues = 0;
+}
+
+/*
+ * Spread the possible CPUs evenly over the hardware queues, and give
+ * every hardware queue the list of the software queues mapped to it.
+ */
+static int blk_mq_map_swqueue(struct request_queue *q,
+			      struct blk_mq_ops *ops)
+{
+	unsigned int i, nr = 0, nr_cpus = num_possible_cpus();
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+
+	for_each_possible_cpu(i)
+		q->mq_map[i] = nr++ * q->nr_hw_queues / nr_cpus;
+
+	for_each_possible_cpu(i) {
+		ctx = __blk_mq_get_ctx(q, i);
+		memset(ctx, 0, sizeof(*ctx));
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = i;
+		ctx->queue = q;
+
+		hctx = ops->map_queue(q, i);
+		hctx->nr_ctx++;
+	}
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		hctx->ctxs = kmalloc_node(hctx->nr_ctx * sizeof(void *),
+					  GFP_KERNEL, hctx->numa_node);
+		hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(hctx->nr_ctx) *
+					     sizeof(unsigned long),
+					     GFP_KERNEL, hctx->numa_node);
+		if (!hctx->ctxs || !hctx->ctx_map)
+			return -ENOMEM;
+		hctx->nr_ctx = 0;
+	}
+
+	/* Start the CPUs of a hardware queue at different tags */
+	for_each_possible_cpu(i) {
+		ctx = __blk_mq_get_ctx(q, i);
+		hctx = ops->map_queue(q, i);
+
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+	for_each_possible_cpu(i) {
+		ctx = __blk_mq_get_ctx(q, i);
+		hctx = ops->map_queue(q, i);
+
+		ctx->last_tag = ctx->index_hw * hctx->queue_depth /
+				hctx->nr_ctx;
+	}
+
+	return 0;
+}
+
+static int blk_mq_init_hw_queues(struct request_queue *q,
+				 struct blk_mq_reg *reg, void *driver_data)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i, j;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (blk_mq_init_rq_map(hctx, reg->cmd_size))
+			break;
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i)) {
+			blk_mq_free_rq_map(hctx);
+			break;
+		}
+	}
+
+	if (i == q->nr_hw_queues)
+		return 0;
+
+	/* Tear down what was set up before the failure */
+	queue_for_each_hw_ctx(q, hctx, j) {
+		if (j == i)
+			break;
+		if (reg->ops->exit_hctx)
+			reg->ops->exit_hctx(hctx, j);
+		blk_mq_free_rq_map(hctx);
+	}
+
+	return -ENOMEM;
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:	the hardware queues and operations of the driver
+ * @driver_data: passed to ->init_hctx()
+ *
+ * Description:
+ *     Returns the new queue, to be released with blk_cleanup_queue(), or
+ *     NULL on failure.  At most one hardware queue per possible CPU is
+ *     used.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	unsigned int nr_hw_queues = min_t(unsigned int, reg->nr_hw_queues,
+					  nr_cpu_ids);
+	struct blk_mq_hw_ctx *hctx;
+	struct request_queue *q;
+	int i;
+
+	if (!nr_hw_queues || !reg->queue_depth ||
+	    reg->queue_depth > BLK_MQ_MAX_DEPTH ||
+	    !reg->ops->queue_rq || !reg->ops->map_queue)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	q->queue_hw_ctx = kzalloc_node(nr_hw_queues * sizeof(*q->queue_hw_ctx),
+				       GFP_KERNEL, reg->numa_node);
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->mq_map = kzalloc_node(nr_cpu_ids * sizeof(*q->mq_map),
+				 GFP_KERNEL, reg->numa_node);
+	if (!q->queue_hw_ctx || !q->queue_ctx || !q->mq_map)
+		goto err_free;
+
+	q->nr_hw_queues = nr_hw_queues;
+	queue_for_each_hw_ctx(q, hctx, i) {
+		hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+		q->queue_hw_ctx[i] = hctx;
+		if (!hctx)
+			goto err_free;
+
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_WORK(&hctx->run_work, blk_mq_work_fn);
+		hctx->queue = q;
+		hctx->flags = reg->flags;
+		hctx->queue_num = i;
+		hctx->queue_depth = reg->queue_depth;
+		hctx->numa_node = reg->numa_node;
+	}
+
+	if (blk_mq_map_swqueue(q, reg->ops))
+		goto err_free;
+	if (blk_mq_init_hw_queues(q, reg, driver_data))
+		goto err_free;
+
+	q->queue_flags = QUEUE_FLAG_DEFAULT;
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->unplug_fn = blk_mq_unplug;
+	q->nr_requests = nr_hw_queues * reg->queue_depth;
+	q->poll_delay = -1;
+
+	q->mq_ops = reg->ops;
+	return q;
+
+err_free:
+	blk_mq_free_hw_queues(q);
+	blk_cleanup_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called by blk_cleanup_queue(), once no more I/O is submitted
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		cancel_work_sync(&hctx->run_work);
+		if (q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+	}
+
+	blk_mq_free_hw_queues(q);
+}
@@ -0,0 +1,22 @@
+#ifndef INT_BLK_MQ_H
+#define INT_BLK_MQ_H
+
+/*
+ * Software queue of one CPU.  Only the submitting CPU adds requests to
+ * rq_list; any CPU running the hardware queue it maps to takes them off.
+ * The lock is never taken from interrupt context.
+ */
+struct blk_mq_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	rq_list;
+	} ____cacheline_aligned_in_smp;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* bit in the hctx ctx_map */
+	unsigned int		last_tag;	/* tag allocation hint */
+
+	struct request_queue	*queue;
+} ____cacheline_aligned_in_smp;
+
+#endif
@@ -6,6 +6,7 @@
 #include <linux/module.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/blktrace_api.h>
 
 #include "blk.h"
@@ -260,6 +261,54 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+static ssize_t queue_poll_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_queue_poll(q), page);
+}
+
+static ssize_t
+queue_poll_store(struct request_queue *q, const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+
+	if (!q->mq_ops || !q->mq_ops->poll)
+		return -EINVAL;
+
+	ret = queue_var_store(&val, page, count);
+	spin_lock_irq(q->queue_lock);
+	if (val)
+		queue_flag_set(QUEUE_FLAG_POLL, q);
+	else
+		queue_flag_clear(QUEUE_FLAG_POLL, q);
+	spin_unlock_irq(q->queue_lock);
+	return ret;
+}
+
+static ssize_t queue_poll_delay_show(struct request_queue *q, char *page)
+{
+	return sprintf(page, "%d\n", q->poll_delay);
+}
+
+static ssize_t
+queue_poll_delay_store(struct request_queue *q, const char *page, size_t count)
+{
+	long val;
+
+	if (strict_strtol(page, 10, &val) || val < -1 || val > INT_MAX)
+		return -EINVAL;
+
+	q->poll_delay = val;
+	return count;
+}
+
+static ssize_t queue_poll_stats_show(struct request_queue *q, char *page)
+{
+	return sprintf(page, "%lu %lu %lu %lu %lu\n", q->poll_invoked,
+		       q->poll_found, q->poll_slept, q->poll_timeouts,
+		       q->poll_mean_ns);
+}
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -369,6 +418,23 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+static struct queue_sysfs_entry queue_poll_entry = {
+	.attr = {.name = "io_poll", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_show,
+	.store = queue_poll_store,
+};
+
+static struct queue_sysfs_entry queue_poll_delay_entry = {
+	.attr = {.name = "io_poll_delay", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_delay_show,
+	.store = queue_poll_delay_store,
+};
+
+static struct queue_sysfs_entry queue_poll_stats_entry = {
+	.attr = {.name = "io_poll_stats", .mode = S_IRUGO },
+	.show = queue_poll_stats_show,
+};
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -390,6 +456,9 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+	&queue_poll_entry.attr,
+	&queue_poll_delay_entry.attr,
+	&queue_poll_stats_entry.attr,
 	NULL,
 };
 
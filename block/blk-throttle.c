@@ -0,0 +1,1039 @@
+/*
+ * Block IO throttling: upper limits on the bandwidth (bytes per second) and
+ * the IOPS of a cgroup on a request queue.
+ *
+ * Bios are checked when they are submitted, before any request is made
+ * out of them, so the limits also hold for stacking drivers that never use
+ * an IO scheduler.  A bio which would go over a limit of its group is
+ * queued on the group, and the group is put on a service tree sorted by the
+ * time its first bio may be dispatched.  A delayed work on kblockd takes
+ * the due groups off the tree and submits their bios again.
+ *
+ * The bandwidth used by a group is accounted over time slices of
+ * throtl_slice: a slice is extended while bios are waiting and trimmed by
+ * the time that has passed, so that a group which was idle cannot build up
+ * credit for a burst beyond its limit.
+ */
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include "blk-cgroup.h"
+#include "blk.h"
+
+/* Max dispatch from a group in one round */
+static int throtl_grp_quantum = 8;
+
+/* Total max dispatch from all groups in one round */
+static int throtl_quantum = 32;
+
+/* Throttling is performed over 100ms slices */
+static unsigned long throtl_slice = HZ/10;
+
+struct throtl_rb_root {
+	struct rb_root rb;
+	struct rb_node *left;
+	unsigned int count;
+	unsigned long min_disptime;
+};
+
+#define THROTL_RB_ROOT	(struct throtl_rb_root) { .rb = RB_ROOT, .left = NULL, \
+			.count = 0, .min_disptime = 0}
+
+#define rb_entry_tg(node)	rb_entry((node), struct throtl_grp, rb_node)
+
+struct throtl_grp {
+	/* List of throtl groups on the request queue */
+	struct hlist_node tg_node;
+
+	/* active throtl group service_tree member */
+	struct rb_node rb_node;
+
+	/*
+	 * Dispatch time in jiffies.  This is the estimated time when the
+	 * group will unthrottle and be ready to dispatch more bios.
+	 */
+	unsigned long disptime;
+
+	struct blkio_group blkg;
+	atomic_t ref;
+	unsigned int on_st;
+
+	/* Two lists for READ and WRITE */
+	struct bio_list bio_lists[2];
+
+	/* Number of queued bios on READ and WRITE lists */
+	unsigned int nr_queued[2];
+
+	/* bytes per second rate limits, BLKIO_LIMIT_NONE if unlimited */
+	u64 bps[2];
+
+	/* IOPS limits, UINT_MAX if unlimited */
+	unsigned int iops[2];
+
+	/* Number of bytes dispatched in current slice */
+	u64 bytes_disp[2];
+	/* Number of bios dispatched in current slice */
+	unsigned int io_disp[2];
+
+	/* When did we start a new slice */
+	unsigned long slice_start[2];
+	unsigned long slice_end[2];
+
+	/* Some throttle limits got updated for the group */
+	bool limits_changed;
+
+	struct rcu_head rcu_head;
+};
+
+struct throtl_data {
+	/* List of throtl groups */
+	struct hlist_head tg_list;
+
+	/* service tree for active throtl groups */
+	struct throtl_rb_root tg_service_tree;
+
+	struct throtl_grp *root_tg;
+	struct request_queue *queue;
+
+	/* Total Number of queued bios on READ and WRITE lists */
+	unsigned int nr_queued[2];
+
+	/* Number of groups which are not yet unlinked from their cgroup */
+	unsigned int nr_undestroyed_grps;
+
+	/* Work for dispatching throttled bios */
+	struct delayed_work throtl_work;
+
+	atomic_t limits_changed;
+};
+
+static inline struct throtl_grp *tg_of_blkg(struct blkio_group *blkg)
+{
+	if (blkg)
+		return container_of(blkg, struct throtl_grp, blkg);
+
+	return NULL;
+}
+
+static inline unsigned int total_nr_queued(struct throtl_data *td)
+{
+	return td->nr_queued[0] + td->nr_queued[1];
+}
+
+static inline struct throtl_grp *throtl_ref_get_tg(struct throtl_grp *tg)
+{
+	atomic_inc(&tg->ref);
+	return tg;
+}
+
+static void throtl_free_tg(struct rcu_head *head)
+{
+	kfree(container_of(head, struct throtl_grp, rcu_head));
+}
+
+static void throtl_put_tg(struct throtl_grp *tg)
+{
+	BUG_ON(atomic_read(&tg->ref) <= 0);
+	if (!atomic_dec_and_test(&tg->ref))
+		return;
+
+	/* blk_throtl_bio() looks groups up without the queue lock */
+	call_rcu(&tg->rcu_head, throtl_free_tg);
+}
+
+static bool tg_no_limits(struct throtl_grp *tg)
+{
+	return tg->bps[READ] == BLKIO_LIMIT_NONE &&
+	       tg->bps[WRITE] == BLKIO_LIMIT_NONE &&
+	       tg->iops[READ] == UINT_MAX && tg->iops[WRITE] == UINT_MAX;
+}
+
+static void throtl_set_limit(struct throtl_grp *tg, int fileid, u64 limit)
+{
+	unsigned int iops = min_t(u64, limit, UINT_MAX);
+
+	switch (fileid) {
+	case BLKIO_THROTL_read_bps_device:
+		tg->bps[READ] = limit;
+		break;
+	case BLKIO_THROTL_write_bps_device:
+		tg->bps[WRITE] = limit;
+		break;
+	case BLKIO_THROTL_read_iops_device:
+		tg->iops[READ] = iops;
+		break;
+	case BLKIO_THROTL_write_iops_device:
+		tg->iops[WRITE] = iops;
+		break;
+	default:
+		BUG();
+	}
+}
+
+/*
+ * The device of a group is only known once the disk of the queue has been
+ * registered, and so are the limits of the cgroup for it.  Called with the
+ * queue lock held.
+ */
+static void throtl_tg_set_dev(struct throtl_data *td, struct throtl_grp *tg,
+			      struct blkio_cgroup *blkcg)
+{
+	struct backing_dev_info *bdi = &td->queue->backing_dev_info;
+	unsigned int major, minor;
+	int fileid;
+
+	if (tg->blkg.dev || !bdi->dev)
+		return;
+
+	sscanf(dev_name(bdi->dev), "%u:%u", &major, &minor);
+	tg->blkg.dev = MKDEV(major, minor);
+
+	for (fileid = BLKIO_THROTL_read_bps_device;
+	     fileid <= BLKIO_THROTL_write_iops_device; fileid++)
+		throtl_set_limit(tg, fileid,
+				 blkcg_get_limit(blkcg, tg->blkg.dev, fileid));
+}
+
+static struct throtl_grp *throtl_alloc_tg(struct throtl_data *td,
+				struct blkio_cgroup *blkcg, gfp_t gfp_mask)
+{
+	struct throtl_grp *tg;
+
+	tg = kzalloc_node(sizeof(*tg), gfp_mask, td->queue->node);
+	if (!tg)
+		return NULL;
+
+	INIT_HLIST_NODE(&tg->tg_node);
+	RB_CLEAR_NODE(&tg->rb_node);
+	bio_list_init(&tg->bio_lists[0]);
+	bio_list_init(&tg->bio_lists[1]);
+	tg->bps[READ] = tg->bps[WRITE] = BLKIO_LIMIT_NONE;
+	tg->iops[READ] = tg->iops[WRITE] = UINT_MAX;
+
+	/* The reference of td->tg_list, dropped by throtl_destroy_tg() */
+	atomic_set(&tg->ref, 1);
+
+	blkiocg_add_blkio_group(blkcg, &tg->blkg, (void *)td, 0,
+				BLKIO_POLICY_THROTL);
+	throtl_tg_set_dev(td, tg, blkcg);
+
+	hlist_add_head(&tg->tg_node, &td->tg_list);
+	td->nr_undestroyed_grps++;
+	return tg;
+}
+
+/* Called under rcu_read_lock() */
+static struct throtl_grp *throtl_find_tg(struct throtl_data *td,
+					 struct blkio_cgroup *blkcg)
+{
+	return tg_of_blkg(blkiocg_lookup_group(blkcg, (void *)td));
+}
+
+/*
+ * Find the group of the current task on the queue, creating it if needed.
+ * Falls back to the root group if that fails.  Called with the queue lock
+ * held.
+ */
+static struct throtl_grp *throtl_get_tg(struct throtl_data *td)
+{
+	struct blkio_cgroup *blkcg;
+	struct throtl_grp *tg;
+
+	rcu_read_lock();
+	blkcg = cgroup_to_blkio_cgroup(task_cgroup(current, blkio_subsys_id));
+	tg = throtl_find_tg(td, blkcg);
+	if (tg)
+		throtl_tg_set_dev(td, tg, blkcg);
+	else
+		tg = throtl_alloc_tg(td, blkcg, GFP_ATOMIC);
+	if (!tg)
+		tg = td->root_tg;
+	rcu_read_unlock();
+
+	return tg;
+}
+
+static struct throtl_grp *throtl_rb_first(struct throtl_rb_root *root)
+{
+	/* Service tree is empty */
+	if (!root->count)
+		return NULL;
+
+	if (!root->left)
+		root->left = rb_first(&root->rb);
+
+	if (root->left)
+		return rb_entry_tg(root->left);
+
+	return NULL;
+}
+
+static void rb_erase_init(struct rb_node *n, struct rb_root *root)
+{
+	rb_erase(n, root);
+	RB_CLEAR_NODE(n);
+}
+
+static void throtl_rb_erase(struct rb_node *n, struct throtl_rb_root *root)
+{
+	if (root->left == n)
+		root->left = NULL;
+	rb_erase_init(n, &root->rb);
+	--root->count;
+}
+
+static void update_min_dispatch_time(struct throtl_rb_root *st)
+{
+	struct throtl_grp *tg;
+
+	tg = throtl_rb_first(st);
+	if (!tg)
+		return;
+
+	st->min_disptime = tg->disptime;
+}
+
+static void tg_service_tree_add(struct throtl_rb_root *st,
+				struct throtl_grp *tg)
+{
+	struct rb_node **node = &st->rb.rb_node;
+	struct rb_node *parent = NULL;
+	struct throtl_grp *__tg;
+	unsigned long key = tg->disptime;
+	int left = 1;
+
+	while (*node != NULL) {
+		parent = *node;
+		__tg = rb_entry_tg(parent);
+
+		if (time_before(key, __tg->disptime))
+			node = &parent->rb_left;
+		else {
+			node = &parent->rb_right;
+			left = 0;
+		}
+	}
+
+	if (left)
+		st->left = &tg->rb_node;
+
+	rb_link_node(&tg->rb_node, parent, node);
+	rb_insert_color(&tg->rb_node, &st->rb);
+}
+
+static void throtl_enqueue_tg(struct throtl_data *td, struct throtl_grp *tg)
+{
+	struct throtl_rb_root *st = &td->tg_service_tree;
+
+	if (tg->on_st)
+		return;
+
+	tg_service_tree_add(st, tg);
+	tg->on_st = 1;
+	st->count++;
+}
+
+static void throtl_dequeue_tg(struct throtl_data *td, struct throtl_grp *tg)
+{
+	if (!tg->on_st)
+		return;
+
+	throtl_rb_erase(&tg->rb_node, &td->tg_service_tree);
+	tg->on_st = 0;
+}
+
+static void throtl_schedule_delayed_work(struct throtl_data *td,
+					 unsigned long delay)
+{
+	struct delayed_work *dwork = &td->throtl_work;
+
+	if (total_nr_queued(td) > 0) {
+		/*
+		 * We might have a work scheduled to be executed in future.
+		 * Cancel that and schedule a new one.
+		 */
+		__cancel_delayed_work(dwork);
+		kblockd_schedule_delayed_work(td->queue, dwork, delay);
+	}
+}
+
+static void throtl_schedule_next_dispatch(struct throtl_data *td)
+{
+	struct throtl_rb_root *st = &td->tg_service_tree;
+
+	/* If there are no throttled groups, nothing to do */
+	if (!total_nr_queued(td))
+		return;
+
+	BUG_ON(!st->count);
+
+	update_min_dispatch_time(st);
+
+	if (time_before_eq(st->min_disptime, jiffies))
+		throtl_schedule_delayed_work(td, 0);
+	else
+		throtl_schedule_delayed_work(td, st->min_disptime - jiffies);
+}
+
+static inline void throtl_start_new_slice(struct throtl_data *td,
+					  struct throtl_grp *tg, bool rw)
+{
+	tg->bytes_disp[rw] = 0;
+	tg->io_disp[rw] = 0;
+	tg->slice_start[rw] = jiffies;
+	tg->slice_end[rw] = jiffies + throtl_slice;
+}
+
+static inline void throtl_extend_slice(struct throtl_data *td,
+				       struct throtl_grp *tg, bool rw,
+				       unsigned long jiffy_end)
+{
+	tg->slice_end[rw] = roundup(jiffy_end, throtl_slice);
+}
+
+/* Determine if previously allocated or extended slice is complete or not */
+static bool throtl_slice_used(struct throtl_data *td, struct throtl_grp *tg,
+			      bool rw)
+{
+	if (time_in_range(jiffies, tg->slice_start[rw], tg->slice_end[rw]))
+		return 0;
+
+	return 1;
+}
+
+/* Trim the used slices and adjust slice start accordingly */
+static void throtl_trim_slice(struct throtl_data *td, struct throtl_grp *tg,
+			      bool rw)
+{
+	unsigned long nr_slices, time_elapsed, io_trim;
+	u64 bytes_trim, tmp;
+
+	BUG_ON(time_before(tg->slice_end[rw], tg->slice_start[rw]));
+
+	/*
+	 * If bps are unlimited (-1), then time slice don't get
+	 * renewed. Don't try to trim the slice if slice is used. A new
+	 * slice will start when appropriate.
+	 */
+	if (throtl_slice_used(td, tg, rw))
+		return;
+
+	throtl_extend_slice(td, tg, rw, jiffies + throtl_slice);
+
+	time_elapsed = jiffies - tg->slice_start[rw];
+
+	nr_slices = time_elapsed / throtl_slice;
+
+	if (!nr_slices)
+		return;
+
+	if (tg->bps[rw] == BLKIO_LIMIT_NONE) {
+		bytes_trim = tg->bytes_disp[rw];
+	} else {
+		tmp = tg->bps[rw] * throtl_slice * nr_slices;
+		do_div(tmp, HZ);
+		bytes_trim = tmp;
+	}
+
+	if (tg->iops[rw] == UINT_MAX) {
+		io_trim = tg->io_disp[rw];
+	} else {
+		tmp = (u64)tg->iops[rw] * throtl_slice * nr_slices;
+		do_div(tmp, HZ);
+		io_trim = min_t(u64, tmp, UINT_MAX);
+	}
+
+	if (!bytes_trim && !io_trim)
+		return;
+
+	if (tg->bytes_disp[rw] >= bytes_trim)
+		tg->bytes_disp[rw] -= bytes_trim;
+	else
+		tg->bytes_disp[rw] = 0;
+
+	if (tg->io_disp[rw] >= io_trim)
+		tg->io_disp[rw] -= io_trim;
+	else
+		tg->io_disp[rw] = 0;
+
+	tg->slice_start[rw] += nr_slices * throtl_slice;
+}
+
+static bool tg_with_in_iops_limit(struct throtl_data *td,
+		struct throtl_grp *tg, struct bio *bio, unsigned long *wait)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned int io_allowed;
+	unsigned long jiffy_elapsed, jiffy_wait, jiffy_elapsed_rnd;
+	u64 tmp;
+
+	if (tg->iops[rw] == UINT_MAX) {
+		*wait = 0;
+		return 1;
+	}
+
+	jiffy_elapsed = jiffy_elapsed_rnd = jiffies - tg->slice_start[rw];
+
+	/* Slice has just started. Consider one slice interval */
+	if (!jiffy_elapsed)
+		jiffy_elapsed_rnd = throtl_slice;
+
+	jiffy_elapsed_rnd = roundup(jiffy_elapsed_rnd, throtl_slice);
+
+	/*
+	 * jiffy_elapsed_rnd should not be a big value as minimum iops can be
+	 * 1 then at max jiffy elapsed should be equivalent of 1 second as we
+	 * will allow dispatch after 1 second and after that slice should
+	 * have been trimmed.
+	 */
+	tmp = (u64)tg->iops[rw] * jiffy_elapsed_rnd;
+	do_div(tmp, HZ);
+	io_allowed = min_t(u64, tmp, UINT_MAX);
+
+	if (tg->io_disp[rw] + 1 <= io_allowed) {
+		*wait = 0;
+		return 1;
+	}
+
+	/* Calc approx time to dispatch */
+	tmp = (u64)(tg->io_disp[rw] + 1) * HZ;
+	do_div(tmp, tg->iops[rw]);
+	jiffy_wait = tmp + 1;
+
+	if (jiffy_wait > jiffy_elapsed)
+		jiffy_wait = jiffy_wait - jiffy_elapsed;
+	else
+		jiffy_wait = 1;
+
+	*wait = jiffy_wait;
+	return 0;
+}
+
+static bool tg_with_in_bps_limit(struct throtl_data *td,
+		struct throtl_grp *tg, struct bio *bio, unsigned long *wait)
+{
+	bool rw = bio_data_dir(bio);
+	u64 bytes_allowed, extra_bytes, tmp;
+	unsigned long jiffy_elapsed, jiffy_wait, jiffy_elapsed_rnd;
+
+	if (tg->bps[rw] == BLKIO_LIMIT_NONE) {
+		*wait = 0;
+		return 1;
+	}
+
+	jiffy_elapsed = jiffy_elapsed_rnd = jiffies - tg->slice_start[rw];
+
+	/* Slice has just started. Consider one slice interval */
+	if (!jiffy_elapsed)
+		jiffy_elapsed_rnd = throtl_slice;
+
+	jiffy_elapsed_rnd = roundup(jiffy_elapsed_rnd, throtl_slice);
+
+	tmp = tg->bps[rw] * jiffy_elapsed_rnd;
+	do_div(tmp, HZ);
+	bytes_allowed = tmp;
+
+	if (tg->bytes_disp[rw] + bio->bi_size <= bytes_allowed) {
+		*wait = 0;
+		return 1;
+	}
+
+	/* Calc approx time to dispatch */
+	extra_bytes = tg->bytes_disp[rw] + bio->bi_size - bytes_allowed;
+	jiffy_wait = div64_u64(extra_bytes * HZ, tg->bps[rw]);
+
+	if (!jiffy_wait)
+		jiffy_wait = 1;
+
+	/*
+	 * This wait time is without taking into consideration the rounding
+	 * up we did. Add that time also.
+	 */
+	jiffy_wait = jiffy_wait + (jiffy_elapsed_rnd - jiffy_elapsed);
+	*wait = jiffy_wait;
+	return 0;
+}
+
+/*
+ * Returns whether one can dispatch a bio or not. Also returns approx number
+ * of jiffies to wait before this bio is with-in IO rate and can be dispatched
+ */
+static bool tg_may_dispatch(struct throtl_data *td, struct throtl_grp *tg,
+			    struct bio *bio, unsigned long *wait)
+{
+	bool rw = bio_data_dir(bio);
+	unsigned long bps_wait = 0, iops_wait = 0, max_wait = 0;
+
+	/*
+	 * Currently whole state machine of group depends on first bio
+	 * queued in the group bio list. So one should not be calling
+	 * this function with a different bio if there are other bios
+	 * queued.
+	 */
+	BUG_ON(tg->nr_queued[rw] && bio != bio_list_peek(&tg->bio_lists[rw]));
+
+	/* If tg->bps = -1, then BW is unlimited */
+	if (tg->bps[rw] == BLKIO_LIMIT_NONE && tg->iops[rw] == UINT_MAX) {
+		if (wait)
+			*wait = 0;
+		return 1;
+	}
+
+	/*
+	 * If previous slice expired, start a new one otherwise renew/extend
+	 * existing slice to make sure it is at least throtl_slice interval
+	 * long since now.
+	 */
+	if (throtl_slice_used(td, tg, rw))
+		throtl_start_new_slice(td, tg, rw);
+	else {
+		if (time_before(tg->slice_end[rw], jiffies + throtl_slice))
+			throtl_extend_slice(td, tg, rw, jiffies + throtl_slice);
+	}
+
+	if (tg_with_in_bps_limit(td, tg, bio, &bps_wait) &&
+	    tg_with_in_iops_limit(td, tg, bio, &iops_wait)) {
+		if (wait)
+			*wait = 0;
+		return 1;
+	}
+
+	max_wait = max(bps_wait, iops_wait);
+
+	if (wait)
+		*wait = max_wait;
+
+	if (time_before(tg->slice_end[rw], jiffies + max_wait))
+		throtl_extend_slice(td, tg, rw, jiffies + max_wait);
+
+	return 0;
+}
+
+static void throtl_charge_bio(struct throtl_grp *tg, struct bio *bio)
+{
+	bool rw = bio_data_dir(bio);
+	bool sync = bio->bi_rw & REQ_SYNC;
+
+	/* Charge the bio to the group */
+	tg->bytes_disp[rw] += bio->bi_size;
+	tg->io_disp[rw]++;
+
+	blkiocg_update_dispatch_stats(&tg->blkg, bio->bi_size, rw, sync);
+}
+
+static void throtl_add_bio_tg(struct throtl_data *td, struct throtl_grp *tg,
+			      struct bio *bio)
+{
+	bool rw = bio_data_dir(bio);
+
+	bio_list_add(&tg->bio_lists[rw], bio);
+	/* Take a bio reference on tg */
+	throtl_ref_get_tg(tg);
+	tg->nr_queued[rw]++;
+	td->nr_queued[rw]++;
+	throtl_enqueue_tg(td, tg);
+}
+
+static void tg_update_disptime(struct throtl_data *td, struct throtl_grp *tg)
+{
+	unsigned long read_wait = -1, write_wait = -1, min_wait = -1, disptime;
+	struct bio *bio;
+
+	bio = bio_list_peek(&tg->bio_lists[READ]);
+	if (bio)
+		tg_may_dispatch(td, tg, bio, &read_wait);
+
+	bio = bio_list_peek(&tg->bio_lists[WRITE]);
+	if (bio)
+		tg_may_dispatch(td, tg, bio, &write_wait);
+
+	min_wait = min(read_wait, write_wait);
+	disptime = jiffies + min_wait;
+
+	/* Update dispatch time */
+	throtl_dequeue_tg(td, tg);
+	tg->disptime = disptime;
+	throtl_enqueue_tg(td, tg);
+}
+
+/*
+ * Move the first queued bio of @tg in direction @rw to @bl.  The caller
+ * must hold a reference on @tg, as this drops the one of the bio.
+ */
+static void tg_dispatch_one_bio(struct throtl_data *td, struct throtl_grp *tg,
+				bool rw, struct bio_list *bl)
+{
+	struct bio *bio;
+
+	bio = bio_list_pop(&tg->bio_lists[rw]);
+	tg->nr_queued[rw]--;
+	/* Drop bio reference on tg */
+	throtl_put_tg(tg);
+
+	BUG_ON(td->nr_queued[rw] <= 0);
+	td->nr_queued[rw]--;
+
+	throtl_charge_bio(tg, bio);
+	bio_list_add(bl, bio);
+	bio->bi_flags |= (1 << BIO_THROTTLED);
+
+	throtl_trim_slice(td, tg, rw);
+}
+
+static int throtl_dispatch_tg(struct throtl_data *td, struct throtl_grp *tg,
+			      struct bio_list *bl)
+{
+	unsigned int nr_reads = 0, nr_writes = 0;
+	unsigned int max_nr_reads = throtl_grp_quantum*3/4;
+	unsigned int max_nr_writes = throtl_grp_quantum - max_nr_reads;
+	struct bio *bio;
+
+	/* Try to dispatch 75% READS and 25% WRITES */
+
+	while ((bio = bio_list_peek(&tg->bio_lists[READ]))
+	       && tg_may_dispatch(td, tg, bio, NULL)) {
+
+		tg_dispatch_one_bio(td, tg, bio_data_dir(bio), bl);
+		nr_reads++;
+
+		if (nr_reads >= max_nr_reads)
+			break;
+	}
+
+	while ((bio = bio_list_peek(&tg->bio_lists[WRITE]))
+	       && tg_may_dispatch(td, tg, bio, NULL)) {
+
+		tg_dispatch_one_bio(td, tg, bio_data_dir(bio), bl);
+		nr_writes++;
+
+		if (nr_writes >= max_nr_writes)
+			break;
+	}
+
+	return nr_reads + nr_writes;
+}
+
+static int throtl_select_dispatch(struct throtl_data *td, struct bio_list *bl)
+{
+	unsigned int nr_disp = 0;
+	struct throtl_grp *tg;
+	struct throtl_rb_root *st = &td->tg_service_tree;
+
+	while (1) {
+		tg = throtl_rb_first(st);
+
+		if (!tg)
+			break;
+
+		if (time_before(jiffies, tg->disptime))
+			break;
+
+		throtl_dequeue_tg(td, tg);
+
+		/*
+		 * The queued bios may hold the last references on a group
+		 * whose cgroup went away, keep it until we are done with it.
+		 */
+		throtl_ref_get_tg(tg);
+		nr_disp += throtl_dispatch_tg(td, tg, bl);
+
+		if (tg->nr_queued[0] || tg->nr_queued[1])
+			tg_update_disptime(td, tg);
+		throtl_put_tg(tg);
+
+		if (nr_disp >= throtl_quantum)
+			break;
+	}
+
+	return nr_disp;
+}
+
+/*
+ * Start new slices for the groups whose limits were changed through the
+ * cgroup files, and recompute when their queued bios are due.  Called with
+ * the queue lock held.
+ */
+static void throtl_process_limit_change(struct throtl_data *td)
+{
+	struct throtl_grp *tg;
+	struct hlist_node *pos, *n;
+
+	if (!atomic_xchg(&td->limits_changed, 0))
+		return;
+
+	hlist_for_each_entry_safe(tg, pos, n, &td->tg_list, tg_node) {
+		if (!xchg(&tg->limits_changed, false))
+			continue;
+
+		throtl_start_new_slice(td, tg, READ);
+		throtl_start_new_slice(td, tg, WRITE);
+
+		if (tg->on_st)
+			tg_update_disptime(td, tg);
+	}
+}
+
+/* Dispatch throttled bios.  Runs on kblockd. */
+static void blk_throtl_work(struct work_struct *work)
+{
+	struct throtl_data *td = container_of(work, struct throtl_data,
+					      throtl_work.work);
+	struct request_queue *q = td->queue;
+	unsigned int nr_disp = 0;
+	struct bio_list bio_list_on_stack;
+	struct bio *bio;
+	struct blk_plug plug;
+
+	spin_lock_irq(q->queue_lock);
+
+	throtl_process_limit_change(td);
+
+	if (!total_nr_queued(td))
+		goto out;
+
+	bio_list_init(&bio_list_on_stack);
+
+	nr_disp = throtl_select_dispatch(td, &bio_list_on_stack);
+
+	throtl_schedule_next_dispatch(td);
+out:
+	spin_unlock_irq(q->queue_lock);
+
+	/*
+	 * If we dispatched some requests, submit them here, outside the
+	 * queue lock.
+	 */
+	if (nr_disp) {
+		blk_start_plug(&plug);
+		while ((bio = bio_list_pop(&bio_list_on_stack)))
+			generic_make_request(bio);
+		blk_finish_plug(&plug);
+	}
+}
+
+/*
+ * Called from the cgroup code with the blkcg lock held, which nests inside
+ * the queue lock, so the limit is just stored and the dispatch work picks
+ * the change up.
+ */
+static void throtl_update_blkio_group_limit(void *key,
+			struct blkio_group *blkg, int fileid, u64 limit)
+{
+	struct throtl_data *td = key;
+	struct throtl_grp *tg = tg_of_blkg(blkg);
+
+	throtl_set_limit(tg, fileid, limit);
+	smp_wmb();
+	xchg(&tg->limits_changed, true);
+	atomic_inc(&td->limits_changed);
+	throtl_schedule_delayed_work(td, 0);
+}
+
+static void throtl_destroy_tg(struct throtl_data *td, struct throtl_grp *tg)
+{
+	/* Something wrong if we are trying to remove same group twice */
+	BUG_ON(hlist_unhashed(&tg->tg_node));
+
+	hlist_del_init(&tg->tg_node);
+
+	/*
+	 * Put the reference taken at the time of creation so that when all
+	 * queues are gone, group can be destroyed.
+	 */
+	throtl_put_tg(tg);
+	td->nr_undestroyed_grps--;
+}
+
+/*
+ * The cgroup of the group is going away.  Called under rcu_read_lock(), which
+ * blk_throtl_exit() relies on to not free the throtl_data under us.
+ */
+static void throtl_unlink_blkio_group(void *key, struct blkio_group *blkg)
+{
+	struct throtl_data *td = key;
+	unsigned long flags;
+
+	spin_lock_irqsave(td->queue->queue_lock, flags);
+	throtl_destroy_tg(td, tg_of_blkg(blkg));
+	spin_unlock_irqrestore(td->queue->queue_lock, flags);
+}
+
+static struct blkio_policy_type blkio_policy_throtl = {
+	.ops = {
+		.blkio_unlink_group_fn = throtl_unlink_blkio_group,
+		.blkio_update_group_limit_fn = throtl_update_blkio_group_limit,
+	},
+	.plid = BLKIO_POLICY_THROTL,
+};
+
+/**
+ * blk_throtl_bio - apply the limits of the submitter's cgroup to a bio
+ * @q:		the queue the bio was submitted to
+ * @bio:	the bio
+ *
+ * Description:
+ *     Called by __generic_make_request() before the bio is handed to the
+ *     make_request_fn of @q.  Returns false if the bio may go on right away,
+ *     and true if it was queued to be submitted again later.
+ */
+bool blk_throtl_bio(struct request_queue *q, struct bio *bio)
+{
+	struct throtl_data *td;
+	struct blkio_cgroup *blkcg;
+	struct throtl_grp *tg;
+	bool rw = bio_data_dir(bio), update_disptime = true;
+
+	/* The bio was released by the dispatch work, let it through */
+	if (bio_flagged(bio, BIO_THROTTLED)) {
+		bio->bi_flags &= ~(1 << BIO_THROTTLED);
+		return false;
+	}
+
+	/*
+	 * Most groups have no limits at all.  Don't take the queue lock for
+	 * those, the stats are all there is to update.
+	 */
+	rcu_read_lock();
+	td = rcu_dereference(q->td);
+	if (!td) {
+		rcu_read_unlock();
+		return false;
+	}
+	blkcg = cgroup_to_blkio_cgroup(task_cgroup(current, blkio_subsys_id));
+	tg = throtl_find_tg(td, blkcg);
+	if (tg && tg->blkg.dev && tg_no_limits(tg) && !tg->nr_queued[rw]) {
+		blkiocg_update_dispatch_stats(&tg->blkg, bio->bi_size, rw,
+					      bio->bi_rw & REQ_SYNC);
+		rcu_read_unlock();
+		return false;
+	}
+	rcu_read_unlock();
+
+	spin_lock_irq(q->queue_lock);
+	/* blk_throtl_exit() may have torn td down since the lookup above */
+	if (td != q->td) {
+		spin_unlock_irq(q->queue_lock);
+		return false;
+	}
+	throtl_process_limit_change(td);
+	tg = throtl_get_tg(td);
+
+	if (tg->nr_queued[rw]) {
+		/*
+		 * There is already another bio queued in same dir. No
+		 * need to update dispatch time.
+		 */
+		update_disptime = false;
+		goto queue_bio;
+	}
+
+	/* Bio is with-in rate limit of group */
+	if (tg_may_dispatch(td, tg, bio, NULL)) {
+		throtl_charge_bio(tg, bio);
+		throtl_trim_slice(td, tg, rw);
+		spin_unlock_irq(q->queue_lock);
+		return false;
+	}
+
+queue_bio:
+	throtl_add_bio_tg(td, tg, bio);
+
+	if (update_disptime) {
+		tg_update_disptime(td, tg);
+		throtl_schedule_next_dispatch(td);
+	}
+
+	spin_unlock_irq(q->queue_lock);
+	return true;
+}
+
+int blk_throtl_init(struct request_queue *q)
+{
+	struct throtl_data *td;
+
+	td = kzalloc_node(sizeof(*td), GFP_KERNEL, q->node);
+	if (!td)
+		return -ENOMEM;
+
+	INIT_HLIST_HEAD(&td->tg_list);
+	td->tg_service_tree = THROTL_RB_ROOT;
+	atomic_set(&td->limits_changed, 0);
+	INIT_DELAYED_WORK(&td->throtl_work, blk_throtl_work);
+	td->queue = q;
+
+	td->root_tg = throtl_alloc_tg(td, &blkio_root_cgroup, GFP_KERNEL);
+	if (!td->root_tg) {
+		kfree(td);
+		return -ENOMEM;
+	}
+
+	q->td = td;
+	return 0;
+}
+
+/*
+ * Tear down throttling of a queue which is going away.  Bios still waiting
+ * for their turn are submitted right away, ignoring the limits.
+ */
+void blk_throtl_exit(struct request_queue *q)
+{
+	struct throtl_data *td = q->td;
+	struct throtl_grp *tg;
+	struct hlist_node *pos, *n;
+	struct bio_list bio_list_on_stack;
+	struct bio *bio;
+
+	if (!td)
+		return;
+
+	bio_list_init(&bio_list_on_stack);
+
+	spin_lock_irq(q->queue_lock);
+
+	/* New bios go straight through from here on */
+	q->td = NULL;
+
+	while ((tg = throtl_rb_first(&td->tg_service_tree))) {
+		throtl_dequeue_tg(td, tg);
+		throtl_ref_get_tg(tg);
+		while (tg->nr_queued[READ])
+			tg_dispatch_one_bio(td, tg, READ, &bio_list_on_stack);
+		while (tg->nr_queued[WRITE])
+			tg_dispatch_one_bio(td, tg, WRITE, &bio_list_on_stack);
+		throtl_put_tg(tg);
+	}
+
+	hlist_for_each_entry_safe(tg, pos, n, &td->tg_list, tg_node) {
+		/*
+		 * If cgroup removal path got to blk_group first and removed
+		 * it from cgroup list, then it will take care of destroying
+		 * the group also.
+		 */
+		if (!blkiocg_del_blkio_group(&tg->blkg))
+			throtl_destroy_tg(td, tg);
+	}
+
+	spin_unlock_irq(q->queue_lock);
+
+	cancel_delayed_work_sync(&td->throtl_work);
+
+	while ((bio = bio_list_pop(&bio_list_on_stack)))
+		generic_make_request(bio);
+
+	/*
+	 * Wait for the group lookups of blk_throtl_bio() that still see td,
+	 * and for the cgroup removal path unlinking the remaining groups,
+	 * both of which hold rcu_read_lock() while they use td.
+	 */
+	synchronize_rcu();
+	kfree(td);
+}
+
+static int __init throtl_init(void)
+{
+	blkio_policy_register(&blkio_policy_throtl);
+	return 0;
+}
+
+module_init(throtl_init);
@@ -85,7 +85,6 @@ struct cfq_rb_root {
 	struct rb_root rb;
 	struct rb_node *left;
 	unsigned count;
-	unsigned total_weight;
 	u64 min_vdisktime;
 	struct rb_node *active;
 };
@@ -179,8 +178,20 @@ struct cfq_group {
 	/* group service_tree key */
 	u64 vdisktime;
 	unsigned int weight;
+	unsigned int new_weight;
 	bool on_st;
 
+	/*
+	 * Hierarchy: the group of the parent cgroup, NULL for the root
+	 * group.  A group is active while it or any group below it is on
+	 * the service tree; nr_active counts those, and children_weight
+	 * sums their weights, the group's own queues counting as one more
+	 * child with the weight of the group.
+	 */
+	struct cfq_group *parent;
+	int nr_active;
+	unsigned int children_weight;
+
 	/* number of cfqq currently on this group */
 	int nr_cfqq;
 
@@ -277,6 +288,7 @@ struct cfq_data {
 	unsigned int cfq_slice_async_rq;
 	unsigned int cfq_slice_idle;
 	unsigned int cfq_group_idle;
+	unsigned int cfq_nonrot_iops;
 	unsigned int cfq_latency;
 	unsigned int cfq_group_isolation;
 
@@ -384,6 +396,17 @@ CFQ_CFQQ_FNS(wait_busy);
 			&cfqg->service_trees[i][j]: NULL) \
 
 
+/*
+ * A non-rotational device with NCQ has no seeks to save by idling, and
+ * idling leaves it with a shallow queue.  Unless told otherwise, never
+ * idle on such a device, on queues or groups.
+ */
+static inline bool cfq_nonrot_iops(struct cfq_data *cfqd)
+{
+	return cfqd->cfq_nonrot_iops && blk_queue_nonrot(cfqd->queue) &&
+		cfqd->hw_tag;
+}
+
 static inline bool iops_mode(struct cfq_data *cfqd)
 {
 	/*
@@ -393,7 +416,7 @@ static inline bool iops_mode(struct cfq_data *cfqd)
 	 * depths and that becomes a performance bottleneck. In such cases
 	 * switch to start providing fairness in terms of number of IOs.
 	 */
-	if (!cfqd->cfq_slice_idle && cfqd->hw_tag)
+	if ((!cfqd->cfq_slice_idle || cfq_nonrot_iops(cfqd)) && cfqd->hw_tag)
 		return true;
 	else
 		return false;
@@ -522,12 +545,33 @@ cfq_prio_to_slice(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	return cfq_prio_slice(cfqd, cfq_cfqq_sync(cfqq), cfqq->ioprio);
 }
 
+/*
+ * The share of the device an active group is entitled to, in units of
+ * 1 << CFQ_SERVICE_SHIFT: the share of its own queues among its active
+ * children, times the share of each group on the way up among the
+ * active children of its parent.
+ */
+static unsigned int cfq_group_vfraction(struct cfq_group *cfqg)
+{
+	unsigned int vfr = 1 << CFQ_SERVICE_SHIFT;
+	struct cfq_group *pos = cfqg;
+
+	if (WARN_ON_ONCE(!pos->children_weight))
+		return vfr;
+
+	vfr = vfr * pos->weight / pos->children_weight;
+	for (; pos->parent; pos = pos->parent)
+		vfr = vfr * pos->weight / pos->parent->children_weight;
+
+	return max(vfr, 1U);
+}
+
 static inline u64 cfq_scale_slice(unsigned long delta, struct cfq_group *cfqg)
 {
 	u64 d = delta << CFQ_SERVICE_SHIFT;
 
-	d = d * BLKIO_WEIGHT_DEFAULT;
-	do_div(d, cfqg->weight);
+	d <<= CFQ_SERVICE_SHIFT;
+	do_div(d, cfq_group_vfraction(cfqg));
 	return d;
 }
 
@@ -591,9 +635,8 @@ static inline unsigned cfq_group_get_avg_queues(struct cfq_data *cfqd,
 static inline unsigned
 cfq_group_slice(struct cfq_data *cfqd, struct cfq_group *cfqg)
 {
-	struct cfq_rb_root *st = &cfqd->grp_service_tree;
-
-	return cfq_target_latency * cfqg->weight / st->total_weight;
+	return cfq_target_latency * cfq_group_vfraction(cfqg) >>
+		CFQ_SERVICE_SHIFT;
 }
 
 static inline void
@@ -852,6 +895,66 @@ __cfq_group_service_tree_add(struct cfq_rb_root *st, struct cfq_group *cfqg)
 	rb_insert_color(&cfqg->rb_node, &st->rb);
 }
 
+/*
+ * Weight changes come in without the queue lock and are applied here,
+ * keeping children_weight of the group and its parent in step.
+ */
+static void cfq_update_group_weight(struct cfq_group *cfqg)
+{
+	unsigned int weight;
+
+	if (!cfqg->new_weight)
+		return;
+
+	weight = xchg(&cfqg->new_weight, 0);
+	if (cfqg->on_st)
+		cfqg->children_weight += weight - cfqg->weight;
+	if (cfqg->nr_active && cfqg->parent)
+		cfqg->parent->children_weight += weight - cfqg->weight;
+	cfqg->weight = weight;
+}
+
+/*
+ * Account the queues of @cfqg as active, and every group above it that
+ * was not active yet.  Called before @cfqg is marked on_st.
+ */
+static void cfq_group_activate(struct cfq_group *cfqg)
+{
+	struct cfq_group *pos = cfqg;
+	bool propagate;
+
+	cfq_update_group_weight(pos);
+	propagate = !pos->nr_active++;
+	pos->children_weight += pos->weight;
+
+	while (propagate && pos->parent) {
+		struct cfq_group *parent = pos->parent;
+
+		cfq_update_group_weight(parent);
+		propagate = !parent->nr_active++;
+		parent->children_weight += pos->weight;
+		pos = parent;
+	}
+}
+
+static void cfq_group_deactivate(struct cfq_group *cfqg)
+{
+	struct cfq_group *pos = cfqg;
+	bool propagate;
+
+	propagate = !--pos->nr_active;
+	pos->children_weight -= pos->weight;
+
+	while (propagate && pos->parent) {
+		struct cfq_group *parent = pos->parent;
+
+		WARN_ON_ONCE(pos->children_weight);
+		propagate = !--parent->nr_active;
+		parent->children_weight -= pos->weight;
+		pos = parent;
+	}
+}
+
 static void
 cfq_group_service_tree_add(struct cfq_data *cfqd, struct cfq_group *cfqg)
 {
@@ -876,8 +979,8 @@ cfq_group_service_tree_add(struct cfq_data *cfqd, struct cfq_group *cfqg)
 		cfqg->vdisktime = st->min_vdisktime;
 
 	__cfq_group_service_tree_add(st, cfqg);
+	cfq_group_activate(cfqg);
 	cfqg->on_st = true;
-	st->total_weight += cfqg->weight;
 }
 
 static void
@@ -897,7 +1000,7 @@ cfq_group_service_tree_del(struct cfq_data *cfqd, struct cfq_group *cfqg)
 
 	cfq_log_cfqg(cfqd, cfqg, "del_from_rr group");
 	cfqg->on_st = false;
-	st->total_weight -= cfqg->weight;
+	cfq_group_deactivate(cfqg);
 	if (!RB_EMPTY_NODE(&cfqg->rb_node))
 		cfq_rb_erase(&cfqg->rb_node, st);
 	cfqg->saved_workload_slice = 0;
@@ -934,6 +1037,7 @@ static void cfq_group_served(struct cfq_data *cfqd, struct cfq_group *cfqg,
 				struct cfq_queue *cfqq)
 {
 	struct cfq_rb_root *st = &cfqd->grp_service_tree;
+	struct cfq_group *pos;
 	unsigned int used_sl, charge;
 	int nr_sync = cfqg->nr_cfqq - cfqg_busy_async_queues(cfqd, cfqg)
 			- cfqg->service_tree_idle.count;
@@ -946,6 +1050,9 @@ static void cfq_group_served(struct cfq_data *cfqd, struct cfq_group *cfqg,
 	else if (!cfq_cfqq_sync(cfqq) && !nr_sync)
 		charge = cfqq->allocated_slice;
 
+	for (pos = cfqg; pos; pos = pos->parent)
+		cfq_update_group_weight(pos);
+
 	/* Can't update vdisktime while group is on service tree */
 	cfq_rb_erase(&cfqg->rb_node, st);
 	cfqg->vdisktime += cfq_scale_slice(charge, cfqg);
@@ -980,14 +1087,14 @@ static inline struct cfq_group *cfqg_of_blkg(struct blkio_group *blkg)
 void
 cfq_update_blkio_group_weight(struct blkio_group *blkg, unsigned int weight)
 {
-	cfqg_of_blkg(blkg)->weight = weight;
+	cfqg_of_blkg(blkg)->new_weight = weight;
 }
 
 static struct cfq_group *
 cfq_find_alloc_cfqg(struct cfq_data *cfqd, struct cgroup *cgroup, int create)
 {
 	struct blkio_cgroup *blkcg = cgroup_to_blkio_cgroup(cgroup);
-	struct cfq_group *cfqg = NULL;
+	struct cfq_group *cfqg = NULL, *parent;
 	void *key = cfqd;
 	int i, j;
 	struct cfq_rb_root *st;
@@ -1011,6 +1118,19 @@ cfq_find_alloc_cfqg(struct cfq_data *cfqd, struct cgroup *cgroup, int create)
 		*st = CFQ_RB_ROOT;
 	RB_CLEAR_NODE(&cfqg->rb_node);
 
+	/*
+	 * The parent cgroup can't go away while this one exists, but its
+	 * group may be unlinked before ours is freed: hold a reference.
+	 * Hang the group off the root if the parent can't be allocated.
+	 */
+	parent = NULL;
+	if (cgroup->parent)
+		parent = cfq_find_alloc_cfqg(cfqd, cgroup->parent, 1);
+	if (!parent)
+		parent = &cfqd->root_group;
+	atomic_inc(&parent->ref);
+	cfqg->parent = parent;
+
 	/*
 	 * Take the initial reference that will be released on destroy
 	 * This can be thought of a joint reference by cgroup and
@@ -1079,6 +1199,7 @@ static void cfq_link_cfqq_cfqg(struct cfq_queue *cfqq, struct cfq_group *cfqg)
 
 static void cfq_put_cfqg(struct cfq_group *cfqg)
 {
+	struct cfq_group *parent;
 	struct cfq_rb_root *st;
 	int i, j;
 
@@ -1087,7 +1208,11 @@ static void cfq_put_cfqg(struct cfq_group *cfqg)
 		return;
 	for_each_cfqg_st(cfqg, i, j, st)
 		BUG_ON(!RB_EMPTY_ROOT(&st->rb) || st->active != NULL);
+	BUG_ON(cfqg->nr_active);
+	parent = cfqg->parent;
 	kfree(cfqg);
+	if (parent)
+		cfq_put_cfqg(parent);
 }
 
 static void cfq_destroy_cfqg(struct cfq_data *cfqd, struct cfq_group *cfqg)
@@ -1875,7 +2000,7 @@ static bool cfq_should_idle(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	BUG_ON(!service_tree);
 	BUG_ON(!service_tree->count);
 
-	if (!cfqd->cfq_slice_idle)
+	if (!cfqd->cfq_slice_idle || cfq_nonrot_iops(cfqd))
 		return false;
 
 	/* We never do for idle class queues. */
@@ -2295,8 +2420,8 @@ static struct cfq_queue *cfq_select_queue(struct cfq_data *cfqd)
 	 * this group, wait for requests to complete.
 	 */
 check_group_idle:
-	if (cfqd->cfq_group_idle && cfqq->cfqg->nr_cfqq == 1
-	    && cfqq->cfqg->dispatched) {
+	if (cfqd->cfq_group_idle && !cfq_nonrot_iops(cfqd)
+	    && cfqq->cfqg->nr_cfqq == 1 && cfqq->cfqg->dispatched) {
 		cfqq = NULL;
 		goto keep_queue;
 	}
@@ -3406,6 +3531,10 @@ static bool cfq_should_wait_busy(struct cfq_data *cfqd, struct cfq_queue *cfqq)
 	if (cfqq->cfqg->nr_cfqq > 1)
 		return false;
 
+	/* Nor if we don't idle on groups at all */
+	if (cfq_nonrot_iops(cfqd))
+		return false;
+
 	if (cfq_slice_used(cfqq))
 		return true;
 
@@ -3924,6 +4053,7 @@ static void *cfq_init_queue(struct request_queue *q)
 	cfqd->cfq_slice_async_rq = cfq_slice_async_rq;
 	cfqd->cfq_slice_idle = cfq_slice_idle;
 	cfqd->cfq_group_idle = cfq_group_idle;
+	cfqd->cfq_nonrot_iops = 1;
 	cfqd->cfq_latency = 1;
 	cfqd->cfq_group_isolation = 0;
 	cfqd->hw_tag = -1;
@@ -4002,6 +4132,7 @@ SHOW_FUNCTION(cfq_slice_async_show, cfqd->cfq_slice[0], 1);
 SHOW_FUNCTION(cfq_slice_async_rq_show, cfqd->cfq_slice_async_rq, 0);
 SHOW_FUNCTION(cfq_low_latency_show, cfqd->cfq_latency, 0);
 SHOW_FUNCTION(cfq_group_isolation_show, cfqd->cfq_group_isolation, 0);
+SHOW_FUNCTION(cfq_nonrot_iops_show, cfqd->cfq_nonrot_iops, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -4036,6 +4167,7 @@ STORE_FUNCTION(cfq_slice_async_rq_store, &cfqd->cfq_slice_async_rq, 1,
 		UINT_MAX, 0);
 STORE_FUNCTION(cfq_low_latency_store, &cfqd->cfq_latency, 0, 1, 0);
 STORE_FUNCTION(cfq_group_isolation_store, &cfqd->cfq_group_isolation, 0, 1, 0);
+STORE_FUNCTION(cfq_nonrot_iops_store, &cfqd->cfq_nonrot_iops, 0, 1, 0);
 #undef STORE_FUNCTION
 
 #define CFQ_ATTR(name) \
@@ -4054,6 +4186,7 @@ static struct elv_fs_entry cfq_attrs[] = {
 	CFQ_ATTR(group_idle),
 	CFQ_ATTR(low_latency),
 	CFQ_ATTR(group_isolation),
+	CFQ_ATTR(nonrot_iops),
 	__ATTR_NULL
 };
 
@@ -4090,6 +4223,7 @@ static struct blkio_policy_type blkio_policy_cfq = {
 		.blkio_unlink_group_fn =	cfq_unlink_blkio_group,
 		.blkio_update_group_weight_fn =	cfq_update_blkio_group_weight,
 	},
+	.plid = BLKIO_POLICY_PROP,
 };
 #else
 static struct blkio_policy_type blkio_policy_cfq;
@@ -13,12 +13,14 @@
 #include <linux/moduleparam.h>
 #include <linux/major.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/bio.h>
 #include <linux/highmem.h>
 #include <linux/smp_lock.h>
 #include <linux/radix-tree.h>
 #include <linux/buffer_head.h> /* invalidate_bh_lrus() */
 #include <linux/slab.h>
+#include <linux/hrtimer.h>
 
 #include <asm/uaccess.h>
 
@@ -366,6 +368,189 @@ out:
 	return 0;
 }
 
+static int completion_nsec;
+
+/*
+ * With completion_nsec set, a served request is only completed that long
+ * later, like the I/O of a device that signals completion with an
+ * interrupt.  The "interrupt" is an hrtimer per hardware queue, armed
+ * whenever requests are waiting, and ->poll() reaps the requests that are
+ * due before it fires.
+ */
+struct brd_hw_queue {
+	spinlock_t		lock;
+	struct list_head	pending;	/* by deadline */
+	struct hrtimer		timer;
+};
+
+struct brd_cmd {
+	struct list_head	list;
+	ktime_t			deadline;
+};
+
+/*
+ * Move the requests of @hq that are due to @done.  Called with hq->lock
+ * held.  The timer is left alone: it is armed for the first request on
+ * the list, which is due if anything was reaped, so it fires soon anyway.
+ */
+static int brd_reap_pending(struct brd_hw_queue *hq, struct list_head *done)
+{
+	ktime_t now = ktime_get();
+	struct brd_cmd *cmd, *next;
+	int nr = 0;
+
+	list_for_each_entry_safe(cmd, next, &hq->pending, list) {
+		if (cmd->deadline.tv64 > now.tv64)
+			break;
+		list_move_tail(&cmd->list, done);
+		nr++;
+	}
+	return nr;
+}
+
+static enum hrtimer_restart brd_timer_fn(struct hrtimer *timer)
+{
+	struct brd_hw_queue *hq = container_of(timer, struct brd_hw_queue,
+					       timer);
+	struct brd_cmd *cmd, *next;
+	unsigned long flags;
+	LIST_HEAD(done);
+
+	spin_lock_irqsave(&hq->lock, flags);
+	brd_reap_pending(hq, &done);
+	if (!list_empty(&hq->pending)) {
+		cmd = list_first_entry(&hq->pending, struct brd_cmd, list);
+		hrtimer_start(&hq->timer, cmd->deadline, HRTIMER_MODE_ABS);
+	}
+	spin_unlock_irqrestore(&hq->lock, flags);
+
+	list_for_each_entry_safe(cmd, next, &done, list)
+		blk_mq_complete_request(blk_mq_rq_from_pdu(cmd));
+
+	return HRTIMER_NORESTART;
+}
+
+static int brd_poll(struct blk_mq_hw_ctx *hctx)
+{
+	struct brd_hw_queue *hq = hctx->driver_data;
+	struct brd_cmd *cmd, *next;
+	unsigned long flags;
+	LIST_HEAD(done);
+	int nr;
+
+	spin_lock_irqsave(&hq->lock, flags);
+	nr = brd_reap_pending(hq, &done);
+	spin_unlock_irqrestore(&hq->lock, flags);
+
+	list_for_each_entry_safe(cmd, next, &done, list) {
+		struct request *rq = blk_mq_rq_from_pdu(cmd);
+
+		blk_mq_end_io(rq, rq->errors);
+	}
+	return nr;
+}
+
+static void brd_complete_rq(struct request *rq)
+{
+	blk_mq_end_io(rq, rq->errors);
+}
+
+static void brd_defer_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct brd_hw_queue *hq = hctx->driver_data;
+	struct brd_cmd *cmd = blk_mq_rq_to_pdu(rq);
+	unsigned long flags;
+
+	spin_lock_irqsave(&hq->lock, flags);
+	cmd->deadline = ktime_add_ns(ktime_get(), completion_nsec);
+	if (list_empty(&hq->pending))
+		hrtimer_start(&hq->timer, cmd->deadline, HRTIMER_MODE_ABS);
+	list_add_tail(&cmd->list, &hq->pending);
+	spin_unlock_irqrestore(&hq->lock, flags);
+}
+
+static int brd_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+			 unsigned int index)
+{
+	struct brd_hw_queue *hq;
+
+	hq = kzalloc_node(sizeof(*hq), GFP_KERNEL, hctx->numa_node);
+	if (!hq)
+		return -ENOMEM;
+	spin_lock_init(&hq->lock);
+	INIT_LIST_HEAD(&hq->pending);
+	hrtimer_init(&hq->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	hq->timer.function = brd_timer_fn;
+	hctx->driver_data = hq;
+	return 0;
+}
+
+static void brd_exit_hctx(struct blk_mq_hw_ctx *hctx, unsigned int index)
+{
+	struct brd_hw_queue *hq = hctx->driver_data;
+
+	hrtimer_cancel(&hq->timer);
+	kfree(hq);
+}
+
+/*
+ * Multi-queue mode: the requests of all CPUs are served right away on the
+ * CPU that runs the hardware queue, which is usually the submitting one.
+ */
+static int brd_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct brd_device *brd = rq->rq_disk->private_data;
+	int rw = rq_data_dir(rq);
+	struct req_iterator iter;
+	struct bio_vec *bvec;
+	sector_t sector;
+	int err = -EIO;
+
+	if (rq->cmd_type != REQ_TYPE_FS)
+		goto out;
+
+	sector = blk_rq_pos(rq);
+	if (sector + blk_rq_sectors(rq) > get_capacity(rq->rq_disk))
+		goto out;
+
+	err = 0;
+	if (unlikely(rq->cmd_flags & REQ_DISCARD)) {
+		discard_from_brd(brd, sector, blk_rq_bytes(rq));
+		goto out;
+	}
+
+	rq_for_each_segment(bvec, rq, iter) {
+		unsigned int len = bvec->bv_len;
+		err = brd_do_bvec(brd, bvec->bv_page, len,
+					bvec->bv_offset, rw, sector);
+		if (err)
+			break;
+		sector += len >> SECTOR_SHIFT;
+	}
+
+out:
+	if (hctx->driver_data) {
+		rq->errors = err;
+		brd_defer_rq(hctx, rq);
+	} else
+		blk_mq_end_io(rq, err);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops brd_mq_ops = {
+	.queue_rq	= brd_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
+
+static struct blk_mq_ops brd_mq_deferred_ops = {
+	.queue_rq	= brd_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.complete	= brd_complete_rq,
+	.init_hctx	= brd_init_hctx,
+	.exit_hctx	= brd_exit_hctx,
+	.poll		= brd_poll,
+};
+
 #ifdef CONFIG_BLK_DEV_XIP
 static int brd_direct_access(struct block_device *bdev, sector_t sector,
 			void **kaddr, unsigned long *pfn)
@@ -439,12 +624,20 @@ static int rd_nr;
 int rd_size = CONFIG_BLK_DEV_RAM_SIZE;
 static int max_part;
 static int part_shift;
+static int hw_queues;
+static int hw_queue_depth = 64;
 module_param(rd_nr, int, 0);
 MODULE_PARM_DESC(rd_nr, "Maximum number of brd devices");
 module_param(rd_size, int, 0);
 MODULE_PARM_DESC(rd_size, "Size of each RAM disk in kbytes.");
 module_param(max_part, int, 0);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per RAM disk");
+module_param(hw_queues, int, 0);
+MODULE_PARM_DESC(hw_queues, "Number of multi-queue hardware queues (0: bio based)");
+module_param(hw_queue_depth, int, 0);
+MODULE_PARM_DESC(hw_queue_depth, "Requests per multi-queue hardware queue");
+module_param(completion_nsec, int, 0);
+MODULE_PARM_DESC(completion_nsec, "Multi-queue requests complete this many ns after being served, from a timer or by polling (0: right away)");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(RAMDISK_MAJOR);
 MODULE_ALIAS("rd");
@@ -478,11 +671,30 @@ static struct brd_device *brd_alloc(int i)
 	spin_lock_init(&brd->brd_lock);
 	INIT_RADIX_TREE(&brd->brd_pages, GFP_ATOMIC);
 
-	brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
-	if (!brd->brd_queue)
-		goto out_free_dev;
-	blk_queue_make_request(brd->brd_queue, brd_make_request);
-	blk_queue_ordered(brd->brd_queue, QUEUE_ORDERED_TAG);
+	if (hw_queues > 0) {
+		struct blk_mq_reg reg = {
+			.ops		= &brd_mq_ops,
+			.nr_hw_queues	= hw_queues,
+			.queue_depth	= hw_queue_depth,
+			.numa_node	= NUMA_NO_NODE,
+			.flags		= BLK_MQ_F_SHOULD_MERGE,
+		};
+
+		if (completion_nsec > 0) {
+			reg.ops = &brd_mq_deferred_ops;
+			reg.cmd_size = sizeof(struct brd_cmd);
+		}
+
+		brd->brd_queue = blk_mq_init_queue(&reg, brd);
+		if (!brd->brd_queue)
+			goto out_free_dev;
+	} else {
+		brd->brd_queue = blk_alloc_queue(GFP_KERNEL);
+		if (!brd->brd_queue)
+			goto out_free_dev;
+		blk_queue_make_request(brd->brd_queue, brd_make_request);
+		blk_queue_ordered(brd->brd_queue, QUEUE_ORDERED_TAG);
+	}
 	blk_queue_max_hw_sectors(brd->brd_queue, 1024);
 	blk_queue_bounce_limit(brd->brd_queue, BLK_BOUNCE_ANY);
 
@@ -0,0 +1,18 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#ifndef DM_CACHE_BLOCK_TYPES_H
+#define DM_CACHE_BLOCK_TYPES_H
+
+#include <linux/types.h>
+
+/*
+ * The origin and the cache device are both carved up into blocks of the
+ * same size.  Origin blocks are addressed by dm_oblock_t, cache blocks
+ * by dm_cblock_t; keep the two apart, mixing them up is an easy mistake.
+ */
+typedef sector_t dm_oblock_t;
+typedef uint32_t dm_cblock_t;
+
+#endif
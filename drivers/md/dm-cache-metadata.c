@@ -0,0 +1,454 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#include "dm-cache-metadata.h"
+
+#include <linux/blkdev.h>
+#include <linux/dm-io.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache metadata"
+
+/*-----------------------------------------------------------------
+ * On disk format.
+ *
+ * The metadata device is divided into 4KB blocks.  The first one holds
+ * the superblock, it is followed by an array of mappings, one per cache
+ * block, indexed by cache block.
+ *
+ * Every mapping only depends on the cache block it describes, so the
+ * order mappings reach the disk in does not matter, and as a mapping
+ * never straddles a sector, it is either old or new after a crash.  The
+ * target orders its I/O around commits so that either is correct:
+ *
+ *  - a cache block is marked dirty in the metadata before it is
+ *    written to;
+ *
+ *  - a mapping is removed from the metadata before its cache block is
+ *    reused for another origin block.
+ *
+ * All on disk structures are in little-endian format.  A metadata
+ * device whose superblock is all zeroes is formatted.
+ *---------------------------------------------------------------*/
+
+/*
+ * Magic for the cache superblock: "hcac".
+ */
+#define CACHE_SUPERBLOCK_MAGIC 0x63616368
+
+/*
+ * The on-disk version of the metadata.
+ */
+#define CACHE_METADATA_VERSION 1
+
+#define CACHE_METADATA_BLOCK_SIZE 4096
+#define CACHE_METADATA_BLOCK_SECTORS (CACHE_METADATA_BLOCK_SIZE >> SECTOR_SHIFT)
+
+/* Superblock flags */
+#define CLEAN_SHUTDOWN (1 << 0)
+
+struct cache_disk_superblock {
+	__le32 magic;
+	__le32 version;
+	__le32 flags;
+
+	/* In sectors */
+	__le32 data_block_size;
+	__le32 cache_blocks;
+
+	/* The policy the hints were written by */
+	char policy_name[CACHE_POLICY_NAME_SIZE];
+} __packed;
+
+/* Mapping flags */
+#define M_VALID (1 << 0)
+#define M_DIRTY (1 << 1)
+
+struct cache_disk_mapping {
+	__le64 oblock;
+	__le32 flags;
+	__le32 hint;
+} __packed;
+
+#define MAPPINGS_PER_BLOCK \
+	(CACHE_METADATA_BLOCK_SIZE / sizeof(struct cache_disk_mapping))
+
+struct dm_cache_metadata {
+	struct block_device *bdev;
+	struct dm_io_client *io_client;
+
+	sector_t data_block_size;
+	dm_cblock_t cache_blocks;
+	char policy_name[CACHE_POLICY_NAME_SIZE];
+	int hints_valid;
+
+	/* Metadata blocks holding mappings, and on the whole device */
+	unsigned mapping_blocks;
+	sector_t dev_blocks;
+
+	struct cache_disk_superblock *sb;
+	struct cache_disk_mapping *mappings;
+
+	/* Mapping blocks changed since the last commit */
+	unsigned long *dirty_blocks;
+};
+
+static int metadata_io(struct dm_cache_metadata *cmd, void *area,
+		       sector_t block, unsigned nr_blocks, int rw)
+{
+	struct dm_io_region where = {
+		.bdev = cmd->bdev,
+		.sector = block * CACHE_METADATA_BLOCK_SECTORS,
+		.count = nr_blocks * CACHE_METADATA_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_VMA,
+		.mem.ptr.vma = area,
+		.client = cmd->io_client,
+		.notify.fn = NULL,
+	};
+
+	return dm_io(&io_req, 1, &where, NULL);
+}
+
+/*
+ * Mapping block i lives in metadata block i + 1, after the superblock.
+ */
+static int mapping_io(struct dm_cache_metadata *cmd, unsigned first,
+		      unsigned nr_blocks, int rw)
+{
+	void *area = cmd->mappings + first * MAPPINGS_PER_BLOCK;
+
+	return metadata_io(cmd, area, first + 1, nr_blocks, rw);
+}
+
+static int flush_metadata(struct dm_cache_metadata *cmd)
+{
+	int r = blkdev_issue_flush(cmd->bdev, GFP_NOIO, NULL, BLKDEV_IFL_WAIT);
+
+	/* Not every device has a write cache to flush */
+	return r == -EOPNOTSUPP ? 0 : r;
+}
+
+static int write_superblock(struct dm_cache_metadata *cmd, uint32_t flags)
+{
+	int r;
+
+	memset(cmd->sb, 0, CACHE_METADATA_BLOCK_SIZE);
+	cmd->sb->magic = cpu_to_le32(CACHE_SUPERBLOCK_MAGIC);
+	cmd->sb->version = cpu_to_le32(CACHE_METADATA_VERSION);
+	cmd->sb->flags = cpu_to_le32(flags);
+	cmd->sb->data_block_size = cpu_to_le32(cmd->data_block_size);
+	cmd->sb->cache_blocks = cpu_to_le32(cmd->cache_blocks);
+	strncpy(cmd->sb->policy_name, cmd->policy_name,
+		sizeof(cmd->sb->policy_name));
+
+	r = metadata_io(cmd, cmd->sb, 0, 1, WRITE);
+	if (r)
+		return r;
+
+	return flush_metadata(cmd);
+}
+
+static int format_metadata(struct dm_cache_metadata *cmd)
+{
+	int r;
+
+	memset(cmd->mappings, 0,
+	       cmd->mapping_blocks * CACHE_METADATA_BLOCK_SIZE);
+
+	r = mapping_io(cmd, 0, cmd->mapping_blocks, WRITE);
+	if (r)
+		return r;
+
+	cmd->hints_valid = 0;
+
+	return write_superblock(cmd, 0);
+}
+
+/*
+ * Returns 1 if the superblock is all zeroes.
+ */
+static int read_superblock(struct dm_cache_metadata *cmd)
+{
+	int r;
+	uint32_t flags;
+
+	r = metadata_io(cmd, cmd->sb, 0, 1, READ);
+	if (r) {
+		DMERR("couldn't read superblock");
+		return r;
+	}
+
+	if (!cmd->sb->magic)
+		return 1;
+
+	if (le32_to_cpu(cmd->sb->magic) != CACHE_SUPERBLOCK_MAGIC) {
+		DMERR("invalid superblock magic");
+		return -EINVAL;
+	}
+
+	if (le32_to_cpu(cmd->sb->version) != CACHE_METADATA_VERSION) {
+		DMERR("unsupported metadata version %u",
+		      le32_to_cpu(cmd->sb->version));
+		return -EINVAL;
+	}
+
+	if (le32_to_cpu(cmd->sb->data_block_size) != cmd->data_block_size) {
+		DMERR("block size %u differs from the one in the table",
+		      le32_to_cpu(cmd->sb->data_block_size));
+		return -EINVAL;
+	}
+
+	if (le32_to_cpu(cmd->sb->cache_blocks) != cmd->cache_blocks) {
+		DMERR("cache device changed size from %u blocks",
+		      le32_to_cpu(cmd->sb->cache_blocks));
+		return -EINVAL;
+	}
+
+	flags = le32_to_cpu(cmd->sb->flags);
+	cmd->hints_valid = (flags & CLEAN_SHUTDOWN) &&
+			   !strncmp(cmd->sb->policy_name, cmd->policy_name,
+				    sizeof(cmd->sb->policy_name));
+
+	return 0;
+}
+
+struct dm_cache_metadata *dm_cache_metadata_open(struct block_device *bdev,
+						 sector_t data_block_size,
+						 dm_cblock_t cache_size,
+						 const char *policy_name)
+{
+	int r = -ENOMEM;
+	struct dm_cache_metadata *cmd;
+	size_t bitmap_size;
+
+	cmd = kzalloc(sizeof(*cmd), GFP_KERNEL);
+	if (!cmd)
+		return ERR_PTR(-ENOMEM);
+
+	cmd->bdev = bdev;
+	cmd->data_block_size = data_block_size;
+	cmd->cache_blocks = cache_size;
+	strlcpy(cmd->policy_name, policy_name, sizeof(cmd->policy_name));
+
+	cmd->mapping_blocks = dm_div_up(cache_size, MAPPINGS_PER_BLOCK);
+	cmd->dev_blocks = i_size_read(bdev->bd_inode) >> SECTOR_SHIFT;
+	sector_div(cmd->dev_blocks, CACHE_METADATA_BLOCK_SECTORS);
+	if (cmd->dev_blocks < cmd->mapping_blocks + 1) {
+		DMERR("metadata device too small, %u blocks needed",
+		      cmd->mapping_blocks + 1);
+		r = -ENOSPC;
+		goto bad_size;
+	}
+
+	cmd->io_client = dm_io_client_create(1);
+	if (IS_ERR(cmd->io_client)) {
+		r = PTR_ERR(cmd->io_client);
+		goto bad_io_client;
+	}
+
+	cmd->sb = vmalloc(CACHE_METADATA_BLOCK_SIZE);
+	if (!cmd->sb)
+		goto bad_sb;
+
+	cmd->mappings = vmalloc(cmd->mapping_blocks *
+				CACHE_METADATA_BLOCK_SIZE);
+	if (!cmd->mappings)
+		goto bad_mappings;
+
+	bitmap_size = BITS_TO_LONGS(cmd->mapping_blocks) * sizeof(long);
+	cmd->dirty_blocks = kzalloc(bitmap_size, GFP_KERNEL);
+	if (!cmd->dirty_blocks)
+		goto bad_dirty_blocks;
+
+	r = read_superblock(cmd);
+	if (r > 0) {
+		DMINFO("formatting new metadata");
+		r = format_metadata(cmd);
+	}
+	if (r)
+		goto bad_read;
+
+	return cmd;
+
+bad_read:
+	kfree(cmd->dirty_blocks);
+bad_dirty_blocks:
+	vfree(cmd->mappings);
+bad_mappings:
+	vfree(cmd->sb);
+bad_sb:
+	dm_io_client_destroy(cmd->io_client);
+bad_io_client:
+bad_size:
+	kfree(cmd);
+	return ERR_PTR(r);
+}
+
+void dm_cache_metadata_close(struct dm_cache_metadata *cmd)
+{
+	kfree(cmd->dirty_blocks);
+	vfree(cmd->mappings);
+	vfree(cmd->sb);
+	dm_io_client_destroy(cmd->io_client);
+	kfree(cmd);
+}
+
+int dm_cache_load_mappings(struct dm_cache_metadata *cmd,
+			   load_mapping_fn fn, void *context)
+{
+	int r;
+	dm_cblock_t cblock;
+	struct cache_disk_mapping *m;
+	uint32_t flags;
+
+	/*
+	 * A table being replaced may have changed the metadata since it
+	 * was opened, so read it all again.
+	 */
+	r = read_superblock(cmd);
+	if (r)
+		return r < 0 ? r : -EINVAL;
+
+	r = mapping_io(cmd, 0, cmd->mapping_blocks, READ);
+	if (r) {
+		DMERR("couldn't read mappings");
+		return r;
+	}
+
+	for (cblock = 0; cblock < cmd->cache_blocks; cblock++) {
+		m = cmd->mappings + cblock;
+		flags = le32_to_cpu(m->flags);
+		if (!(flags & M_VALID))
+			continue;
+
+		r = fn(context, le64_to_cpu(m->oblock), cblock,
+		       flags & M_DIRTY, le32_to_cpu(m->hint),
+		       cmd->hints_valid);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+static void mark_mapping_dirty(struct dm_cache_metadata *cmd,
+			       dm_cblock_t cblock)
+{
+	__set_bit(cblock / MAPPINGS_PER_BLOCK, cmd->dirty_blocks);
+}
+
+void dm_cache_insert_mapping(struct dm_cache_metadata *cmd,
+			     dm_cblock_t cblock, dm_oblock_t oblock)
+{
+	struct cache_disk_mapping *m = cmd->mappings + cblock;
+
+	m->oblock = cpu_to_le64(oblock);
+	m->flags = cpu_to_le32(M_VALID);
+	m->hint = 0;
+	mark_mapping_dirty(cmd, cblock);
+}
+
+void dm_cache_remove_mapping(struct dm_cache_metadata *cmd,
+			     dm_cblock_t cblock)
+{
+	struct cache_disk_mapping *m = cmd->mappings + cblock;
+
+	memset(m, 0, sizeof(*m));
+	mark_mapping_dirty(cmd, cblock);
+}
+
+void dm_cache_set_dirty(struct dm_cache_metadata *cmd,
+			dm_cblock_t cblock, bool dirty)
+{
+	struct cache_disk_mapping *m = cmd->mappings + cblock;
+	uint32_t flags = le32_to_cpu(m->flags);
+
+	if (dirty)
+		flags |= M_DIRTY;
+	else
+		flags &= ~M_DIRTY;
+
+	if (flags != le32_to_cpu(m->flags)) {
+		m->flags = cpu_to_le32(flags);
+		mark_mapping_dirty(cmd, cblock);
+	}
+}
+
+void dm_cache_set_hint(struct dm_cache_metadata *cmd,
+		       dm_cblock_t cblock, uint32_t hint)
+{
+	struct cache_disk_mapping *m = cmd->mappings + cblock;
+
+	if (le32_to_cpu(m->hint) != hint) {
+		m->hint = cpu_to_le32(hint);
+		mark_mapping_dirty(cmd, cblock);
+	}
+}
+
+bool dm_cache_metadata_dirty(struct dm_cache_metadata *cmd)
+{
+	return find_first_bit(cmd->dirty_blocks, cmd->mapping_blocks) <
+		cmd->mapping_blocks;
+}
+
+int dm_cache_commit(struct dm_cache_metadata *cmd)
+{
+	int r;
+	unsigned first, end;
+
+	if (!dm_cache_metadata_dirty(cmd))
+		return 0;
+
+	/* Write each run of dirty blocks with a single io */
+	first = find_first_bit(cmd->dirty_blocks, cmd->mapping_blocks);
+	while (first < cmd->mapping_blocks) {
+		end = find_next_zero_bit(cmd->dirty_blocks, cmd->mapping_blocks,
+					 first);
+
+		r = mapping_io(cmd, first, end - first, WRITE);
+		if (r) {
+			DMERR("couldn't write mappings");
+			return r;
+		}
+
+		first = find_next_bit(cmd->dirty_blocks, cmd->mapping_blocks,
+				      end);
+	}
+
+	r = flush_metadata(cmd);
+	if (r)
+		return r;
+
+	bitmap_zero(cmd->dirty_blocks, cmd->mapping_blocks);
+
+	return 0;
+}
+
+int dm_cache_metadata_set_clean(struct dm_cache_metadata *cmd, bool clean)
+{
+	int r;
+
+	r = dm_cache_commit(cmd);
+	if (r)
+		return r;
+
+	/*
+	 * Whatever hints there were are only trusted again after the
+	 * next clean shutdown.
+	 */
+	cmd->hints_valid = 0;
+
+	return write_superblock(cmd, clean ? CLEAN_SHUTDOWN : 0);
+}
+
+void dm_cache_metadata_usage(struct dm_cache_metadata *cmd,
+			     sector_t *used, sector_t *total)
+{
+	*used = cmd->mapping_blocks + 1;
+	*total = cmd->dev_blocks;
+}
@@ -0,0 +1,76 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#ifndef DM_CACHE_METADATA_H
+#define DM_CACHE_METADATA_H
+
+#include "dm-cache-block-types.h"
+#include "dm-cache-policy.h"
+
+/*
+ * The persistent metadata of a cache: which origin block each cache
+ * block holds, whether it is dirty, and a hint per block for the policy.
+ *
+ * All of it is kept in core, changes are only written out by
+ * dm_cache_commit().  None of these functions lock; the caller has to
+ * serialise them, and only dm_cache_commit() and the functions marked
+ * below may block.
+ */
+struct dm_cache_metadata;
+
+/*
+ * Opens the metadata on bdev, formatting it if it starts with a zeroed
+ * superblock.  Returns an ERR_PTR on failure.  May block.
+ */
+struct dm_cache_metadata *dm_cache_metadata_open(struct block_device *bdev,
+						 sector_t data_block_size,
+						 dm_cblock_t cache_size,
+						 const char *policy_name);
+
+void dm_cache_metadata_close(struct dm_cache_metadata *cmd);
+
+/*
+ * Reads the mappings from disk and calls fn for every one of them.  The
+ * hints are only valid if the cache was shut down cleanly, under the
+ * same policy.  May block.
+ */
+typedef int (*load_mapping_fn)(void *context, dm_oblock_t oblock,
+			       dm_cblock_t cblock, bool dirty,
+			       uint32_t hint, bool hint_valid);
+int dm_cache_load_mappings(struct dm_cache_metadata *cmd,
+			   load_mapping_fn fn, void *context);
+
+void dm_cache_insert_mapping(struct dm_cache_metadata *cmd,
+			     dm_cblock_t cblock, dm_oblock_t oblock);
+void dm_cache_remove_mapping(struct dm_cache_metadata *cmd,
+			     dm_cblock_t cblock);
+void dm_cache_set_dirty(struct dm_cache_metadata *cmd,
+			dm_cblock_t cblock, bool dirty);
+void dm_cache_set_hint(struct dm_cache_metadata *cmd,
+		       dm_cblock_t cblock, uint32_t hint);
+
+/*
+ * Are there changes which haven't been committed yet?
+ */
+bool dm_cache_metadata_dirty(struct dm_cache_metadata *cmd);
+
+/*
+ * Writes out all changes and flushes them to stable storage.  May block.
+ */
+int dm_cache_commit(struct dm_cache_metadata *cmd);
+
+/*
+ * A cache marked clean was shut down with all changes and the policy
+ * hints committed, so that the hints can be trusted when it is loaded
+ * again.  Commits.  May block.
+ */
+int dm_cache_metadata_set_clean(struct dm_cache_metadata *cmd, bool clean);
+
+/*
+ * Metadata blocks used and available on the metadata device.
+ */
+void dm_cache_metadata_usage(struct dm_cache_metadata *cmd,
+			     sector_t *used, sector_t *total);
+
+#endif
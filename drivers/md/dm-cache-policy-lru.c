@@ -0,0 +1,294 @@
+/*
+ * This file is released under the GPL.
+ *
+ * A least recently used cache policy: every miss promotes the block,
+ * evicting the least recently used clean block if the cache is full.
+ * Simple and predictable, but a large scan flushes the whole cache, see
+ * the mq policy for something smarter.
+ */
+
+#include "dm-cache-policy.h"
+
+#include <linux/hash.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache-policy-lru"
+
+struct lru_entry {
+	struct hlist_node hlist;
+	struct list_head list;
+	dm_oblock_t oblock;
+	bool allocated;
+	bool dirty;
+};
+
+struct lru_policy {
+	struct dm_cache_policy policy;
+
+	dm_cblock_t cache_size;
+	dm_cblock_t nr_allocated;
+
+	/* Indexed by cblock */
+	struct lru_entry *entries;
+
+	/* Least recently used first */
+	struct list_head free;
+	struct list_head clean;
+	struct list_head dirty;
+
+	unsigned hash_bits;
+	struct hlist_head *table;
+};
+
+static struct lru_policy *to_lru_policy(struct dm_cache_policy *p)
+{
+	return container_of(p, struct lru_policy, policy);
+}
+
+static dm_cblock_t to_cblock(struct lru_policy *lru, struct lru_entry *e)
+{
+	return e - lru->entries;
+}
+
+static struct hlist_head *oblock_bucket(struct lru_policy *lru,
+					dm_oblock_t oblock)
+{
+	return lru->table + hash_64(oblock, lru->hash_bits);
+}
+
+static struct lru_entry *lookup(struct lru_policy *lru, dm_oblock_t oblock)
+{
+	struct lru_entry *e;
+	struct hlist_node *tmp;
+
+	hlist_for_each_entry(e, tmp, oblock_bucket(lru, oblock), hlist)
+		if (e->oblock == oblock)
+			return e;
+
+	return NULL;
+}
+
+static struct list_head *lru_list(struct lru_policy *lru, struct lru_entry *e)
+{
+	return e->dirty ? &lru->dirty : &lru->clean;
+}
+
+static void insert(struct lru_policy *lru, struct lru_entry *e,
+		   dm_oblock_t oblock, bool dirty)
+{
+	e->oblock = oblock;
+	e->allocated = true;
+	e->dirty = dirty;
+	hlist_add_head(&e->hlist, oblock_bucket(lru, oblock));
+	list_move_tail(&e->list, lru_list(lru, e));
+}
+
+static void lru_destroy(struct dm_cache_policy *p)
+{
+	struct lru_policy *lru = to_lru_policy(p);
+
+	vfree(lru->table);
+	vfree(lru->entries);
+	kfree(lru);
+}
+
+static int lru_map(struct dm_cache_policy *p, dm_oblock_t oblock,
+		   bool can_block, bool can_migrate, bool is_write,
+		   struct policy_result *result)
+{
+	struct lru_policy *lru = to_lru_policy(p);
+	struct lru_entry *e = lookup(lru, oblock);
+
+	if (e) {
+		list_move_tail(&e->list, lru_list(lru, e));
+		result->op = POLICY_HIT;
+		result->cblock = to_cblock(lru, e);
+		return 0;
+	}
+
+	/* Dirty blocks are never evicted */
+	if (list_empty(&lru->free) && list_empty(&lru->clean)) {
+		result->op = POLICY_MISS;
+		return 0;
+	}
+
+	if (!can_block)
+		return -EWOULDBLOCK;
+
+	if (!can_migrate) {
+		result->op = POLICY_MISS;
+		return 0;
+	}
+
+	if (!list_empty(&lru->free)) {
+		e = list_first_entry(&lru->free, struct lru_entry, list);
+		lru->nr_allocated++;
+		result->op = POLICY_NEW;
+	} else {
+		e = list_first_entry(&lru->clean, struct lru_entry, list);
+		hlist_del(&e->hlist);
+		result->op = POLICY_REPLACE;
+		result->old_oblock = e->oblock;
+	}
+
+	insert(lru, e, oblock, false);
+	result->cblock = to_cblock(lru, e);
+
+	return 0;
+}
+
+static int lru_load_mapping(struct dm_cache_policy *p, dm_oblock_t oblock,
+			    dm_cblock_t cblock, bool dirty, uint32_t hint,
+			    bool hint_valid)
+{
+	struct lru_policy *lru = to_lru_policy(p);
+	struct lru_entry *e = lru->entries + cblock;
+
+	if (e->allocated || lookup(lru, oblock))
+		return -EINVAL;
+
+	insert(lru, e, oblock, dirty);
+	lru->nr_allocated++;
+
+	return 0;
+}
+
+static uint32_t lru_get_hint(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	return 0;
+}
+
+static void lru_remove_mapping(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	struct lru_policy *lru = to_lru_policy(p);
+	struct lru_entry *e = lru->entries + cblock;
+
+	BUG_ON(!e->allocated);
+
+	hlist_del(&e->hlist);
+	e->allocated = false;
+	list_move(&e->list, &lru->free);
+	lru->nr_allocated--;
+}
+
+static void lru_set_dirty(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	struct lru_policy *lru = to_lru_policy(p);
+	struct lru_entry *e = lru->entries + cblock;
+
+	e->dirty = true;
+	list_move_tail(&e->list, &lru->dirty);
+}
+
+static void lru_clear_dirty(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	struct lru_policy *lru = to_lru_policy(p);
+	struct lru_entry *e = lru->entries + cblock;
+
+	e->dirty = false;
+	list_move_tail(&e->list, &lru->clean);
+}
+
+static int lru_writeback_work(struct dm_cache_policy *p, dm_oblock_t *oblock,
+			      dm_cblock_t *cblock)
+{
+	struct lru_policy *lru = to_lru_policy(p);
+	struct lru_entry *e;
+
+	if (list_empty(&lru->dirty))
+		return -ENODATA;
+
+	e = list_first_entry(&lru->dirty, struct lru_entry, list);
+	list_move_tail(&e->list, &lru->dirty);
+	*oblock = e->oblock;
+	*cblock = to_cblock(lru, e);
+
+	return 0;
+}
+
+static dm_cblock_t lru_residency(struct dm_cache_policy *p)
+{
+	return to_lru_policy(p)->nr_allocated;
+}
+
+static struct dm_cache_policy *lru_create(dm_cblock_t cache_size,
+					  unsigned argc, char **argv)
+{
+	struct lru_policy *lru;
+	dm_cblock_t i;
+	unsigned nr_buckets;
+
+	if (argc) {
+		DMWARN("lru takes no arguments");
+		return ERR_PTR(-EINVAL);
+	}
+
+	lru = kzalloc(sizeof(*lru), GFP_KERNEL);
+	if (!lru)
+		return ERR_PTR(-ENOMEM);
+
+	lru->policy.destroy = lru_destroy;
+	lru->policy.map = lru_map;
+	lru->policy.load_mapping = lru_load_mapping;
+	lru->policy.get_hint = lru_get_hint;
+	lru->policy.remove_mapping = lru_remove_mapping;
+	lru->policy.set_dirty = lru_set_dirty;
+	lru->policy.clear_dirty = lru_clear_dirty;
+	lru->policy.writeback_work = lru_writeback_work;
+	lru->policy.residency = lru_residency;
+
+	lru->cache_size = cache_size;
+	INIT_LIST_HEAD(&lru->free);
+	INIT_LIST_HEAD(&lru->clean);
+	INIT_LIST_HEAD(&lru->dirty);
+
+	lru->entries = vmalloc(cache_size * sizeof(*lru->entries));
+	if (!lru->entries)
+		goto bad_entries;
+
+	for (i = 0; i < cache_size; i++) {
+		lru->entries[i].allocated = false;
+		list_add_tail(&lru->entries[i].list, &lru->free);
+	}
+
+	nr_buckets = roundup_pow_of_two(max(cache_size / 4, 16U));
+	lru->hash_bits = ilog2(nr_buckets);
+	lru->table = vmalloc(nr_buckets * sizeof(*lru->table));
+	if (!lru->table)
+		goto bad_table;
+
+	for (i = 0; i < nr_buckets; i++)
+		INIT_HLIST_HEAD(lru->table + i);
+
+	return &lru->policy;
+
+bad_table:
+	vfree(lru->entries);
+bad_entries:
+	kfree(lru);
+	return ERR_PTR(-ENOMEM);
+}
+
+static struct dm_cache_policy_type lru_policy_type = {
+	.name = "lru",
+	.owner = THIS_MODULE,
+	.create = lru_create,
+};
+
+static int __init lru_init(void)
+{
+	return dm_cache_policy_register(&lru_policy_type);
+}
+
+static void __exit lru_exit(void)
+{
+	dm_cache_policy_unregister(&lru_policy_type);
+}
+
+module_init(lru_init);
+module_exit(lru_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache policy lru");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,614 @@
+/*
+ * This file is released under the GPL.
+ *
+ * The multiqueue cache policy.
+ *
+ * Hits are counted per block, for the cached blocks as well as for a
+ * pool of origin blocks which are candidates for promotion (the "pre
+ * cache").  Blocks are kept on multiple LRU queues, one per power of two
+ * of their hit count, so the coldest block is always at the front of the
+ * lowest non-empty queue.  Hit counts decay: they are halved every
+ * generation, which is a number of accesses the size of the cache.
+ *
+ * A candidate is promoted once it has been hit more often than the
+ * coldest clean cached block, plus an adjustment which makes it harder
+ * for a block to go through the cache and back again.  Long sequential
+ * runs of I/O are left to the origin, they are better served by its
+ * read ahead than by the cache.
+ */
+
+#include "dm-cache-policy.h"
+
+#include <linux/hash.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "cache-policy-mq"
+
+#define NR_QUEUE_LEVELS 16
+
+#define DEFAULT_SEQUENTIAL_THRESHOLD 512
+#define DEFAULT_READ_PROMOTE_ADJUSTMENT 4
+#define DEFAULT_WRITE_PROMOTE_ADJUSTMENT 8
+
+/*-----------------------------------------------------------------
+ * Multiqueues
+ *---------------------------------------------------------------*/
+struct queue {
+	struct list_head qs[NR_QUEUE_LEVELS];
+};
+
+static void queue_init(struct queue *q)
+{
+	unsigned i;
+
+	for (i = 0; i < NR_QUEUE_LEVELS; i++)
+		INIT_LIST_HEAD(q->qs + i);
+}
+
+static void queue_push(struct queue *q, unsigned level, struct list_head *elt)
+{
+	list_add_tail(elt, q->qs + level);
+}
+
+/*
+ * The least recently used element of the lowest level.
+ */
+static struct list_head *queue_peek(struct queue *q)
+{
+	unsigned i;
+
+	for (i = 0; i < NR_QUEUE_LEVELS; i++)
+		if (!list_empty(q->qs + i))
+			return q->qs[i].next;
+
+	return NULL;
+}
+
+static struct list_head *queue_pop(struct queue *q)
+{
+	struct list_head *r = queue_peek(q);
+
+	if (r)
+		list_del(r);
+
+	return r;
+}
+
+/*-----------------------------------------------------------------
+ * The policy
+ *---------------------------------------------------------------*/
+struct entry {
+	struct hlist_node hlist;
+	struct list_head list;
+	dm_oblock_t oblock;
+	unsigned hit_count;
+	unsigned generation;
+	bool in_cache;
+	bool dirty;
+};
+
+struct mq_policy {
+	struct dm_cache_policy policy;
+
+	dm_cblock_t cache_size;
+	dm_cblock_t nr_cached;
+
+	/* Indexed by cblock */
+	struct entry *cache_entries;
+	struct list_head free_cache;
+	struct queue cache_clean;
+	struct queue cache_dirty;
+
+	/* Candidates for promotion */
+	unsigned nr_pre_entries;
+	struct entry *pre_entries;
+	struct list_head free_pre;
+	struct queue pre_cache;
+
+	unsigned generation;
+	unsigned generation_period;
+	unsigned nr_accesses;
+
+	/* Sequential I/O detection */
+	dm_oblock_t last_oblock;
+	unsigned nr_sequential;
+
+	/* Tunables */
+	unsigned sequential_threshold;
+	unsigned read_promote_adjustment;
+	unsigned write_promote_adjustment;
+
+	unsigned hash_bits;
+	struct hlist_head *table;
+};
+
+static struct mq_policy *to_mq_policy(struct dm_cache_policy *p)
+{
+	return container_of(p, struct mq_policy, policy);
+}
+
+static dm_cblock_t to_cblock(struct mq_policy *mq, struct entry *e)
+{
+	return e - mq->cache_entries;
+}
+
+static struct hlist_head *oblock_bucket(struct mq_policy *mq,
+					dm_oblock_t oblock)
+{
+	return mq->table + hash_64(oblock, mq->hash_bits);
+}
+
+static struct entry *lookup(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	struct entry *e;
+	struct hlist_node *tmp;
+
+	hlist_for_each_entry(e, tmp, oblock_bucket(mq, oblock), hlist)
+		if (e->oblock == oblock)
+			return e;
+
+	return NULL;
+}
+
+static struct queue *entry_queue(struct mq_policy *mq, struct entry *e)
+{
+	if (!e->in_cache)
+		return &mq->pre_cache;
+
+	return e->dirty ? &mq->cache_dirty : &mq->cache_clean;
+}
+
+static unsigned queue_level(struct entry *e)
+{
+	return e->hit_count ?
+		min_t(unsigned, ilog2(e->hit_count), NR_QUEUE_LEVELS - 1) : 0;
+}
+
+/*
+ * Hit count of e with the generations it missed taken into account.
+ */
+static unsigned aged_hit_count(struct mq_policy *mq, struct entry *e)
+{
+	unsigned age = mq->generation - e->generation;
+
+	return age >= 32 ? 0 : e->hit_count >> age;
+}
+
+static void push(struct mq_policy *mq, struct entry *e)
+{
+	queue_push(entry_queue(mq, e), queue_level(e), &e->list);
+}
+
+static void requeue(struct mq_policy *mq, struct entry *e)
+{
+	list_del(&e->list);
+	push(mq, e);
+}
+
+static void touch(struct mq_policy *mq, struct entry *e)
+{
+	e->hit_count = aged_hit_count(mq, e);
+	if (e->hit_count < UINT_MAX)
+		e->hit_count++;
+	e->generation = mq->generation;
+	requeue(mq, e);
+}
+
+/*
+ * Entries nobody touches keep their hit count, and their level, for
+ * ever.  So every generation the oldest entry of each level gets aged.
+ */
+static void age_queue(struct mq_policy *mq, struct queue *q)
+{
+	unsigned level;
+	struct entry *e;
+
+	for (level = 1; level < NR_QUEUE_LEVELS; level++) {
+		if (list_empty(q->qs + level))
+			continue;
+
+		e = list_first_entry(q->qs + level, struct entry, list);
+		if (e->generation == mq->generation)
+			continue;
+
+		e->hit_count = aged_hit_count(mq, e);
+		e->generation = mq->generation;
+		requeue(mq, e);
+	}
+}
+
+static void count_access(struct mq_policy *mq)
+{
+	if (++mq->nr_accesses < mq->generation_period)
+		return;
+
+	mq->nr_accesses = 0;
+	mq->generation++;
+	age_queue(mq, &mq->pre_cache);
+	age_queue(mq, &mq->cache_clean);
+	age_queue(mq, &mq->cache_dirty);
+}
+
+/*
+ * The hit count a candidate needs to be promoted.
+ */
+static unsigned promote_threshold(struct mq_policy *mq, bool is_write)
+{
+	unsigned adjustment = is_write ? mq->write_promote_adjustment :
+					 mq->read_promote_adjustment;
+	struct list_head *victim;
+
+	if (!list_empty(&mq->free_cache))
+		return adjustment;
+
+	/* Dirty blocks are never evicted */
+	victim = queue_peek(&mq->cache_clean);
+	if (!victim)
+		return UINT_MAX;
+
+	return aged_hit_count(mq, list_entry(victim, struct entry, list)) +
+		adjustment;
+}
+
+/*
+ * Track oblock as a candidate, recycling the coldest candidate if
+ * needed.
+ */
+static void add_pre_entry(struct mq_policy *mq, dm_oblock_t oblock,
+			  unsigned hit_count)
+{
+	struct entry *e;
+
+	if (!list_empty(&mq->free_pre)) {
+		e = list_first_entry(&mq->free_pre, struct entry, list);
+		list_del(&e->list);
+	} else {
+		e = list_entry(queue_pop(&mq->pre_cache), struct entry, list);
+		hlist_del(&e->hlist);
+	}
+
+	e->oblock = oblock;
+	e->hit_count = hit_count;
+	e->generation = mq->generation;
+	e->in_cache = false;
+	e->dirty = false;
+	hlist_add_head(&e->hlist, oblock_bucket(mq, oblock));
+	push(mq, e);
+}
+
+static void del_pre_entry(struct mq_policy *mq, struct entry *e)
+{
+	hlist_del(&e->hlist);
+	list_move(&e->list, &mq->free_pre);
+}
+
+static void promote(struct mq_policy *mq, struct entry *pre,
+		    dm_oblock_t oblock, unsigned hit_count,
+		    struct policy_result *result)
+{
+	struct entry *e;
+
+	if (pre)
+		del_pre_entry(mq, pre);
+
+	if (!list_empty(&mq->free_cache)) {
+		e = list_first_entry(&mq->free_cache, struct entry, list);
+		list_del(&e->list);
+		mq->nr_cached++;
+		result->op = POLICY_NEW;
+	} else {
+		e = list_entry(queue_pop(&mq->cache_clean), struct entry, list);
+		hlist_del(&e->hlist);
+		result->op = POLICY_REPLACE;
+		result->old_oblock = e->oblock;
+
+		/* The evicted block becomes a candidate itself */
+		add_pre_entry(mq, e->oblock, aged_hit_count(mq, e));
+	}
+
+	e->oblock = oblock;
+	e->hit_count = hit_count;
+	e->generation = mq->generation;
+	e->in_cache = true;
+	e->dirty = false;
+	hlist_add_head(&e->hlist, oblock_bucket(mq, oblock));
+	push(mq, e);
+
+	result->cblock = to_cblock(mq, e);
+}
+
+static void mq_destroy(struct dm_cache_policy *p)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	vfree(mq->table);
+	vfree(mq->pre_entries);
+	vfree(mq->cache_entries);
+	kfree(mq);
+}
+
+static int mq_map(struct dm_cache_policy *p, dm_oblock_t oblock,
+		  bool can_block, bool can_migrate, bool is_write,
+		  struct policy_result *result)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e = lookup(mq, oblock);
+	unsigned nr_sequential = mq->nr_sequential;
+	unsigned hit_count;
+
+	if (oblock == mq->last_oblock + 1)
+		nr_sequential++;
+	else if (oblock != mq->last_oblock)
+		nr_sequential = 0;
+
+	if (e && e->in_cache) {
+		touch(mq, e);
+		result->op = POLICY_HIT;
+		result->cblock = to_cblock(mq, e);
+		goto out;
+	}
+
+	result->op = POLICY_MISS;
+
+	if (mq->sequential_threshold &&
+	    nr_sequential >= mq->sequential_threshold)
+		goto out;
+
+	hit_count = e ? aged_hit_count(mq, e) + 1 : 1;
+	if (hit_count >= promote_threshold(mq, is_write)) {
+		if (!can_block)
+			return -EWOULDBLOCK;
+
+		if (can_migrate) {
+			promote(mq, e, oblock, hit_count, result);
+			goto out;
+		}
+	}
+
+	if (e)
+		touch(mq, e);
+	else
+		add_pre_entry(mq, oblock, 1);
+
+out:
+	mq->last_oblock = oblock;
+	mq->nr_sequential = nr_sequential;
+	count_access(mq);
+
+	return 0;
+}
+
+static int mq_load_mapping(struct dm_cache_policy *p, dm_oblock_t oblock,
+			   dm_cblock_t cblock, bool dirty, uint32_t hint,
+			   bool hint_valid)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e = mq->cache_entries + cblock;
+
+	if (e->in_cache || lookup(mq, oblock))
+		return -EINVAL;
+
+	list_del(&e->list);
+	e->oblock = oblock;
+	e->hit_count = hint_valid ? hint : 0;
+	e->generation = mq->generation;
+	e->in_cache = true;
+	e->dirty = dirty;
+	hlist_add_head(&e->hlist, oblock_bucket(mq, oblock));
+	push(mq, e);
+	mq->nr_cached++;
+
+	return 0;
+}
+
+static uint32_t mq_get_hint(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+
+	return aged_hit_count(mq, mq->cache_entries + cblock);
+}
+
+static void mq_remove_mapping(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e = mq->cache_entries + cblock;
+
+	BUG_ON(!e->in_cache);
+
+	hlist_del(&e->hlist);
+	e->in_cache = false;
+	list_move(&e->list, &mq->free_cache);
+	mq->nr_cached--;
+}
+
+static void mq_set_dirty(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e = mq->cache_entries + cblock;
+
+	e->dirty = true;
+	requeue(mq, e);
+}
+
+static void mq_clear_dirty(struct dm_cache_policy *p, dm_cblock_t cblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct entry *e = mq->cache_entries + cblock;
+
+	e->dirty = false;
+	requeue(mq, e);
+}
+
+static int mq_writeback_work(struct dm_cache_policy *p, dm_oblock_t *oblock,
+			     dm_cblock_t *cblock)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	struct list_head *l = queue_pop(&mq->cache_dirty);
+	struct entry *e;
+
+	if (!l)
+		return -ENODATA;
+
+	e = list_entry(l, struct entry, list);
+	push(mq, e);
+
+	*oblock = e->oblock;
+	*cblock = to_cblock(mq, e);
+
+	return 0;
+}
+
+static dm_cblock_t mq_residency(struct dm_cache_policy *p)
+{
+	return to_mq_policy(p)->nr_cached;
+}
+
+static int mq_status(struct dm_cache_policy *p, status_type_t type,
+		     char *result, unsigned maxlen)
+{
+	struct mq_policy *mq = to_mq_policy(p);
+	unsigned sz = 0;
+
+	if (type == STATUSTYPE_TABLE)
+		DMEMIT("6 sequential_threshold %u read_promote_adjustment %u "
+		       "write_promote_adjustment %u",
+		       mq->sequential_threshold,
+		       mq->read_promote_adjustment,
+		       mq->write_promote_adjustment);
+
+	return sz;
+}
+
+static int process_args(struct mq_policy *mq, unsigned argc, char **argv)
+{
+	unsigned value;
+
+	if (argc & 1) {
+		DMWARN("arguments come in key value pairs");
+		return -EINVAL;
+	}
+
+	for (; argc; argc -= 2, argv += 2) {
+		if (sscanf(argv[1], "%u", &value) != 1) {
+			DMWARN("invalid value for %s", argv[0]);
+			return -EINVAL;
+		}
+
+		if (!strcasecmp(argv[0], "sequential_threshold"))
+			mq->sequential_threshold = value;
+		else if (!strcasecmp(argv[0], "read_promote_adjustment"))
+			mq->read_promote_adjustment = value;
+		else if (!strcasecmp(argv[0], "write_promote_adjustment"))
+			mq->write_promote_adjustment = value;
+		else {
+			DMWARN("unknown argument %s", argv[0]);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static struct dm_cache_policy *mq_create(dm_cblock_t cache_size,
+					 unsigned argc, char **argv)
+{
+	struct mq_policy *mq;
+	unsigned i, nr_buckets;
+	int r = -ENOMEM;
+
+	mq = kzalloc(sizeof(*mq), GFP_KERNEL);
+	if (!mq)
+		return ERR_PTR(-ENOMEM);
+
+	mq->policy.destroy = mq_destroy;
+	mq->policy.map = mq_map;
+	mq->policy.load_mapping = mq_load_mapping;
+	mq->policy.get_hint = mq_get_hint;
+	mq->policy.remove_mapping = mq_remove_mapping;
+	mq->policy.set_dirty = mq_set_dirty;
+	mq->policy.clear_dirty = mq_clear_dirty;
+	mq->policy.writeback_work = mq_writeback_work;
+	mq->policy.residency = mq_residency;
+	mq->policy.status = mq_status;
+
+	mq->sequential_threshold = DEFAULT_SEQUENTIAL_THRESHOLD;
+	mq->read_promote_adjustment = DEFAULT_READ_PROMOTE_ADJUSTMENT;
+	mq->write_promote_adjustment = DEFAULT_WRITE_PROMOTE_ADJUSTMENT;
+
+	r = process_args(mq, argc, argv);
+	if (r)
+		goto bad_args;
+	r = -ENOMEM;
+
+	mq->cache_size = cache_size;
+	mq->nr_pre_entries = max(cache_size, 256U);
+	mq->generation_period = max(cache_size, 1024U);
+	mq->last_oblock = -1;
+
+	INIT_LIST_HEAD(&mq->free_cache);
+	INIT_LIST_HEAD(&mq->free_pre);
+	queue_init(&mq->cache_clean);
+	queue_init(&mq->cache_dirty);
+	queue_init(&mq->pre_cache);
+
+	mq->cache_entries = vmalloc(cache_size * sizeof(struct entry));
+	if (!mq->cache_entries)
+		goto bad_cache_entries;
+
+	for (i = 0; i < cache_size; i++) {
+		mq->cache_entries[i].in_cache = false;
+		list_add_tail(&mq->cache_entries[i].list, &mq->free_cache);
+	}
+
+	mq->pre_entries = vmalloc(mq->nr_pre_entries * sizeof(struct entry));
+	if (!mq->pre_entries)
+		goto bad_pre_entries;
+
+	for (i = 0; i < mq->nr_pre_entries; i++)
+		list_add_tail(&mq->pre_entries[i].list, &mq->free_pre);
+
+	nr_buckets = roundup_pow_of_two(max((cache_size + mq->nr_pre_entries)
+					    / 4, 16U));
+	mq->hash_bits = ilog2(nr_buckets);
+	mq->table = vmalloc(nr_buckets * sizeof(*mq->table));
+	if (!mq->table)
+		goto bad_table;
+
+	for (i = 0; i < nr_buckets; i++)
+		INIT_HLIST_HEAD(mq->table + i);
+
+	return &mq->policy;
+
+bad_table:
+	vfree(mq->pre_entries);
+bad_pre_entries:
+	vfree(mq->cache_entries);
+bad_cache_entries:
+bad_args:
+	kfree(mq);
+	return ERR_PTR(r);
+}
+
+static struct dm_cache_policy_type mq_policy_type = {
+	.name = "mq",
+	.owner = THIS_MODULE,
+	.create = mq_create,
+};
+
+static int __init mq_init(void)
+{
+	return dm_cache_policy_register(&mq_policy_type);
+}
+
+static void __exit mq_exit(void)
+{
+	dm_cache_policy_unregister(&mq_policy_type);
+}
+
+module_init(mq_init);
+module_exit(mq_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache policy mq");
+MODULE_LICENSE("GPL");
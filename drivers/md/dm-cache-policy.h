@@ -0,0 +1,142 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Cache policy registration.
+ */
+
+#ifndef DM_CACHE_POLICY_H
+#define DM_CACHE_POLICY_H
+
+#include <linux/device-mapper.h>
+
+#include "dm-cache-block-types.h"
+
+/*
+ * A cache policy decides which origin blocks are worth keeping on the
+ * cache device and which cached block gets evicted to make room for
+ * them.  It owns the oblock <-> cblock mapping; the target does the
+ * I/O, the copying and the metadata.
+ *
+ * All methods are called with the cache lock held, interrupts disabled,
+ * so they must not block.
+ */
+
+enum policy_operation {
+	POLICY_HIT,	/* oblock is cached in cblock */
+	POLICY_MISS,	/* oblock is not cached, use the origin */
+	POLICY_NEW,	/* promote oblock into the free cblock */
+	POLICY_REPLACE,	/* evict old_oblock from cblock, promote oblock */
+};
+
+struct policy_result {
+	enum policy_operation op;
+	dm_oblock_t old_oblock;	/* POLICY_REPLACE only */
+	dm_cblock_t cblock;	/* POLICY_HIT, POLICY_NEW and POLICY_REPLACE */
+};
+
+struct dm_cache_policy {
+	void (*destroy)(struct dm_cache_policy *p);
+
+	/*
+	 * Look up oblock for an I/O and record the access.
+	 *
+	 * If can_block is false and the policy would like to migrate a
+	 * block, it returns -EWOULDBLOCK without recording anything; the
+	 * target then calls again from its worker, with can_block set.
+	 * If can_migrate is false the answer must be POLICY_HIT or
+	 * POLICY_MISS.
+	 *
+	 * A POLICY_NEW or POLICY_REPLACE answer takes effect at once: from
+	 * then on oblock maps to cblock.  A block is only ever evicted
+	 * while clean.
+	 */
+	int (*map)(struct dm_cache_policy *p, dm_oblock_t oblock,
+		   bool can_block, bool can_migrate, bool is_write,
+		   struct policy_result *result);
+
+	/*
+	 * Mappings read back from the metadata when the cache starts.
+	 * hint is whatever get_hint() returned when the cache was last
+	 * shut down cleanly; it is only meaningful if hint_valid is set.
+	 */
+	int (*load_mapping)(struct dm_cache_policy *p, dm_oblock_t oblock,
+			    dm_cblock_t cblock, bool dirty, uint32_t hint,
+			    bool hint_valid);
+	uint32_t (*get_hint)(struct dm_cache_policy *p, dm_cblock_t cblock);
+
+	/*
+	 * Forget about cblock, eg. because promoting into it failed.
+	 */
+	void (*remove_mapping)(struct dm_cache_policy *p, dm_cblock_t cblock);
+
+	void (*set_dirty)(struct dm_cache_policy *p, dm_cblock_t cblock);
+	void (*clear_dirty)(struct dm_cache_policy *p, dm_cblock_t cblock);
+
+	/*
+	 * Pick a dirty block to be written back to the origin, the least
+	 * recently used first.  The block stays dirty, and so can't be
+	 * evicted, until the writeback succeeds and the target calls
+	 * clear_dirty(); successive calls cycle through the dirty blocks.
+	 * Returns -ENODATA if there is no dirty block.
+	 */
+	int (*writeback_work)(struct dm_cache_policy *p, dm_oblock_t *oblock,
+			      dm_cblock_t *cblock);
+
+	/*
+	 * Number of cache blocks in use.
+	 */
+	dm_cblock_t (*residency)(struct dm_cache_policy *p);
+
+	/*
+	 * Called about once a second.  Optional.
+	 */
+	void (*tick)(struct dm_cache_policy *p);
+
+	/*
+	 * Emits the policy's arguments as "<#args> <args>*" for
+	 * STATUSTYPE_TABLE.  Returns the number of characters emitted.
+	 * Optional.
+	 */
+	int (*status)(struct dm_cache_policy *p, status_type_t type,
+		      char *result, unsigned maxlen);
+
+	/* For internal use by the policy registration code */
+	void *private;
+};
+
+#define CACHE_POLICY_NAME_SIZE 16
+
+/* Information about a policy type */
+struct dm_cache_policy_type {
+	char name[CACHE_POLICY_NAME_SIZE];
+	struct module *owner;
+
+	/* For internal use by the policy registration code */
+	struct list_head list;
+
+	/*
+	 * Constructs a policy for a cache of cache_size blocks, takes
+	 * custom arguments.  Returns an ERR_PTR on failure.
+	 */
+	struct dm_cache_policy *(*create)(dm_cblock_t cache_size,
+					  unsigned argc, char **argv);
+};
+
+/* Register a policy type */
+int dm_cache_policy_register(struct dm_cache_policy_type *type);
+
+/* Unregister a policy type */
+void dm_cache_policy_unregister(struct dm_cache_policy_type *type);
+
+/*
+ * Creates a policy of the named type, loading the module
+ * dm-cache-<name> if need be.
+ */
+struct dm_cache_policy *dm_cache_policy_create(const char *name,
+					       dm_cblock_t cache_size,
+					       unsigned argc, char **argv);
+void dm_cache_policy_destroy(struct dm_cache_policy *p);
+
+const char *dm_cache_policy_get_name(struct dm_cache_policy *p);
+
+#endif
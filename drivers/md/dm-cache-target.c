@@ -0,0 +1,1309 @@
+/*
+ * This file is released under the GPL.
+ *
+ * A target which uses a fast device, eg. an SSD, as a cache in front of
+ * a slow origin device.  See Documentation/device-mapper/cache.txt.
+ */
+
+#include "dm-cache-metadata.h"
+#include "dm-cache-policy.h"
+
+#include <linux/device-mapper.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/log2.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#define DM_MSG_PREFIX "cache"
+
+/*
+ * Limits on the cache block size, in sectors.  The block size must be a
+ * power of two.
+ */
+#define MIN_BLOCK_SIZE (32 * 1024 >> SECTOR_SHIFT)
+#define MAX_BLOCK_SIZE (1024 * 1024 * 1024 >> SECTOR_SHIFT)
+
+/*
+ * No more than this many sectors are copied between the devices at
+ * once, so that promotions and writebacks don't drown out the I/O the
+ * cache is there for.  One block is always allowed.
+ */
+#define MIGRATION_THRESHOLD 2048
+
+#define MIN_MIGRATIONS 16
+#define KCOPYD_PAGES 64
+#define DM_IO_PAGES 64
+
+/*
+ * Changes to the metadata which can't break consistency are committed
+ * this often.
+ */
+#define COMMIT_PERIOD HZ
+
+/*
+ * Writes to an origin block which is not cached are counted in flight
+ * in one of these buckets, so that promoting the block can wait for them.
+ */
+#define ORIGIN_HASH_BITS 8
+#define ORIGIN_HASH_SIZE (1 << ORIGIN_HASH_BITS)
+
+/*
+ * map_info->ll of a bio says what end_io() has to release: the low bits
+ * hold the cache block or origin bucket it is counted in flight on.
+ */
+#define PENDING_CBLOCK (1ULL << 32)
+#define PENDING_ORIGIN (1ULL << 33)
+
+enum cache_mode {
+	CM_WRITEBACK,
+	CM_WRITETHROUGH,
+};
+
+struct cache_stats {
+	atomic_t read_hit;
+	atomic_t read_miss;
+	atomic_t write_hit;
+	atomic_t write_miss;
+	atomic_t demotion;
+	atomic_t promotion;
+	atomic_t writeback;
+};
+
+struct cache {
+	struct dm_target *ti;
+
+	struct dm_dev *metadata_dev;
+	struct dm_dev *cache_dev;
+	struct dm_dev *origin_dev;
+
+	enum cache_mode mode;
+	struct dm_cache_metadata *cmd;
+	struct dm_cache_policy *policy;
+
+	sector_t sectors_per_block;
+	unsigned block_shift;
+	dm_cblock_t cache_size;
+
+	/* Only whole blocks of the origin are cached */
+	dm_oblock_t origin_blocks;
+
+	spinlock_t lock;
+	struct bio_list deferred_bios;	/* for the worker */
+	struct bio_list held_bios;	/* until a migration completes */
+	struct bio_list commit_bios;	/* until the next commit */
+
+	/* All migrations, oldest first */
+	struct list_head migrations;
+	unsigned nr_migrations;
+	wait_queue_head_t migration_wait;
+
+	/* Indexed by cblock */
+	unsigned long *dirty_bitset;
+	unsigned long *migrating_bitset;
+	unsigned *cblock_pending;
+	dm_cblock_t nr_dirty;
+
+	unsigned origin_pending[ORIGIN_HASH_SIZE];
+
+	int loaded;
+	int quiescing;
+	unsigned long last_commit;
+	unsigned long last_io;
+
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+
+	struct dm_kcopyd_client *copier;
+	struct dm_io_client *io_client;
+	mempool_t *migration_pool;
+
+	struct cache_stats stats;
+};
+
+/*
+ * A migration copies one block between the devices: a promotion from
+ * the origin into the cache, a writeback the other way.
+ */
+enum migration_state {
+	MG_WAITING,	/* for older migrations of the same cache block */
+	MG_COMMIT,	/* for the removal of the old mapping to be committed */
+	MG_QUIESCE,	/* for the I/O in flight to the block to complete */
+	MG_COPYING,
+	MG_COMPLETE,
+};
+
+struct dm_cache_migration {
+	struct list_head list;
+	struct cache *cache;
+
+	enum migration_state state;
+	int writeback;
+	int demote;		/* cblock held another origin block */
+	int err;
+
+	dm_oblock_t oblock;
+	dm_cblock_t cblock;
+};
+
+static struct kmem_cache *_migration_cache;
+
+static void wake_worker(struct cache *cache)
+{
+	queue_work(cache->wq, &cache->worker);
+}
+
+/*-----------------------------------------------------------------
+ * Remapping
+ *---------------------------------------------------------------*/
+static dm_oblock_t get_bio_block(struct cache *cache, struct bio *bio)
+{
+	return dm_target_offset(cache->ti, bio->bi_sector) >> cache->block_shift;
+}
+
+static void remap_to_origin(struct cache *cache, struct bio *bio)
+{
+	bio->bi_bdev = cache->origin_dev->bdev;
+	bio->bi_sector = dm_target_offset(cache->ti, bio->bi_sector);
+}
+
+static sector_t cache_sector(struct cache *cache, struct bio *bio,
+			     dm_cblock_t cblock)
+{
+	sector_t offset = dm_target_offset(cache->ti, bio->bi_sector);
+
+	return ((sector_t)cblock << cache->block_shift) |
+		(offset & (cache->sectors_per_block - 1));
+}
+
+static void remap_to_cache(struct cache *cache, struct bio *bio,
+			   dm_cblock_t cblock)
+{
+	bio->bi_bdev = cache->cache_dev->bdev;
+	bio->bi_sector = cache_sector(cache, bio, cblock);
+}
+
+/*-----------------------------------------------------------------
+ * I/O in flight.  A block is only copied once all the bios which could
+ * touch its data in the meantime have completed.
+ *---------------------------------------------------------------*/
+static unsigned origin_bucket(dm_oblock_t oblock)
+{
+	return hash_64(oblock, ORIGIN_HASH_BITS);
+}
+
+/* Called with the cache lock held */
+static void inc_cblock_pending(struct cache *cache, union map_info *info,
+			       dm_cblock_t cblock)
+{
+	cache->cblock_pending[cblock]++;
+	info->ll = PENDING_CBLOCK | cblock;
+}
+
+/* Called with the cache lock held */
+static void inc_origin_pending(struct cache *cache, union map_info *info,
+			       dm_oblock_t oblock)
+{
+	unsigned bucket = origin_bucket(oblock);
+
+	cache->origin_pending[bucket]++;
+	info->ll = PENDING_ORIGIN | bucket;
+}
+
+static void dec_pending(struct cache *cache, union map_info *info)
+{
+	unsigned long flags;
+	unsigned index = (unsigned)info->ll;
+	unsigned *pending;
+	int wake;
+
+	if (!(info->ll & (PENDING_CBLOCK | PENDING_ORIGIN)))
+		return;
+
+	pending = (info->ll & PENDING_CBLOCK) ?
+		cache->cblock_pending + index : cache->origin_pending + index;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	wake = !--*pending && !list_empty(&cache->migrations);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	info->ll = 0;
+
+	if (wake)
+		wake_worker(cache);
+}
+
+static void inc_stats(struct cache *cache, struct bio *bio, int hit)
+{
+	if (bio_data_dir(bio) == WRITE)
+		atomic_inc(hit ? &cache->stats.write_hit :
+				 &cache->stats.write_miss);
+	else
+		atomic_inc(hit ? &cache->stats.read_hit :
+				 &cache->stats.read_miss);
+}
+
+/*-----------------------------------------------------------------
+ * Migrations
+ *---------------------------------------------------------------*/
+static int spare_migration_bandwidth(struct cache *cache)
+{
+	return !cache->nr_migrations ||
+		(cache->nr_migrations + 1) * cache->sectors_per_block <=
+		MIGRATION_THRESHOLD;
+}
+
+/*
+ * Is there a migration of cblock other than mg?  If before is set, only
+ * the migrations older than mg count.  Called with the cache lock held.
+ */
+static int cblock_migrating(struct cache *cache, dm_cblock_t cblock,
+			    struct dm_cache_migration *mg, int before)
+{
+	struct dm_cache_migration *m;
+
+	list_for_each_entry(m, &cache->migrations, list) {
+		if (m == mg) {
+			if (before)
+				break;
+			continue;
+		}
+		if (m->cblock == cblock)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Called with the cache lock held */
+static void add_migration(struct cache *cache, struct dm_cache_migration *mg)
+{
+	mg->cache = cache;
+	mg->state = MG_WAITING;
+	mg->err = 0;
+
+	set_bit(mg->cblock, cache->migrating_bitset);
+	cache->nr_migrations++;
+	list_add_tail(&mg->list, &cache->migrations);
+}
+
+/* Called with the cache lock held */
+static void start_promotion(struct cache *cache, struct dm_cache_migration *mg,
+			    dm_oblock_t oblock, struct policy_result *lookup)
+{
+	mg->writeback = 0;
+	mg->demote = lookup->op == POLICY_REPLACE;
+	mg->oblock = oblock;
+	mg->cblock = lookup->cblock;
+	add_migration(cache, mg);
+
+	atomic_inc(&cache->stats.promotion);
+	if (mg->demote)
+		atomic_inc(&cache->stats.demotion);
+}
+
+/* Called with the cache lock held */
+static void complete_migration(struct cache *cache,
+			       struct dm_cache_migration *mg)
+{
+	list_del(&mg->list);
+
+	if (mg->writeback) {
+		if (mg->err)
+			DMERR_LIMIT("writeback failed; couldn't copy block");
+		else {
+			if (test_and_clear_bit(mg->cblock, cache->dirty_bitset))
+				cache->nr_dirty--;
+			dm_cache_set_dirty(cache->cmd, mg->cblock, false);
+			cache->policy->clear_dirty(cache->policy, mg->cblock);
+			atomic_inc(&cache->stats.writeback);
+		}
+	} else {
+		if (mg->err) {
+			DMERR_LIMIT("promotion failed; couldn't copy block");
+			/* A later promotion may have taken the block over */
+			if (!cblock_migrating(cache, mg->cblock, mg, 0))
+				cache->policy->remove_mapping(cache->policy,
+							      mg->cblock);
+		} else
+			dm_cache_insert_mapping(cache->cmd, mg->cblock,
+						mg->oblock);
+	}
+
+	if (!cblock_migrating(cache, mg->cblock, mg, 0))
+		clear_bit(mg->cblock, cache->migrating_bitset);
+
+	if (!--cache->nr_migrations)
+		wake_up(&cache->migration_wait);
+
+	/* The bios held back may well have been waiting for this one */
+	bio_list_merge(&cache->deferred_bios, &cache->held_bios);
+	bio_list_init(&cache->held_bios);
+
+	mempool_free(mg, cache->migration_pool);
+}
+
+static void process_completed_migrations(struct cache *cache)
+{
+	struct dm_cache_migration *mg, *tmp;
+
+	spin_lock_irq(&cache->lock);
+	list_for_each_entry_safe(mg, tmp, &cache->migrations, list)
+		if (mg->state == MG_COMPLETE)
+			complete_migration(cache, mg);
+	spin_unlock_irq(&cache->lock);
+}
+
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	struct dm_cache_migration *mg = context;
+	struct cache *cache = mg->cache;
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	mg->err = read_err || write_err;
+	mg->state = MG_COMPLETE;
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+static void issue_copy(struct dm_cache_migration *mg)
+{
+	int r;
+	struct cache *cache = mg->cache;
+	struct dm_io_region o_region, c_region;
+
+	o_region.bdev = cache->origin_dev->bdev;
+	o_region.sector = mg->oblock << cache->block_shift;
+	o_region.count = cache->sectors_per_block;
+
+	c_region.bdev = cache->cache_dev->bdev;
+	c_region.sector = (sector_t)mg->cblock << cache->block_shift;
+	c_region.count = cache->sectors_per_block;
+
+	if (mg->writeback)
+		r = dm_kcopyd_copy(cache->copier, &c_region, 1, &o_region, 0,
+				   copy_complete, mg);
+	else
+		r = dm_kcopyd_copy(cache->copier, &o_region, 1, &c_region, 0,
+				   copy_complete, mg);
+
+	if (r < 0)
+		copy_complete(1, 0, mg);
+}
+
+/*
+ * Migrations of the same cache block go one after the other, in order.
+ */
+static void advance_waiting_migrations(struct cache *cache)
+{
+	struct dm_cache_migration *mg;
+
+	spin_lock_irq(&cache->lock);
+	list_for_each_entry(mg, &cache->migrations, list) {
+		if (mg->state != MG_WAITING ||
+		    cblock_migrating(cache, mg->cblock, mg, 1))
+			continue;
+
+		/*
+		 * The old mapping has to be gone from the disk before the
+		 * block is overwritten.
+		 */
+		if (mg->demote) {
+			dm_cache_remove_mapping(cache->cmd, mg->cblock);
+			mg->state = MG_COMMIT;
+		} else
+			mg->state = MG_QUIESCE;
+	}
+	spin_unlock_irq(&cache->lock);
+}
+
+/* Called with the cache lock held */
+static int quiesced(struct cache *cache, struct dm_cache_migration *mg)
+{
+	if (cache->cblock_pending[mg->cblock])
+		return 0;
+
+	return mg->writeback || !cache->origin_pending[origin_bucket(mg->oblock)];
+}
+
+static void start_quiesced_migrations(struct cache *cache)
+{
+	struct dm_cache_migration *mg, *found;
+
+	for (;;) {
+		found = NULL;
+
+		spin_lock_irq(&cache->lock);
+		list_for_each_entry(mg, &cache->migrations, list)
+			if (mg->state == MG_QUIESCE && quiesced(cache, mg)) {
+				mg->state = MG_COPYING;
+				found = mg;
+				break;
+			}
+		spin_unlock_irq(&cache->lock);
+
+		if (!found)
+			break;
+
+		issue_copy(found);
+	}
+}
+
+/*
+ * Dirty blocks are written back whenever the cache is in writethrough
+ * mode, and otherwise once it has been idle for a second, or is more
+ * than half dirty.
+ */
+static int should_writeback(struct cache *cache)
+{
+	if (cache->quiescing || !cache->nr_dirty)
+		return 0;
+
+	return cache->mode == CM_WRITETHROUGH ||
+		time_after(jiffies, cache->last_io + HZ) ||
+		cache->nr_dirty > cache->cache_size / 2;
+}
+
+static void writeback_some_dirty_blocks(struct cache *cache)
+{
+	struct dm_cache_migration *mg;
+	dm_oblock_t oblock;
+	dm_cblock_t cblock;
+	int r;
+
+	while (should_writeback(cache)) {
+		mg = mempool_alloc(cache->migration_pool, GFP_NOWAIT);
+		if (!mg)
+			break;
+
+		spin_lock_irq(&cache->lock);
+		r = -EBUSY;
+		if (spare_migration_bandwidth(cache))
+			r = cache->policy->writeback_work(cache->policy,
+							  &oblock, &cblock);
+
+		/* Back to a block which is still being written back */
+		if (!r && test_bit(cblock, cache->migrating_bitset))
+			r = -EBUSY;
+
+		if (!r) {
+			mg->writeback = 1;
+			mg->demote = 0;
+			mg->oblock = oblock;
+			mg->cblock = cblock;
+			add_migration(cache, mg);
+		}
+		spin_unlock_irq(&cache->lock);
+
+		if (r) {
+			mempool_free(mg, cache->migration_pool);
+			break;
+		}
+	}
+}
+
+/*-----------------------------------------------------------------
+ * Commits
+ *---------------------------------------------------------------*/
+static void commit_if_needed(struct cache *cache)
+{
+	int r, need_commit = 0;
+	struct bio_list bios;
+	struct bio *bio;
+	struct dm_cache_migration *mg;
+	union map_info *info;
+
+	bio_list_init(&bios);
+
+	spin_lock_irq(&cache->lock);
+	bio_list_merge(&bios, &cache->commit_bios);
+	bio_list_init(&cache->commit_bios);
+
+	list_for_each_entry(mg, &cache->migrations, list)
+		if (mg->state == MG_COMMIT)
+			need_commit = 1;
+	spin_unlock_irq(&cache->lock);
+
+	if (!bio_list_empty(&bios))
+		need_commit = 1;
+	else if (dm_cache_metadata_dirty(cache->cmd) &&
+		 time_after_eq(jiffies, cache->last_commit + COMMIT_PERIOD))
+		need_commit = 1;
+
+	if (!need_commit)
+		return;
+
+	r = dm_cache_commit(cache->cmd);
+	cache->last_commit = jiffies;
+	if (r)
+		DMERR_LIMIT("couldn't commit metadata");
+
+	spin_lock_irq(&cache->lock);
+	list_for_each_entry(mg, &cache->migrations, list)
+		if (mg->state == MG_COMMIT) {
+			if (r) {
+				/* The old block was clean, give up */
+				mg->err = 1;
+				mg->state = MG_COMPLETE;
+			} else
+				mg->state = MG_QUIESCE;
+		}
+
+	/*
+	 * The writes waiting for the commit went to clean blocks, which are
+	 * now dirty on disk too.
+	 */
+	if (!r)
+		bio_list_for_each(bio, &bios) {
+			info = dm_get_mapinfo(bio);
+			if (!test_and_set_bit((dm_cblock_t)info->ll,
+					      cache->dirty_bitset))
+				cache->nr_dirty++;
+		}
+	spin_unlock_irq(&cache->lock);
+
+	while ((bio = bio_list_pop(&bios))) {
+		if (r) {
+			bio_endio(bio, -EIO);
+			continue;
+		}
+
+		info = dm_get_mapinfo(bio);
+		remap_to_cache(cache, bio, (dm_cblock_t)info->ll);
+		generic_make_request(bio);
+	}
+
+	if (r)
+		wake_worker(cache);
+}
+
+/*-----------------------------------------------------------------
+ * Bios
+ *---------------------------------------------------------------*/
+static void write_through_endio(unsigned long error, void *context)
+{
+	bio_endio(context, error ? -EIO : 0);
+}
+
+/*
+ * A write to a cached block in writethrough mode goes to both devices.
+ */
+static void write_through(struct cache *cache, struct bio *bio,
+			  dm_cblock_t cblock)
+{
+	struct dm_io_region where[2];
+	struct dm_io_request io_req = {
+		.bi_rw = WRITE,
+		.mem.type = DM_IO_BVEC,
+		.mem.ptr.bvec = bio->bi_io_vec + bio->bi_idx,
+		.notify.fn = write_through_endio,
+		.notify.context = bio,
+		.client = cache->io_client,
+	};
+
+	where[0].bdev = cache->origin_dev->bdev;
+	where[0].sector = dm_target_offset(cache->ti, bio->bi_sector);
+	where[0].count = bio_sectors(bio);
+
+	where[1].bdev = cache->cache_dev->bdev;
+	where[1].sector = cache_sector(cache, bio, cblock);
+	where[1].count = bio_sectors(bio);
+
+	BUG_ON(dm_io(&io_req, 2, where, NULL));
+}
+
+enum bio_action {
+	BIO_HELD,
+	BIO_TO_ORIGIN,
+	BIO_TO_CACHE,
+	BIO_WRITE_THROUGH,
+};
+
+static void process_bio(struct cache *cache, struct bio *bio)
+{
+	int r;
+	int is_write = bio_data_dir(bio) == WRITE;
+	union map_info *info = dm_get_mapinfo(bio);
+	dm_oblock_t oblock = get_bio_block(cache, bio);
+	struct dm_cache_migration *mg = NULL;
+	struct policy_result lookup;
+	enum bio_action action = BIO_HELD;
+
+	if (spare_migration_bandwidth(cache))
+		mg = mempool_alloc(cache->migration_pool, GFP_NOWAIT);
+
+	spin_lock_irq(&cache->lock);
+	r = cache->policy->map(cache->policy, oblock, true, mg != NULL,
+			       is_write, &lookup);
+	BUG_ON(r);
+
+	switch (lookup.op) {
+	case POLICY_HIT:
+		if (test_bit(lookup.cblock, cache->migrating_bitset)) {
+			bio_list_add(&cache->held_bios, bio);
+			break;
+		}
+
+		inc_cblock_pending(cache, info, lookup.cblock);
+		if (!is_write || (cache->mode == CM_WRITEBACK &&
+				  test_bit(lookup.cblock, cache->dirty_bitset)))
+			action = BIO_TO_CACHE;
+		else if (cache->mode == CM_WRITEBACK) {
+			/* The block has to be dirty on disk first */
+			dm_cache_set_dirty(cache->cmd, lookup.cblock, true);
+			cache->policy->set_dirty(cache->policy, lookup.cblock);
+			bio_list_add(&cache->commit_bios, bio);
+		} else
+			action = BIO_WRITE_THROUGH;
+		break;
+
+	case POLICY_MISS:
+		if (is_write)
+			inc_origin_pending(cache, info, oblock);
+		action = BIO_TO_ORIGIN;
+		break;
+
+	case POLICY_NEW:
+	case POLICY_REPLACE:
+		start_promotion(cache, mg, oblock, &lookup);
+		mg = NULL;
+		bio_list_add(&cache->held_bios, bio);
+		break;
+	}
+	spin_unlock_irq(&cache->lock);
+
+	if (mg)
+		mempool_free(mg, cache->migration_pool);
+
+	switch (action) {
+	case BIO_HELD:
+		break;
+
+	case BIO_TO_ORIGIN:
+		inc_stats(cache, bio, 0);
+		remap_to_origin(cache, bio);
+		generic_make_request(bio);
+		break;
+
+	case BIO_TO_CACHE:
+		inc_stats(cache, bio, 1);
+		remap_to_cache(cache, bio, lookup.cblock);
+		generic_make_request(bio);
+		break;
+
+	case BIO_WRITE_THROUGH:
+		inc_stats(cache, bio, 1);
+		write_through(cache, bio, lookup.cblock);
+		break;
+	}
+}
+
+static void process_deferred_bios(struct cache *cache)
+{
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irq(&cache->lock);
+	bio_list_merge(&bios, &cache->deferred_bios);
+	bio_list_init(&cache->deferred_bios);
+	spin_unlock_irq(&cache->lock);
+
+	while ((bio = bio_list_pop(&bios)))
+		process_bio(cache, bio);
+}
+
+/*-----------------------------------------------------------------
+ * The worker.  Everything which may block, or which changes the
+ * metadata, happens here.
+ *---------------------------------------------------------------*/
+static void do_worker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(ws, struct cache, worker);
+
+	process_completed_migrations(cache);
+	process_deferred_bios(cache);
+	writeback_some_dirty_blocks(cache);
+	advance_waiting_migrations(cache);
+	commit_if_needed(cache);
+	start_quiesced_migrations(cache);
+}
+
+/*
+ * Ticks the policy and makes sure the periodic commit and the writeback
+ * of an idle cache happen.
+ */
+static void do_waker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(to_delayed_work(ws), struct cache,
+					   waker);
+
+	if (cache->policy->tick) {
+		spin_lock_irq(&cache->lock);
+		cache->policy->tick(cache->policy);
+		spin_unlock_irq(&cache->lock);
+	}
+
+	wake_worker(cache);
+	queue_delayed_work(cache->wq, &cache->waker, COMMIT_PERIOD);
+}
+
+/*-----------------------------------------------------------------
+ * Target methods
+ *---------------------------------------------------------------*/
+static sector_t get_dev_size(struct dm_dev *dev)
+{
+	return i_size_read(dev->bdev->bd_inode) >> SECTOR_SHIFT;
+}
+
+static void destroy(struct cache *cache)
+{
+	if (cache->migration_pool)
+		mempool_destroy(cache->migration_pool);
+	if (cache->io_client)
+		dm_io_client_destroy(cache->io_client);
+	if (cache->copier)
+		dm_kcopyd_client_destroy(cache->copier);
+	if (cache->wq)
+		destroy_workqueue(cache->wq);
+
+	vfree(cache->cblock_pending);
+	vfree(cache->migrating_bitset);
+	vfree(cache->dirty_bitset);
+
+	if (cache->policy)
+		dm_cache_policy_destroy(cache->policy);
+	if (cache->cmd)
+		dm_cache_metadata_close(cache->cmd);
+
+	if (cache->origin_dev)
+		dm_put_device(cache->ti, cache->origin_dev);
+	if (cache->cache_dev)
+		dm_put_device(cache->ti, cache->cache_dev);
+	if (cache->metadata_dev)
+		dm_put_device(cache->ti, cache->metadata_dev);
+
+	kfree(cache);
+}
+
+static unsigned long *alloc_bitset(dm_cblock_t nr_bits)
+{
+	size_t size = BITS_TO_LONGS(nr_bits) * sizeof(long);
+	unsigned long *bits = vmalloc(size);
+
+	if (bits)
+		memset(bits, 0, size);
+
+	return bits;
+}
+
+static int parse_features(struct cache *cache, unsigned *argc, char ***argv)
+{
+	struct dm_target *ti = cache->ti;
+	unsigned nr_features;
+
+	if (!*argc || sscanf((*argv)[0], "%u", &nr_features) != 1 ||
+	    nr_features > *argc - 1) {
+		ti->error = "Invalid number of feature arguments";
+		return -EINVAL;
+	}
+	(*argc)--;
+	(*argv)++;
+
+	cache->mode = CM_WRITEBACK;
+	for (; nr_features; nr_features--, (*argc)--, (*argv)++) {
+		if (!strcasecmp((*argv)[0], "writeback"))
+			cache->mode = CM_WRITEBACK;
+		else if (!strcasecmp((*argv)[0], "writethrough"))
+			cache->mode = CM_WRITETHROUGH;
+		else {
+			ti->error = "Unrecognised cache feature requested";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Construct a cache mapping:
+ *
+ * cache <metadata dev> <cache dev> <origin dev> <block size>
+ *       <#feature args> [<feature arg>]*
+ *       <policy> <#policy args> [<policy arg>]*
+ */
+static int cache_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	int r = -EINVAL;
+	struct cache *cache;
+	unsigned long block_size;
+	unsigned nr_policy_args;
+	sector_t cache_blocks;
+	char *policy_name;
+	fmode_t mode = dm_table_get_mode(ti->table);
+
+	if (argc < 7) {
+		ti->error = "Insufficient arguments";
+		return -EINVAL;
+	}
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache) {
+		ti->error = "Cannot allocate cache context";
+		return -ENOMEM;
+	}
+	cache->ti = ti;
+
+	r = dm_get_device(ti, argv[0], mode, &cache->metadata_dev);
+	if (r) {
+		ti->error = "Error opening metadata device";
+		goto bad;
+	}
+
+	r = dm_get_device(ti, argv[1], mode, &cache->cache_dev);
+	if (r) {
+		ti->error = "Error opening cache device";
+		goto bad;
+	}
+
+	r = dm_get_device(ti, argv[2], mode, &cache->origin_dev);
+	if (r) {
+		ti->error = "Error opening origin device";
+		goto bad;
+	}
+
+	r = -EINVAL;
+	if (get_dev_size(cache->origin_dev) < ti->len) {
+		ti->error = "Origin device is too small";
+		goto bad;
+	}
+
+	if (sscanf(argv[3], "%lu", &block_size) != 1 ||
+	    block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE ||
+	    !is_power_of_2(block_size)) {
+		ti->error = "Invalid block size";
+		goto bad;
+	}
+	cache->sectors_per_block = block_size;
+	cache->block_shift = ilog2(block_size);
+	cache->origin_blocks = ti->len >> cache->block_shift;
+
+	cache_blocks = get_dev_size(cache->cache_dev) >> cache->block_shift;
+	if (!cache_blocks || cache_blocks > UINT_MAX) {
+		ti->error = "Invalid cache device size";
+		goto bad;
+	}
+	cache->cache_size = cache_blocks;
+
+	argc -= 4;
+	argv += 4;
+	r = parse_features(cache, &argc, &argv);
+	if (r)
+		goto bad;
+
+	r = -EINVAL;
+	if (argc < 2 || sscanf(argv[1], "%u", &nr_policy_args) != 1 ||
+	    nr_policy_args != argc - 2) {
+		ti->error = "Invalid policy arguments";
+		goto bad;
+	}
+	policy_name = argv[0];
+
+	cache->policy = dm_cache_policy_create(policy_name, cache->cache_size,
+					       nr_policy_args, argv + 2);
+	if (IS_ERR(cache->policy)) {
+		r = PTR_ERR(cache->policy);
+		cache->policy = NULL;
+		ti->error = "Error creating cache's policy";
+		goto bad;
+	}
+
+	cache->cmd = dm_cache_metadata_open(cache->metadata_dev->bdev,
+					    cache->sectors_per_block,
+					    cache->cache_size, policy_name);
+	if (IS_ERR(cache->cmd)) {
+		r = PTR_ERR(cache->cmd);
+		cache->cmd = NULL;
+		ti->error = "Error opening metadata";
+		goto bad;
+	}
+
+	spin_lock_init(&cache->lock);
+	bio_list_init(&cache->deferred_bios);
+	bio_list_init(&cache->held_bios);
+	bio_list_init(&cache->commit_bios);
+	INIT_LIST_HEAD(&cache->migrations);
+	init_waitqueue_head(&cache->migration_wait);
+	cache->last_commit = cache->last_io = jiffies;
+
+	r = -ENOMEM;
+	cache->dirty_bitset = alloc_bitset(cache->cache_size);
+	cache->migrating_bitset = alloc_bitset(cache->cache_size);
+	cache->cblock_pending = vmalloc(cache->cache_size * sizeof(unsigned));
+	if (!cache->dirty_bitset || !cache->migrating_bitset ||
+	    !cache->cblock_pending) {
+		ti->error = "Cannot allocate cache block state";
+		goto bad;
+	}
+	memset(cache->cblock_pending, 0, cache->cache_size * sizeof(unsigned));
+
+	cache->wq = create_singlethread_workqueue("kcached");
+	if (!cache->wq) {
+		ti->error = "Cannot create workqueue";
+		goto bad;
+	}
+	INIT_WORK(&cache->worker, do_worker);
+	INIT_DELAYED_WORK(&cache->waker, do_waker);
+
+	r = dm_kcopyd_client_create(KCOPYD_PAGES, &cache->copier);
+	if (r) {
+		cache->copier = NULL;
+		ti->error = "Cannot create kcopyd client";
+		goto bad;
+	}
+
+	cache->io_client = dm_io_client_create(DM_IO_PAGES);
+	if (IS_ERR(cache->io_client)) {
+		r = PTR_ERR(cache->io_client);
+		cache->io_client = NULL;
+		ti->error = "Cannot create io client";
+		goto bad;
+	}
+
+	r = -ENOMEM;
+	cache->migration_pool = mempool_create_slab_pool(MIN_MIGRATIONS,
+							 _migration_cache);
+	if (!cache->migration_pool) {
+		ti->error = "Cannot allocate migration mempool";
+		goto bad;
+	}
+
+	ti->split_io = cache->sectors_per_block;
+	ti->num_flush_requests = 2;
+	ti->private = cache;
+
+	return 0;
+
+bad:
+	destroy(cache);
+	return r;
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	destroy(ti->private);
+}
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct cache *cache = ti->private;
+	int is_write = bio_data_dir(bio) == WRITE;
+	struct policy_result lookup;
+	unsigned long flags;
+	dm_oblock_t oblock;
+	int r;
+
+	/*
+	 * Flushes go to both devices.  The metadata needs none: it is
+	 * committed before a write relies on it.
+	 */
+	if (unlikely(bio_empty_barrier(bio))) {
+		if (!map_context->target_request_nr)
+			remap_to_cache(cache, bio, 0);
+		else
+			remap_to_origin(cache, bio);
+		map_context->ll = 0;
+		return DM_MAPIO_REMAPPED;
+	}
+
+	map_context->ll = 0;
+
+	oblock = get_bio_block(cache, bio);
+	if (unlikely(oblock >= cache->origin_blocks)) {
+		remap_to_origin(cache, bio);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	spin_lock_irqsave(&cache->lock, flags);
+	cache->last_io = jiffies;
+
+	r = cache->policy->map(cache->policy, oblock, false, false, is_write,
+			       &lookup);
+	if (r == -EWOULDBLOCK)
+		goto defer;
+	BUG_ON(r);
+
+	if (lookup.op == POLICY_HIT) {
+		/*
+		 * Writes to clean blocks have to wait for the metadata to
+		 * say dirty, writethrough writes go to both devices.
+		 */
+		if (test_bit(lookup.cblock, cache->migrating_bitset) ||
+		    (is_write && (cache->mode != CM_WRITEBACK ||
+				  !test_bit(lookup.cblock, cache->dirty_bitset))))
+			goto defer;
+
+		inc_cblock_pending(cache, map_context, lookup.cblock);
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		inc_stats(cache, bio, 1);
+		remap_to_cache(cache, bio, lookup.cblock);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	if (is_write)
+		inc_origin_pending(cache, map_context, oblock);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	inc_stats(cache, bio, 0);
+	remap_to_origin(cache, bio);
+	return DM_MAPIO_REMAPPED;
+
+defer:
+	bio_list_add(&cache->deferred_bios, bio);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+	return DM_MAPIO_SUBMITTED;
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int error, union map_info *map_context)
+{
+	dec_pending(ti->private, map_context);
+
+	return error;
+}
+
+static void cache_presuspend(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	/* No new writebacks, the bios in flight may still need promotions */
+	spin_lock_irq(&cache->lock);
+	cache->quiescing = 1;
+	spin_unlock_irq(&cache->lock);
+}
+
+static int no_migrations(struct cache *cache)
+{
+	int r;
+
+	spin_lock_irq(&cache->lock);
+	r = !cache->nr_migrations;
+	spin_unlock_irq(&cache->lock);
+
+	return r;
+}
+
+static void save_hints(struct cache *cache)
+{
+	dm_cblock_t cblock;
+
+	spin_lock_irq(&cache->lock);
+	for (cblock = 0; cblock < cache->cache_size; cblock++)
+		dm_cache_set_hint(cache->cmd, cblock,
+				  cache->policy->get_hint(cache->policy,
+							  cblock));
+	spin_unlock_irq(&cache->lock);
+}
+
+static void cache_postsuspend(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	wait_event(cache->migration_wait, no_migrations(cache));
+	cancel_delayed_work_sync(&cache->waker);
+	flush_workqueue(cache->wq);
+
+	if (!cache->loaded)
+		return;
+
+	/* Make the next load start from where we are */
+	save_hints(cache);
+	if (dm_cache_metadata_set_clean(cache->cmd, true))
+		DMERR("couldn't shut down metadata cleanly");
+}
+
+static int load_mapping(void *context, dm_oblock_t oblock, dm_cblock_t cblock,
+			bool dirty, uint32_t hint, bool hint_valid)
+{
+	struct cache *cache = context;
+	int r;
+
+	if (oblock >= cache->origin_blocks) {
+		DMERR("mapping beyond the end of the origin");
+		return -EINVAL;
+	}
+
+	spin_lock_irq(&cache->lock);
+	r = cache->policy->load_mapping(cache->policy, oblock, cblock, dirty,
+					hint, hint_valid);
+	if (!r && dirty) {
+		set_bit(cblock, cache->dirty_bitset);
+		cache->nr_dirty++;
+	}
+	spin_unlock_irq(&cache->lock);
+
+	return r;
+}
+
+static int cache_preresume(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+	int r;
+
+	if (!cache->loaded) {
+		r = dm_cache_load_mappings(cache->cmd, load_mapping, cache);
+		if (r) {
+			DMERR("couldn't load cache mappings");
+			return r;
+		}
+		cache->loaded = 1;
+	}
+
+	/* Until the next clean shutdown, the hints are stale */
+	r = dm_cache_metadata_set_clean(cache->cmd, false);
+	if (r)
+		DMERR("couldn't write superblock");
+
+	return r;
+}
+
+static void cache_resume(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	spin_lock_irq(&cache->lock);
+	cache->quiescing = 0;
+	spin_unlock_irq(&cache->lock);
+
+	queue_delayed_work(cache->wq, &cache->waker, COMMIT_PERIOD);
+	wake_worker(cache);
+}
+
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned maxlen)
+{
+	struct cache *cache = ti->private;
+	sector_t used, total;
+	dm_cblock_t residency;
+	unsigned sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		dm_cache_metadata_usage(cache->cmd, &used, &total);
+
+		spin_lock_irq(&cache->lock);
+		residency = cache->policy->residency(cache->policy);
+		spin_unlock_irq(&cache->lock);
+
+		DMEMIT("%llu/%llu %u %u %u %u %u %u %u %u %u %s",
+		       (unsigned long long)used, (unsigned long long)total,
+		       atomic_read(&cache->stats.read_hit),
+		       atomic_read(&cache->stats.read_miss),
+		       atomic_read(&cache->stats.write_hit),
+		       atomic_read(&cache->stats.write_miss),
+		       atomic_read(&cache->stats.demotion),
+		       atomic_read(&cache->stats.promotion),
+		       atomic_read(&cache->stats.writeback),
+		       residency, cache->nr_dirty,
+		       dm_cache_policy_get_name(cache->policy));
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %s %llu 1 %s %s ",
+		       cache->metadata_dev->name, cache->cache_dev->name,
+		       cache->origin_dev->name,
+		       (unsigned long long)cache->sectors_per_block,
+		       cache->mode == CM_WRITEBACK ? "writeback" :
+						     "writethrough",
+		       dm_cache_policy_get_name(cache->policy));
+
+		if (!cache->policy->status)
+			DMEMIT("0");
+		else if (sz < maxlen)
+			sz += cache->policy->status(cache->policy, type,
+						    result + sz, maxlen - sz);
+		break;
+	}
+
+	return 0;
+}
+
+static int cache_iterate_devices(struct dm_target *ti,
+				 iterate_devices_callout_fn fn, void *data)
+{
+	struct cache *cache = ti->private;
+	int r;
+
+	r = fn(ti, cache->cache_dev, 0, get_dev_size(cache->cache_dev), data);
+	if (!r)
+		r = fn(ti, cache->origin_dev, 0, ti->len, data);
+
+	return r;
+}
+
+static void cache_io_hints(struct dm_target *ti, struct queue_limits *limits)
+{
+	struct cache *cache = ti->private;
+
+	blk_limits_io_min(limits, cache->sectors_per_block << SECTOR_SHIFT);
+	blk_limits_io_opt(limits, cache->sectors_per_block << SECTOR_SHIFT);
+}
+
+static struct target_type cache_target = {
+	.name = "cache",
+	.version = {1, 0, 0},
+	.module = THIS_MODULE,
+	.ctr = cache_ctr,
+	.dtr = cache_dtr,
+	.map = cache_map,
+	.end_io = cache_end_io,
+	.presuspend = cache_presuspend,
+	.postsuspend = cache_postsuspend,
+	.preresume = cache_preresume,
+	.resume = cache_resume,
+	.status = cache_status,
+	.iterate_devices = cache_iterate_devices,
+	.io_hints = cache_io_hints,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r;
+
+	_migration_cache = KMEM_CACHE(dm_cache_migration, 0);
+	if (!_migration_cache)
+		return -ENOMEM;
+
+	r = dm_register_target(&cache_target);
+	if (r) {
+		DMERR("cache target registration failed: %d", r);
+		kmem_cache_destroy(_migration_cache);
+	}
+
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+	kmem_cache_destroy(_migration_cache);
+}
+
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache target");
+MODULE_LICENSE("GPL");
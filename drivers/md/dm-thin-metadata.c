@@ -0,0 +1,1930 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#include "dm-thin-metadata.h"
+
+#include <linux/device-mapper.h>
+#include <linux/dm-io.h>
+#include <linux/hash.h>
+#include <linux/rwsem.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX "thin metadata"
+
+/*-----------------------------------------------------------------
+ * On disk format.
+ *
+ * The metadata device is divided into 4KB blocks.  The first one holds
+ * the superblock, which points to the root of the details tree: a
+ * B-tree mapping thin device ids to their details, which in turn point
+ * to the root of each device's mapping tree, a B-tree from virtual
+ * block to data block.
+ *
+ * Trees are never changed in place.  A node is shadowed - copied to a
+ * free block - the first time it is changed in a transaction, so the
+ * trees the superblock points to stay intact until the superblock is
+ * overwritten by the next commit.  Blocks freed in a transaction can't
+ * be reused until it is committed.
+ *
+ * Snapshots share the origin's mapping tree, and so every block it
+ * maps, until either device writes to it.  Tree nodes may be shared by
+ * any number of trees; a shared node is shadowed for the tree being
+ * changed, leaving the others alone.
+ *
+ * The reference counts of metadata and data blocks are only kept in
+ * core.  They are rebuilt by walking all the trees when the metadata
+ * is opened.
+ *
+ * All on disk structures are in little-endian format.  A metadata
+ * device whose superblock is all zeroes is formatted.
+ *---------------------------------------------------------------*/
+
+#define THIN_SUPERBLOCK_MAGIC 27022010
+#define THIN_METADATA_VERSION 1
+
+#define THIN_METADATA_BLOCK_SIZE 4096
+#define THIN_METADATA_BLOCK_SECTORS (THIN_METADATA_BLOCK_SIZE >> SECTOR_SHIFT)
+#define THIN_SUPERBLOCK_LOCATION 0
+
+/*
+ * 16GB of metadata, enough to map 16TB of data in 64KB blocks even
+ * with no sharing at all.  The rest of a larger device is unused.
+ */
+#define THIN_MAX_METADATA_BLOCKS (1 << 22)
+
+/*
+ * Metadata blocks kept in core once they are clean.
+ */
+#define METADATA_CACHE_SIZE 2048
+#define BUFFER_HASH_BITS 10
+
+/*
+ * A mapping packs the data block with the time it was made.  The time
+ * is bumped by every snapshot, so a mapping older than the last
+ * snapshot of its device may be shared.
+ */
+#define TIME_BITS 24
+#define MAX_DATA_BLOCKS (1ULL << (64 - TIME_BITS))
+
+struct thin_disk_superblock {
+	__le32 magic;
+	__le32 version;
+	__le64 transaction_id;
+
+	/* Root of the details tree */
+	__le64 details_root;
+
+	/* In sectors */
+	__le64 data_block_size;
+	__le64 nr_data_blocks;
+	__le64 nr_metadata_blocks;
+
+	__le32 time;
+	__le32 padding;
+} __packed;
+
+struct disk_device_details {
+	__le64 mapping_root;
+	__le64 mapped_blocks;
+	__le64 transaction_id;
+	__le32 creation_time;
+	__le32 snapshotted_time;
+} __packed;
+
+/* Node flags */
+#define INTERNAL_NODE (1 << 0)
+#define LEAF_NODE (1 << 1)
+
+struct node_header {
+	__le32 flags;
+	__le32 nr_entries;
+	__le32 max_entries;
+	__le32 value_size;
+
+	/* Where the node lives, as a sanity check */
+	__le64 blocknr;
+} __packed;
+
+/*
+ * The keys are followed by the values, max_entries of each.  Internal
+ * nodes hold the block of each child, which covers the keys from its
+ * own up to the next one.
+ */
+struct btree_node {
+	struct node_header header;
+	__le64 keys[0];
+} __packed;
+
+/*-----------------------------------------------------------------
+ * In core
+ *---------------------------------------------------------------*/
+struct md_buffer {
+	struct hlist_node hlist;
+	struct list_head list;		/* clean lru or dirty list */
+	dm_block_t b;
+	void *data;
+	unsigned holders;
+	int dirty;
+};
+
+struct dm_thin_device {
+	struct list_head list;
+	struct dm_pool_metadata *pmd;
+	dm_thin_id id;
+
+	int open_count;
+	int changed;
+
+	dm_block_t mapping_root;
+	uint64_t mapped_blocks;
+	uint64_t transaction_id;
+	uint32_t creation_time;
+	uint32_t snapshotted_time;
+};
+
+struct dm_pool_metadata {
+	struct block_device *bdev;
+	struct dm_io_client *io_client;
+
+	/*
+	 * Held for write by everything which changes the metadata or
+	 * reads blocks in; non-blocking lookups only take it for read.
+	 */
+	struct rw_semaphore root_lock;
+
+	sector_t data_block_size;
+	uint64_t trans_id;
+	uint32_t time;
+	dm_block_t details_root;
+	int changed;
+
+	/* Open devices, and those changed this transaction */
+	struct list_head thin_devices;
+
+	/* Metadata blocks in core, protected by bm_lock */
+	spinlock_t bm_lock;
+	struct hlist_head buffer_hash[1 << BUFFER_HASH_BITS];
+	struct list_head clean_buffers;	/* least recently used first */
+	struct list_head dirty_buffers;
+	unsigned nr_clean;
+
+	/* Metadata space map */
+	dm_block_t nr_metadata_blocks;
+	uint32_t *md_counts;
+	unsigned long *md_new;		/* allocated this transaction */
+	unsigned long *md_freed;	/* freed this transaction */
+	dm_block_t md_nr_free;
+	dm_block_t md_cursor;
+
+	/* Data space map */
+	dm_block_t nr_data_blocks;
+	uint32_t *data_counts;
+	unsigned long *data_freed;
+	dm_block_t data_nr_free;
+	dm_block_t data_cursor;
+
+	struct thin_disk_superblock *sb;
+};
+
+/*-----------------------------------------------------------------
+ * Metadata block I/O
+ *---------------------------------------------------------------*/
+static int block_io(struct dm_pool_metadata *pmd, void *data, dm_block_t b,
+		    int rw)
+{
+	struct dm_io_region where = {
+		.bdev = pmd->bdev,
+		.sector = b * THIN_METADATA_BLOCK_SECTORS,
+		.count = THIN_METADATA_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_KMEM,
+		.mem.ptr.addr = data,
+		.client = pmd->io_client,
+		.notify.fn = NULL,
+	};
+
+	return dm_io(&io_req, 1, &where, NULL);
+}
+
+static int flush_metadata(struct dm_pool_metadata *pmd)
+{
+	int r = blkdev_issue_flush(pmd->bdev, GFP_NOIO, NULL, BLKDEV_IFL_WAIT);
+
+	/* Not every device has a write cache to flush */
+	return r == -EOPNOTSUPP ? 0 : r;
+}
+
+/*-----------------------------------------------------------------
+ * The metadata block cache.  Dirty buffers hold the blocks written in
+ * this transaction, they stay in core until the commit.
+ *---------------------------------------------------------------*/
+static struct hlist_head *buffer_bucket(struct dm_pool_metadata *pmd,
+					dm_block_t b)
+{
+	return pmd->buffer_hash + hash_64(b, BUFFER_HASH_BITS);
+}
+
+static struct md_buffer *bm_find_and_hold(struct dm_pool_metadata *pmd,
+					  dm_block_t b)
+{
+	struct md_buffer *buf;
+	struct hlist_node *tmp;
+
+	spin_lock(&pmd->bm_lock);
+	hlist_for_each_entry(buf, tmp, buffer_bucket(pmd, b), hlist)
+		if (buf->b == b) {
+			buf->holders++;
+			if (!buf->dirty)
+				list_move_tail(&buf->list, &pmd->clean_buffers);
+			spin_unlock(&pmd->bm_lock);
+			return buf;
+		}
+	spin_unlock(&pmd->bm_lock);
+
+	return NULL;
+}
+
+static void free_buffer(struct md_buffer *buf)
+{
+	kfree(buf->data);
+	kfree(buf);
+}
+
+static struct md_buffer *alloc_buffer(dm_block_t b)
+{
+	struct md_buffer *buf = kmalloc(sizeof(*buf), GFP_NOIO);
+
+	if (!buf)
+		return NULL;
+
+	buf->data = kmalloc(THIN_METADATA_BLOCK_SIZE, GFP_NOIO);
+	if (!buf->data) {
+		kfree(buf);
+		return NULL;
+	}
+
+	buf->b = b;
+	buf->holders = 1;
+	buf->dirty = 0;
+
+	return buf;
+}
+
+/* Called with bm_lock held */
+static void evict_buffers(struct dm_pool_metadata *pmd)
+{
+	struct md_buffer *buf, *tmp;
+
+	list_for_each_entry_safe(buf, tmp, &pmd->clean_buffers, list) {
+		if (pmd->nr_clean <= METADATA_CACHE_SIZE)
+			break;
+
+		if (buf->holders)
+			continue;
+
+		hlist_del(&buf->hlist);
+		list_del(&buf->list);
+		pmd->nr_clean--;
+		free_buffer(buf);
+	}
+}
+
+/* Called with root_lock held for write */
+static void insert_buffer(struct dm_pool_metadata *pmd, struct md_buffer *buf)
+{
+	spin_lock(&pmd->bm_lock);
+	hlist_add_head(&buf->hlist, buffer_bucket(pmd, buf->b));
+	list_add_tail(&buf->list, &pmd->clean_buffers);
+	pmd->nr_clean++;
+	evict_buffers(pmd);
+	spin_unlock(&pmd->bm_lock);
+}
+
+/*
+ * Reads a block in, unless !can_block, when it has to be in core
+ * already.  Blocking callers must hold root_lock for write.
+ */
+static int bm_read(struct dm_pool_metadata *pmd, dm_block_t b,
+		   struct md_buffer **result, int can_block)
+{
+	int r;
+	struct md_buffer *buf;
+
+	buf = bm_find_and_hold(pmd, b);
+	if (buf) {
+		*result = buf;
+		return 0;
+	}
+
+	if (!can_block)
+		return -EWOULDBLOCK;
+
+	buf = alloc_buffer(b);
+	if (!buf)
+		return -ENOMEM;
+
+	r = block_io(pmd, buf->data, b, READ);
+	if (r) {
+		DMERR_LIMIT("couldn't read metadata block %llu",
+			    (unsigned long long)b);
+		free_buffer(buf);
+		return r;
+	}
+
+	insert_buffer(pmd, buf);
+	*result = buf;
+
+	return 0;
+}
+
+static void bm_dirty(struct dm_pool_metadata *pmd, struct md_buffer *buf)
+{
+	spin_lock(&pmd->bm_lock);
+	if (!buf->dirty) {
+		buf->dirty = 1;
+		list_move_tail(&buf->list, &pmd->dirty_buffers);
+		pmd->nr_clean--;
+	}
+	spin_unlock(&pmd->bm_lock);
+}
+
+/*
+ * A zeroed buffer for a newly allocated block.
+ */
+static int bm_new(struct dm_pool_metadata *pmd, dm_block_t b,
+		  struct md_buffer **result)
+{
+	struct md_buffer *buf;
+
+	/* The block may have held a node which has since been freed */
+	buf = bm_find_and_hold(pmd, b);
+	if (!buf) {
+		buf = alloc_buffer(b);
+		if (!buf)
+			return -ENOMEM;
+		insert_buffer(pmd, buf);
+	}
+
+	memset(buf->data, 0, THIN_METADATA_BLOCK_SIZE);
+	bm_dirty(pmd, buf);
+	*result = buf;
+
+	return 0;
+}
+
+static void bm_put(struct dm_pool_metadata *pmd, struct md_buffer *buf)
+{
+	spin_lock(&pmd->bm_lock);
+	BUG_ON(!buf->holders);
+	buf->holders--;
+	spin_unlock(&pmd->bm_lock);
+}
+
+struct flush_context {
+	atomic_t count;
+	int err;
+	struct completion done;
+};
+
+static void buffer_written(unsigned long error, void *context)
+{
+	struct flush_context *fc = context;
+
+	if (error)
+		fc->err = -EIO;
+
+	if (atomic_dec_and_test(&fc->count))
+		complete(&fc->done);
+}
+
+/*
+ * Writes out all dirty buffers at once.  Called with root_lock held
+ * for write.
+ */
+static int bm_flush(struct dm_pool_metadata *pmd)
+{
+	int r;
+	struct md_buffer *buf, *tmp;
+	struct flush_context fc;
+	struct dm_io_region where = {
+		.bdev = pmd->bdev,
+		.count = THIN_METADATA_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = WRITE,
+		.mem.type = DM_IO_KMEM,
+		.notify.fn = buffer_written,
+		.notify.context = &fc,
+		.client = pmd->io_client,
+	};
+
+	atomic_set(&fc.count, 1);
+	fc.err = 0;
+	init_completion(&fc.done);
+
+	list_for_each_entry(buf, &pmd->dirty_buffers, list) {
+		where.sector = buf->b * THIN_METADATA_BLOCK_SECTORS;
+		io_req.mem.ptr.addr = buf->data;
+
+		atomic_inc(&fc.count);
+		r = dm_io(&io_req, 1, &where, NULL);
+		if (r) {
+			fc.err = r;
+			atomic_dec(&fc.count);
+			break;
+		}
+	}
+
+	buffer_written(0, &fc);
+	wait_for_completion(&fc.done);
+
+	if (fc.err) {
+		DMERR("couldn't write metadata");
+		return fc.err;
+	}
+
+	spin_lock(&pmd->bm_lock);
+	list_for_each_entry_safe(buf, tmp, &pmd->dirty_buffers, list) {
+		buf->dirty = 0;
+		list_move_tail(&buf->list, &pmd->clean_buffers);
+		pmd->nr_clean++;
+	}
+	evict_buffers(pmd);
+	spin_unlock(&pmd->bm_lock);
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Space maps.  Each block has a reference count.  A block freed this
+ * transaction is still referenced by the last commit, so it is held
+ * back from allocation until the next one.
+ *---------------------------------------------------------------*/
+static int md_alloc(struct dm_pool_metadata *pmd, dm_block_t *result)
+{
+	dm_block_t i, b;
+
+	for (i = 0; i < pmd->nr_metadata_blocks; i++) {
+		b = pmd->md_cursor++;
+		if (pmd->md_cursor == pmd->nr_metadata_blocks)
+			pmd->md_cursor = 0;
+
+		if (!pmd->md_counts[b] && !test_bit(b, pmd->md_freed)) {
+			pmd->md_counts[b] = 1;
+			pmd->md_nr_free--;
+			set_bit(b, pmd->md_new);
+			*result = b;
+			return 0;
+		}
+	}
+
+	DMERR_LIMIT("out of metadata space");
+	return -ENOSPC;
+}
+
+static void md_inc(struct dm_pool_metadata *pmd, dm_block_t b)
+{
+	if (!pmd->md_counts[b]++)
+		pmd->md_nr_free--;
+}
+
+/*
+ * Returns the new reference count.
+ */
+static uint32_t md_dec(struct dm_pool_metadata *pmd, dm_block_t b)
+{
+	BUG_ON(!pmd->md_counts[b]);
+
+	if (!--pmd->md_counts[b]) {
+		pmd->md_nr_free++;
+		set_bit(b, pmd->md_freed);
+	}
+
+	return pmd->md_counts[b];
+}
+
+static void data_inc(struct dm_pool_metadata *pmd, dm_block_t b)
+{
+	if (!pmd->data_counts[b]++)
+		pmd->data_nr_free--;
+}
+
+static void data_dec(struct dm_pool_metadata *pmd, dm_block_t b)
+{
+	BUG_ON(!pmd->data_counts[b]);
+
+	if (!--pmd->data_counts[b]) {
+		pmd->data_nr_free++;
+		set_bit(b, pmd->data_freed);
+	}
+}
+
+static unsigned long *alloc_bitset(dm_block_t nr_bits)
+{
+	size_t size = BITS_TO_LONGS(nr_bits) * sizeof(long);
+	unsigned long *bits = vmalloc(size);
+
+	if (bits)
+		memset(bits, 0, size);
+
+	return bits;
+}
+
+static uint32_t *alloc_counts(dm_block_t nr_blocks)
+{
+	size_t size = nr_blocks * sizeof(uint32_t);
+	uint32_t *counts = vmalloc(size);
+
+	if (counts)
+		memset(counts, 0, size);
+
+	return counts;
+}
+
+/*-----------------------------------------------------------------
+ * Mapping values
+ *---------------------------------------------------------------*/
+static __le64 pack_block_time(dm_block_t b, uint32_t t)
+{
+	return cpu_to_le64((b << TIME_BITS) | (t & ((1 << TIME_BITS) - 1)));
+}
+
+static void unpack_block_time(__le64 *v, dm_block_t *b, uint32_t *t)
+{
+	uint64_t value = le64_to_cpu(*v);
+
+	*b = value >> TIME_BITS;
+	*t = value & ((1 << TIME_BITS) - 1);
+}
+
+/*
+ * What a tree's leaf values refer to, so that sharing and freeing a
+ * leaf can adjust their reference counts.
+ */
+struct btree_info {
+	size_t value_size;
+	void (*inc)(struct dm_pool_metadata *pmd, void *value);
+	void (*dec)(struct dm_pool_metadata *pmd, void *value);
+};
+
+static void mapping_inc(struct dm_pool_metadata *pmd, void *value)
+{
+	dm_block_t b;
+	uint32_t t;
+
+	unpack_block_time(value, &b, &t);
+	data_inc(pmd, b);
+}
+
+static void mapping_dec(struct dm_pool_metadata *pmd, void *value)
+{
+	dm_block_t b;
+	uint32_t t;
+
+	unpack_block_time(value, &b, &t);
+	data_dec(pmd, b);
+}
+
+static struct btree_info mapping_info = {
+	.value_size = sizeof(__le64),
+	.inc = mapping_inc,
+	.dec = mapping_dec,
+};
+
+/*
+ * There is only one details tree, so its nodes are never shared.
+ */
+static struct btree_info details_info = {
+	.value_size = sizeof(struct disk_device_details),
+};
+
+/*-----------------------------------------------------------------
+ * B-trees
+ *---------------------------------------------------------------*/
+static struct btree_node *to_node(struct md_buffer *buf)
+{
+	return buf->data;
+}
+
+static uint32_t nr_entries(struct btree_node *n)
+{
+	return le32_to_cpu(n->header.nr_entries);
+}
+
+static uint32_t max_entries(struct btree_node *n)
+{
+	return le32_to_cpu(n->header.max_entries);
+}
+
+static size_t value_size(struct btree_node *n)
+{
+	return le32_to_cpu(n->header.value_size);
+}
+
+static int is_leaf(struct btree_node *n)
+{
+	return le32_to_cpu(n->header.flags) & LEAF_NODE;
+}
+
+static uint64_t key(struct btree_node *n, unsigned i)
+{
+	return le64_to_cpu(n->keys[i]);
+}
+
+static void *value_ptr(struct btree_node *n, unsigned i)
+{
+	return (void *)(n->keys + max_entries(n)) + i * value_size(n);
+}
+
+static dm_block_t child(struct btree_node *n, unsigned i)
+{
+	return le64_to_cpu(*(__le64 *)value_ptr(n, i));
+}
+
+static void set_child(struct btree_node *n, unsigned i, dm_block_t b)
+{
+	*(__le64 *)value_ptr(n, i) = cpu_to_le64(b);
+}
+
+static void init_node(struct btree_node *n, dm_block_t b, uint32_t flags,
+		      size_t value_size)
+{
+	uint32_t max = (THIN_METADATA_BLOCK_SIZE - sizeof(struct node_header)) /
+		       (sizeof(__le64) + value_size);
+
+	n->header.flags = cpu_to_le32(flags);
+	n->header.nr_entries = 0;
+	n->header.max_entries = cpu_to_le32(max);
+	n->header.value_size = cpu_to_le32(value_size);
+	n->header.blocknr = cpu_to_le64(b);
+}
+
+static int check_node(struct btree_node *n, dm_block_t b)
+{
+	if (le64_to_cpu(n->header.blocknr) != b ||
+	    nr_entries(n) > max_entries(n) ||
+	    !(le32_to_cpu(n->header.flags) & (INTERNAL_NODE | LEAF_NODE))) {
+		DMERR_LIMIT("metadata block %llu is not a valid node",
+			    (unsigned long long)b);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int read_node(struct dm_pool_metadata *pmd, dm_block_t b,
+		     struct md_buffer **result, int can_block)
+{
+	int r = bm_read(pmd, b, result, can_block);
+
+	if (!r) {
+		r = check_node(to_node(*result), b);
+		if (r)
+			bm_put(pmd, *result);
+	}
+
+	return r;
+}
+
+/*
+ * Index of the last key <= k, or -1.
+ */
+static int lower_bound(struct btree_node *n, uint64_t k)
+{
+	int lo = -1, hi = nr_entries(n);
+
+	while (hi - lo > 1) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (key(n, mid) <= k)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static void insert_at(struct btree_node *n, unsigned index, uint64_t k,
+		      void *value)
+{
+	unsigned nr = nr_entries(n);
+	size_t vs = value_size(n);
+
+	memmove(n->keys + index + 1, n->keys + index,
+		(nr - index) * sizeof(__le64));
+	memmove(value_ptr(n, index + 1), value_ptr(n, index),
+		(nr - index) * vs);
+
+	n->keys[index] = cpu_to_le64(k);
+	memcpy(value_ptr(n, index), value, vs);
+	n->header.nr_entries = cpu_to_le32(nr + 1);
+}
+
+static void delete_at(struct btree_node *n, unsigned index)
+{
+	unsigned nr = nr_entries(n);
+	size_t vs = value_size(n);
+
+	memmove(n->keys + index, n->keys + index + 1,
+		(nr - index - 1) * sizeof(__le64));
+	memmove(value_ptr(n, index), value_ptr(n, index + 1),
+		(nr - index - 1) * vs);
+	n->header.nr_entries = cpu_to_le32(nr - 1);
+}
+
+/*
+ * Copies entries [start, start + count) of one node to the end of
+ * another with the same layout.
+ */
+static void copy_entries(struct btree_node *dest, struct btree_node *src,
+			 unsigned start, unsigned count)
+{
+	unsigned nr = nr_entries(dest);
+
+	memcpy(dest->keys + nr, src->keys + start, count * sizeof(__le64));
+	memcpy(value_ptr(dest, nr), value_ptr(src, start),
+	       count * value_size(src));
+	dest->header.nr_entries = cpu_to_le32(nr + count);
+}
+
+static int btree_empty(struct dm_pool_metadata *pmd, struct btree_info *info,
+		       dm_block_t *root)
+{
+	int r;
+	struct md_buffer *buf;
+
+	r = md_alloc(pmd, root);
+	if (r)
+		return r;
+
+	r = bm_new(pmd, *root, &buf);
+	if (r)
+		return r;
+
+	init_node(to_node(buf), *root, LEAF_NODE, info->value_size);
+	bm_put(pmd, buf);
+
+	return 0;
+}
+
+static int btree_lookup(struct dm_pool_metadata *pmd, dm_block_t root,
+			uint64_t k, void *value, int can_block)
+{
+	int r, i;
+	struct md_buffer *buf;
+	struct btree_node *n;
+
+	for (;;) {
+		r = read_node(pmd, root, &buf, can_block);
+		if (r)
+			return r;
+
+		n = to_node(buf);
+		i = lower_bound(n, k);
+		if (i < 0 || (is_leaf(n) && key(n, i) != k)) {
+			bm_put(pmd, buf);
+			return -ENODATA;
+		}
+
+		if (is_leaf(n))
+			break;
+
+		root = child(n, i);
+		bm_put(pmd, buf);
+	}
+
+	memcpy(value, value_ptr(n, i), value_size(n));
+	bm_put(pmd, buf);
+
+	return 0;
+}
+
+/*
+ * Gets a node ready to be changed in this transaction, copying it
+ * unless it was already copied and nothing else refers to it.
+ */
+static int shadow_node(struct dm_pool_metadata *pmd, struct btree_info *info,
+		       dm_block_t b, dm_block_t *result,
+		       struct md_buffer **result_buf)
+{
+	int r;
+	unsigned i;
+	dm_block_t nb;
+	struct md_buffer *buf, *nbuf;
+	struct btree_node *n;
+
+	r = read_node(pmd, b, &buf, 1);
+	if (r)
+		return r;
+
+	if (pmd->md_counts[b] == 1 && test_bit(b, pmd->md_new)) {
+		bm_dirty(pmd, buf);
+		*result = b;
+		*result_buf = buf;
+		return 0;
+	}
+
+	r = md_alloc(pmd, &nb);
+	if (r)
+		goto out;
+
+	r = bm_new(pmd, nb, &nbuf);
+	if (r)
+		goto out;
+
+	n = to_node(nbuf);
+	memcpy(n, to_node(buf), THIN_METADATA_BLOCK_SIZE);
+	n->header.blocknr = cpu_to_le64(nb);
+
+	/* The copy is a new reference to everything the node refers to */
+	if (pmd->md_counts[b] > 1) {
+		for (i = 0; i < nr_entries(n); i++) {
+			if (!is_leaf(n))
+				md_inc(pmd, child(n, i));
+			else if (info->inc)
+				info->inc(pmd, value_ptr(n, i));
+		}
+	}
+	md_dec(pmd, b);
+
+	*result = nb;
+	*result_buf = nbuf;
+
+out:
+	bm_put(pmd, buf);
+	return r;
+}
+
+/*
+ * Moves the upper half of a full node to a new sibling.
+ */
+static int split_node(struct dm_pool_metadata *pmd, struct btree_node *n,
+		      dm_block_t *sibling, struct md_buffer **sibling_buf)
+{
+	int r;
+	unsigned nr_left = nr_entries(n) / 2;
+	struct btree_node *s;
+
+	r = md_alloc(pmd, sibling);
+	if (r)
+		return r;
+
+	r = bm_new(pmd, *sibling, sibling_buf);
+	if (r)
+		return r;
+
+	s = to_node(*sibling_buf);
+	init_node(s, *sibling, le32_to_cpu(n->header.flags), value_size(n));
+	copy_entries(s, n, nr_left, nr_entries(n) - nr_left);
+	n->header.nr_entries = cpu_to_le32(nr_left);
+
+	return 0;
+}
+
+/*
+ * The root stays where it is: its entries move to two new children.
+ */
+static int split_root(struct dm_pool_metadata *pmd, struct btree_node *root)
+{
+	int r;
+	dm_block_t left, right;
+	struct md_buffer *lbuf, *rbuf;
+	struct btree_node *l;
+	__le64 value;
+
+	r = md_alloc(pmd, &left);
+	if (r)
+		return r;
+
+	r = bm_new(pmd, left, &lbuf);
+	if (r)
+		return r;
+
+	l = to_node(lbuf);
+	init_node(l, left, le32_to_cpu(root->header.flags), value_size(root));
+	copy_entries(l, root, 0, nr_entries(root));
+
+	r = split_node(pmd, l, &right, &rbuf);
+	if (r) {
+		bm_put(pmd, lbuf);
+		return r;
+	}
+
+	init_node(root, le64_to_cpu(root->header.blocknr), INTERNAL_NODE,
+		  sizeof(__le64));
+	value = cpu_to_le64(left);
+	insert_at(root, 0, key(l, 0), &value);
+	value = cpu_to_le64(right);
+	insert_at(root, 1, key(to_node(rbuf), 0), &value);
+
+	bm_put(pmd, rbuf);
+	bm_put(pmd, lbuf);
+
+	return 0;
+}
+
+/*
+ * Inserts or overwrites a value.  Full nodes are split on the way down,
+ * so there's always room in the parent for a new sibling.  If old_value
+ * is given, *inserted says whether the key is new, and if not old_value
+ * gets what it was mapped to.
+ */
+static int btree_insert(struct dm_pool_metadata *pmd, struct btree_info *info,
+			dm_block_t *root, uint64_t k, void *value,
+			void *old_value, int *inserted)
+{
+	int r, i;
+	dm_block_t b, sibling;
+	__le64 sibling_le;
+	struct md_buffer *buf, *cbuf, *sbuf;
+	struct btree_node *n, *c;
+
+	r = shadow_node(pmd, info, *root, root, &buf);
+	if (r)
+		return r;
+
+	n = to_node(buf);
+	if (nr_entries(n) == max_entries(n)) {
+		r = split_root(pmd, n);
+		if (r)
+			goto out;
+	}
+
+	while (!is_leaf(n)) {
+		i = lower_bound(n, k);
+		if (i < 0) {
+			i = 0;
+			n->keys[0] = cpu_to_le64(k);
+		}
+
+		r = shadow_node(pmd, info, child(n, i), &b, &cbuf);
+		if (r)
+			goto out;
+		set_child(n, i, b);
+
+		c = to_node(cbuf);
+		if (nr_entries(c) == max_entries(c)) {
+			r = split_node(pmd, c, &sibling, &sbuf);
+			if (r) {
+				bm_put(pmd, cbuf);
+				goto out;
+			}
+
+			sibling_le = cpu_to_le64(sibling);
+			insert_at(n, i + 1, key(to_node(sbuf), 0), &sibling_le);
+
+			if (k >= key(n, i + 1)) {
+				bm_put(pmd, cbuf);
+				cbuf = sbuf;
+			} else
+				bm_put(pmd, sbuf);
+		}
+
+		bm_put(pmd, buf);
+		buf = cbuf;
+		n = to_node(buf);
+	}
+
+	i = lower_bound(n, k);
+	if (i >= 0 && key(n, i) == k) {
+		if (old_value)
+			memcpy(old_value, value_ptr(n, i), value_size(n));
+		memcpy(value_ptr(n, i), value, value_size(n));
+		if (inserted)
+			*inserted = 0;
+	} else {
+		insert_at(n, i + 1, k, value);
+		if (inserted)
+			*inserted = 1;
+	}
+
+out:
+	bm_put(pmd, buf);
+	return r;
+}
+
+/*
+ * Removes a key.  Nodes are left to become empty rather than merged.
+ */
+static int btree_remove(struct dm_pool_metadata *pmd, struct btree_info *info,
+			dm_block_t *root, uint64_t k)
+{
+	int r, i;
+	dm_block_t b;
+	struct md_buffer *buf, *cbuf;
+	struct btree_node *n;
+
+	r = shadow_node(pmd, info, *root, root, &buf);
+	if (r)
+		return r;
+
+	for (;;) {
+		n = to_node(buf);
+		i = lower_bound(n, k);
+		if (i < 0 || (is_leaf(n) && key(n, i) != k)) {
+			r = -ENODATA;
+			break;
+		}
+
+		if (is_leaf(n)) {
+			delete_at(n, i);
+			break;
+		}
+
+		r = shadow_node(pmd, info, child(n, i), &b, &cbuf);
+		if (r)
+			break;
+		set_child(n, i, b);
+
+		bm_put(pmd, buf);
+		buf = cbuf;
+	}
+
+	bm_put(pmd, buf);
+	return r;
+}
+
+/*
+ * Drops a reference to a tree, freeing the nodes nothing else refers to.
+ */
+static int btree_dec(struct dm_pool_metadata *pmd, struct btree_info *info,
+		     dm_block_t root)
+{
+	int r = 0;
+	unsigned i;
+	struct md_buffer *buf;
+	struct btree_node *n;
+
+	if (pmd->md_counts[root] > 1) {
+		md_dec(pmd, root);
+		return 0;
+	}
+
+	r = read_node(pmd, root, &buf, 1);
+	if (r)
+		return r;
+
+	n = to_node(buf);
+	for (i = 0; i < nr_entries(n) && !r; i++) {
+		if (!is_leaf(n))
+			r = btree_dec(pmd, info, child(n, i));
+		else if (info->dec)
+			info->dec(pmd, value_ptr(n, i));
+	}
+	bm_put(pmd, buf);
+
+	md_dec(pmd, root);
+
+	return r;
+}
+
+/*
+ * Counts the references a tree holds, calling fn for the values of
+ * every leaf the first time it is seen.
+ */
+typedef int (*count_fn)(struct dm_pool_metadata *pmd, void *value);
+
+static int btree_count(struct dm_pool_metadata *pmd, dm_block_t root,
+		       count_fn fn)
+{
+	int r = 0;
+	unsigned i;
+	struct md_buffer *buf;
+	struct btree_node *n;
+
+	if (root >= pmd->nr_metadata_blocks) {
+		DMERR("metadata block %llu beyond the end of the device",
+		      (unsigned long long)root);
+		return -EINVAL;
+	}
+
+	if (pmd->md_counts[root]++)
+		return 0;
+
+	r = read_node(pmd, root, &buf, 1);
+	if (r)
+		return r;
+
+	n = to_node(buf);
+	for (i = 0; i < nr_entries(n) && !r; i++) {
+		if (!is_leaf(n))
+			r = btree_count(pmd, child(n, i), fn);
+		else
+			r = fn(pmd, value_ptr(n, i));
+	}
+	bm_put(pmd, buf);
+
+	return r;
+}
+
+static int count_mapping(struct dm_pool_metadata *pmd, void *value)
+{
+	dm_block_t b;
+	uint32_t t;
+
+	unpack_block_time(value, &b, &t);
+	if (b >= pmd->nr_data_blocks) {
+		DMERR("mapping beyond the end of the data device");
+		return -EINVAL;
+	}
+
+	pmd->data_counts[b]++;
+
+	return 0;
+}
+
+static int count_device(struct dm_pool_metadata *pmd, void *value)
+{
+	struct disk_device_details *details = value;
+
+	return btree_count(pmd, le64_to_cpu(details->mapping_root),
+			   count_mapping);
+}
+
+/*-----------------------------------------------------------------
+ * Superblock
+ *---------------------------------------------------------------*/
+static int write_superblock(struct dm_pool_metadata *pmd)
+{
+	int r;
+
+	memset(pmd->sb, 0, THIN_METADATA_BLOCK_SIZE);
+	pmd->sb->magic = cpu_to_le32(THIN_SUPERBLOCK_MAGIC);
+	pmd->sb->version = cpu_to_le32(THIN_METADATA_VERSION);
+	pmd->sb->transaction_id = cpu_to_le64(pmd->trans_id);
+	pmd->sb->details_root = cpu_to_le64(pmd->details_root);
+	pmd->sb->data_block_size = cpu_to_le64(pmd->data_block_size);
+	pmd->sb->nr_data_blocks = cpu_to_le64(pmd->nr_data_blocks);
+	pmd->sb->nr_metadata_blocks = cpu_to_le64(pmd->nr_metadata_blocks);
+	pmd->sb->time = cpu_to_le32(pmd->time);
+
+	r = block_io(pmd, pmd->sb, THIN_SUPERBLOCK_LOCATION, WRITE);
+	if (r)
+		return r;
+
+	return flush_metadata(pmd);
+}
+
+static void count_free_blocks(struct dm_pool_metadata *pmd)
+{
+	dm_block_t b;
+
+	pmd->md_nr_free = 0;
+	for (b = 0; b < pmd->nr_metadata_blocks; b++)
+		if (!pmd->md_counts[b])
+			pmd->md_nr_free++;
+
+	pmd->data_nr_free = 0;
+	for (b = 0; b < pmd->nr_data_blocks; b++)
+		if (!pmd->data_counts[b])
+			pmd->data_nr_free++;
+}
+
+static int __commit(struct dm_pool_metadata *pmd);
+
+static int format_metadata(struct dm_pool_metadata *pmd)
+{
+	int r;
+
+	pmd->md_counts[THIN_SUPERBLOCK_LOCATION] = 1;
+	count_free_blocks(pmd);
+
+	r = btree_empty(pmd, &details_info, &pmd->details_root);
+	if (r)
+		return r;
+
+	pmd->trans_id = 0;
+	pmd->time = 0;
+
+	return __commit(pmd);
+}
+
+/*
+ * Returns 1 if the superblock is all zeroes.
+ */
+static int read_superblock(struct dm_pool_metadata *pmd)
+{
+	int r;
+	dm_block_t nr_blocks;
+
+	r = block_io(pmd, pmd->sb, THIN_SUPERBLOCK_LOCATION, READ);
+	if (r) {
+		DMERR("couldn't read superblock");
+		return r;
+	}
+
+	if (!pmd->sb->magic)
+		return 1;
+
+	if (le32_to_cpu(pmd->sb->magic) != THIN_SUPERBLOCK_MAGIC) {
+		DMERR("invalid superblock magic");
+		return -EINVAL;
+	}
+
+	if (le32_to_cpu(pmd->sb->version) != THIN_METADATA_VERSION) {
+		DMERR("unsupported metadata version %u",
+		      le32_to_cpu(pmd->sb->version));
+		return -EINVAL;
+	}
+
+	if (le64_to_cpu(pmd->sb->data_block_size) != pmd->data_block_size) {
+		DMERR("block size %llu differs from the one in the table",
+		      (unsigned long long)le64_to_cpu(pmd->sb->data_block_size));
+		return -EINVAL;
+	}
+
+	nr_blocks = le64_to_cpu(pmd->sb->nr_metadata_blocks);
+	if (nr_blocks > pmd->nr_metadata_blocks) {
+		DMERR("metadata device shrank from %llu blocks",
+		      (unsigned long long)nr_blocks);
+		return -EINVAL;
+	}
+
+	nr_blocks = le64_to_cpu(pmd->sb->nr_data_blocks);
+	if (nr_blocks > pmd->nr_data_blocks) {
+		DMERR("data device shrank from %llu blocks",
+		      (unsigned long long)nr_blocks);
+		return -EINVAL;
+	}
+
+	pmd->trans_id = le64_to_cpu(pmd->sb->transaction_id);
+	pmd->details_root = le64_to_cpu(pmd->sb->details_root);
+	pmd->time = le32_to_cpu(pmd->sb->time);
+
+	return 0;
+}
+
+static int load_metadata(struct dm_pool_metadata *pmd)
+{
+	int r;
+
+	pmd->md_counts[THIN_SUPERBLOCK_LOCATION] = 1;
+
+	r = btree_count(pmd, pmd->details_root, count_device);
+	if (r)
+		return r;
+
+	count_free_blocks(pmd);
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Thin devices
+ *---------------------------------------------------------------*/
+static struct dm_thin_device *find_device(struct dm_pool_metadata *pmd,
+					  dm_thin_id dev)
+{
+	struct dm_thin_device *td;
+
+	list_for_each_entry(td, &pmd->thin_devices, list)
+		if (td->id == dev)
+			return td;
+
+	return NULL;
+}
+
+/*
+ * Brings a device's details into core.  If create is set, the device
+ * must not exist yet, and is created.
+ */
+static int __open_device(struct dm_pool_metadata *pmd, dm_thin_id dev,
+			 int create, struct dm_thin_device **result)
+{
+	int r;
+	struct dm_thin_device *td;
+	struct disk_device_details details;
+
+	td = find_device(pmd, dev);
+	if (td) {
+		if (create)
+			return -EEXIST;
+		*result = td;
+		return 0;
+	}
+
+	r = btree_lookup(pmd, pmd->details_root, dev, &details, 1);
+	if (!r && create)
+		return -EEXIST;
+	if (r != -ENODATA && r)
+		return r;
+	if (r == -ENODATA && !create)
+		return -ENODEV;
+
+	td = kzalloc(sizeof(*td), GFP_NOIO);
+	if (!td)
+		return -ENOMEM;
+
+	td->pmd = pmd;
+	td->id = dev;
+
+	if (create) {
+		td->changed = 1;
+		td->transaction_id = pmd->trans_id;
+		td->creation_time = td->snapshotted_time = pmd->time;
+	} else {
+		td->mapping_root = le64_to_cpu(details.mapping_root);
+		td->mapped_blocks = le64_to_cpu(details.mapped_blocks);
+		td->transaction_id = le64_to_cpu(details.transaction_id);
+		td->creation_time = le32_to_cpu(details.creation_time);
+		td->snapshotted_time = le32_to_cpu(details.snapshotted_time);
+	}
+
+	list_add(&td->list, &pmd->thin_devices);
+	*result = td;
+
+	return 0;
+}
+
+static void __close_device(struct dm_thin_device *td)
+{
+	if (!td->open_count && !td->changed) {
+		list_del(&td->list);
+		kfree(td);
+	}
+}
+
+static int __write_changed_details(struct dm_pool_metadata *pmd)
+{
+	int r;
+	struct dm_thin_device *td, *tmp;
+	struct disk_device_details details;
+
+	list_for_each_entry_safe(td, tmp, &pmd->thin_devices, list) {
+		if (!td->changed)
+			continue;
+
+		details.mapping_root = cpu_to_le64(td->mapping_root);
+		details.mapped_blocks = cpu_to_le64(td->mapped_blocks);
+		details.transaction_id = cpu_to_le64(td->transaction_id);
+		details.creation_time = cpu_to_le32(td->creation_time);
+		details.snapshotted_time = cpu_to_le32(td->snapshotted_time);
+
+		r = btree_insert(pmd, &details_info, &pmd->details_root,
+				 td->id, &details, NULL, NULL);
+		if (r)
+			return r;
+
+		td->changed = 0;
+		__close_device(td);
+	}
+
+	return 0;
+}
+
+/*
+ * The new trees are written to free blocks first.  Only once they are
+ * on disk does the superblock switch over to them.
+ */
+static int __commit(struct dm_pool_metadata *pmd)
+{
+	int r;
+	size_t size;
+
+	r = __write_changed_details(pmd);
+	if (r)
+		return r;
+
+	r = bm_flush(pmd);
+	if (r)
+		return r;
+
+	r = flush_metadata(pmd);
+	if (r)
+		return r;
+
+	r = write_superblock(pmd);
+	if (r)
+		return r;
+
+	size = BITS_TO_LONGS(pmd->nr_metadata_blocks) * sizeof(long);
+	memset(pmd->md_new, 0, size);
+	memset(pmd->md_freed, 0, size);
+	memset(pmd->data_freed, 0,
+	       BITS_TO_LONGS(pmd->nr_data_blocks) * sizeof(long));
+	pmd->changed = 0;
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Public interface
+ *---------------------------------------------------------------*/
+static void free_metadata(struct dm_pool_metadata *pmd)
+{
+	struct md_buffer *buf, *tmp;
+
+	list_for_each_entry_safe(buf, tmp, &pmd->clean_buffers, list)
+		free_buffer(buf);
+	list_for_each_entry_safe(buf, tmp, &pmd->dirty_buffers, list)
+		free_buffer(buf);
+
+	vfree(pmd->data_freed);
+	vfree(pmd->data_counts);
+	vfree(pmd->md_freed);
+	vfree(pmd->md_new);
+	vfree(pmd->md_counts);
+	kfree(pmd->sb);
+
+	if (pmd->io_client)
+		dm_io_client_destroy(pmd->io_client);
+
+	kfree(pmd);
+}
+
+struct dm_pool_metadata *dm_pool_metadata_open(struct block_device *bdev,
+					       sector_t data_block_size,
+					       dm_block_t nr_data_blocks)
+{
+	int r = -ENOMEM;
+	unsigned i;
+	struct dm_pool_metadata *pmd;
+	sector_t nr_blocks;
+
+	if (nr_data_blocks > MAX_DATA_BLOCKS) {
+		DMERR("data device too large");
+		return ERR_PTR(-EINVAL);
+	}
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> SECTOR_SHIFT;
+	sector_div(nr_blocks, THIN_METADATA_BLOCK_SECTORS);
+	if (nr_blocks > THIN_MAX_METADATA_BLOCKS) {
+		DMWARN("metadata device too large, only using %u blocks",
+		       THIN_MAX_METADATA_BLOCKS);
+		nr_blocks = THIN_MAX_METADATA_BLOCKS;
+	}
+
+	if (nr_blocks < 2) {
+		DMERR("metadata device too small");
+		return ERR_PTR(-ENOSPC);
+	}
+
+	pmd = kzalloc(sizeof(*pmd), GFP_KERNEL);
+	if (!pmd)
+		return ERR_PTR(-ENOMEM);
+
+	pmd->bdev = bdev;
+	pmd->data_block_size = data_block_size;
+	pmd->nr_metadata_blocks = nr_blocks;
+	pmd->nr_data_blocks = nr_data_blocks;
+	init_rwsem(&pmd->root_lock);
+	INIT_LIST_HEAD(&pmd->thin_devices);
+
+	spin_lock_init(&pmd->bm_lock);
+	for (i = 0; i < ARRAY_SIZE(pmd->buffer_hash); i++)
+		INIT_HLIST_HEAD(pmd->buffer_hash + i);
+	INIT_LIST_HEAD(&pmd->clean_buffers);
+	INIT_LIST_HEAD(&pmd->dirty_buffers);
+
+	pmd->io_client = dm_io_client_create(16);
+	if (IS_ERR(pmd->io_client)) {
+		r = PTR_ERR(pmd->io_client);
+		pmd->io_client = NULL;
+		goto bad;
+	}
+
+	pmd->sb = kmalloc(THIN_METADATA_BLOCK_SIZE, GFP_KERNEL);
+	pmd->md_counts = alloc_counts(nr_blocks);
+	pmd->md_new = alloc_bitset(nr_blocks);
+	pmd->md_freed = alloc_bitset(nr_blocks);
+	pmd->data_counts = alloc_counts(nr_data_blocks);
+	pmd->data_freed = alloc_bitset(nr_data_blocks);
+	if (!pmd->sb || !pmd->md_counts || !pmd->md_new || !pmd->md_freed ||
+	    !pmd->data_counts || !pmd->data_freed)
+		goto bad;
+
+	r = read_superblock(pmd);
+	if (r > 0) {
+		DMINFO("formatting new metadata");
+		r = format_metadata(pmd);
+	} else if (!r)
+		r = load_metadata(pmd);
+	if (r)
+		goto bad;
+
+	return pmd;
+
+bad:
+	free_metadata(pmd);
+	return ERR_PTR(r);
+}
+
+int dm_pool_metadata_close(struct dm_pool_metadata *pmd)
+{
+	int r = 0;
+	struct dm_thin_device *td, *tmp;
+
+	list_for_each_entry(td, &pmd->thin_devices, list)
+		if (td->open_count) {
+			DMERR("attempt to close pool metadata with open devices");
+			return -EBUSY;
+		}
+
+	if (pmd->changed) {
+		r = __commit(pmd);
+		if (r)
+			DMWARN("%s: __commit failed: error = %d", __func__, r);
+	}
+
+	list_for_each_entry_safe(td, tmp, &pmd->thin_devices, list) {
+		list_del(&td->list);
+		kfree(td);
+	}
+
+	free_metadata(pmd);
+
+	return r;
+}
+
+int dm_pool_set_metadata_transaction_id(struct dm_pool_metadata *pmd,
+					uint64_t current_id,
+					uint64_t new_id)
+{
+	int r = 0;
+
+	down_write(&pmd->root_lock);
+	if (pmd->trans_id != current_id) {
+		DMERR("mismatched transaction id");
+		r = -EINVAL;
+	} else {
+		pmd->trans_id = new_id;
+		pmd->changed = 1;
+	}
+	up_write(&pmd->root_lock);
+
+	return r;
+}
+
+uint64_t dm_pool_get_metadata_transaction_id(struct dm_pool_metadata *pmd)
+{
+	uint64_t r;
+
+	down_read(&pmd->root_lock);
+	r = pmd->trans_id;
+	up_read(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_pool_create_thin(struct dm_pool_metadata *pmd, dm_thin_id dev)
+{
+	int r;
+	struct dm_thin_device *td;
+	dm_block_t root;
+
+	down_write(&pmd->root_lock);
+	r = btree_empty(pmd, &mapping_info, &root);
+	if (r)
+		goto out;
+
+	r = __open_device(pmd, dev, 1, &td);
+	if (r) {
+		btree_dec(pmd, &mapping_info, root);
+		goto out;
+	}
+
+	td->mapping_root = root;
+	pmd->changed = 1;
+
+out:
+	up_write(&pmd->root_lock);
+	return r;
+}
+
+int dm_pool_create_snap(struct dm_pool_metadata *pmd, dm_thin_id dev,
+			dm_thin_id origin)
+{
+	int r;
+	struct dm_thin_device *otd, *td;
+
+	down_write(&pmd->root_lock);
+	r = __open_device(pmd, origin, 0, &otd);
+	if (r)
+		goto out;
+
+	if (pmd->time == (1 << TIME_BITS) - 1) {
+		DMERR("too many snapshots taken in this pool");
+		r = -ENOSPC;
+		goto out;
+	}
+
+	r = __open_device(pmd, dev, 1, &td);
+	if (r) {
+		__close_device(otd);
+		goto out;
+	}
+
+	/*
+	 * Both devices now share every mapping made so far, which is
+	 * older than the new time.
+	 */
+	pmd->time++;
+	md_inc(pmd, otd->mapping_root);
+
+	td->mapping_root = otd->mapping_root;
+	td->mapped_blocks = otd->mapped_blocks;
+	td->creation_time = td->snapshotted_time = pmd->time;
+
+	otd->snapshotted_time = pmd->time;
+	otd->changed = 1;
+	pmd->changed = 1;
+
+out:
+	up_write(&pmd->root_lock);
+	return r;
+}
+
+int dm_pool_delete_thin_device(struct dm_pool_metadata *pmd,
+			       dm_thin_id dev)
+{
+	int r;
+	struct dm_thin_device *td;
+
+	down_write(&pmd->root_lock);
+	r = __open_device(pmd, dev, 0, &td);
+	if (r)
+		goto out;
+
+	if (td->open_count) {
+		r = -EBUSY;
+		goto out;
+	}
+
+	r = btree_remove(pmd, &details_info, &pmd->details_root, dev);
+	if (r == -ENODATA)
+		/* Created this transaction */
+		r = 0;
+	if (r)
+		goto out;
+
+	r = btree_dec(pmd, &mapping_info, td->mapping_root);
+
+	list_del(&td->list);
+	kfree(td);
+	pmd->changed = 1;
+
+out:
+	up_write(&pmd->root_lock);
+	return r;
+}
+
+int dm_pool_changed_this_transaction(struct dm_pool_metadata *pmd)
+{
+	int r;
+
+	down_read(&pmd->root_lock);
+	r = pmd->changed;
+	up_read(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_pool_commit_metadata(struct dm_pool_metadata *pmd)
+{
+	int r;
+
+	down_write(&pmd->root_lock);
+	r = __commit(pmd);
+	up_write(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_pool_alloc_data_block(struct dm_pool_metadata *pmd, dm_block_t *result)
+{
+	int r = -ENOSPC;
+	dm_block_t i, b;
+
+	down_write(&pmd->root_lock);
+	for (i = 0; i < pmd->nr_data_blocks; i++) {
+		b = pmd->data_cursor++;
+		if (pmd->data_cursor == pmd->nr_data_blocks)
+			pmd->data_cursor = 0;
+
+		if (!pmd->data_counts[b] && !test_bit(b, pmd->data_freed)) {
+			data_inc(pmd, b);
+			*result = b;
+			r = 0;
+			break;
+		}
+	}
+	up_write(&pmd->root_lock);
+
+	return r;
+}
+
+void dm_pool_free_data_block(struct dm_pool_metadata *pmd, dm_block_t b)
+{
+	down_write(&pmd->root_lock);
+	data_dec(pmd, b);
+	up_write(&pmd->root_lock);
+}
+
+int dm_pool_resize_data_dev(struct dm_pool_metadata *pmd,
+			    dm_block_t new_count)
+{
+	int r = 0;
+	uint32_t *counts;
+	unsigned long *freed;
+
+	if (new_count > MAX_DATA_BLOCKS)
+		return -EINVAL;
+
+	down_write(&pmd->root_lock);
+	if (new_count < pmd->nr_data_blocks) {
+		DMERR("data device can't shrink");
+		r = -EINVAL;
+		goto out;
+	}
+
+	if (new_count == pmd->nr_data_blocks)
+		goto out;
+
+	counts = alloc_counts(new_count);
+	freed = alloc_bitset(new_count);
+	if (!counts || !freed) {
+		vfree(counts);
+		vfree(freed);
+		r = -ENOMEM;
+		goto out;
+	}
+
+	memcpy(counts, pmd->data_counts,
+	       pmd->nr_data_blocks * sizeof(uint32_t));
+	memcpy(freed, pmd->data_freed,
+	       BITS_TO_LONGS(pmd->nr_data_blocks) * sizeof(long));
+
+	vfree(pmd->data_counts);
+	vfree(pmd->data_freed);
+	pmd->data_counts = counts;
+	pmd->data_freed = freed;
+
+	pmd->data_nr_free += new_count - pmd->nr_data_blocks;
+	pmd->nr_data_blocks = new_count;
+	pmd->changed = 1;
+
+out:
+	up_write(&pmd->root_lock);
+	return r;
+}
+
+void dm_pool_get_data_usage(struct dm_pool_metadata *pmd,
+			    dm_block_t *free, dm_block_t *total)
+{
+	down_read(&pmd->root_lock);
+	*free = pmd->data_nr_free;
+	*total = pmd->nr_data_blocks;
+	up_read(&pmd->root_lock);
+}
+
+void dm_pool_get_metadata_usage(struct dm_pool_metadata *pmd,
+				dm_block_t *free, dm_block_t *total)
+{
+	down_read(&pmd->root_lock);
+	*free = pmd->md_nr_free;
+	*total = pmd->nr_metadata_blocks;
+	up_read(&pmd->root_lock);
+}
+
+int dm_pool_open_thin_device(struct dm_pool_metadata *pmd, dm_thin_id dev,
+			     struct dm_thin_device **td)
+{
+	int r;
+
+	down_write(&pmd->root_lock);
+	r = __open_device(pmd, dev, 0, td);
+	if (!r)
+		(*td)->open_count++;
+	up_write(&pmd->root_lock);
+
+	return r;
+}
+
+void dm_pool_close_thin_device(struct dm_thin_device *td)
+{
+	struct dm_pool_metadata *pmd = td->pmd;
+
+	down_write(&pmd->root_lock);
+	td->open_count--;
+	__close_device(td);
+	up_write(&pmd->root_lock);
+}
+
+dm_thin_id dm_thin_dev_id(struct dm_thin_device *td)
+{
+	return td->id;
+}
+
+int dm_thin_find_block(struct dm_thin_device *td, dm_block_t block,
+		       int can_block, struct dm_thin_lookup_result *result)
+{
+	int r;
+	__le64 value;
+	uint32_t t;
+	struct dm_pool_metadata *pmd = td->pmd;
+
+	if (can_block)
+		down_write(&pmd->root_lock);
+	else if (!down_read_trylock(&pmd->root_lock))
+		return -EWOULDBLOCK;
+
+	r = btree_lookup(pmd, td->mapping_root, block, &value, can_block);
+	if (!r) {
+		unpack_block_time(&value, &result->block, &t);
+		result->shared = t < td->snapshotted_time;
+	}
+
+	if (can_block)
+		up_write(&pmd->root_lock);
+	else
+		up_read(&pmd->root_lock);
+
+	return r;
+}
+
+int dm_thin_insert_block(struct dm_thin_device *td, dm_block_t block,
+			 dm_block_t data_block)
+{
+	int r, inserted;
+	__le64 value, old_value;
+	dm_block_t old_block;
+	uint32_t t;
+	struct dm_pool_metadata *pmd = td->pmd;
+
+	down_write(&pmd->root_lock);
+	value = pack_block_time(data_block, pmd->time);
+	r = btree_insert(pmd, &mapping_info, &td->mapping_root, block,
+			 &value, &old_value, &inserted);
+	if (r)
+		goto out;
+
+	if (inserted)
+		td->mapped_blocks++;
+	else {
+		unpack_block_time(&old_value, &old_block, &t);
+		data_dec(pmd, old_block);
+	}
+
+	td->changed = 1;
+	pmd->changed = 1;
+
+out:
+	up_write(&pmd->root_lock);
+	return r;
+}
+
+int dm_thin_unshare_block(struct dm_thin_device *td, dm_block_t block,
+			  int *shared)
+{
+	int r;
+	__le64 value;
+	dm_block_t b;
+	uint32_t t;
+	struct dm_pool_metadata *pmd = td->pmd;
+
+	down_write(&pmd->root_lock);
+	r = btree_lookup(pmd, td->mapping_root, block, &value, 1);
+	if (r)
+		goto out;
+
+	/*
+	 * Rewriting the mapping unshares the nodes leading to it, after
+	 * which the data block's count is exact.  Only once no snapshot
+	 * refers to it any more does the mapping get the current time.
+	 */
+	unpack_block_time(&value, &b, &t);
+	r = btree_insert(pmd, &mapping_info, &td->mapping_root, block,
+			 &value, NULL, NULL);
+	if (r)
+		goto out;
+
+	*shared = pmd->data_counts[b] > 1;
+	if (!*shared) {
+		value = pack_block_time(b, pmd->time);
+		r = btree_insert(pmd, &mapping_info, &td->mapping_root, block,
+				 &value, NULL, NULL);
+	}
+
+	td->changed = 1;
+	pmd->changed = 1;
+
+out:
+	up_write(&pmd->root_lock);
+	return r;
+}
+
+dm_block_t dm_thin_get_mapped_count(struct dm_thin_device *td)
+{
+	dm_block_t r;
+
+	down_read(&td->pmd->root_lock);
+	r = td->mapped_blocks;
+	up_read(&td->pmd->root_lock);
+
+	return r;
+}
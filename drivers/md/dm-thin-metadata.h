@@ -0,0 +1,145 @@
+/*
+ * This file is released under the GPL.
+ */
+
+#ifndef DM_THIN_METADATA_H
+#define DM_THIN_METADATA_H
+
+#include <linux/blkdev.h>
+
+/*
+ * The persistent metadata of a thin pool: which data block backs each
+ * virtual block of every thin device, and the details of the devices.
+ *
+ * Changes are made copy-on-write, and only become visible on disk when
+ * dm_pool_commit_metadata() writes the superblock.  A crash rolls the
+ * pool back to the last commit.
+ *
+ * Functions with a can_block argument, and those documented as such,
+ * only look at what is in core and never block.  All others may.
+ */
+struct dm_pool_metadata;
+struct dm_thin_device;
+
+typedef uint64_t dm_block_t;
+
+/*
+ * Device identifier.
+ */
+typedef uint64_t dm_thin_id;
+
+/*
+ * Opens the metadata on bdev, formatting it if it starts with a zeroed
+ * superblock.  data_block_size is in sectors.  Returns an ERR_PTR on
+ * failure.
+ */
+struct dm_pool_metadata *dm_pool_metadata_open(struct block_device *bdev,
+					       sector_t data_block_size,
+					       dm_block_t nr_data_blocks);
+
+int dm_pool_metadata_close(struct dm_pool_metadata *pmd);
+
+/*
+ * Compare and set the transaction id, a number userland may use to
+ * keep track of the changes it has made to the pool.
+ */
+int dm_pool_set_metadata_transaction_id(struct dm_pool_metadata *pmd,
+					uint64_t current_id,
+					uint64_t new_id);
+
+/*
+ * Device creation and deletion.  Ids are chosen by userland.
+ */
+int dm_pool_create_thin(struct dm_pool_metadata *pmd, dm_thin_id dev);
+
+/*
+ * An internal snapshot: dev shares all of origin's blocks until either
+ * is written to.  The origin must not be written to while the snapshot
+ * is taken.
+ */
+int dm_pool_create_snap(struct dm_pool_metadata *pmd, dm_thin_id dev,
+			dm_thin_id origin);
+
+/*
+ * Fails with -EBUSY if the device is open.
+ */
+int dm_pool_delete_thin_device(struct dm_pool_metadata *pmd,
+			       dm_thin_id dev);
+
+/*
+ * Are there changes which haven't been committed yet?  Doesn't block.
+ */
+int dm_pool_changed_this_transaction(struct dm_pool_metadata *pmd);
+
+int dm_pool_commit_metadata(struct dm_pool_metadata *pmd);
+
+/*
+ * Data blocks are allocated with a reference held by the caller, which
+ * dm_thin_insert_block() passes on to the mapping.  A block which never
+ * gets mapped is given back with dm_pool_free_data_block().
+ */
+int dm_pool_alloc_data_block(struct dm_pool_metadata *pmd, dm_block_t *result);
+void dm_pool_free_data_block(struct dm_pool_metadata *pmd, dm_block_t b);
+
+/*
+ * The data device may only grow.
+ */
+int dm_pool_resize_data_dev(struct dm_pool_metadata *pmd,
+			    dm_block_t new_count);
+
+/*
+ * Space accounting, in blocks.  These don't block.
+ */
+void dm_pool_get_data_usage(struct dm_pool_metadata *pmd,
+			    dm_block_t *free, dm_block_t *total);
+void dm_pool_get_metadata_usage(struct dm_pool_metadata *pmd,
+				dm_block_t *free, dm_block_t *total);
+uint64_t dm_pool_get_metadata_transaction_id(struct dm_pool_metadata *pmd);
+
+/*
+ * Opening a device keeps it from being deleted.
+ */
+int dm_pool_open_thin_device(struct dm_pool_metadata *pmd, dm_thin_id dev,
+			     struct dm_thin_device **td);
+void dm_pool_close_thin_device(struct dm_thin_device *td);
+
+dm_thin_id dm_thin_dev_id(struct dm_thin_device *td);
+
+struct dm_thin_lookup_result {
+	dm_block_t block;
+
+	/*
+	 * The block may be shared with a snapshot, and must be copied
+	 * before it is written to.
+	 */
+	unsigned shared:1;
+};
+
+/*
+ * Returns -ENODATA if the block isn't mapped, and -EWOULDBLOCK if
+ * !can_block and the answer isn't in core.
+ */
+int dm_thin_find_block(struct dm_thin_device *td, dm_block_t block,
+		       int can_block, struct dm_thin_lookup_result *result);
+
+/*
+ * Maps block to data_block, dropping the reference to any block it was
+ * mapped to before.
+ */
+int dm_thin_insert_block(struct dm_thin_device *td, dm_block_t block,
+			 dm_block_t data_block);
+
+/*
+ * Called for a write to a block reported as shared.  Snapshots may
+ * have gone since, in which case the mapping is made private and
+ * *shared is cleared, otherwise the block has to be copied.
+ */
+int dm_thin_unshare_block(struct dm_thin_device *td, dm_block_t block,
+			  int *shared);
+
+/*
+ * Doesn't block.
+ */
+dm_block_t dm_thin_get_mapped_count(struct dm_thin_device *td);
+
+#endif
@@ -0,0 +1,1575 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Thin provisioning: a pool of data blocks, shared by any number of
+ * thin devices which are only given blocks as they are written to.
+ * See Documentation/device-mapper/thin-provisioning.txt.
+ */
+
+#include "dm-thin-metadata.h"
+
+#include <linux/device-mapper.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/log2.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+#define DM_MSG_PREFIX "thin"
+
+/*
+ * Limits on the data block size, in sectors.  The block size must be a
+ * power of two.
+ */
+#define MIN_BLOCK_SIZE (64 * 1024 >> SECTOR_SHIFT)
+#define MAX_BLOCK_SIZE (1024 * 1024 * 1024 >> SECTOR_SHIFT)
+
+/*
+ * The metadata is committed at least this often.
+ */
+#define COMMIT_PERIOD HZ
+
+#define CELL_HASH_BITS 10
+#define MIN_CELLS 256
+#define MIN_MAPPINGS 64
+#define KCOPYD_PAGES 64
+#define DM_IO_PAGES 64
+
+/*
+ * How it works
+ * ------------
+ *
+ * Reads, and writes to blocks already mapped to a data block of their
+ * own, are remapped straight away.  Everything else goes to the pool's
+ * worker:
+ *
+ *  - a write to a block which isn't mapped gets a new data block,
+ *    which is zeroed unless the write covers all of it;
+ *
+ *  - a write to a block shared with a snapshot gets a new data block
+ *    the shared one is copied to.  However many snapshots share it,
+ *    this happens only once for the device written to.
+ *
+ * The new mapping is only inserted once the data block is ready.
+ * Until then, other bios for the same virtual block are held in a
+ * cell.
+ *
+ * Mappings only survive a crash once committed.  Every commit first
+ * flushes the data device, so that a committed mapping never points
+ * at data which didn't make it to disk.
+ */
+
+/*-----------------------------------------------------------------
+ * Cells.  Only ever touched by the worker.
+ *---------------------------------------------------------------*/
+struct cell_key {
+	dm_thin_id dev;
+	dm_block_t block;
+};
+
+struct cell {
+	struct hlist_node list;
+	struct cell_key key;
+	struct bio *holder;
+	struct bio_list bios;
+};
+
+static struct kmem_cache *_cell_cache;
+static struct kmem_cache *_new_mapping_cache;
+
+/*
+ * A data block being prepared for a virtual block: zeroed, copied to or
+ * overwritten.
+ */
+struct new_mapping {
+	struct list_head list;
+	struct thin_c *tc;
+	dm_block_t virt_block;
+	dm_block_t data_block;
+	struct cell *cell;
+	int err;
+
+	/*
+	 * A write covering the whole block goes straight to the new
+	 * block, and is only completed once the mapping is inserted.
+	 */
+	struct bio *bio;
+	bio_end_io_t *saved_bi_end_io;
+	void *saved_bi_private;
+};
+
+/*
+ * A pool is shared by the pool target and all the thin targets using
+ * it, and survives table reloads.  It is looked up by the mapped device
+ * of the pool.
+ */
+struct pool {
+	struct list_head list;
+	struct mapped_device *pool_md;
+	struct block_device *md_dev;
+	struct dm_pool_metadata *pmd;
+	unsigned ref_count;
+
+	sector_t sectors_per_block;
+	unsigned block_shift;
+
+	/* Set by the pool target bound to the pool, on resume */
+	struct dm_target *ti;
+	struct block_device *data_bdev;
+	dm_block_t low_water_blocks;
+	int zero_new_blocks;
+
+	int low_water_triggered;
+	int no_free_space;
+
+	struct dm_kcopyd_client *copier;
+	struct dm_io_client *io_client;
+
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+	unsigned long last_commit_jiffies;
+
+	spinlock_t lock;
+	struct bio_list deferred_bios;
+	struct bio_list deferred_flush_bios;
+	struct list_head prepared_mappings;
+	int commit_requested;
+	int commit_err;
+
+	struct hlist_head cells[1 << CELL_HASH_BITS];
+	mempool_t *cell_pool;
+	mempool_t *mapping_pool;
+};
+
+/*
+ * Target context for a pool.
+ */
+struct pool_c {
+	struct dm_target *ti;
+	struct pool *pool;
+	struct dm_dev *data_dev;
+	struct dm_dev *metadata_dev;
+
+	dm_block_t low_water_blocks;
+	int zero_new_blocks;
+};
+
+/*
+ * Target context for a thin device.
+ */
+struct thin_c {
+	struct dm_target *ti;
+	struct dm_dev *pool_dev;
+	dm_thin_id dev_id;
+
+	struct pool *pool;
+	struct dm_thin_device *td;
+};
+
+/* The zero page repeated, for zeroing new blocks */
+static struct page_list _zero_page_list;
+
+static void wake_worker(struct pool *pool)
+{
+	queue_work(pool->wq, &pool->worker);
+}
+
+/*-----------------------------------------------------------------
+ * Cells
+ *---------------------------------------------------------------*/
+static struct hlist_head *cell_bucket(struct pool *pool, struct cell_key *key)
+{
+	return pool->cells + hash_64((key->dev << 40) ^ key->block,
+				     CELL_HASH_BITS);
+}
+
+/*
+ * Returns 1 if the block already has a cell, which the bio joins.
+ * Otherwise the bio becomes the holder of a new cell.
+ */
+static int bio_detain(struct pool *pool, struct cell_key *key,
+		      struct bio *bio, struct cell **result)
+{
+	struct cell *cell;
+	struct hlist_node *tmp;
+	struct hlist_head *bucket = cell_bucket(pool, key);
+
+	hlist_for_each_entry(cell, tmp, bucket, list)
+		if (cell->key.dev == key->dev && cell->key.block == key->block) {
+			bio_list_add(&cell->bios, bio);
+			return 1;
+		}
+
+	cell = mempool_alloc(pool->cell_pool, GFP_NOIO);
+	cell->key = *key;
+	cell->holder = bio;
+	bio_list_init(&cell->bios);
+	hlist_add_head(&cell->list, bucket);
+
+	*result = cell;
+	return 0;
+}
+
+/*
+ * Frees the cell, handing back the bios other than the holder.
+ */
+static void cell_release(struct pool *pool, struct cell *cell,
+			 struct bio_list *bios)
+{
+	hlist_del(&cell->list);
+	bio_list_merge(bios, &cell->bios);
+	mempool_free(cell, pool->cell_pool);
+}
+
+/*
+ * The other bios go round again.
+ */
+static void cell_defer_others(struct pool *pool, struct cell *cell)
+{
+	unsigned long flags;
+	struct bio_list bios;
+
+	bio_list_init(&bios);
+	cell_release(pool, cell, &bios);
+
+	if (bio_list_empty(&bios))
+		return;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	bio_list_merge(&pool->deferred_bios, &bios);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	wake_worker(pool);
+}
+
+static void cell_error(struct pool *pool, struct cell *cell, int error)
+{
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+	bio_list_add(&bios, cell->holder);
+	cell_release(pool, cell, &bios);
+
+	while ((bio = bio_list_pop(&bios)))
+		bio_endio(bio, error);
+}
+
+/*-----------------------------------------------------------------
+ * Remapping
+ *---------------------------------------------------------------*/
+static dm_block_t get_bio_block(struct thin_c *tc, struct bio *bio)
+{
+	return dm_target_offset(tc->ti, bio->bi_sector) >>
+		tc->pool->block_shift;
+}
+
+static void remap(struct thin_c *tc, struct bio *bio, dm_block_t block)
+{
+	struct pool *pool = tc->pool;
+	sector_t offset = dm_target_offset(tc->ti, bio->bi_sector);
+
+	bio->bi_bdev = pool->data_bdev;
+	bio->bi_sector = (block << pool->block_shift) |
+		(offset & (pool->sectors_per_block - 1));
+}
+
+static void remap_and_issue(struct thin_c *tc, struct bio *bio,
+			    dm_block_t block)
+{
+	remap(tc, bio, block);
+	generic_make_request(bio);
+}
+
+static void defer_bio(struct thin_c *tc, struct bio *bio)
+{
+	unsigned long flags;
+	struct pool *pool = tc->pool;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	bio_list_add(&pool->deferred_bios, bio);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	wake_worker(pool);
+}
+
+/*-----------------------------------------------------------------
+ * Preparing new blocks
+ *---------------------------------------------------------------*/
+static void complete_mapping(struct new_mapping *m, int err)
+{
+	unsigned long flags;
+	struct pool *pool = m->tc->pool;
+
+	m->err = err;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	list_add_tail(&m->list, &pool->prepared_mappings);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	wake_worker(pool);
+}
+
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	complete_mapping(context, (read_err || write_err) ? -EIO : 0);
+}
+
+static void zero_complete(unsigned long error, void *context)
+{
+	complete_mapping(context, error ? -EIO : 0);
+}
+
+static void overwrite_endio(struct bio *bio, int err)
+{
+	struct new_mapping *m = bio->bi_private;
+
+	bio->bi_end_io = m->saved_bi_end_io;
+	bio->bi_private = m->saved_bi_private;
+
+	complete_mapping(m, err);
+}
+
+static int io_overwrites_block(struct pool *pool, struct bio *bio)
+{
+	return bio_data_dir(bio) == WRITE &&
+		bio->bi_size == pool->sectors_per_block << SECTOR_SHIFT;
+}
+
+/*
+ * Gets data_block ready for virt_block: a copy of old_block if
+ * copy is set, or zeroed.
+ */
+static void schedule_mapping(struct thin_c *tc, dm_block_t virt_block,
+			     int copy, dm_block_t old_block,
+			     dm_block_t data_block, struct cell *cell,
+			     struct bio *bio)
+{
+	int r;
+	struct pool *pool = tc->pool;
+	struct new_mapping *m = mempool_alloc(pool->mapping_pool, GFP_NOIO);
+	struct dm_io_region from, to;
+
+	m->tc = tc;
+	m->virt_block = virt_block;
+	m->data_block = data_block;
+	m->cell = cell;
+	m->err = 0;
+	m->bio = NULL;
+
+	if (io_overwrites_block(pool, bio)) {
+		m->bio = bio;
+		m->saved_bi_end_io = bio->bi_end_io;
+		m->saved_bi_private = bio->bi_private;
+		bio->bi_end_io = overwrite_endio;
+		bio->bi_private = m;
+		remap_and_issue(tc, bio, data_block);
+		return;
+	}
+
+	to.bdev = pool->data_bdev;
+	to.sector = data_block << pool->block_shift;
+	to.count = pool->sectors_per_block;
+
+	if (copy) {
+		from.bdev = pool->data_bdev;
+		from.sector = old_block << pool->block_shift;
+		from.count = pool->sectors_per_block;
+
+		r = dm_kcopyd_copy(pool->copier, &from, 1, &to, 0,
+				   copy_complete, m);
+		if (r < 0) {
+			DMERR_LIMIT("dm_kcopyd_copy() failed");
+			complete_mapping(m, r);
+		}
+
+	} else if (pool->zero_new_blocks) {
+		struct dm_io_request io_req = {
+			.bi_rw = WRITE,
+			.mem.type = DM_IO_PAGE_LIST,
+			.mem.ptr.pl = &_zero_page_list,
+			.mem.offset = 0,
+			.notify.fn = zero_complete,
+			.notify.context = m,
+			.client = pool->io_client,
+		};
+
+		r = dm_io(&io_req, 1, &to, NULL);
+		if (r < 0) {
+			DMERR_LIMIT("dm_io() failed");
+			complete_mapping(m, r);
+		}
+
+	} else
+		complete_mapping(m, 0);
+}
+
+static void check_low_water_mark(struct pool *pool)
+{
+	dm_block_t free, total;
+
+	dm_pool_get_data_usage(pool->pmd, &free, &total);
+	if (free <= pool->low_water_blocks && !pool->low_water_triggered) {
+		DMWARN("%s: reached low water mark, sending event.",
+		       dm_device_name(pool->pool_md));
+		pool->low_water_triggered = 1;
+		dm_table_event(pool->ti->table);
+	}
+}
+
+static int alloc_data_block(struct pool *pool, dm_block_t *result)
+{
+	int r = dm_pool_alloc_data_block(pool->pmd, result);
+
+	if (r == -ENOSPC && !pool->no_free_space) {
+		DMWARN("%s: no free space available.",
+		       dm_device_name(pool->pool_md));
+		pool->no_free_space = 1;
+		dm_table_event(pool->ti->table);
+	}
+
+	if (!r)
+		check_low_water_mark(pool);
+
+	return r;
+}
+
+static void process_prepared_mapping(struct new_mapping *m)
+{
+	int r = m->err;
+	struct thin_c *tc = m->tc;
+	struct pool *pool = tc->pool;
+	struct bio_list bios;
+	struct bio *bio;
+
+	if (!r) {
+		r = dm_thin_insert_block(tc->td, m->virt_block, m->data_block);
+		if (r)
+			DMERR_LIMIT("dm_thin_insert_block() failed");
+	}
+
+	if (r) {
+		dm_pool_free_data_block(pool->pmd, m->data_block);
+		if (m->bio) {
+			/* The holder was issued already */
+			bio_endio(m->bio, r);
+			bio_list_init(&bios);
+			cell_release(pool, m->cell, &bios);
+			while ((bio = bio_list_pop(&bios)))
+				bio_endio(bio, r);
+		} else
+			cell_error(pool, m->cell, r);
+		goto out;
+	}
+
+	/*
+	 * The new block is private to the device, everything held can go
+	 * straight to it.
+	 */
+	bio_list_init(&bios);
+	if (m->bio)
+		bio_endio(m->bio, 0);
+	else
+		bio_list_add(&bios, m->cell->holder);
+	cell_release(pool, m->cell, &bios);
+
+	while ((bio = bio_list_pop(&bios)))
+		remap_and_issue(tc, bio, m->data_block);
+
+out:
+	mempool_free(m, pool->mapping_pool);
+}
+
+static void process_prepared_mappings(struct pool *pool)
+{
+	struct list_head maps;
+	struct new_mapping *m, *tmp;
+
+	INIT_LIST_HEAD(&maps);
+	spin_lock_irq(&pool->lock);
+	list_splice_init(&pool->prepared_mappings, &maps);
+	spin_unlock_irq(&pool->lock);
+
+	list_for_each_entry_safe(m, tmp, &maps, list)
+		process_prepared_mapping(m);
+}
+
+/*-----------------------------------------------------------------
+ * Deferred bios
+ *---------------------------------------------------------------*/
+static void break_sharing(struct thin_c *tc, struct bio *bio,
+			  dm_block_t block, dm_block_t data_block,
+			  struct cell *cell)
+{
+	int r, shared;
+	dm_block_t new_block;
+
+	r = dm_thin_unshare_block(tc->td, block, &shared);
+	if (r) {
+		DMERR_LIMIT("dm_thin_unshare_block() failed");
+		cell_error(tc->pool, cell, r);
+		return;
+	}
+
+	/* The snapshots sharing it have gone */
+	if (!shared) {
+		remap_and_issue(tc, bio, data_block);
+		cell_defer_others(tc->pool, cell);
+		return;
+	}
+
+	r = alloc_data_block(tc->pool, &new_block);
+	if (r) {
+		cell_error(tc->pool, cell, r);
+		return;
+	}
+
+	schedule_mapping(tc, block, 1, data_block, new_block, cell, bio);
+}
+
+static void provision_block(struct thin_c *tc, struct bio *bio,
+			    dm_block_t block, struct cell *cell)
+{
+	int r;
+	dm_block_t data_block;
+
+	r = alloc_data_block(tc->pool, &data_block);
+	if (r) {
+		cell_error(tc->pool, cell, r);
+		return;
+	}
+
+	schedule_mapping(tc, block, 0, 0, data_block, cell, bio);
+}
+
+static void process_bio(struct thin_c *tc, struct bio *bio)
+{
+	int r;
+	struct pool *pool = tc->pool;
+	dm_block_t block = get_bio_block(tc, bio);
+	struct cell_key key;
+	struct cell *cell;
+	struct dm_thin_lookup_result lookup_result;
+
+	key.dev = tc->dev_id;
+	key.block = block;
+	if (bio_detain(pool, &key, bio, &cell))
+		return;
+
+	r = dm_thin_find_block(tc->td, block, 1, &lookup_result);
+	switch (r) {
+	case 0:
+		if (lookup_result.shared && bio_data_dir(bio) == WRITE)
+			break_sharing(tc, bio, block, lookup_result.block,
+				      cell);
+		else {
+			remap_and_issue(tc, bio, lookup_result.block);
+			cell_defer_others(pool, cell);
+		}
+		break;
+
+	case -ENODATA:
+		if (bio_data_dir(bio) == WRITE) {
+			provision_block(tc, bio, block, cell);
+			break;
+		}
+
+		zero_fill_bio(bio);
+		bio_endio(bio, 0);
+		cell_defer_others(pool, cell);
+		break;
+
+	default:
+		DMERR_LIMIT("dm_thin_find_block() failed, error = %d", r);
+		cell_error(pool, cell, r);
+	}
+}
+
+static void process_deferred_bios(struct pool *pool)
+{
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irq(&pool->lock);
+	bio_list_merge(&bios, &pool->deferred_bios);
+	bio_list_init(&pool->deferred_bios);
+	spin_unlock_irq(&pool->lock);
+
+	while ((bio = bio_list_pop(&bios)))
+		process_bio(dm_get_mapinfo(bio)->ptr, bio);
+}
+
+/*
+ * Flushes the data device before the metadata, so that no mapping is
+ * committed before its data.
+ */
+static int commit(struct pool *pool)
+{
+	int r = 0;
+
+	if (pool->data_bdev) {
+		r = blkdev_issue_flush(pool->data_bdev, GFP_NOIO, NULL,
+				       BLKDEV_IFL_WAIT);
+		if (r == -EOPNOTSUPP)
+			r = 0;
+	}
+
+	if (!r)
+		r = dm_pool_commit_metadata(pool->pmd);
+
+	if (r)
+		DMERR_LIMIT("%s: commit failed, error = %d",
+			    dm_device_name(pool->pool_md), r);
+
+	pool->last_commit_jiffies = jiffies;
+
+	return r;
+}
+
+/*
+ * Empty barriers complete once everything written before them has been
+ * committed.
+ */
+static void process_deferred_flushes(struct pool *pool)
+{
+	int r = 0, requested;
+	struct bio_list bios;
+	struct bio *bio;
+
+	bio_list_init(&bios);
+
+	spin_lock_irq(&pool->lock);
+	bio_list_merge(&bios, &pool->deferred_flush_bios);
+	bio_list_init(&pool->deferred_flush_bios);
+	requested = pool->commit_requested;
+	pool->commit_requested = 0;
+	spin_unlock_irq(&pool->lock);
+
+	if (bio_list_empty(&bios) && !requested &&
+	    time_before(jiffies, pool->last_commit_jiffies + COMMIT_PERIOD))
+		return;
+
+	if (dm_pool_changed_this_transaction(pool->pmd))
+		r = commit(pool);
+	else if (!bio_list_empty(&bios) && pool->data_bdev) {
+		r = blkdev_issue_flush(pool->data_bdev, GFP_NOIO, NULL,
+				       BLKDEV_IFL_WAIT);
+		if (r == -EOPNOTSUPP)
+			r = 0;
+	}
+
+	if (requested)
+		pool->commit_err = r;
+
+	while ((bio = bio_list_pop(&bios)))
+		bio_endio(bio, r);
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct pool *pool = container_of(ws, struct pool, worker);
+
+	process_prepared_mappings(pool);
+	process_deferred_bios(pool);
+	process_deferred_flushes(pool);
+}
+
+static void do_waker(struct work_struct *ws)
+{
+	struct pool *pool = container_of(to_delayed_work(ws), struct pool,
+					 waker);
+
+	wake_worker(pool);
+	queue_delayed_work(pool->wq, &pool->waker, COMMIT_PERIOD);
+}
+
+/*
+ * Commits from outside the worker go through it, so that every
+ * mapping it inserted is covered by the data device flush.
+ */
+static int commit_sync(struct pool *pool)
+{
+	spin_lock_irq(&pool->lock);
+	pool->commit_requested = 1;
+	spin_unlock_irq(&pool->lock);
+
+	wake_worker(pool);
+	flush_workqueue(pool->wq);
+
+	return pool->commit_err;
+}
+
+/*-----------------------------------------------------------------
+ * Pool table.  Pools are shared between table reloads, and found by
+ * the thin targets through the mapped device of the pool.
+ *---------------------------------------------------------------*/
+static struct dm_thin_pool_table {
+	struct mutex mutex;
+	struct list_head pools;
+} dm_thin_pool_table;
+
+static void pool_table_init(void)
+{
+	mutex_init(&dm_thin_pool_table.mutex);
+	INIT_LIST_HEAD(&dm_thin_pool_table.pools);
+}
+
+static struct pool *__pool_table_lookup(struct mapped_device *md)
+{
+	struct pool *pool;
+
+	BUG_ON(!mutex_is_locked(&dm_thin_pool_table.mutex));
+
+	list_for_each_entry(pool, &dm_thin_pool_table.pools, list)
+		if (pool->pool_md == md)
+			return pool;
+
+	return NULL;
+}
+
+static struct pool *__pool_table_lookup_metadata_dev(struct block_device *md_dev)
+{
+	struct pool *pool;
+
+	BUG_ON(!mutex_is_locked(&dm_thin_pool_table.mutex));
+
+	list_for_each_entry(pool, &dm_thin_pool_table.pools, list)
+		if (pool->md_dev == md_dev)
+			return pool;
+
+	return NULL;
+}
+
+static void pool_destroy(struct pool *pool)
+{
+	list_del(&pool->list);
+
+	if (dm_pool_metadata_close(pool->pmd) < 0)
+		DMWARN("%s: dm_pool_metadata_close() failed.", __func__);
+
+	mempool_destroy(pool->mapping_pool);
+	mempool_destroy(pool->cell_pool);
+	destroy_workqueue(pool->wq);
+	dm_io_client_destroy(pool->io_client);
+	dm_kcopyd_client_destroy(pool->copier);
+	kfree(pool);
+}
+
+static struct pool *pool_create(struct mapped_device *pool_md,
+				struct block_device *md_dev,
+				sector_t block_size, dm_block_t nr_blocks,
+				char **error)
+{
+	int r;
+	unsigned i;
+	void *err_p;
+	struct pool *pool;
+	struct dm_pool_metadata *pmd;
+
+	pmd = dm_pool_metadata_open(md_dev, block_size, nr_blocks);
+	if (IS_ERR(pmd)) {
+		*error = "Error creating metadata object";
+		return (struct pool *)pmd;
+	}
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool) {
+		*error = "Error allocating memory for pool";
+		err_p = ERR_PTR(-ENOMEM);
+		goto bad_pool;
+	}
+
+	pool->pmd = pmd;
+	pool->pool_md = pool_md;
+	pool->md_dev = md_dev;
+	pool->sectors_per_block = block_size;
+	pool->block_shift = ilog2(block_size);
+	pool->ref_count = 1;
+	pool->last_commit_jiffies = jiffies;
+
+	spin_lock_init(&pool->lock);
+	bio_list_init(&pool->deferred_bios);
+	bio_list_init(&pool->deferred_flush_bios);
+	INIT_LIST_HEAD(&pool->prepared_mappings);
+	for (i = 0; i < ARRAY_SIZE(pool->cells); i++)
+		INIT_HLIST_HEAD(pool->cells + i);
+
+	r = dm_kcopyd_client_create(KCOPYD_PAGES, &pool->copier);
+	if (r) {
+		*error = "Error creating pool's kcopyd client";
+		err_p = ERR_PTR(r);
+		goto bad_kcopyd_client;
+	}
+
+	pool->io_client = dm_io_client_create(DM_IO_PAGES);
+	if (IS_ERR(pool->io_client)) {
+		*error = "Error creating pool's io client";
+		err_p = pool->io_client;
+		goto bad_io_client;
+	}
+
+	/*
+	 * A single threaded workqueue: the worker is the only thing
+	 * which touches the cells.
+	 */
+	pool->wq = create_singlethread_workqueue("dm-" DM_MSG_PREFIX);
+	if (!pool->wq) {
+		*error = "Error creating pool's workqueue";
+		err_p = ERR_PTR(-ENOMEM);
+		goto bad_wq;
+	}
+	INIT_WORK(&pool->worker, do_worker);
+	INIT_DELAYED_WORK(&pool->waker, do_waker);
+
+	pool->cell_pool = mempool_create_slab_pool(MIN_CELLS, _cell_cache);
+	if (!pool->cell_pool) {
+		*error = "Error creating pool's cell mempool";
+		err_p = ERR_PTR(-ENOMEM);
+		goto bad_cell_pool;
+	}
+
+	pool->mapping_pool = mempool_create_slab_pool(MIN_MAPPINGS,
+						      _new_mapping_cache);
+	if (!pool->mapping_pool) {
+		*error = "Error creating pool's mapping mempool";
+		err_p = ERR_PTR(-ENOMEM);
+		goto bad_mapping_pool;
+	}
+
+	list_add(&pool->list, &dm_thin_pool_table.pools);
+
+	return pool;
+
+bad_mapping_pool:
+	mempool_destroy(pool->cell_pool);
+bad_cell_pool:
+	destroy_workqueue(pool->wq);
+bad_wq:
+	dm_io_client_destroy(pool->io_client);
+bad_io_client:
+	dm_kcopyd_client_destroy(pool->copier);
+bad_kcopyd_client:
+	kfree(pool);
+bad_pool:
+	if (dm_pool_metadata_close(pmd))
+		DMWARN("%s: dm_pool_metadata_close() failed.", __func__);
+
+	return err_p;
+}
+
+static void __pool_inc(struct pool *pool)
+{
+	BUG_ON(!mutex_is_locked(&dm_thin_pool_table.mutex));
+	pool->ref_count++;
+}
+
+static void __pool_dec(struct pool *pool)
+{
+	BUG_ON(!mutex_is_locked(&dm_thin_pool_table.mutex));
+	BUG_ON(!pool->ref_count);
+	if (!--pool->ref_count)
+		pool_destroy(pool);
+}
+
+static struct pool *__pool_find(struct mapped_device *pool_md,
+				struct block_device *md_dev,
+				sector_t block_size, dm_block_t nr_blocks,
+				char **error)
+{
+	struct pool *pool = __pool_table_lookup_metadata_dev(md_dev);
+
+	if (pool) {
+		if (pool->pool_md != pool_md) {
+			*error = "metadata device already in use by a pool";
+			return ERR_PTR(-EBUSY);
+		}
+		__pool_inc(pool);
+
+	} else {
+		pool = __pool_table_lookup(pool_md);
+		if (pool) {
+			if (pool->md_dev != md_dev) {
+				*error = "different pool cannot replace a pool";
+				return ERR_PTR(-EINVAL);
+			}
+			__pool_inc(pool);
+
+		} else
+			pool = pool_create(pool_md, md_dev, block_size,
+					   nr_blocks, error);
+	}
+
+	if (!IS_ERR(pool) && pool->sectors_per_block != block_size) {
+		*error = "Pool block size can't change";
+		__pool_dec(pool);
+		return ERR_PTR(-EINVAL);
+	}
+
+	return pool;
+}
+
+/*-----------------------------------------------------------------
+ * Pool target methods
+ *---------------------------------------------------------------*/
+static sector_t get_dev_size(struct dm_dev *dev)
+{
+	return i_size_read(dev->bdev->bd_inode) >> SECTOR_SHIFT;
+}
+
+static void pool_dtr(struct dm_target *ti)
+{
+	struct pool_c *pt = ti->private;
+
+	mutex_lock(&dm_thin_pool_table.mutex);
+
+	if (pt->pool->ti == ti) {
+		pt->pool->ti = NULL;
+		pt->pool->data_bdev = NULL;
+	}
+	__pool_dec(pt->pool);
+	dm_put_device(ti, pt->metadata_dev);
+	dm_put_device(ti, pt->data_dev);
+	kfree(pt);
+
+	mutex_unlock(&dm_thin_pool_table.mutex);
+}
+
+static int parse_pool_features(struct pool_c *pt, unsigned argc, char **argv)
+{
+	struct dm_target *ti = pt->ti;
+	unsigned nr_features;
+
+	pt->zero_new_blocks = 1;
+
+	if (!argc)
+		return 0;
+
+	if (sscanf(argv[0], "%u", &nr_features) != 1 ||
+	    nr_features != argc - 1) {
+		ti->error = "Invalid number of pool feature arguments";
+		return -EINVAL;
+	}
+
+	for (argv++; nr_features; nr_features--, argv++) {
+		if (!strcasecmp(argv[0], "skip_block_zeroing"))
+			pt->zero_new_blocks = 0;
+		else {
+			ti->error = "Unrecognised pool feature requested";
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * thin-pool <metadata dev> <data dev>
+ *	     <data block size (sectors)>
+ *	     <low water mark (blocks)>
+ *	     [<#feature args> [<arg>]*]
+ *
+ * Optional feature arguments are:
+ *	     skip_block_zeroing: skips the zeroing of newly-provisioned blocks.
+ */
+static int pool_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	int r;
+	struct pool_c *pt;
+	struct pool *pool;
+	unsigned long block_size;
+	unsigned long long low_water;
+	fmode_t mode = dm_table_get_mode(ti->table);
+
+	if (argc < 4) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	if (sscanf(argv[2], "%lu", &block_size) != 1 ||
+	    block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE ||
+	    !is_power_of_2(block_size)) {
+		ti->error = "Invalid block size";
+		return -EINVAL;
+	}
+
+	if (sscanf(argv[3], "%llu", &low_water) != 1) {
+		ti->error = "Invalid low water mark";
+		return -EINVAL;
+	}
+
+	pt = kzalloc(sizeof(*pt), GFP_KERNEL);
+	if (!pt) {
+		ti->error = "Error allocating pool context";
+		return -ENOMEM;
+	}
+	pt->ti = ti;
+	pt->low_water_blocks = low_water;
+
+	r = parse_pool_features(pt, argc - 4, argv + 4);
+	if (r)
+		goto bad_features;
+
+	r = dm_get_device(ti, argv[0], mode, &pt->metadata_dev);
+	if (r) {
+		ti->error = "Error opening metadata block device";
+		goto bad_features;
+	}
+
+	r = dm_get_device(ti, argv[1], mode, &pt->data_dev);
+	if (r) {
+		ti->error = "Error getting data device";
+		goto bad_data;
+	}
+
+	if (get_dev_size(pt->data_dev) < ti->len) {
+		ti->error = "Data device is too small";
+		r = -EINVAL;
+		goto bad_pool;
+	}
+
+	mutex_lock(&dm_thin_pool_table.mutex);
+	pool = __pool_find(dm_table_get_md(ti->table), pt->metadata_dev->bdev,
+			   block_size, ti->len >> ilog2(block_size),
+			   &ti->error);
+	mutex_unlock(&dm_thin_pool_table.mutex);
+	if (IS_ERR(pool)) {
+		r = PTR_ERR(pool);
+		goto bad_pool;
+	}
+	pt->pool = pool;
+
+	ti->num_flush_requests = 1;
+	ti->private = pt;
+
+	return 0;
+
+bad_pool:
+	dm_put_device(ti, pt->data_dev);
+bad_data:
+	dm_put_device(ti, pt->metadata_dev);
+bad_features:
+	kfree(pt);
+	return r;
+}
+
+static int pool_map(struct dm_target *ti, struct bio *bio,
+		    union map_info *map_context)
+{
+	struct pool_c *pt = ti->private;
+
+	bio->bi_bdev = pt->data_dev->bdev;
+	bio->bi_sector = dm_target_offset(ti, bio->bi_sector);
+
+	return DM_MAPIO_REMAPPED;
+}
+
+/*
+ * The pool target which is about to go live takes over the pool, and
+ * any growth of the data device is picked up.
+ */
+static int pool_preresume(struct dm_target *ti)
+{
+	int r;
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+	dm_block_t data_size, free, total;
+
+	data_size = ti->len >> pool->block_shift;
+	dm_pool_get_data_usage(pool->pmd, &free, &total);
+
+	if (data_size < total) {
+		DMERR("pool target too small, is %llu blocks (expected %llu)",
+		      (unsigned long long)data_size,
+		      (unsigned long long)total);
+		return -EINVAL;
+	}
+
+	if (data_size > total) {
+		r = dm_pool_resize_data_dev(pool->pmd, data_size);
+		if (r) {
+			DMERR("failed to resize data device");
+			return r;
+		}
+	}
+
+	mutex_lock(&dm_thin_pool_table.mutex);
+	pool->ti = ti;
+	pool->data_bdev = pt->data_dev->bdev;
+	pool->low_water_blocks = pt->low_water_blocks;
+	pool->zero_new_blocks = pt->zero_new_blocks;
+	pool->low_water_triggered = 0;
+	pool->no_free_space = 0;
+	mutex_unlock(&dm_thin_pool_table.mutex);
+
+	return 0;
+}
+
+static void pool_resume(struct dm_target *ti)
+{
+	struct pool *pool = ((struct pool_c *)ti->private)->pool;
+
+	queue_delayed_work(pool->wq, &pool->waker, COMMIT_PERIOD);
+	wake_worker(pool);
+}
+
+static void pool_postsuspend(struct dm_target *ti)
+{
+	struct pool *pool = ((struct pool_c *)ti->private)->pool;
+
+	cancel_delayed_work_sync(&pool->waker);
+	commit_sync(pool);
+}
+
+static int check_arg_count(unsigned argc, unsigned args_required)
+{
+	if (argc != args_required) {
+		DMWARN("Message received with %u arguments instead of %u.",
+		       argc, args_required);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int read_dev_id(char *arg, dm_thin_id *dev_id, int warning)
+{
+	unsigned long long id;
+
+	if (sscanf(arg, "%llu", &id) == 1) {
+		*dev_id = id;
+		return 0;
+	}
+
+	if (warning)
+		DMWARN("Message received with invalid device id: %s", arg);
+
+	return -EINVAL;
+}
+
+/*
+ * Messages supported:
+ *   create_thin	<dev_id>
+ *   create_snap	<dev_id> <origin_id>
+ *   delete		<dev_id>
+ *   set_transaction_id <current_trans_id> <new_trans_id>
+ */
+static int pool_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	int r = -EINVAL;
+	struct pool *pool = ((struct pool_c *)ti->private)->pool;
+	dm_thin_id dev_id, origin_id;
+	unsigned long long old_id, new_id;
+
+	if (!argc)
+		goto bad;
+
+	if (!strcasecmp(argv[0], "create_thin")) {
+		r = check_arg_count(argc, 2);
+		if (!r)
+			r = read_dev_id(argv[1], &dev_id, 1);
+		if (!r) {
+			r = dm_pool_create_thin(pool->pmd, dev_id);
+			if (r)
+				DMWARN("Creation of new thinly-provisioned device with id %s failed.",
+				       argv[1]);
+		}
+
+	} else if (!strcasecmp(argv[0], "create_snap")) {
+		r = check_arg_count(argc, 3);
+		if (!r)
+			r = read_dev_id(argv[1], &dev_id, 1);
+		if (!r)
+			r = read_dev_id(argv[2], &origin_id, 1);
+		if (!r) {
+			r = dm_pool_create_snap(pool->pmd, dev_id, origin_id);
+			if (r)
+				DMWARN("Creation of new snapshot %s of device %s failed.",
+				       argv[1], argv[2]);
+		}
+
+	} else if (!strcasecmp(argv[0], "delete")) {
+		r = check_arg_count(argc, 2);
+		if (!r)
+			r = read_dev_id(argv[1], &dev_id, 1);
+		if (!r) {
+			r = dm_pool_delete_thin_device(pool->pmd, dev_id);
+			if (r)
+				DMWARN("Deletion of thin device %s failed.",
+				       argv[1]);
+		}
+
+	} else if (!strcasecmp(argv[0], "set_transaction_id")) {
+		r = check_arg_count(argc, 3);
+		if (r)
+			goto out;
+
+		if (sscanf(argv[1], "%llu", &old_id) != 1 ||
+		    sscanf(argv[2], "%llu", &new_id) != 1) {
+			DMWARN("set_transaction_id message: Unrecognised id.");
+			r = -EINVAL;
+			goto out;
+		}
+
+		r = dm_pool_set_metadata_transaction_id(pool->pmd, old_id,
+							new_id);
+		if (r)
+			DMWARN("Failed to change transaction id from %s to %s.",
+			       argv[1], argv[2]);
+
+	} else
+		goto bad;
+
+	if (!r)
+		r = commit_sync(pool);
+
+out:
+	return r;
+
+bad:
+	DMWARN("Unrecognised thin pool target message received.");
+	return -EINVAL;
+}
+
+/*
+ * Status line is:
+ *    <transaction id> <used metadata blocks>/<total metadata blocks>
+ *    <used data blocks>/<total data blocks>
+ */
+static int pool_status(struct dm_target *ti, status_type_t type,
+		       char *result, unsigned maxlen)
+{
+	unsigned sz = 0;
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+	dm_block_t free_md, total_md, free_data, total_data;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		dm_pool_get_metadata_usage(pool->pmd, &free_md, &total_md);
+		dm_pool_get_data_usage(pool->pmd, &free_data, &total_data);
+
+		DMEMIT("%llu %llu/%llu %llu/%llu",
+		       (unsigned long long)
+				dm_pool_get_metadata_transaction_id(pool->pmd),
+		       (unsigned long long)(total_md - free_md),
+		       (unsigned long long)total_md,
+		       (unsigned long long)(total_data - free_data),
+		       (unsigned long long)total_data);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %llu %llu ",
+		       pt->metadata_dev->name, pt->data_dev->name,
+		       (unsigned long long)pool->sectors_per_block,
+		       (unsigned long long)pt->low_water_blocks);
+
+		if (pt->zero_new_blocks)
+			DMEMIT("0");
+		else
+			DMEMIT("1 skip_block_zeroing");
+		break;
+	}
+
+	return 0;
+}
+
+static int pool_iterate_devices(struct dm_target *ti,
+				iterate_devices_callout_fn fn, void *data)
+{
+	struct pool_c *pt = ti->private;
+
+	return fn(ti, pt->data_dev, 0, ti->len, data);
+}
+
+static void pool_io_hints(struct dm_target *ti, struct queue_limits *limits)
+{
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+
+	blk_limits_io_min(limits, pool->sectors_per_block << SECTOR_SHIFT);
+	blk_limits_io_opt(limits, pool->sectors_per_block << SECTOR_SHIFT);
+}
+
+static struct target_type pool_target = {
+	.name = "thin-pool",
+	.version = {1, 0, 0},
+	.module = THIS_MODULE,
+	.ctr = pool_ctr,
+	.dtr = pool_dtr,
+	.map = pool_map,
+	.postsuspend = pool_postsuspend,
+	.preresume = pool_preresume,
+	.resume = pool_resume,
+	.message = pool_message,
+	.status = pool_status,
+	.iterate_devices = pool_iterate_devices,
+	.io_hints = pool_io_hints,
+};
+
+/*-----------------------------------------------------------------
+ * Thin target methods
+ *---------------------------------------------------------------*/
+static void thin_dtr(struct dm_target *ti)
+{
+	struct thin_c *tc = ti->private;
+
+	mutex_lock(&dm_thin_pool_table.mutex);
+
+	dm_pool_close_thin_device(tc->td);
+	__pool_dec(tc->pool);
+	dm_put_device(ti, tc->pool_dev);
+	kfree(tc);
+
+	mutex_unlock(&dm_thin_pool_table.mutex);
+}
+
+/*
+ * Thin target parameters:
+ *
+ * <pool_dev> <dev_id>
+ *
+ * pool_dev: the path to the pool (eg, /dev/mapper/my_pool)
+ * dev_id: the internal device identifier
+ */
+static int thin_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	int r;
+	struct thin_c *tc;
+	struct mapped_device *pool_md;
+
+	mutex_lock(&dm_thin_pool_table.mutex);
+
+	if (argc != 2) {
+		ti->error = "Invalid argument count";
+		r = -EINVAL;
+		goto out_unlock;
+	}
+
+	tc = ti->private = kzalloc(sizeof(*tc), GFP_KERNEL);
+	if (!tc) {
+		ti->error = "Out of memory";
+		r = -ENOMEM;
+		goto out_unlock;
+	}
+	tc->ti = ti;
+
+	r = dm_get_device(ti, argv[0], dm_table_get_mode(ti->table),
+			  &tc->pool_dev);
+	if (r) {
+		ti->error = "Error opening pool device";
+		goto bad_pool_dev;
+	}
+
+	if (read_dev_id(argv[1], &tc->dev_id, 0)) {
+		ti->error = "Invalid device id";
+		r = -EINVAL;
+		goto bad_common;
+	}
+
+	pool_md = dm_get_md(tc->pool_dev->bdev->bd_dev);
+	if (!pool_md) {
+		ti->error = "Couldn't get pool mapped device";
+		r = -EINVAL;
+		goto bad_common;
+	}
+
+	tc->pool = __pool_table_lookup(pool_md);
+	dm_put(pool_md);
+	if (!tc->pool || !tc->pool->ti) {
+		ti->error = "Couldn't find active pool object";
+		r = -EINVAL;
+		goto bad_common;
+	}
+	__pool_inc(tc->pool);
+
+	r = dm_pool_open_thin_device(tc->pool->pmd, tc->dev_id, &tc->td);
+	if (r) {
+		ti->error = "Couldn't open thin internal device";
+		goto bad_thin_open;
+	}
+
+	ti->split_io = tc->pool->sectors_per_block;
+	ti->num_flush_requests = 1;
+
+	mutex_unlock(&dm_thin_pool_table.mutex);
+
+	return 0;
+
+bad_thin_open:
+	__pool_dec(tc->pool);
+bad_common:
+	dm_put_device(ti, tc->pool_dev);
+bad_pool_dev:
+	kfree(tc);
+out_unlock:
+	mutex_unlock(&dm_thin_pool_table.mutex);
+
+	return r;
+}
+
+static int thin_map(struct dm_target *ti, struct bio *bio,
+		    union map_info *map_context)
+{
+	int r;
+	struct thin_c *tc = ti->private;
+	struct pool *pool = tc->pool;
+	dm_block_t block = get_bio_block(tc, bio);
+	struct dm_thin_lookup_result result;
+	unsigned long flags;
+
+	map_context->ptr = tc;
+
+	if (unlikely(bio_empty_barrier(bio))) {
+		spin_lock_irqsave(&pool->lock, flags);
+		bio_list_add(&pool->deferred_flush_bios, bio);
+		spin_unlock_irqrestore(&pool->lock, flags);
+
+		wake_worker(pool);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	r = dm_thin_find_block(tc->td, block, 0, &result);
+	switch (r) {
+	case 0:
+		if (result.shared && bio_data_dir(bio) == WRITE)
+			break;
+
+		remap(tc, bio, result.block);
+		return DM_MAPIO_REMAPPED;
+
+	case -ENODATA:
+		if (bio_data_dir(bio) == WRITE)
+			break;
+
+		zero_fill_bio(bio);
+		bio_endio(bio, 0);
+		return DM_MAPIO_SUBMITTED;
+
+	case -EWOULDBLOCK:
+		break;
+
+	default:
+		return r;
+	}
+
+	defer_bio(tc, bio);
+	return DM_MAPIO_SUBMITTED;
+}
+
+/*
+ * Status line is:
+ *    <nr mapped sectors>
+ */
+static int thin_status(struct dm_target *ti, status_type_t type,
+		       char *result, unsigned maxlen)
+{
+	unsigned sz = 0;
+	struct thin_c *tc = ti->private;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		DMEMIT("%llu", (unsigned long long)
+		       (dm_thin_get_mapped_count(tc->td) <<
+			tc->pool->block_shift));
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %llu", tc->pool_dev->name,
+		       (unsigned long long)tc->dev_id);
+		break;
+	}
+
+	return 0;
+}
+
+static int thin_iterate_devices(struct dm_target *ti,
+				iterate_devices_callout_fn fn, void *data)
+{
+	struct thin_c *tc = ti->private;
+	struct pool *pool = tc->pool;
+	dm_block_t blocks;
+
+	/* A thin device may well be larger than its pool */
+	if (!pool->ti)
+		return 0;
+
+	blocks = pool->ti->len >> pool->block_shift;
+	if (!blocks)
+		return 0;
+
+	return fn(ti, tc->pool_dev, 0, blocks << pool->block_shift, data);
+}
+
+static struct target_type thin_target = {
+	.name = "thin",
+	.version = {1, 0, 0},
+	.module	= THIS_MODULE,
+	.ctr = thin_ctr,
+	.dtr = thin_dtr,
+	.map = thin_map,
+	.status = thin_status,
+	.iterate_devices = thin_iterate_devices,
+};
+
+/*----------------------------------------------------------------*/
+
+static int __init dm_thin_init(void)
+{
+	int r;
+
+	pool_table_init();
+
+	_zero_page_list.next = &_zero_page_list;
+	_zero_page_list.page = ZERO_PAGE(0);
+
+	_cell_cache = KMEM_CACHE(cell, 0);
+	if (!_cell_cache)
+		return -ENOMEM;
+
+	_new_mapping_cache = KMEM_CACHE(new_mapping, 0);
+	if (!_new_mapping_cache) {
+		r = -ENOMEM;
+		goto bad_new_mapping_cache;
+	}
+
+	r = dm_register_target(&thin_target);
+	if (r)
+		goto bad_thin_target;
+
+	r = dm_register_target(&pool_target);
+	if (r)
+		goto bad_pool_target;
+
+	return 0;
+
+bad_pool_target:
+	dm_unregister_target(&thin_target);
+bad_thin_target:
+	kmem_cache_destroy(_new_mapping_cache);
+bad_new_mapping_cache:
+	kmem_cache_destroy(_cell_cache);
+
+	return r;
+}
+
+static void __exit dm_thin_exit(void)
+{
+	dm_unregister_target(&pool_target);
+	dm_unregister_target(&thin_target);
+
+	kmem_cache_destroy(_new_mapping_cache);
+	kmem_cache_destroy(_cell_cache);
+}
+
+module_init(dm_thin_init);
+module_exit(dm_thin_exit);
+
+MODULE_DESCRIPTION(DM_NAME " thin provisioning target");
+MODULE_LICENSE("GPL");
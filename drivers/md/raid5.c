@@ -193,6 +193,16 @@ static int stripe_operations_active(struct stripe_head *sh)
 	       test_bit(STRIPE_COMPUTE_RUN, &sh->state);
 }
 
+static struct workqueue_struct *raid5_wq;
+
+static inline struct r5worker_group *stripe_worker_group(raid5_conf_t *conf,
+							 struct stripe_head *sh)
+{
+	int hash = (sh->sector >> STRIPE_SHIFT) & HASH_MASK;
+
+	return conf->worker_groups + hash % conf->group_cnt;
+}
+
 static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 {
 	if (atomic_dec_and_test(&sh->count)) {
@@ -208,6 +218,15 @@ static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 				plugger_set_plug(&conf->plug);
 			} else {
 				clear_bit(STRIPE_BIT_DELAY, &sh->state);
+				if (conf->group_cnt) {
+					struct r5worker_group *group;
+
+					group = stripe_worker_group(conf, sh);
+					list_add_tail(&sh->lru,
+						      &group->handle_list);
+					queue_work(raid5_wq, &group->work);
+					return;
+				}
 				list_add_tail(&sh->lru, &conf->handle_list);
 			}
 			md_wakeup_thread(conf->mddev->thread);
@@ -3924,19 +3943,22 @@ static int chunk_aligned_read(mddev_t *mddev, struct bio * raid_bio)
  * stripe with in flight i/o.  The bypass_count will be reset when the
  * head of the hold_list has changed, i.e. the head was promoted to the
  * handle_list.
+ *
+ * handle_list is either conf->handle_list, or that of a worker group.
  */
-static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf)
+static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf,
+						 struct list_head *handle_list)
 {
 	struct stripe_head *sh;
 
 	pr_debug("%s: handle: %s hold: %s full_writes: %d bypass_count: %d\n",
 		  __func__,
-		  list_empty(&conf->handle_list) ? "empty" : "busy",
+		  list_empty(handle_list) ? "empty" : "busy",
 		  list_empty(&conf->hold_list) ? "empty" : "busy",
 		  atomic_read(&conf->pending_full_writes), conf->bypass_count);
 
-	if (!list_empty(&conf->handle_list)) {
-		sh = list_entry(conf->handle_list.next, typeof(*sh), lru);
+	if (!list_empty(handle_list)) {
+		sh = list_entry(handle_list->next, typeof(*sh), lru);
 
 		if (list_empty(&conf->hold_list))
 			conf->bypass_count = 0;
@@ -4553,7 +4575,7 @@ static void raid5d(mddev_t *mddev)
 			handled++;
 		}
 
-		sh = __get_priority_stripe(conf);
+		sh = __get_priority_stripe(conf, &conf->handle_list);
 
 		if (!sh)
 			break;
@@ -4576,6 +4598,68 @@ static void raid5d(mddev_t *mddev)
 	pr_debug("--- raid5d inactive\n");
 }
 
+/*
+ * Handles the stripes of a worker group, and any on the hold_list which
+ * are due.  raid5d still takes care of everything else.
+ */
+static void raid5_do_work(struct work_struct *work)
+{
+	struct r5worker_group *group = container_of(work, struct r5worker_group,
+						    work);
+	raid5_conf_t *conf = group->conf;
+	struct stripe_head *sh;
+	int handled = 0;
+
+	pr_debug("+++ raid5worker active\n");
+
+	spin_lock_irq(&conf->device_lock);
+	while ((sh = __get_priority_stripe(conf, &group->handle_list))) {
+		spin_unlock_irq(&conf->device_lock);
+
+		handled++;
+		handle_stripe(sh);
+		release_stripe(sh);
+		cond_resched();
+
+		spin_lock_irq(&conf->device_lock);
+	}
+	spin_unlock_irq(&conf->device_lock);
+	pr_debug("%d stripes handled\n", handled);
+
+	async_tx_issue_pending_all();
+	unplug_slaves(conf->mddev);
+
+	pr_debug("--- raid5worker inactive\n");
+}
+
+static struct r5worker_group *alloc_worker_groups(raid5_conf_t *conf, int cnt)
+{
+	struct r5worker_group *groups;
+	int i;
+
+	groups = kcalloc(cnt, sizeof(*groups), GFP_KERNEL);
+	if (!groups)
+		return NULL;
+
+	for (i = 0; i < cnt; i++) {
+		INIT_LIST_HEAD(&groups[i].handle_list);
+		INIT_WORK(&groups[i].work, raid5_do_work);
+		groups[i].conf = conf;
+	}
+	return groups;
+}
+
+static void free_worker_groups(struct r5worker_group *groups, int cnt)
+{
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		flush_work(&groups[i].work);
+		BUG_ON(!list_empty(&groups[i].handle_list));
+	}
+	kfree(groups);
+}
+
 static ssize_t
 raid5_show_stripe_cache_size(mddev_t *mddev, char *page)
 {
@@ -4684,10 +4768,70 @@ stripe_cache_active_show(mddev_t *mddev, char *page)
 static struct md_sysfs_entry
 raid5_stripecache_active = __ATTR_RO(stripe_cache_active);
 
+static ssize_t
+raid5_show_group_thread_cnt(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev->private;
+	if (conf)
+		return sprintf(page, "%d\n", conf->group_cnt);
+	else
+		return 0;
+}
+
+static ssize_t
+raid5_store_group_thread_cnt(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev->private;
+	struct r5worker_group *groups = NULL, *old_groups;
+	unsigned long new;
+	int old_cnt;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (strict_strtoul(page, 10, &new))
+		return -EINVAL;
+	if (new > num_possible_cpus())
+		return -EINVAL;
+	if (new == conf->group_cnt)
+		return len;
+
+	if (new) {
+		groups = alloc_worker_groups(conf, new);
+		if (!groups)
+			return -ENOMEM;
+	}
+
+	/* Once quiesced, no stripe is waiting to be handled */
+	mddev_suspend(mddev);
+
+	spin_lock_irq(&conf->device_lock);
+	old_groups = conf->worker_groups;
+	old_cnt = conf->group_cnt;
+	conf->worker_groups = groups;
+	conf->group_cnt = new;
+	spin_unlock_irq(&conf->device_lock);
+
+	mddev_resume(mddev);
+
+	if (old_groups)
+		free_worker_groups(old_groups, old_cnt);
+
+	return len;
+}
+
+static struct md_sysfs_entry
+raid5_group_thread_cnt = __ATTR(group_thread_cnt, S_IRUGO | S_IWUSR,
+				raid5_show_group_thread_cnt,
+				raid5_store_group_thread_cnt);
+
 static struct attribute *raid5_attrs[] =  {
 	&raid5_stripecache_size.attr,
 	&raid5_stripecache_active.attr,
 	&raid5_preread_bypass_threshold.attr,
+	&raid5_group_thread_cnt.attr,
 	NULL,
 };
 static struct attribute_group raid5_attrs_group = {
@@ -4735,6 +4879,8 @@ static void raid5_free_percpu(raid5_conf_t *conf)
 
 static void free_conf(raid5_conf_t *conf)
 {
+	if (conf->worker_groups)
+		free_worker_groups(conf->worker_groups, conf->group_cnt);
 	shrink_stripes(conf);
 	raid5_free_percpu(conf);
 	kfree(conf->disks);
@@ -6031,6 +6177,9 @@ static struct mdk_personality raid4_personality =
 
 static int __init raid5_init(void)
 {
+	raid5_wq = alloc_workqueue("raid5wq", WQ_UNBOUND | WQ_RESCUER, 0);
+	if (!raid5_wq)
+		return -ENOMEM;
 	register_md_personality(&raid6_personality);
 	register_md_personality(&raid5_personality);
 	register_md_personality(&raid4_personality);
@@ -6042,6 +6191,7 @@ static void raid5_exit(void)
 	unregister_md_personality(&raid6_personality);
 	unregister_md_personality(&raid5_personality);
 	unregister_md_personality(&raid4_personality);
+	destroy_workqueue(raid5_wq);
 }
 
 module_init(raid5_init);
@@ -343,6 +343,17 @@ struct disk_info {
 	mdk_rdev_t	*rdev;
 };
 
+/*
+ * Stripes needing handling may be spread over groups, each handled by a
+ * work item of its own, so that several CPUs handle stripes at once.
+ * A stripe always goes to the group picked by its hash.
+ */
+struct r5worker_group {
+	struct list_head	handle_list; /* stripes needing handling */
+	struct work_struct	work;
+	struct raid5_private_data *conf;
+};
+
 struct raid5_private_data {
 	struct hlist_head	*stripe_hashtbl;
 	mddev_t			*mddev;
@@ -383,6 +394,10 @@ struct raid5_private_data {
 	int			bypass_threshold; /* preread nice */
 	struct list_head	*last_hold; /* detect hold_list promotions */
 
+	/* When group_cnt is 0, raid5d handles all stripes itself */
+	struct r5worker_group	*worker_groups;
+	int			group_cnt;
+
 	atomic_t		reshape_stripes; /* stripes with pending writes for reshape */
 	/* unfortunately we need two cache names as we temporarily have
 	 * two caches.
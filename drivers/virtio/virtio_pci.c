@@ -401,7 +401,7 @@ static struct virtqueue *setup_vq(struct virtio_device *vdev, unsigned index,
 		  vp_dev->ioaddr + VIRTIO_PCI_QUEUE_PFN);
 
 	/* create the vring */
-	vq = vring_new_virtqueue(info->num, VIRTIO_PCI_VRING_ALIGN,
+	vq = vring_new_virtqueue(index, info->num, VIRTIO_PCI_VRING_ALIGN,
 				 vdev, info->queue, vp_notify, callback, name);
 	if (!vq) {
 		err = -ENOMEM;
@@ -475,9 +475,13 @@ static void vp_del_vqs(struct virtio_device *vdev)
 	list_for_each_entry_safe(vq, n, &vdev->vqs, list) {
 		info = vq->priv;
 		if (vp_dev->per_vq_vectors &&
-			info->msix_vector != VIRTIO_MSI_NO_VECTOR)
-			free_irq(vp_dev->msix_entries[info->msix_vector].vector,
-				 vq);
+			info->msix_vector != VIRTIO_MSI_NO_VECTOR) {
+			unsigned irq =
+				vp_dev->msix_entries[info->msix_vector].vector;
+
+			irq_set_affinity_hint(irq, NULL);
+			free_irq(irq, vq);
+		}
 		vp_del_vq(vq);
 	}
 	vp_dev->per_vq_vectors = false;
@@ -581,6 +585,22 @@ static int vp_find_vqs(struct virtio_device *vdev, unsigned nvqs,
 				  false, false);
 }
 
+/* the config->set_vq_affinity() implementation: only a vq with an
+ * interrupt of its own can be steered */
+static int vp_set_vq_affinity(struct virtqueue *vq, int cpu)
+{
+	struct virtio_pci_device *vp_dev = to_vp_device(vq->vdev);
+	struct virtio_pci_vq_info *info = vq->priv;
+	unsigned irq;
+
+	if (!vp_dev->per_vq_vectors ||
+	    info->msix_vector == VIRTIO_MSI_NO_VECTOR)
+		return -EINVAL;
+
+	irq = vp_dev->msix_entries[info->msix_vector].vector;
+	return irq_set_affinity_hint(irq, cpu < 0 ? NULL : cpumask_of(cpu));
+}
+
 static struct virtio_config_ops virtio_pci_config_ops = {
 	.get		= vp_get,
 	.set		= vp_set,
@@ -591,6 +611,7 @@ static struct virtio_config_ops virtio_pci_config_ops = {
 	.del_vqs	= vp_del_vqs,
 	.get_features	= vp_get_features,
 	.finalize_features = vp_finalize_features,
+	.set_vq_affinity = vp_set_vq_affinity,
 };
 
 static void virtio_pci_release_dev(struct device *_d)
@@ -20,6 +20,7 @@
 #include "dedupfs_jbd.h"
 #include <linux/quotaops.h>
 #include <linux/buffer_head.h>
+#include <linux/blkdev.h>
 
 /*
  * balloc.c contains the blocks allocation and deallocation routines
@@ -2095,3 +2096,217 @@ unsigned long dedupfs_bg_num_gdb(struct super_block *sb, int group)
 	return dedupfs_bg_num_gdb_meta(sb,group);
 
 }
+
+/**
+ * dedupfs_trim_all_free() -- discard the free extents of a group
+ * @sb:			superblock for the filesystem
+ * @group:		block group to trim
+ * @start:		first block (group relative) to look at
+ * @max:		block (group relative) to stop at
+ * @minblocks:		minimum length of the extents to discard
+ *
+ * Each free extent is claimed in the bitmap while it is discarded, so
+ * that nobody allocates it meanwhile, and freed again afterwards.
+ * Blocks freed by a transaction which hasn't committed yet are not
+ * free as far as we are concerned, just as for the allocator.
+ *
+ * Returns the number of blocks discarded, or an error.
+ */
+static dedupfs_grpblk_t dedupfs_trim_all_free(struct super_block *sb,
+					unsigned int group,
+					dedupfs_grpblk_t start, dedupfs_grpblk_t max,
+					dedupfs_grpblk_t minblocks)
+{
+	handle_t *handle;
+	dedupfs_grpblk_t next, bit, freed, count = 0;
+	dedupfsblk_t discard_block;
+	struct dedupfs_sb_info *sbi = DEDUPFS_SB(sb);
+	struct buffer_head *gdp_bh, *bitmap_bh = NULL;
+	struct dedupfs_group_desc *gdp;
+	int err = 0, ret;
+
+	/* We will update one block bitmap, and one group descriptor */
+	handle = dedupfs_journal_start_sb(sb, 2);
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	bitmap_bh = read_block_bitmap(sb, group);
+	if (!bitmap_bh) {
+		err = -EIO;
+		goto err_out;
+	}
+
+	BUFFER_TRACE(bitmap_bh, "getting undo access");
+	err = dedupfs_journal_get_undo_access(handle, bitmap_bh);
+	if (err)
+		goto err_out;
+
+	gdp = dedupfs_get_group_desc(sb, group, &gdp_bh);
+	if (!gdp) {
+		err = -EIO;
+		goto err_out;
+	}
+
+	BUFFER_TRACE(gdp_bh, "get_write_access");
+	err = dedupfs_journal_get_write_access(handle, gdp_bh);
+	if (err)
+		goto err_out;
+
+	while (start < max) {
+		start = bitmap_search_next_usable_block(start, bitmap_bh, max);
+		if (start < 0)
+			break;
+
+		/* Leave extents too short to be worth discarding alone */
+		next = start + 1;
+		while (next < max && dedupfs_test_allocatable(next, bitmap_bh))
+			next++;
+		if (next - start < minblocks) {
+			start = next;
+			continue;
+		}
+
+		/* Claim the extent, which may have shrunk meanwhile */
+		for (bit = start; bit < next; bit++)
+			if (!claim_block(sb_bgl_lock(sbi, group), bit,
+					 bitmap_bh))
+				break;
+		next = bit;
+		if (next == start) {
+			start++;
+			continue;
+		}
+
+		spin_lock(sb_bgl_lock(sbi, group));
+		le16_add_cpu(&gdp->bg_free_blocks_count, start - next);
+		spin_unlock(sb_bgl_lock(sbi, group));
+		percpu_counter_sub(&sbi->s_freeblocks_counter, next - start);
+
+		discard_block = start + dedupfs_group_first_block_no(sb, group);
+		err = sb_issue_discard(sb, discard_block, next - start);
+		if (!err)
+			count += next - start;
+
+		freed = 0;
+		for (bit = start; bit < next; bit++) {
+			BUFFER_TRACE(bitmap_bh, "clear bit");
+			if (!dedupfs_clear_bit_atomic(sb_bgl_lock(sbi, group),
+						   bit, bitmap_bh->b_data)) {
+				dedupfs_error(sb, __func__,
+					   "bit already cleared for block "E3FSBLK,
+					   discard_block + bit - start);
+				BUFFER_TRACE(bitmap_bh, "bit already cleared");
+			} else
+				freed++;
+		}
+
+		spin_lock(sb_bgl_lock(sbi, group));
+		le16_add_cpu(&gdp->bg_free_blocks_count, freed);
+		spin_unlock(sb_bgl_lock(sbi, group));
+		percpu_counter_add(&sbi->s_freeblocks_counter, freed);
+
+		start = next;
+		if (err)
+			break;
+
+		if (fatal_signal_pending(current)) {
+			err = -ERESTARTSYS;
+			break;
+		}
+
+		cond_resched();
+	}
+
+	/* We dirtied the bitmap block */
+	BUFFER_TRACE(bitmap_bh, "dirtied bitmap block");
+	ret = dedupfs_journal_dirty_metadata(handle, bitmap_bh);
+	if (!err)
+		err = ret;
+
+	/* And the group descriptor block */
+	BUFFER_TRACE(gdp_bh, "dirtied group descriptor block");
+	ret = dedupfs_journal_dirty_metadata(handle, gdp_bh);
+	if (!err)
+		err = ret;
+
+	dedupfs_debug("trimmed %d blocks in group %u\n", count, group);
+
+err_out:
+	dedupfs_journal_stop(handle);
+	brelse(bitmap_bh);
+
+	return err ? err : count;
+}
+
+/**
+ * dedupfs_trim_fs() -- discard the free space of a range of the filesystem
+ * @sb:			superblock for the filesystem
+ * @range:		byte range to trim, and minimum length of a free extent
+ *
+ * Discards every free extent of at least range->minlen bytes in the
+ * range, so that slow discards can be batched, instead of being issued
+ * as blocks are freed.  On return range->len holds the number of bytes
+ * discarded.
+ */
+int dedupfs_trim_fs(struct super_block *sb, struct fstrim_range *range)
+{
+	struct dedupfs_super_block *es = DEDUPFS_SB(sb)->s_es;
+	dedupfsblk_t first_data_block = le32_to_cpu(es->s_first_data_block);
+	dedupfsblk_t blocks_count = le32_to_cpu(es->s_blocks_count);
+	dedupfsblk_t start, end;
+	dedupfs_grpblk_t first_block, last_block, minlen, cnt;
+	unsigned long group, first_group, last_group;
+	struct dedupfs_group_desc *gdp;
+	uint64_t trimmed = 0;
+	int ret = 0;
+
+	if (!blk_queue_discard(bdev_get_queue(sb->s_bdev)))
+		return -EOPNOTSUPP;
+
+	if (range->minlen >> sb->s_blocksize_bits > DEDUPFS_BLOCKS_PER_GROUP(sb))
+		return -EINVAL;
+	minlen = range->minlen >> sb->s_blocksize_bits;
+
+	if (range->start >> sb->s_blocksize_bits >= blocks_count) {
+		range->len = 0;
+		return 0;
+	}
+	start = range->start >> sb->s_blocksize_bits;
+	end = blocks_count;
+	if (range->len >> sb->s_blocksize_bits < end - start)
+		end = start + (range->len >> sb->s_blocksize_bits);
+	if (start < first_data_block)
+		start = first_data_block;
+	if (start >= end) {
+		range->len = 0;
+		return 0;
+	}
+
+	first_group = (start - first_data_block) / DEDUPFS_BLOCKS_PER_GROUP(sb);
+	first_block = (start - first_data_block) % DEDUPFS_BLOCKS_PER_GROUP(sb);
+	last_group = (end - 1 - first_data_block) / DEDUPFS_BLOCKS_PER_GROUP(sb);
+	last_block = (end - 1 - first_data_block) % DEDUPFS_BLOCKS_PER_GROUP(sb);
+
+	for (group = first_group; group <= last_group; group++) {
+		gdp = dedupfs_get_group_desc(sb, group, NULL);
+		if (!gdp) {
+			ret = -EIO;
+			break;
+		}
+
+		if (le16_to_cpu(gdp->bg_free_blocks_count) >= minlen) {
+			cnt = dedupfs_trim_all_free(sb, group, first_block,
+					group == last_group ? last_block + 1 :
+					DEDUPFS_BLOCKS_PER_GROUP(sb), minlen);
+			if (cnt < 0) {
+				ret = cnt;
+				break;
+			}
+			trimmed += cnt;
+		}
+		first_block = 0;
+	}
+	range->len = trimmed << sb->s_blocksize_bits;
+
+	return ret;
+}
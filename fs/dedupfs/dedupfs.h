@@ -864,6 +864,7 @@ extern struct dedupfs_group_desc * dedupfs_get_group_desc(struct super_block * s
 extern int dedupfs_should_retry_alloc(struct super_block *sb, int *retries);
 extern void dedupfs_init_block_alloc_info(struct inode *);
 extern void dedupfs_rsv_window_add(struct super_block *sb, struct dedupfs_reserve_window_node *rsv);
+extern int dedupfs_trim_fs(struct super_block *sb, struct fstrim_range *range);
 
 /* dir.c */
 extern int dedupfs_check_dir_entry(const char *, struct inode *,
@@ -786,6 +786,7 @@ static const struct super_operations dedupfs_sops = {
 	.quota_write	= dedupfs_quota_write,
 #endif
 	.bdev_try_to_free_page = bdev_try_to_free_page,
+	.trim_fs	= dedupfs_trim_fs,
 };
 
 static const struct export_operations dedupfs_export_ops = {
@@ -105,6 +105,8 @@ struct dio {
 	unsigned long refcount;		/* direct_io_worker() and bios */
 	struct bio *bio_list;		/* singly linked via bi_private */
 	struct task_struct *waiter;	/* waiting task (NULL if none) */
+	struct request_queue *poll_queue; /* poll it rather than sleep */
+	ktime_t poll_issued;		/* when the last bio was submitted */
 
 	/* AIO related stuff */
 	struct kiocb *iocb;		/* kiocb */
@@ -366,6 +368,15 @@ static void dio_bio_submit(struct dio *dio)
 	if (dio->is_async && dio->rw == READ)
 		bio_set_pages_dirty(bio);
 
+	if (!dio->is_async && dio->rw == READ) {
+		struct request_queue *q = bdev_get_queue(bio->bi_bdev);
+
+		if (blk_queue_poll(q)) {
+			dio->poll_queue = q;
+			dio->poll_issued = ktime_get();
+		}
+	}
+
 	if (dio->submit_io)
 		dio->submit_io(dio->rw, bio, dio->inode,
 			       dio->logical_offset_in_bio);
@@ -409,8 +420,10 @@ static struct bio *dio_await_one(struct dio *dio)
 		__set_current_state(TASK_UNINTERRUPTIBLE);
 		dio->waiter = current;
 		spin_unlock_irqrestore(&dio->bio_lock, flags);
-		io_schedule();
-		/* wake up sets us TASK_RUNNING */
+		if (!dio->poll_queue ||
+		    !blk_poll(dio->poll_queue, dio->poll_issued))
+			io_schedule();
+		/* wake up, or blk_poll() returning true, sets us TASK_RUNNING */
 		spin_lock_irqsave(&dio->bio_lock, flags);
 		dio->waiter = NULL;
 	}
@@ -987,6 +1000,7 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 {
 	unsigned long user_addr; 
 	unsigned long flags;
+	struct blk_plug plug;
 	int seg;
 	ssize_t ret = 0;
 	ssize_t ret2;
@@ -1024,6 +1038,8 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 				- user_addr/PAGE_SIZE);
 	}
 
+	blk_start_plug(&plug);
+
 	for (seg = 0; seg < nr_segs; seg++) {
 		user_addr = (unsigned long)iov[seg].iov_base;
 		dio->size += bytes = iov[seg].iov_len;
@@ -1080,6 +1096,8 @@ direct_io_worker(int rw, struct kiocb *iocb, struct inode *inode,
 	if (dio->bio)
 		dio_bio_submit(dio);
 
+	blk_finish_plug(&plug);
+
 	/*
 	 * It is possible that, we return short IO due to end of file.
 	 * In that case, we need to release all the pages we got hold on.
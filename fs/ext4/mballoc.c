@@ -2557,7 +2557,7 @@ int ext4_mb_release(struct super_block *sb)
 	return 0;
 }
 
-static inline void ext4_issue_discard(struct super_block *sb,
+static inline int ext4_issue_discard(struct super_block *sb,
 		ext4_group_t block_group, ext4_grpblk_t block, int count)
 {
 	int ret;
@@ -2571,6 +2571,7 @@ static inline void ext4_issue_discard(struct super_block *sb,
 		ext4_warning(sb, "discard not supported, disabling");
 		clear_opt(EXT4_SB(sb)->s_mount_opt, DISCARD);
 	}
+	return ret;
 }
 
 /*
@@ -4689,3 +4690,155 @@ error_return:
 		kmem_cache_free(ext4_ac_cachep, ac);
 	return;
 }
+
+/*
+ * Discard the free extent start..start+count-1 of the group.  It is
+ * marked used in the buddy meanwhile, so that nobody allocates it while
+ * the group lock is dropped for the discard.  Called, and returns, with
+ * the group locked.
+ */
+static int ext4_trim_extent(struct super_block *sb, int start, int count,
+			    ext4_group_t group, struct ext4_buddy *e4b)
+{
+	struct ext4_free_extent ex;
+	int ret;
+
+	assert_spin_locked(ext4_group_lock_ptr(sb, group));
+
+	ex.fe_start = start;
+	ex.fe_group = group;
+	ex.fe_len = count;
+
+	mb_mark_used(e4b, &ex);
+	ext4_unlock_group(sb, group);
+
+	ret = ext4_issue_discard(sb, group, start, count);
+
+	ext4_lock_group(sb, group);
+	mb_free_blocks(NULL, e4b, start, count);
+	return ret;
+}
+
+/*
+ * Discard the free extents of at least minblocks blocks between start
+ * and max in the group.  Returns the number of blocks discarded, or an
+ * error.
+ */
+static ext4_grpblk_t ext4_trim_all_free(struct super_block *sb,
+					struct ext4_buddy *e4b,
+					ext4_grpblk_t start, ext4_grpblk_t max,
+					ext4_grpblk_t minblocks)
+{
+	void *bitmap = e4b->bd_bitmap;
+	ext4_group_t group = e4b->bd_group;
+	ext4_grpblk_t next, count = 0;
+	int ret = 0;
+
+	ext4_lock_group(sb, group);
+	if (start < e4b->bd_info->bb_first_free)
+		start = e4b->bd_info->bb_first_free;
+
+	while (start < max) {
+		start = mb_find_next_zero_bit(bitmap, max, start);
+		if (start >= max)
+			break;
+		next = mb_find_next_bit(bitmap, max, start);
+
+		if (next - start >= minblocks) {
+			ret = ext4_trim_extent(sb, start, next - start,
+					       group, e4b);
+			if (ret < 0)
+				break;
+			count += next - start;
+		}
+		start = next + 1;
+
+		if (fatal_signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+
+		if (need_resched()) {
+			ext4_unlock_group(sb, group);
+			cond_resched();
+			ext4_lock_group(sb, group);
+		}
+
+		if (e4b->bd_info->bb_free < minblocks)
+			break;
+	}
+	ext4_unlock_group(sb, group);
+
+	ext4_debug("trimmed %d blocks in group %u\n", count, group);
+
+	return ret < 0 ? ret : count;
+}
+
+/**
+ * ext4_trim_fs() -- discard the free space of a range of the filesystem
+ * @sb:		superblock of the filesystem
+ * @range:	byte range to trim, and minimum length of a free extent
+ *
+ * Walks the buddy of each group in the range and discards every free
+ * extent of at least range->minlen bytes, so that slow discards can be
+ * batched, instead of being issued as blocks are freed.  On return
+ * range->len holds the number of bytes discarded.
+ */
+int ext4_trim_fs(struct super_block *sb, struct fstrim_range *range)
+{
+	struct ext4_buddy e4b;
+	struct ext4_super_block *es = EXT4_SB(sb)->s_es;
+	ext4_group_t group, first_group, last_group;
+	ext4_grpblk_t first_block, last_block, cnt;
+	ext4_fsblk_t start, end, blocks_count = ext4_blocks_count(es);
+	ext4_grpblk_t minlen;
+	uint64_t trimmed = 0;
+	int ret = 0;
+
+	if (!blk_queue_discard(bdev_get_queue(sb->s_bdev)))
+		return -EOPNOTSUPP;
+
+	if (range->minlen >> sb->s_blocksize_bits > EXT4_BLOCKS_PER_GROUP(sb))
+		return -EINVAL;
+	minlen = range->minlen >> sb->s_blocksize_bits;
+
+	start = range->start >> sb->s_blocksize_bits;
+	end = start + (range->len >> sb->s_blocksize_bits);
+	if (end < start || end > blocks_count)
+		end = blocks_count;
+	if (start < le32_to_cpu(es->s_first_data_block))
+		start = le32_to_cpu(es->s_first_data_block);
+	if (start >= end) {
+		range->len = 0;
+		return 0;
+	}
+
+	ext4_get_group_no_and_offset(sb, start, &first_group, &first_block);
+	ext4_get_group_no_and_offset(sb, end - 1, &last_group, &last_block);
+
+	for (group = first_group; group <= last_group; group++) {
+		ret = ext4_mb_load_buddy(sb, group, &e4b);
+		if (ret) {
+			ext4_error(sb, "Error in loading buddy "
+				   "information for %u", group);
+			break;
+		}
+
+		cnt = 0;
+		if (e4b.bd_info->bb_free >= minlen)
+			cnt = ext4_trim_all_free(sb, &e4b, first_block,
+					group == last_group ? last_block + 1 :
+					EXT4_BLOCKS_PER_GROUP(sb), minlen);
+		ext4_mb_unload_buddy(&e4b);
+
+		if (cnt < 0) {
+			ret = cnt;
+			break;
+		}
+		trimmed += cnt;
+		first_block = 0;
+	}
+	range->len = trimmed << sb->s_blocksize_bits;
+
+	return ret;
+}
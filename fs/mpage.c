@@ -327,6 +327,27 @@ confused:
 	goto out;
 }
 
+struct mpage_readpages_data {
+	struct bio *bio;
+	unsigned nr_pages;		/* left to read, at most */
+	sector_t last_block_in_bio;
+	struct buffer_head map_bh;
+	unsigned long first_logical_block;
+	get_block_t *get_block;
+};
+
+static int mpage_readpages_filler(void *data, struct page *page)
+{
+	struct mpage_readpages_data *mrd = data;
+
+	prefetchw(&page->flags);
+	mrd->bio = do_mpage_readpage(mrd->bio, page, mrd->nr_pages--,
+				     &mrd->last_block_in_bio, &mrd->map_bh,
+				     &mrd->first_logical_block,
+				     mrd->get_block);
+	return 0;
+}
+
 /**
  * mpage_readpages - populate an address space with some pages & start reads against them
  * @mapping: the address_space
@@ -337,8 +358,8 @@ confused:
  * @nr_pages: The number of pages at *@pages
  * @get_block: The filesystem's block mapper function.
  *
- * This function walks the pages and the blocks within each page, building and
- * emitting large BIOs.
+ * This function adds the pages to the page cache in one batch, then walks the
+ * pages and the blocks within each page, building and emitting large BIOs.
  *
  * If anything unusual happens, such as:
  *
@@ -374,32 +395,16 @@ int
 mpage_readpages(struct address_space *mapping, struct list_head *pages,
 				unsigned nr_pages, get_block_t get_block)
 {
-	struct bio *bio = NULL;
-	unsigned page_idx;
-	sector_t last_block_in_bio = 0;
-	struct buffer_head map_bh;
-	unsigned long first_logical_block = 0;
+	struct mpage_readpages_data mrd = {
+		.nr_pages = nr_pages,
+		.get_block = get_block,
+	};
 
-	map_bh.b_state = 0;
-	map_bh.b_size = 0;
-	for (page_idx = 0; page_idx < nr_pages; page_idx++) {
-		struct page *page = list_entry(pages->prev, struct page, lru);
-
-		prefetchw(&page->flags);
-		list_del(&page->lru);
-		if (!add_to_page_cache_lru(page, mapping,
-					page->index, GFP_KERNEL)) {
-			bio = do_mpage_readpage(bio, page,
-					nr_pages - page_idx,
-					&last_block_in_bio, &map_bh,
-					&first_logical_block,
-					get_block);
-		}
-		page_cache_release(page);
-	}
+	add_to_page_cache_lru_list(pages, mapping, GFP_KERNEL,
+				   mpage_readpages_filler, &mrd);
 	BUG_ON(!list_empty(pages));
-	if (bio)
-		mpage_bio_submit(READ, bio);
+	if (mrd.bio)
+		mpage_bio_submit(READ, mrd.bio);
 	return 0;
 }
 EXPORT_SYMBOL(mpage_readpages);
@@ -692,10 +697,13 @@ mpage_writepages(struct address_space *mapping,
 			.get_block = get_block,
 			.use_writepage = 1,
 		};
+		struct blk_plug plug;
 
+		blk_start_plug(&plug);
 		ret = write_cache_pages(mapping, wbc, __mpage_writepage, &mpd);
 		if (mpd.bio)
 			mpage_bio_submit(WRITE, mpd.bio);
+		blk_finish_plug(&plug);
 	}
 	return ret;
 }
@@ -40,11 +40,19 @@ typedef int (congested_fn)(void *, int);
 enum bdi_stat_item {
 	BDI_RECLAIMABLE,
 	BDI_WRITEBACK,
+	BDI_DIRTIED,
+	BDI_WRITTEN,
 	NR_BDI_STAT_ITEMS
 };
 
 #define BDI_STAT_BATCH (8*(1+ilog2(nr_cpu_ids)))
 
+/* Bandwidth estimates of a bdi are refreshed at most this often */
+#define BANDWIDTH_INTERVAL	max(HZ/5, 1)
+
+/* Write bandwidth a new bdi starts out with: 100 MB/s, in pages */
+#define INIT_BW		(100 << (20 - PAGE_SHIFT))
+
 struct bdi_writeback {
 	struct backing_dev_info *bdi;	/* our parent bdi */
 	unsigned int nr;
@@ -73,6 +81,19 @@ struct backing_dev_info {
 
 	struct percpu_counter bdi_stat[NR_BDI_STAT_ITEMS];
 
+	/*
+	 * Write bandwidth estimation, in pages per second, updated every
+	 * BANDWIDTH_INTERVAL by whoever gets there first.  dirty_ratelimit
+	 * is the rate at which each dirtier is allowed to dirty pages while
+	 * the bdi is at its dirty setpoint.
+	 */
+	unsigned long bw_time_stamp;	/* last time the estimates were updated */
+	unsigned long dirtied_stamp;	/* BDI_DIRTIED at bw_time_stamp */
+	unsigned long written_stamp;	/* BDI_WRITTEN at bw_time_stamp */
+	unsigned long write_bandwidth;	/* the estimated write bandwidth */
+	unsigned long avg_write_bandwidth; /* further smoothed write bw */
+	unsigned long dirty_ratelimit;
+
 	struct prop_local_percpu completions;
 	int dirty_exceeded;
 
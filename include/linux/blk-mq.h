@@ -0,0 +1,145 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+/*
+ * Multi-queue block layer
+ *
+ * A queue set up with blk_mq_init_queue() has no elevator and no
+ * queue_lock on the I/O path.  Bios are turned into requests on the
+ * submitting CPU and added to that CPU's software queue (struct
+ * blk_mq_ctx); the software queues are mapped onto the hardware dispatch
+ * queues of the driver (struct blk_mq_hw_ctx), each with its own tag
+ * space and preallocated requests.  ->queue_rq() is called from process
+ * context, and may be called for several hardware queues, and for the
+ * same hardware queue, on several CPUs at once.
+ *
+ * Requests are completed with blk_mq_end_io(); a driver completing from
+ * its interrupt handler can call blk_mq_complete_request() instead, which
+ * runs ->complete() on the CPU that submitted the request.
+ */
+
+#include <linux/blkdev.h>
+#include <linux/workqueue.h>
+
+struct blk_mq_tags;
+struct blk_mq_ctx;
+
+struct blk_mq_hw_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	dispatch;	/* requests to retry */
+	} ____cacheline_aligned_in_smp;
+
+	unsigned long		state;		/* BLK_MQ_S_* flags */
+	struct work_struct	run_work;
+
+	unsigned long		flags;		/* BLK_MQ_F_* flags */
+
+	struct request_queue	*queue;
+	void			*driver_data;
+
+	/* Software queues mapped to this queue, and which have requests */
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_map;
+
+	struct request		**rqs;		/* indexed by tag */
+	struct blk_mq_tags	*tags;
+
+	unsigned int		queue_num;
+	unsigned int		queue_depth;
+	int			numa_node;
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef struct blk_mq_hw_ctx *(map_queue_fn)(struct request_queue *, const int);
+typedef int (init_hctx_fn)(struct blk_mq_hw_ctx *, void *, unsigned int);
+typedef void (exit_hctx_fn)(struct blk_mq_hw_ctx *, unsigned int);
+typedef int (poll_fn)(struct blk_mq_hw_ctx *);
+
+struct blk_mq_ops {
+	/* Start a request, returns a BLK_MQ_RQ_QUEUE_* value */
+	queue_rq_fn		*queue_rq;
+
+	/* Hardware queue of a CPU, usually blk_mq_map_queue */
+	map_queue_fn		*map_queue;
+
+	/* Called by blk_mq_complete_request() on the submitting CPU */
+	softirq_done_fn		*complete;
+
+	/* Set up and tear down the driver's part of a hardware queue */
+	init_hctx_fn		*init_hctx;
+	exit_hctx_fn		*exit_hctx;
+
+	/*
+	 * Reap the completion queue of a hardware queue without waiting
+	 * for an interrupt, ending what has completed.  Returns the number
+	 * of requests found, or < 0 if the queue can't be polled right
+	 * now.  Optional; needed for the io_poll queue attribute.
+	 */
+	poll_fn			*poll;
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* requests per hardware queue */
+	unsigned int		cmd_size;	/* driver data after each request */
+	int			numa_node;
+	unsigned int		flags;		/* BLK_MQ_F_* */
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* queued fine */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* requeue, the queue was stopped */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* end the request with an error */
+
+	BLK_MQ_F_SHOULD_MERGE	= 1 << 0,
+
+	BLK_MQ_S_STOPPED	= 0,
+
+	BLK_MQ_MAX_DEPTH	= 2048,
+};
+
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *, void *);
+void blk_mq_free_queue(struct request_queue *);
+
+void blk_mq_insert_request(struct request_queue *, struct request *,
+			   bool at_head, bool run_queue);
+void blk_mq_run_queues(struct request_queue *q, bool async);
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async);
+void blk_mq_free_request(struct request *rq);
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp);
+
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *, const int cpu);
+
+void blk_mq_end_io(struct request *rq, int error);
+void blk_mq_complete_request(struct request *rq);
+
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx);
+void blk_mq_start_stopped_hw_queues(struct request_queue *q, bool async);
+
+/*
+ * Driver command data is immediately after the request, so subtract
+ * the request size to get back to the original request.
+ */
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return (void *) rq + sizeof(*rq);
+}
+
+static inline struct request *blk_mq_rq_from_pdu(void *pdu)
+{
+	return pdu - sizeof(struct request);
+}
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ({ hctx = (q)->queue_hw_ctx[i]; 1; }); (i)++)
+
+#define hctx_for_each_ctx(hctx, ctx, i)					\
+	for ((i) = 0; (i) < (hctx)->nr_ctx &&				\
+	     ({ ctx = (hctx)->ctxs[(i)]; 1; }); (i)++)
+
+#endif
@@ -28,8 +28,12 @@ struct request_queue;
 struct elevator_queue;
 struct request_pm_state;
 struct blk_trace;
+struct throtl_data;
 struct request;
 struct sg_io_hdr;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -81,6 +85,7 @@ struct request {
 	struct call_single_data csd;
 
 	struct request_queue *q;
+	struct blk_mq_ctx *mq_ctx;
 
 	unsigned int cmd_flags;
 	enum rq_cmd_type_bits cmd_type;
@@ -120,6 +125,7 @@ struct request {
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    /* when passed to hardware */
 #endif
+	u64 poll_issue_ns;		/* passed to a polled mq driver */
 	/* Number of scatter-gather DMA addr+len pairs after
 	 * physical address coalescing is performed.
 	 */
@@ -275,6 +281,32 @@ struct request_queue
 	dma_drain_needed_fn	*dma_drain_needed;
 	lld_busy_fn		*lld_busy_fn;
 
+	/*
+	 * Multi-queue state, see include/linux/blk-mq.h
+	 */
+	struct blk_mq_ops	*mq_ops;
+	unsigned int		*mq_map;	/* cpu to hardware queue */
+	struct blk_mq_ctx __percpu *queue_ctx;
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
+
+	/*
+	 * Completion polling, see blk_poll().  poll_mean_ns is a moving
+	 * average of the service time of polled requests, updated without
+	 * a lock.
+	 */
+	int			poll_delay;	/* -1 spin, 0 adaptive, else usecs */
+	unsigned long		poll_mean_ns;
+	unsigned long		poll_invoked;
+	unsigned long		poll_found;
+	unsigned long		poll_slept;
+	unsigned long		poll_timeouts;
+
+#ifdef CONFIG_BLK_DEV_THROTTLING
+	/* Throttle data */
+	struct throtl_data	*td;
+#endif
+
 	/*
 	 * Dispatch queue sorting
 	 */
@@ -390,6 +422,7 @@ struct request_queue
 #define QUEUE_FLAG_NOXMERGES   17	/* No extended merges */
 #define QUEUE_FLAG_ADD_RANDOM  18	/* Contributes to random pool */
 #define QUEUE_FLAG_SECDISCARD  19	/* supports SECDISCARD */
+#define QUEUE_FLAG_POLL        20	/* sync reads poll for completion */
 
 #define QUEUE_FLAG_DEFAULT	((1 << QUEUE_FLAG_IO_STAT) |		\
 				 (1 << QUEUE_FLAG_CLUSTER) |		\
@@ -527,6 +560,7 @@ enum {
 #define blk_queue_discard(q)	test_bit(QUEUE_FLAG_DISCARD, &(q)->queue_flags)
 #define blk_queue_secdiscard(q)	(blk_queue_discard(q) && \
 	test_bit(QUEUE_FLAG_SECDISCARD, &(q)->queue_flags))
+#define blk_queue_poll(q)	test_bit(QUEUE_FLAG_POLL, &(q)->queue_flags)
 
 #define blk_noretry_request(rq) \
 	((rq)->cmd_flags & (REQ_FAILFAST_DEV|REQ_FAILFAST_TRANSPORT| \
@@ -751,6 +785,37 @@ extern int blk_execute_rq(struct request_queue *, struct gendisk *,
 extern void blk_execute_rq_nowait(struct request_queue *, struct gendisk *,
 				  struct request *, int, rq_end_io_fn *);
 extern void blk_unplug(struct request_queue *q);
+extern bool blk_poll(struct request_queue *q, ktime_t issued);
+
+/*
+ * blk_plug gathers the requests a task submits between blk_start_plug()
+ * and blk_finish_plug() on a private list, and adds them to their queues
+ * in one go when the plug is finished or the task goes to sleep.  Plugs
+ * live on the stack of the task; nested plugs are left to the outermost.
+ */
+struct blk_plug {
+	struct list_head list;
+	unsigned int should_sort;	/* requests of several queues */
+};
+
+extern void blk_start_plug(struct blk_plug *);
+extern void blk_finish_plug(struct blk_plug *);
+extern void blk_flush_plug_list(struct blk_plug *);
+
+static inline void blk_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	if (plug)
+		blk_flush_plug_list(plug);
+}
+
+static inline bool blk_needs_flush_plug(struct task_struct *tsk)
+{
+	struct blk_plug *plug = tsk->plug;
+
+	return plug && !list_empty(&plug->list);
+}
 
 static inline struct request_queue *bdev_get_queue(struct block_device *bdev)
 {
@@ -1126,7 +1191,11 @@ static inline void put_dev_sector(Sector p)
 }
 
 struct work_struct;
+struct delayed_work;
 int kblockd_schedule_work(struct request_queue *q, struct work_struct *work);
+int kblockd_schedule_delayed_work(struct request_queue *q,
+				  struct delayed_work *dwork,
+				  unsigned long delay);
 
 #ifdef CONFIG_BLK_CGROUP
 /*
@@ -1277,6 +1346,28 @@ static inline long nr_blockdev_pages(void)
 	return 0;
 }
 
+struct task_struct;
+
+struct blk_plug {
+};
+
+static inline void blk_start_plug(struct blk_plug *plug)
+{
+}
+
+static inline void blk_finish_plug(struct blk_plug *plug)
+{
+}
+
+static inline void blk_flush_plug(struct task_struct *tsk)
+{
+}
+
+static inline bool blk_needs_flush_plug(struct task_struct *tsk)
+{
+	return false;
+}
+
 #endif /* CONFIG_BLOCK */
 
 #endif
@@ -0,0 +1,87 @@
+/*
+ * Dynamic queue limits (dql) - Definitions
+ *
+ * Dynamic queue limits bound the number of objects (e.g. bytes) queued
+ * to a consumer which completes them in batches, typically a network
+ * device transmit ring.  The limit is adjusted on every completion so
+ * that just enough objects are in flight to keep the consumer busy:
+ *
+ * - When the queue was over its limit during the last completion
+ *   interval and then ran empty (or could have), the consumer was
+ *   starved and the limit is raised.
+ * - When the queue stayed busy, the unused excess over the limit
+ *   ("slack") is tracked, and the limit is lowered by the smallest
+ *   slack seen over a hold time.
+ *
+ * Usage: the producer calls dql_queued() for the objects it hands to the
+ * consumer and stops when dql_avail() goes negative; the completion path
+ * calls dql_completed() and restarts the producer when dql_avail() is
+ * non-negative again.  Neither side takes a lock, so the producer and the
+ * completer must each be serialized by their callers.
+ */
+#ifndef _LKML_DQL_H
+#define _LKML_DQL_H
+
+#ifdef __KERNEL__
+
+#include <linux/cache.h>
+#include <linux/kernel.h>
+
+struct dql {
+	/* Fields accessed in enqueue path (dql_queued) */
+	unsigned int	num_queued;		/* Total ever queued */
+	unsigned int	adj_limit;		/* limit + num_completed */
+	unsigned int	last_obj_cnt;		/* Count at last queuing */
+
+	/* Fields accessed only by completion path (dql_completed) */
+
+	unsigned int	limit ____cacheline_aligned_in_smp; /* Current limit */
+	unsigned int	num_completed;		/* Total ever completed */
+
+	unsigned int	prev_ovlimit;		/* Previous over limit */
+	unsigned int	prev_num_queued;	/* Previous queue total */
+	unsigned int	prev_last_obj_cnt;	/* Previous queuing cnt */
+
+	unsigned int	lowest_slack;		/* Lowest slack found */
+	unsigned long	slack_start_time;	/* Time slacks seen */
+
+	/* Configuration */
+	unsigned int	max_limit;		/* Max limit */
+	unsigned int	min_limit;		/* Minimum limit */
+	unsigned int	slack_hold_time;	/* Time to measure slack */
+};
+
+/* Set some static maximums */
+#define DQL_MAX_OBJECT (UINT_MAX / 16)
+#define DQL_MAX_LIMIT ((UINT_MAX / 2) - DQL_MAX_OBJECT)
+
+/*
+ * Record number of objects queued. Assumes that caller has already checked
+ * availability in the queue with dql_avail.
+ */
+static inline void dql_queued(struct dql *dql, unsigned int count)
+{
+	BUG_ON(count > DQL_MAX_OBJECT);
+
+	dql->num_queued += count;
+	dql->last_obj_cnt = count;
+}
+
+/* Returns how many objects can be queued, < 0 indicates over limit. */
+static inline int dql_avail(const struct dql *dql)
+{
+	return ACCESS_ONCE(dql->adj_limit) - ACCESS_ONCE(dql->num_queued);
+}
+
+/* Record number of completed objects and recalculate the limit. */
+extern void dql_completed(struct dql *dql, unsigned int count);
+
+/* Reset dql state */
+extern void dql_reset(struct dql *dql);
+
+/* Initialize dql state */
+extern int dql_init(struct dql *dql, unsigned hold_time);
+
+#endif /* __KERNEL__ */
+
+#endif /* _LKML_DQL_H */
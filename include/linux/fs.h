@@ -311,11 +311,23 @@ struct inodes_stat_t {
 #define BLKDISCARDZEROES _IO(0x12,124)
 #define BLKSECDISCARD _IO(0x12,125)
 
+/*
+ * Argument of FITRIM: discard the free space between start and
+ * start + len (in bytes), in free extents of at least minlen bytes.
+ * On return len holds the number of bytes discarded.
+ */
+struct fstrim_range {
+	__u64 start;
+	__u64 len;
+	__u64 minlen;
+};
+
 #define BMAP_IOCTL 1		/* obsolete - kept for compatibility */
 #define FIBMAP	   _IO(0x00,1)	/* bmap access */
 #define FIGETBSZ   _IO(0x00,2)	/* get the block size used for bmap */
 #define FIFREEZE	_IOWR('X', 119, int)	/* Freeze */
 #define FITHAW		_IOWR('X', 120, int)	/* Thaw */
+#define FITRIM		_IOWR('X', 121, struct fstrim_range)	/* Trim */
 
 #define	FS_IOC_GETFLAGS			_IOR('f', 1, long)
 #define	FS_IOC_SETFLAGS			_IOW('f', 2, long)
@@ -881,8 +893,19 @@ struct fown_struct {
 };
 
 /*
- * Track a single file's readahead state
+ * Readahead state of a stream that is not the most recently used one on
+ * this file, see ra_select_stream() in mm/readahead.c.
  */
+struct file_ra_stream {
+	pgoff_t start;
+	unsigned int size;
+	unsigned int async_size;
+	loff_t prev_pos;
+	unsigned long stride;
+};
+
+#define RA_SAVED_STREAMS	3
+
 struct file_ra_state {
 	pgoff_t start;			/* where readahead started */
 	unsigned int size;		/* # of readahead pages */
@@ -892,10 +915,15 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+	unsigned long stride;		/* Gap between strided reads, in pages */
+	unsigned int ra_scale;		/* Window scale for slow devices */
+
+	/* Other concurrent streams on the file, most recently used first */
+	struct file_ra_stream streams[RA_SAVED_STREAMS];
 };
 
 /*
- * Check if @index falls in the readahead windows.
+ * Check if @index falls in the current stream's readahead window.
  */
 static inline int ra_has_index(struct file_ra_state *ra, pgoff_t index)
 {
@@ -1581,6 +1609,7 @@ struct super_operations {
 	ssize_t (*quota_write)(struct super_block *, int, const char *, size_t, loff_t);
 #endif
 	int (*bdev_try_to_free_page)(struct super_block*, struct page*, gfp_t);
+	int (*trim_fs)(struct super_block *, struct fstrim_range *);
 };
 
 /*
@@ -55,6 +55,12 @@ struct tpacket_stats {
 	unsigned int	tp_drops;
 };
 
+struct tpacket_stats_v3 {
+	unsigned int	tp_packets;
+	unsigned int	tp_drops;
+	unsigned int	tp_freeze_q_cnt;
+};
+
 struct tpacket_auxdata {
 	__u32		tp_status;
 	__u32		tp_len;
@@ -70,6 +76,7 @@ struct tpacket_auxdata {
 #define TP_STATUS_COPY		0x2
 #define TP_STATUS_LOSING	0x4
 #define TP_STATUS_CSUMNOTREADY	0x8
+#define TP_STATUS_BLK_TMO	0x10	/* V3 block retired by timeout */
 
 /* Tx ring - header status */
 #define TP_STATUS_AVAILABLE	0x0
@@ -104,9 +111,66 @@ struct tpacket2_hdr {
 
 #define TPACKET2_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket2_hdr)) + sizeof(struct sockaddr_ll))
 
+struct tpacket_hdr_variant1 {
+	__u32	tp_rxhash;
+	__u32	tp_vlan_tci;
+};
+
+struct tpacket3_hdr {
+	__u32		tp_next_offset;	/* from this header, 0 for the last one */
+	__u32		tp_sec;
+	__u32		tp_nsec;
+	__u32		tp_snaplen;
+	__u32		tp_len;
+	__u32		tp_status;
+	__u16		tp_mac;
+	__u16		tp_net;
+	struct tpacket_hdr_variant1 hv1;
+};
+
+#define TPACKET3_HDRLEN		(TPACKET_ALIGN(sizeof(struct tpacket3_hdr)) + sizeof(struct sockaddr_ll))
+
+struct tpacket_bd_ts {
+	unsigned int	ts_sec;
+	unsigned int	ts_nsec;
+};
+
+struct tpacket_hdr_v1 {
+	__u32		block_status;
+	__u32		num_pkts;
+	__u32		offset_to_first_pkt;
+
+	/* Number of valid bytes (including padding) in the block */
+	__u32		blk_len;
+
+	/*
+	 * Incremented for every block handed to user space, so that an
+	 * application can tell whether it missed one.
+	 */
+	__aligned_u64	seq_num;
+
+	/*
+	 * ts_first_pkt is the time the block was opened, ts_last_pkt the
+	 * timestamp of the last packet (or the retire time of an empty
+	 * block).
+	 */
+	struct tpacket_bd_ts	ts_first_pkt, ts_last_pkt;
+};
+
+union tpacket_bd_header_u {
+	struct tpacket_hdr_v1 bh1;
+};
+
+struct tpacket_block_desc {
+	__u32 version;
+	__u32 offset_to_priv;
+	union tpacket_bd_header_u hdr;
+};
+
 enum tpacket_versions {
 	TPACKET_V1,
 	TPACKET_V2,
+	TPACKET_V3,
 };
 
 /*
@@ -122,6 +186,22 @@ enum tpacket_versions {
    - Pad to align to TPACKET_ALIGNMENT=16
  */
 
+/*
+   TPACKET_V3 block structure (rx ring only):
+
+   - struct tpacket_block_desc, at the start of every tp_block_size block
+   - tp_sizeof_priv bytes private to the application, at offset_to_priv
+   - packets, back to back from offset_to_first_pkt, each one a
+     struct tpacket3_hdr followed by struct sockaddr_ll and the data as
+     for the frames above, and aligned to 8 bytes. tp_next_offset
+     leads from one to the next.
+
+   A block is handed to user space (block_status TP_STATUS_USER) when
+   it is full, or when tp_retire_blk_tov milliseconds passed since it
+   was opened (TP_STATUS_BLK_TMO). User space gives it back by setting
+   block_status to TP_STATUS_KERNEL.
+ */
+
 struct tpacket_req {
 	unsigned int	tp_block_size;	/* Minimal size of contiguous block */
 	unsigned int	tp_block_nr;	/* Number of blocks */
@@ -129,6 +209,24 @@ struct tpacket_req {
 	unsigned int	tp_frame_nr;	/* Total number of frames */
 };
 
+struct tpacket_req3 {
+	unsigned int	tp_block_size;	/* Minimal size of contiguous block */
+	unsigned int	tp_block_nr;	/* Number of blocks */
+	unsigned int	tp_frame_size;	/* Size of frame */
+	unsigned int	tp_frame_nr;	/* Total number of frames */
+	unsigned int	tp_retire_blk_tov; /* timeout in msecs, 0: default */
+	unsigned int	tp_sizeof_priv; /* size of the private area */
+	unsigned int	tp_feature_req_word;
+};
+
+/* tp_feature_req_word */
+#define TP_FT_REQ_FILL_RXHASH	0x1
+
+union tpacket_req_u {
+	struct tpacket_req	req;
+	struct tpacket_req3	req3;
+};
+
 struct packet_mreq {
 	int		mr_ifindex;
 	unsigned short	mr_type;
@@ -310,6 +310,12 @@ struct mm_struct {
 #ifdef CONFIG_MMU_NOTIFIER
 	struct mmu_notifier_mm *mmu_notifier_mm;
 #endif
+#ifdef CONFIG_NUMA_BALANCING
+	/* jiffies after which the next NUMA hinting scan may run */
+	unsigned long numa_next_scan;
+	/* Address the next NUMA hinting scan starts at */
+	unsigned long numa_scan_offset;
+#endif
 };
 
 /* Future-safe accessor for struct mm_struct's cpu_vm_mask. */
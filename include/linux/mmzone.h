@@ -166,15 +166,42 @@ enum zone_watermarks {
 #define low_wmark_pages(z) (z->watermark[WMARK_LOW])
 #define high_wmark_pages(z) (z->watermark[WMARK_HIGH])
 
+/*
+ * Orders up to PAGE_ALLOC_PCP_MAX_ORDER are cached on the per-cpu lists so
+ * that small high-order allocations (kernel stacks, slab pages, skbs) do
+ * not take zone->lock. There is one list per migrate type for every order.
+ */
+#define PAGE_ALLOC_PCP_MAX_ORDER	PAGE_ALLOC_COSTLY_ORDER
+#define NR_PCP_LISTS	(MIGRATE_PCPTYPES * (PAGE_ALLOC_PCP_MAX_ORDER + 1))
+
+/*
+ * The batch used to refill or drain the per-cpu lists is scaled by up to
+ * 1 << PCP_BATCH_SCALE_MAX while a CPU keeps allocating (or freeing) without
+ * the opposite operation in between, and decays again when it does not.
+ */
+#define PCP_BATCH_SCALE_MAX	5
+
 struct per_cpu_pages {
-	int count;		/* number of pages in the list */
+	int count;		/* number of base pages in the lists */
 	int high;		/* high watermark, emptying needed */
 	int batch;		/* chunk size for buddy add/remove */
+	u8 alloc_factor;	/* refill batch scale, see PCP_BATCH_SCALE_MAX */
+	u8 free_factor;		/* drain batch scale */
 
-	/* Lists of pages, one per migrate type stored on the pcp-lists */
-	struct list_head lists[MIGRATE_PCPTYPES];
+	/* Lists of pages, one per migrate type and order on the pcp-lists */
+	struct list_head lists[NR_PCP_LISTS];
 };
 
+static inline unsigned int order_to_pindex(int migratetype, unsigned int order)
+{
+	return order * MIGRATE_PCPTYPES + migratetype;
+}
+
+static inline unsigned int pindex_to_order(unsigned int pindex)
+{
+	return pindex / MIGRATE_PCPTYPES;
+}
+
 struct per_cpu_pageset {
 	struct per_cpu_pages pcp;
 #ifdef CONFIG_NUMA
@@ -635,6 +662,12 @@ typedef struct pglist_data {
 	wait_queue_head_t kswapd_wait;
 	struct task_struct *kswapd;
 	int kswapd_max_order;
+#ifdef CONFIG_COMPACTION
+	wait_queue_head_t kcompactd_wait;
+	struct task_struct *kcompactd;
+	int kcompactd_max_order;
+	enum zone_type kcompactd_classzone_idx;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
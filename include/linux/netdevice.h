@@ -44,6 +44,7 @@
 #include <linux/rculist.h>
 #include <linux/dmaengine.h>
 #include <linux/workqueue.h>
+#include <linux/dynamic_queue_limits.h>
 
 #include <linux/ethtool.h>
 #include <net/net_namespace.h>
@@ -364,12 +365,14 @@ struct napi_struct {
 	struct list_head	dev_list;
 	struct sk_buff		*gro_list;
 	struct sk_buff		*skb;
+	struct hrtimer		timer;	/* Flushes gro_list, see napi_complete */
 };
 
 enum {
 	NAPI_STATE_SCHED,	/* Poll is scheduled */
 	NAPI_STATE_DISABLE,	/* Disable pending */
 	NAPI_STATE_NPSVC,	/* Netpoll - don't dequeue from poll_list */
+	NAPI_STATE_GRO_FLUSH,	/* GRO flush timer expired */
 };
 
 enum gro_result {
@@ -442,15 +445,10 @@ extern void napi_complete(struct napi_struct *n);
  *	@n: napi context
  *
  * Stop NAPI from being scheduled on this context.
- * Waits till any outstanding processing completes.
+ * Waits till any outstanding processing completes, then delivers
+ * the packets GRO still holds.  May sleep.
  */
-static inline void napi_disable(struct napi_struct *n)
-{
-	set_bit(NAPI_STATE_DISABLE, &n->state);
-	while (test_and_set_bit(NAPI_STATE_SCHED, &n->state))
-		msleep(1);
-	clear_bit(NAPI_STATE_DISABLE, &n->state);
-}
+extern void napi_disable(struct napi_struct *n);
 
 /**
  *	napi_enable - enable NAPI scheduling
@@ -485,10 +483,14 @@ static inline void napi_synchronize(const struct napi_struct *n)
 #endif
 
 enum netdev_queue_state_t {
-	__QUEUE_STATE_XOFF,
+	__QUEUE_STATE_XOFF,		/* stopped by the driver */
+	__QUEUE_STATE_STACK_XOFF,	/* stopped by byte queue limits */
 	__QUEUE_STATE_FROZEN,
 };
 
+#define QUEUE_STATE_ANY_XOFF	((1 << __QUEUE_STATE_XOFF) |		\
+				 (1 << __QUEUE_STATE_STACK_XOFF))
+
 struct netdev_queue {
 /*
  * read mostly part
@@ -497,6 +499,9 @@ struct netdev_queue {
 	struct Qdisc		*qdisc;
 	unsigned long		state;
 	struct Qdisc		*qdisc_sleeping;
+#ifdef CONFIG_SYSFS
+	struct kobject		kobj;
+#endif
 /*
  * write mostly part
  */
@@ -509,6 +514,9 @@ struct netdev_queue {
 	u64			tx_bytes;
 	u64			tx_packets;
 	u64			tx_dropped;
+#ifdef CONFIG_BQL
+	struct dql		dql;
+#endif
 } ____cacheline_aligned_in_smp;
 
 #ifdef CONFIG_RPS
@@ -591,6 +599,32 @@ struct netdev_rx_queue {
 } ____cacheline_aligned_in_smp;
 #endif /* CONFIG_RPS */
 
+#ifdef CONFIG_XPS
+/*
+ * This structure holds an XPS map which can be of variable length.  The
+ * map is an array of queues.
+ */
+struct xps_map {
+	unsigned int len;
+	unsigned int alloc_len;
+	struct rcu_head rcu;
+	u16 queues[0];
+};
+#define XPS_MAP_SIZE(_num) (sizeof(struct xps_map) + (_num * sizeof(u16)))
+#define XPS_MIN_MAP_ALLOC ((L1_CACHE_BYTES - sizeof(struct xps_map))	\
+    / sizeof(u16))
+
+/*
+ * This structure holds all XPS maps for device.  Maps are indexed by CPU.
+ */
+struct xps_dev_maps {
+	struct rcu_head rcu;
+	struct xps_map *cpu_map[0];
+};
+#define XPS_DEV_MAPS_SIZE (sizeof(struct xps_dev_maps) +		\
+    (nr_cpu_ids * sizeof(struct xps_map *)))
+#endif /* CONFIG_XPS */
+
 /*
  * This structure defines the management hooks for network devices.
  * The following hooks can be defined; unless noted otherwise, they are
@@ -860,6 +894,8 @@ struct net_device {
 #define NETIF_F_TSO_ECN		(SKB_GSO_TCP_ECN << NETIF_F_GSO_SHIFT)
 #define NETIF_F_TSO6		(SKB_GSO_TCPV6 << NETIF_F_GSO_SHIFT)
 #define NETIF_F_FSO		(SKB_GSO_FCOE << NETIF_F_GSO_SHIFT)
+#define NETIF_F_GSO_GRE		(SKB_GSO_GRE << NETIF_F_GSO_SHIFT)
+#define NETIF_F_GSO_IPIP	(SKB_GSO_IPIP << NETIF_F_GSO_SHIFT)
 
 	/* List of features with software fallbacks. */
 #define NETIF_F_GSO_SOFTWARE	(NETIF_F_TSO | NETIF_F_TSO_ECN | \
@@ -964,9 +1000,11 @@ struct net_device {
 
 	unsigned char		broadcast[MAX_ADDR_LEN];	/* hw bcast add	*/
 
-#ifdef CONFIG_RPS
+#ifdef CONFIG_SYSFS
 	struct kset		*queues_kset;
+#endif
 
+#ifdef CONFIG_RPS
 	struct netdev_rx_queue	*_rx;
 
 	/* Number of RX queues allocated at alloc_netdev_mq() time  */
@@ -977,6 +1015,9 @@ struct net_device {
 	rx_handler_func_t	*rx_handler;
 	void			*rx_handler_data;
 
+	/* Nanoseconds GRO holds packets after a poll, 0 to flush at once */
+	unsigned long		gro_flush_timeout;
+
 	struct netdev_queue	*_tx ____cacheline_aligned_in_smp;
 
 	/* Number of TX queues allocated at alloc_netdev_mq() time  */
@@ -985,6 +1026,11 @@ struct net_device {
 	/* Number of TX queues currently active in device  */
 	unsigned int		real_num_tx_queues;
 
+#ifdef CONFIG_XPS
+	/* Per CPU transmit queue maps, see net/core/net-sysfs.c */
+	struct xps_dev_maps	*xps_maps;
+#endif
+
 	/* root qdisc from userspace point of view */
 	struct Qdisc		*qdisc;
 
@@ -1210,6 +1256,9 @@ struct napi_gro_cb {
 
 	/* Free the skb? */
 	int free;
+
+	/* Set once a tunnel header has been pulled. */
+	int encap_mark;
 };
 
 #define NAPI_GRO_CB(skb) ((struct napi_gro_cb *)(skb)->cb)
@@ -1451,7 +1500,7 @@ extern void __netif_schedule(struct Qdisc *q);
 
 static inline void netif_schedule_queue(struct netdev_queue *txq)
 {
-	if (!test_bit(__QUEUE_STATE_XOFF, &txq->state))
+	if (!(txq->state & QUEUE_STATE_ANY_XOFF))
 		__netif_schedule(txq->qdisc);
 }
 
@@ -1571,6 +1620,124 @@ static inline int netif_tx_queue_frozen(const struct netdev_queue *dev_queue)
 	return test_bit(__QUEUE_STATE_FROZEN, &dev_queue->state);
 }
 
+/**
+ *	netif_xmit_stopped - test if the stack may hand packets to a queue
+ *	@dev_queue: transmit queue
+ *
+ *	Unlike netif_tx_queue_stopped(), this is also true when byte queue
+ *	limits hold the queue back although the driver still has room.
+ */
+static inline int netif_xmit_stopped(const struct netdev_queue *dev_queue)
+{
+	return dev_queue->state & QUEUE_STATE_ANY_XOFF;
+}
+
+static inline int
+netif_xmit_frozen_or_stopped(const struct netdev_queue *dev_queue)
+{
+	return dev_queue->state & (QUEUE_STATE_ANY_XOFF |
+				   (1 << __QUEUE_STATE_FROZEN));
+}
+
+/**
+ *	netdev_tx_sent_queue - account bytes handed to a transmit ring
+ *	@dev_queue: transmit queue
+ *	@bytes: number of bytes just queued to the hardware
+ *
+ *	Called by drivers from their transmit routine.  Stops the queue on
+ *	behalf of the stack once the byte queue limit is exceeded.
+ */
+static inline void netdev_tx_sent_queue(struct netdev_queue *dev_queue,
+					unsigned int bytes)
+{
+#ifdef CONFIG_BQL
+	dql_queued(&dev_queue->dql, bytes);
+
+	if (likely(dql_avail(&dev_queue->dql) >= 0))
+		return;
+
+	set_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+
+	/*
+	 * The XOFF flag must be set before checking the dql_avail below,
+	 * because in netdev_tx_completed_queue we update the dql_completed
+	 * before checking the XOFF flag.
+	 */
+	smp_mb();
+
+	/* check again in case another CPU has just made room avail */
+	if (unlikely(dql_avail(&dev_queue->dql) >= 0))
+		clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+#endif
+}
+
+/**
+ *	netdev_tx_completed_queue - account bytes completed by the hardware
+ *	@dev_queue: transmit queue
+ *	@pkts: number of packets completed (informational)
+ *	@bytes: number of bytes completed
+ *
+ *	Called by drivers from their transmit completion routine, once per
+ *	batch of reclaimed descriptors.  Adjusts the limit and restarts the
+ *	queue if it was held back by the stack.
+ */
+static inline void netdev_tx_completed_queue(struct netdev_queue *dev_queue,
+					     unsigned int pkts,
+					     unsigned int bytes)
+{
+#ifdef CONFIG_BQL
+	if (unlikely(!bytes))
+		return;
+
+	dql_completed(&dev_queue->dql, bytes);
+
+	/*
+	 * Without the memory barrier there is a small possiblity that
+	 * netdev_tx_sent_queue will miss the update and cause the queue to
+	 * be stopped forever
+	 */
+	smp_mb();
+
+	if (dql_avail(&dev_queue->dql) < 0)
+		return;
+
+	if (test_and_clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state))
+		netif_schedule_queue(dev_queue);
+#endif
+}
+
+/**
+ *	netdev_tx_reset_queue - reset byte queue limits state
+ *	@dev_queue: transmit queue
+ *
+ *	Must be called when a driver discards its ring without completing
+ *	the packets on it, e.g. on down or reset.
+ */
+static inline void netdev_tx_reset_queue(struct netdev_queue *dev_queue)
+{
+#ifdef CONFIG_BQL
+	clear_bit(__QUEUE_STATE_STACK_XOFF, &dev_queue->state);
+	dql_reset(&dev_queue->dql);
+#endif
+}
+
+static inline void netdev_sent_queue(struct net_device *dev,
+				     unsigned int bytes)
+{
+	netdev_tx_sent_queue(netdev_get_tx_queue(dev, 0), bytes);
+}
+
+static inline void netdev_completed_queue(struct net_device *dev,
+					  unsigned int pkts, unsigned int bytes)
+{
+	netdev_tx_completed_queue(netdev_get_tx_queue(dev, 0), pkts, bytes);
+}
+
+static inline void netdev_reset_queue(struct net_device *dev)
+{
+	netdev_tx_reset_queue(netdev_get_tx_queue(dev, 0));
+}
+
 /**
  *	netif_running - test if up
  *	@dev: network device
@@ -442,6 +442,9 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 				pgoff_t index, gfp_t gfp_mask);
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t index, gfp_t gfp_mask);
+unsigned add_to_page_cache_lru_list(struct list_head *pages,
+				struct address_space *mapping, gfp_t gfp_mask,
+				filler_t *filler, void *data);
 extern void remove_from_page_cache(struct page *page);
 extern void __remove_from_page_cache(struct page *page);
 
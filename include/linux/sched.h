@@ -1001,6 +1001,7 @@ partition_sched_domains(int ndoms_new, cpumask_var_t doms_new[],
 
 
 struct io_context;			/* See blkdev.h */
+struct blk_plug;
 
 
 #ifdef ARCH_HAS_PREFETCH_SWITCH_STACK
@@ -1401,6 +1402,9 @@ struct task_struct {
 	struct backing_dev_info *backing_dev_info;
 
 	struct io_context *io_context;
+#ifdef CONFIG_BLOCK
+	struct blk_plug *plug;		/* on-stack request plug */
+#endif
 
 	unsigned long ptrace_message;
 	siginfo_t *last_siginfo; /* For ptrace use.  */
@@ -1438,6 +1442,13 @@ struct task_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *mempolicy;	/* Protected by alloc_lock */
 	short il_next;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	int numa_preferred_nid;		/* Node most hinting faults hit */
+	unsigned int numa_scan_period;	/* Milliseconds between scans */
+	unsigned long numa_faults_local;	/* since the last scan */
+	unsigned long numa_faults_remote;
+	unsigned long *numa_faults;	/* Decaying per-node fault counts */
 #endif
 	atomic_t fs_excl;	/* holding fs exclusive resources */
 	struct rcu_head rcu;
@@ -1453,6 +1464,12 @@ struct task_struct {
 	int make_it_fail;
 #endif
 	struct prop_local_single dirties;
+	/*
+	 * Pages dirtied since the last balance_dirty_pages() call, which is
+	 * due once there are nr_dirtied_pause of them.
+	 */
+	int nr_dirtied;
+	int nr_dirtied_pause;
 #ifdef CONFIG_LATENCYTOP
 	int latency_record_count;
 	struct latency_record latency_record[LT_SAVECOUNT];
@@ -1900,6 +1917,29 @@ int sched_rt_handler(struct ctl_table *table, int write,
 
 extern unsigned int sysctl_sched_compat_yield;
 
+#ifdef CONFIG_NUMA_BALANCING
+extern int sysctl_numa_balancing;
+extern unsigned int sysctl_numa_balancing_scan_delay;
+extern unsigned int sysctl_numa_balancing_scan_period_min;
+extern unsigned int sysctl_numa_balancing_scan_period_max;
+extern unsigned int sysctl_numa_balancing_scan_size;
+
+extern void task_numa_fault(int node, int pages, bool local);
+extern void task_numa_work(void);
+extern void task_numa_free(struct task_struct *p);
+extern void sched_numa_migrate(int nid);
+#else
+static inline void task_numa_fault(int node, int pages, bool local)
+{
+}
+static inline void task_numa_work(void)
+{
+}
+static inline void task_numa_free(struct task_struct *p)
+{
+}
+#endif
+
 #ifdef CONFIG_RT_MUTEXES
 extern int rt_mutex_getprio(struct task_struct *p);
 extern void rt_mutex_setprio(struct task_struct *p, int prio);
@@ -105,12 +105,14 @@ enum {
 #define TCP_COOKIE_TRANSACTIONS	15	/* TCP Cookie Transactions */
 #define TCP_THIN_LINEAR_TIMEOUTS 16      /* Use linear timeouts for thin streams*/
 #define TCP_THIN_DUPACK         17      /* Fast retrans. after 1 dupack */
+#define TCP_FASTOPEN		23	/* Enable FastOpen on listeners */
 
 /* for TCP_INFO socket option */
 #define TCPI_OPT_TIMESTAMPS	1
 #define TCPI_OPT_SACK		2
 #define TCPI_OPT_WSCALE		4
 #define TCPI_OPT_ECN		8
+#define TCPI_OPT_SYN_DATA	32 /* SYN-ACK acked data in SYN sent or rcvd */
 
 enum tcp_ca_state {
 	TCP_CA_Open = 0,
@@ -270,7 +272,21 @@ static inline void tcp_clear_options(struct tcp_options_received *rx_opt)
  * only four options will fit in a standard TCP header */
 #define TCP_NUM_SACKS 4
 
+/* TCP Fast Open */
+#define TCP_FASTOPEN_COOKIE_MIN	4	/* Min Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_MAX	16	/* Max Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_SIZE 8	/* the size employed by this impl. */
+
+/* TCP Fast Open Cookie as stored in memory: a negative len means no
+ * option, zero an empty option (a cookie request).
+ */
+struct tcp_fastopen_cookie {
+	s8	len;
+	u8	val[TCP_FASTOPEN_COOKIE_MAX];
+};
+
 struct tcp_cookie_values;
+struct tcp_fastopen_request;
 struct tcp_request_sock_ops;
 
 struct tcp_request_sock {
@@ -281,6 +297,9 @@ struct tcp_request_sock {
 #endif
 	u32				rcv_isn;
 	u32				snt_isn;
+	u32				rcv_nxt; /* the ack # by SYN-ACK: past the
+						  * data of a Fast Open SYN */
+	struct sock			*listener; /* needed for TFO */
 };
 
 static inline struct tcp_request_sock *tcp_rsk(const struct request_sock *req)
@@ -345,7 +364,8 @@ struct tcp_sock {
 	u8	nonagle     : 4,/* Disable Nagle algorithm?             */
 		thin_lto    : 1,/* Use linear timeouts for thin streams */
 		thin_dupack : 1,/* Fast retransmit on first dupack      */
-		unused      : 2;
+		syn_fastopen: 1,/* SYN includes Fast Open option        */
+		syn_data    : 1;/* SYN includes data                    */
 
 /* RTT measurement */
 	u32	srtt;		/* smoothed round trip time << 3	*/
@@ -363,6 +383,7 @@ struct tcp_sock {
 	u32	snd_up;		/* Urgent pointer		*/
 
 	u8	keepalive_probes; /* num of allowed keep alive probes	*/
+	u8	syn_data_acked:1;/* data in SYN is acked by SYN-ACK	*/
 /*
  *      Options received (usually on last packet, some only on SYN packets).
  */
@@ -459,6 +480,15 @@ struct tcp_sock {
 	 * contains related tcp_cookie_transactions fields.
 	 */
 	struct tcp_cookie_values  *cookie_values;
+
+	/* Data to be sent in the SYN of an active Fast Open, only set
+	 * while tcp_sendmsg() with MSG_FASTOPEN is connecting.
+	 */
+	struct tcp_fastopen_request *fastopen_req;
+	/* A passive Fast Open socket keeps the request sock of its
+	 * listener until the 3WHS completes, to retransmit the SYN-ACK.
+	 */
+	struct request_sock *fastopen_rsk;
 };
 
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
@@ -466,6 +496,13 @@ static inline struct tcp_sock *tcp_sk(const struct sock *sk)
 	return (struct tcp_sock *)sk;
 }
 
+/* Child socket created by a Fast Open SYN, handshake not yet complete */
+static inline bool tcp_passive_fastopen(const struct sock *sk)
+{
+	return sk->sk_state == TCP_SYN_RECV &&
+	       tcp_sk(sk)->fastopen_rsk != NULL;
+}
+
 struct tcp_timewait_sock {
 	struct inet_timewait_sock tw_sk;
 	u32			  tw_rcv_nxt;
@@ -15,6 +15,7 @@
  * @callback: the function to call when buffers are consumed (can be NULL).
  * @name: the name of this virtqueue (mainly for debugging)
  * @vdev: the virtio device this queue was created for.
+ * @index: the zero-based ordinal number for this queue.
  * @priv: a pointer for the virtqueue implementation to use.
  */
 struct virtqueue {
@@ -22,6 +23,7 @@ struct virtqueue {
 	void (*callback)(struct virtqueue *vq);
 	const char *name;
 	struct virtio_device *vdev;
+	unsigned int index;
 	void *priv;
 };
 
@@ -245,6 +245,9 @@ static inline void skb_tunnel_rx(struct sk_buff *skb, struct net_device *dev)
 	skb_set_queue_mapping(skb, 0);
 	skb_dst_drop(skb);
 	nf_reset(skb);
+	/* Segments merged by GRO are no longer tunnelled */
+	if (skb_is_gso(skb))
+		skb_shinfo(skb)->gso_type &= ~(SKB_GSO_GRE | SKB_GSO_IPIP);
 }
 
 /* Children define the path of the packet through the
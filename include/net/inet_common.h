@@ -16,6 +16,8 @@ struct socket;
 extern int inet_release(struct socket *sock);
 extern int inet_stream_connect(struct socket *sock, struct sockaddr * uaddr,
 			       int addr_len, int flags);
+extern int __inet_stream_connect(struct socket *sock, struct sockaddr *uaddr,
+				 int addr_len, int flags);
 extern int inet_dgram_connect(struct socket *sock, struct sockaddr * uaddr,
 			      int addr_len, int flags);
 extern int inet_accept(struct socket *sock, struct socket *newsock, int flags);
@@ -36,6 +38,20 @@ extern int inet_ctl_sock_create(struct sock **sk, unsigned short family,
 				unsigned short type, unsigned char protocol,
 				struct net *net);
 
+struct sk_buff;
+extern struct sk_buff **inet_gro_receive(struct sk_buff **head,
+					 struct sk_buff *skb);
+extern int inet_gro_complete(struct sk_buff *skb);
+extern struct sk_buff **inet_tunnel_gro_receive(struct sk_buff **head,
+						struct sk_buff *skb,
+						const void *th,
+						unsigned int hlen);
+extern int inet_tunnel_gro_complete(struct sk_buff *skb, unsigned int hlen,
+				    int gso_type);
+extern struct sk_buff *inet_tunnel_gso_segment(struct sk_buff *skb,
+					       int features,
+					       unsigned int hlen);
+
 static inline void inet_ctl_sock_destroy(struct sock *sk)
 {
 	sk_release_kernel(sk);
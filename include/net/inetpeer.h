@@ -37,6 +37,22 @@ struct inet_peer {
 		};
 		struct rcu_head         rcu;
 	};
+	/*
+	 * Path state learned from ICMP and applied to every route towards
+	 * this peer, see ip_rt_frag_needed() and ip_rt_redirect().
+	 */
+	__be32			redirect_learned;
+	__u32			pmtu_learned;
+	unsigned long		pmtu_expires;
+	/*
+	 * TCP Fast Open client state, see tcp_fastopen_cache_get():
+	 * the cookie and MSS the peer sent, and recent SYN-data losses.
+	 */
+	__u16			tcp_fastopen_mss;
+	__s8			tcp_fastopen_cookie_len;
+	__u8			tcp_fastopen_syn_loss;
+	__u8			tcp_fastopen_cookie[16];
+	unsigned long		tcp_fastopen_syn_loss_ts;
 };
 
 void			inet_initpeers(void) __init;
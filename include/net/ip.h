@@ -35,6 +35,7 @@ struct sock;
 
 struct inet_skb_parm {
 	struct ip_options	opt;		/* Compiled IP options		*/
+	int			iif;		/* Device the packet arrived on	*/
 	unsigned char		flags;
 
 #define IPSKB_FORWARDED		1
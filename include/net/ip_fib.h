@@ -44,6 +44,7 @@ struct fib_config {
  };
 
 struct fib_info;
+struct rtable;
 
 struct fib_nh {
 	struct net_device	*nh_dev;
@@ -60,6 +61,9 @@ struct fib_nh {
 #endif
 	int			nh_oif;
 	__be32			nh_gw;
+	/* last route built through this nexthop, one per cpu */
+	struct rtable * __percpu *nh_pcpu_rth_output;
+	struct rtable * __percpu *nh_pcpu_rth_input;
 };
 
 /*
@@ -74,6 +74,14 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
             const struct nf_conntrack_l3proto *l3proto,
             const struct nf_conntrack_l4proto *proto);
 
-extern spinlock_t nf_conntrack_lock ;
+#define CONNTRACK_LOCKS 1024
+
+/* Hash chains are protected by nf_conntrack_locks[bucket % CONNTRACK_LOCKS],
+ * expectations and helper assignment by nf_conntrack_expect_lock.
+ */
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_lock(spinlock_t *lock);
+
+extern spinlock_t nf_conntrack_expect_lock;
 
 #endif /* _NF_CONNTRACK_CORE_H */
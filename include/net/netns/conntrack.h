@@ -3,11 +3,19 @@
 
 #include <linux/list.h>
 #include <linux/list_nulls.h>
+#include <linux/seqlock.h>
+#include <linux/spinlock.h>
 #include <asm/atomic.h>
 
 struct ctl_table_header;
 struct nf_conntrack_ecache;
 
+struct ct_pcpu {
+	spinlock_t		lock;
+	struct hlist_nulls_head	unconfirmed;
+	struct hlist_nulls_head	dying;
+};
+
 struct netns_ct {
 	atomic_t		count;
 	unsigned int		expect_count;
@@ -15,8 +23,8 @@ struct netns_ct {
 	struct kmem_cache	*nf_conntrack_cachep;
 	struct hlist_nulls_head	*hash;
 	struct hlist_head	*expect_hash;
-	struct hlist_nulls_head	unconfirmed;
-	struct hlist_nulls_head	dying;
+	seqcount_t		generation;
+	struct ct_pcpu __percpu	*pcpu_lists;
 	struct ip_conntrack_stat __percpu *stat;
 	int			sysctl_events;
 	unsigned int		sysctl_events_retry_timeout;
@@ -105,12 +105,32 @@ struct listen_sock {
 	struct request_sock	*syn_table[0];
 };
 
+/** struct fastopen_queue - TCP Fast Open requests of a listener
+ *
+ * @rskq_rst_head - head of requests reset before their 3WHS completed
+ * @rskq_rst_tail - tail of requests reset before their 3WHS completed
+ * @lock - serializer, taken from softirq as well as from accept()
+ * @qlen - number of Fast Open children whose 3WHS is pending, plus the
+ *	   reset requests, which are kept around for a while so that a
+ *	   flood of spoofed Fast Open SYNs disables Fast Open on the
+ *	   listener instead of filling its accept queue
+ * @max_qlen - limit on @qlen set by the TCP_FASTOPEN socket option
+ */
+struct fastopen_queue {
+	struct request_sock	*rskq_rst_head;
+	struct request_sock	*rskq_rst_tail;
+	spinlock_t		lock;
+	int			qlen;
+	int			max_qlen;
+};
+
 /** struct request_sock_queue - queue of request_socks
  *
  * @rskq_accept_head - FIFO head of established children
  * @rskq_accept_tail - FIFO tail of established children
  * @rskq_defer_accept - User waits for some data after accept()
  * @syn_wait_lock - serializer
+ * @fastopenq - TCP Fast Open state, allocated by the TCP_FASTOPEN option
  *
  * %syn_wait_lock is necessary only to avoid proc interface having to grab the main
  * lock sock while browsing the listening hash (otherwise it's deadlock prone).
@@ -128,6 +148,7 @@ struct request_sock_queue {
 	u8			rskq_defer_accept;
 	/* 3 bytes hole, try to pack */
 	struct listen_sock	*listen_opt;
+	struct fastopen_queue	*fastopenq;
 };
 
 extern int reqsk_queue_alloc(struct request_sock_queue *queue,
@@ -135,6 +156,8 @@ extern int reqsk_queue_alloc(struct request_sock_queue *queue,
 
 extern void __reqsk_queue_destroy(struct request_sock_queue *queue);
 extern void reqsk_queue_destroy(struct request_sock_queue *queue);
+extern void reqsk_fastopen_remove(struct sock *sk, struct request_sock *req,
+				  bool reset);
 
 static inline struct request_sock *
 	reqsk_queue_yank_acceptq(struct request_sock_queue *queue)
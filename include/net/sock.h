@@ -56,6 +56,7 @@
 #include <linux/filter.h>
 #include <linux/rculist_nulls.h>
 #include <linux/poll.h>
+#include <linux/random.h>
 
 #include <asm/atomic.h>
 #include <net/dst.h>
@@ -114,6 +115,7 @@ struct net;
  *	@skc_family: network address family
  *	@skc_state: Connection state
  *	@skc_reuse: %SO_REUSEADDR setting
+ *	@skc_reuseport: %SO_REUSEPORT setting
  *	@skc_bound_dev_if: bound device index if != 0
  *	@skc_bind_node: bind hash linkage for various protocol lookup tables
  *	@skc_portaddr_node: second hash linkage for UDP/UDP-Lite protocol
@@ -140,7 +142,8 @@ struct sock_common {
 	};
 	unsigned short		skc_family;
 	volatile unsigned char	skc_state;
-	unsigned char		skc_reuse;
+	unsigned char		skc_reuse:4;
+	unsigned char		skc_reuseport:4;
 	int			skc_bound_dev_if;
 	union {
 		struct hlist_node	skc_bind_node;
@@ -237,6 +240,7 @@ struct sock {
 #define sk_family		__sk_common.skc_family
 #define sk_state		__sk_common.skc_state
 #define sk_reuse		__sk_common.skc_reuse
+#define sk_reuseport		__sk_common.skc_reuseport
 #define sk_bound_dev_if		__sk_common.skc_bound_dev_if
 #define sk_bind_node		__sk_common.skc_bind_node
 #define sk_prot			__sk_common.skc_prot
@@ -517,6 +521,21 @@ static __inline__ void sk_add_bind_node(struct sock *sk,
 #define sk_for_each_bound(__sk, node, list) \
 	hlist_for_each_entry(__sk, node, list, sk_bind_node)
 
+/*
+ * SO_REUSEPORT: called for each further socket that ties with the best
+ * score of a lookup, with @hash seeded by the flow hash at the first one.
+ * Returns true if the socket should replace the current pick.  The n-th
+ * candidate wins with probability 1/n, so the flows are spread evenly over
+ * the group and a given flow always picks the same socket.
+ */
+static inline bool sk_reuseport_pick(u32 *hash, int *matches)
+{
+	bool pick = (((u64)*hash * ++*matches) >> 32) == 0;
+
+	*hash = next_pseudo_random32(*hash);
+	return pick;
+}
+
 /* Sock flags */
 enum sock_flags {
 	SOCK_DEAD,
@@ -1164,8 +1183,10 @@ extern void sock_init_data(struct socket *sock, struct sock *sk);
 
 static inline void sk_filter_release(struct sk_filter *fp)
 {
-	if (atomic_dec_and_test(&fp->refcnt))
+	if (atomic_dec_and_test(&fp->refcnt)) {
+		bpf_jit_free(fp);
 		kfree(fp);
+	}
 }
 
 static inline void sk_filter_uncharge(struct sock *sk, struct sk_filter *fp)
@@ -165,6 +165,7 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 #define TCPOPT_SACK             5       /* SACK Block */
 #define TCPOPT_TIMESTAMP	8	/* Better RTT estimations/PAWS */
 #define TCPOPT_MD5SIG		19	/* MD5 Signature (RFC2385) */
+#define TCPOPT_FASTOPEN		34	/* Fast open (RFC7413) */
 #define TCPOPT_COOKIE		253	/* Cookie extension (experimental) */
 
 /*
@@ -176,6 +177,7 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 #define TCPOLEN_SACK_PERM      2
 #define TCPOLEN_TIMESTAMP      10
 #define TCPOLEN_MD5SIG         18
+#define TCPOLEN_FASTOPEN_BASE  2
 #define TCPOLEN_COOKIE_BASE    2	/* Cookie-less header extension */
 #define TCPOLEN_COOKIE_PAIR    3	/* Cookie pair header extension */
 #define TCPOLEN_COOKIE_MIN     (TCPOLEN_COOKIE_BASE+TCP_COOKIE_MIN)
@@ -246,6 +248,7 @@ extern int sysctl_tcp_max_ssthresh;
 extern int sysctl_tcp_cookie_size;
 extern int sysctl_tcp_thin_linear_timeouts;
 extern int sysctl_tcp_thin_dupack;
+extern int sysctl_tcp_fastopen;
 
 extern atomic_t tcp_memory_allocated;
 extern struct percpu_counter tcp_sockets_allocated;
@@ -397,8 +400,10 @@ extern int tcp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		       size_t len, int nonblock, int flags, int *addr_len);
 extern void tcp_parse_options(struct sk_buff *skb,
 			      struct tcp_options_received *opt_rx, u8 **hvpp,
-			      int estab);
+			      int estab, struct tcp_fastopen_cookie *foc);
 extern u8 *tcp_parse_md5sig_option(struct tcphdr *th);
+extern void tcp_init_metrics(struct sock *sk);
+extern void tcp_init_buffer_space(struct sock *sk);
 
 /*
  *	TCP v4 functions exported for the inet6 API
@@ -981,6 +986,8 @@ static inline void tcp_openreq_init(struct request_sock *req,
 	req->rcv_wnd = 0;		/* So that tcp_send_synack() knows! */
 	req->cookie_ts = 0;
 	tcp_rsk(req)->rcv_isn = TCP_SKB_CB(skb)->seq;
+	tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->seq + 1;
+	tcp_rsk(req)->listener = NULL;
 	req->mss = rx_opt->mss_clamp;
 	req->ts_recent = rx_opt->saw_tstamp ? rx_opt->rcv_tsval : 0;
 	ireq->tstamp_ok = rx_opt->tstamp_ok;
@@ -1511,6 +1518,9 @@ static inline int tcp_s_data_size(const struct tcp_sock *tp)
  *
  * @cookie_plus:	bytes in authenticator/cookie option, copied from
  *			struct tcp_options_received (above).
+ *
+ * @fastopen_cookie:	Fast Open cookie to send in the SYN-ACK, if its
+ *			len is positive.
  */
 struct tcp_extend_values {
 	struct request_values		rv;
@@ -1518,6 +1528,7 @@ struct tcp_extend_values {
 	u8				cookie_plus:6,
 					cookie_out_never:1,
 					cookie_in_always:1;
+	struct tcp_fastopen_cookie	fastopen_cookie;
 };
 
 static inline struct tcp_extend_values *tcp_xv(struct request_values *rvp)
@@ -1525,6 +1536,34 @@ static inline struct tcp_extend_values *tcp_xv(struct request_values *rvp)
 	return (struct tcp_extend_values *)rvp;
 }
 
+/* From tcp_fastopen.c */
+
+/* Bits of sysctl_tcp_fastopen */
+#define	TFO_CLIENT_ENABLE	1	/* send data in SYN, MSG_FASTOPEN */
+#define	TFO_SERVER_ENABLE	2	/* accept data in SYN, TCP_FASTOPEN */
+
+/* State of an active Fast Open, lives during tcp_sendmsg() */
+struct tcp_fastopen_request {
+	/* Fast Open cookie. Size 0 means a cookie request */
+	struct tcp_fastopen_cookie	cookie;
+	struct msghdr			*data;  /* data in MSG_FASTOPEN */
+	int				copied;	/* queued in tcp_connect() */
+};
+
+extern void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+				    struct tcp_fastopen_cookie *foc);
+extern void tcp_fastopen_set_key(const u32 *key);
+extern void tcp_fastopen_get_key(u32 *key);
+extern void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+				   struct tcp_fastopen_cookie *cookie,
+				   int *syn_loss, unsigned long *last_syn_loss);
+extern void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+				   struct tcp_fastopen_cookie *cookie,
+				   bool syn_lost);
+extern int tcp_fastopen_init_queue(struct sock *sk, int backlog);
+
+#define TCP_FASTOPEN_KEY_LENGTH 16
+
 extern void tcp_v4_init(void);
 extern void tcp_init(void);
 
@@ -186,6 +186,7 @@ void __put_task_struct(struct task_struct *tsk)
 	exit_creds(tsk);
 	delayacct_tsk_free(tsk);
 	put_signal_struct(tsk->signal);
+	task_numa_free(tsk);
 
 	if (!profile_handoff_task(tsk))
 		free_task(tsk);
@@ -486,6 +487,11 @@ static struct mm_struct * mm_init(struct mm_struct * mm, struct task_struct *p)
 	spin_lock_init(&mm->page_table_lock);
 	mm->free_area_cache = TASK_UNMAPPED_BASE;
 	mm->cached_hole_size = ~0UL;
+#ifdef CONFIG_NUMA_BALANCING
+	mm->numa_next_scan = jiffies +
+			msecs_to_jiffies(sysctl_numa_balancing_scan_delay);
+	mm->numa_scan_offset = 0;
+#endif
 	mm_init_aio(mm);
 	mm_init_owner(mm, p);
 
@@ -1079,6 +1085,11 @@ static struct task_struct *copy_process(unsigned long clone_flags,
 	p->real_start_time = p->start_time;
 	monotonic_to_bootbased(&p->real_start_time);
 	p->io_context = NULL;
+#ifdef CONFIG_BLOCK
+	p->plug = NULL;
+#endif
+	p->nr_dirtied = 0;
+	p->nr_dirtied_pause = 128 >> (PAGE_SHIFT - 10);
 	p->audit_context = NULL;
 	cgroup_fork(p);
 #ifdef CONFIG_NUMA
@@ -72,6 +72,7 @@
 #include <linux/ctype.h>
 #include <linux/ftrace.h>
 #include <linux/slab.h>
+#include <linux/mempolicy.h>
 
 #include <asm/tlb.h>
 #include <asm/irq_regs.h>
@@ -2511,6 +2512,14 @@ static void __sched_fork(struct task_struct *p)
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
+
+#ifdef CONFIG_NUMA_BALANCING
+	p->numa_preferred_nid = -1;
+	p->numa_scan_period = sysctl_numa_balancing_scan_period_min;
+	p->numa_faults_local = 0;
+	p->numa_faults_remote = 0;
+	p->numa_faults = NULL;
+#endif
 }
 
 /*
@@ -3230,6 +3239,47 @@ unlock:
 	task_rq_unlock(rq, &flags);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * sched_numa_migrate - move current to the least loaded CPU of node @nid
+ * that it may run on, so that it runs close to the memory it uses. The
+ * move is skipped if that CPU is busier than the one we are on.
+ */
+void sched_numa_migrate(int nid)
+{
+	struct task_struct *p = current;
+	unsigned long load, min_load = ULONG_MAX;
+	unsigned long flags;
+	int cpu, dest_cpu = -1;
+	struct rq *rq;
+
+	for_each_cpu_and(cpu, cpumask_of_node(nid), &p->cpus_allowed) {
+		if (!cpu_active(cpu))
+			continue;
+
+		load = weighted_cpuload(cpu);
+		if (load < min_load) {
+			min_load = load;
+			dest_cpu = cpu;
+		}
+	}
+
+	if (dest_cpu < 0 || min_load > weighted_cpuload(task_cpu(p)))
+		return;
+
+	rq = task_rq_lock(p, &flags);
+	if (cpumask_test_cpu(dest_cpu, &p->cpus_allowed) &&
+	    likely(cpu_active(dest_cpu)) && migrate_task(p, dest_cpu)) {
+		struct migration_arg arg = { p, dest_cpu };
+
+		task_rq_unlock(rq, &flags);
+		stop_one_cpu(cpu_of(rq), migration_cpu_stop, &arg);
+		return;
+	}
+	task_rq_unlock(rq, &flags);
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 #endif
 
 DEFINE_PER_CPU(struct kernel_stat, kstat);
@@ -3736,6 +3786,18 @@ pick_next_task(struct rq *rq)
 	}
 }
 
+/*
+ * A task going to sleep submits the requests held in its block plug:
+ * it may well be waiting for one of them.
+ */
+static inline void sched_submit_work(struct task_struct *tsk)
+{
+	if (!tsk->state || (preempt_count() & PREEMPT_ACTIVE))
+		return;
+	if (blk_needs_flush_plug(tsk))
+		blk_flush_plug(tsk);
+}
+
 /*
  * schedule() is the main scheduler function.
  */
@@ -3746,6 +3808,8 @@ asmlinkage void __sched schedule(void)
 	struct rq *rq;
 	int cpu;
 
+	sched_submit_work(current);
+
 need_resched:
 	preempt_disable();
 	cpu = smp_processor_id();
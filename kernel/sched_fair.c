@@ -91,6 +91,205 @@ const_debug unsigned int sysctl_sched_migration_cost = 500000UL;
 
 static const struct sched_class fair_sched_class;
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Automatic NUMA placement. The address space of a task is periodically
+ * scanned in chunks and the PTEs of its private pages are turned into
+ * NUMA hinting PTEs. The next access to such a page faults, which tells
+ * us which node the task touches its memory from; the page is migrated
+ * to that node if it lives elsewhere (see do_numa_page()) and the fault
+ * is accounted to the node the page ends up on. The node with most
+ * faults becomes the preferred node of the task, which the load balancer
+ * is then reluctant to move the task away from.
+ */
+int sysctl_numa_balancing = 1;
+
+/* Delay before the first scan of a new address space, in milliseconds */
+unsigned int sysctl_numa_balancing_scan_delay = 1000;
+
+/*
+ * Scan period bounds, in milliseconds. The period of a task doubles while
+ * most of its hinting faults are local and halves while they are not.
+ */
+unsigned int sysctl_numa_balancing_scan_period_min = 1000;
+unsigned int sysctl_numa_balancing_scan_period_max = 60000;
+
+/* Amount of address space to mark per scan, in megabytes */
+unsigned int sysctl_numa_balancing_scan_size = 256;
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+	p->numa_faults = NULL;
+}
+
+void task_numa_fault(int node, int pages, bool local)
+{
+	struct task_struct *p = current;
+
+	if (!sysctl_numa_balancing)
+		return;
+
+	if (unlikely(!p->numa_faults)) {
+		p->numa_faults = kzalloc(sizeof(*p->numa_faults) * nr_node_ids,
+					 GFP_KERNEL | __GFP_NOWARN);
+		if (!p->numa_faults)
+			return;
+	}
+
+	p->numa_faults[node] += pages;
+	if (local)
+		p->numa_faults_local += pages;
+	else
+		p->numa_faults_remote += pages;
+}
+
+/*
+ * Pick the preferred node of a task from its decaying fault statistics,
+ * adapt the scan period to how local its accesses were, and move the
+ * task to its preferred node if it is running elsewhere.
+ */
+static void task_numa_placement(struct task_struct *p)
+{
+	unsigned long faults, max_faults = 0;
+	unsigned long local = p->numa_faults_local;
+	unsigned long total = local + p->numa_faults_remote;
+	int nid, max_nid = -1;
+
+	if (!p->numa_faults)
+		return;
+
+	for_each_online_node(nid) {
+		faults = p->numa_faults[nid];
+		p->numa_faults[nid] = faults / 2;
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+	}
+
+	if (total) {
+		if (local * 4 >= total * 3)
+			p->numa_scan_period = min(p->numa_scan_period * 2,
+				sysctl_numa_balancing_scan_period_max);
+		else
+			p->numa_scan_period = max(p->numa_scan_period / 2,
+				sysctl_numa_balancing_scan_period_min);
+	}
+	p->numa_faults_local = 0;
+	p->numa_faults_remote = 0;
+
+	if (max_nid == -1)
+		return;
+
+	p->numa_preferred_nid = max_nid;
+	if (cpu_to_node(task_cpu(p)) != max_nid)
+		sched_numa_migrate(max_nid);
+}
+
+/*
+ * Called on return to user space after task_tick_numa() noticed that the
+ * address space is due for a scan. Only one thread of a process scans
+ * per period.
+ */
+void task_numa_work(void)
+{
+	unsigned long migrate, next_scan, now = jiffies;
+	struct task_struct *p = current;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long start, end;
+	long pages;
+
+	if (!sysctl_numa_balancing || !mm || (p->flags & PF_EXITING))
+		return;
+
+	migrate = mm->numa_next_scan;
+	if (time_before(now, migrate))
+		return;
+
+	task_numa_placement(p);
+
+	next_scan = now + msecs_to_jiffies(p->numa_scan_period);
+	if (cmpxchg(&mm->numa_next_scan, migrate, next_scan) != migrate)
+		return;
+
+	pages = sysctl_numa_balancing_scan_size;
+	pages <<= 20 - PAGE_SHIFT;
+
+	down_read(&mm->mmap_sem);
+	start = mm->numa_scan_offset;
+	vma = find_vma(mm, start);
+	if (!vma) {
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma))
+			continue;
+
+		/* PTEs of inaccessible mappings look like hinting PTEs */
+		if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+			continue;
+
+		do {
+			start = max(start, vma->vm_start);
+			end = min(start + (pages << PAGE_SHIFT), vma->vm_end);
+			change_prot_numa(vma, start, end);
+			pages -= (end - start) >> PAGE_SHIFT;
+			start = end;
+			if (pages <= 0)
+				goto out;
+		} while (end != vma->vm_end);
+	}
+
+out:
+	/* Continue where we stopped, or from the beginning next time */
+	mm->numa_scan_offset = vma ? start : 0;
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Ask current to scan its address space on the way back to user space
+ * once the scan period of its mm expired.
+ */
+static inline void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	struct mm_struct *mm = curr->mm;
+
+	if (!sysctl_numa_balancing || !mm || (curr->flags & PF_EXITING))
+		return;
+
+	if (time_after_eq(jiffies, mm->numa_next_scan))
+		set_tsk_thread_flag(curr, TIF_NOTIFY_RESUME);
+}
+
+/*
+ * Returns true if moving @p from @src_cpu to @dst_cpu would take it away
+ * from the node most of its memory accesses go to.
+ */
+static inline bool task_numa_keep_node(struct task_struct *p, int src_cpu,
+				int dst_cpu)
+{
+	int nid = p->numa_preferred_nid;
+
+	if (!sysctl_numa_balancing || nid == -1)
+		return false;
+
+	return cpu_to_node(src_cpu) == nid && cpu_to_node(dst_cpu) != nid;
+}
+#else
+static inline void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+}
+
+static inline bool task_numa_keep_node(struct task_struct *p, int src_cpu,
+				int dst_cpu)
+{
+	return false;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /**************************************************************
  * CFS operations on generic schedulable entities:
  */
@@ -1792,6 +1991,14 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 		return 0;
 	}
 
+	/*
+	 * Leave a task on the node its memory is on, unless balancing
+	 * keeps failing without moving it.
+	 */
+	if (task_numa_keep_node(p, cpu_of(rq), this_cpu) &&
+	    sd->nr_balance_failed <= sd->cache_nice_tries)
+		return 0;
+
 	/*
 	 * Aggressive migration if:
 	 * 1) task is cache cold, or
@@ -3732,6 +3939,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	task_tick_numa(rq, curr);
 }
 
 /*
@@ -14,6 +14,8 @@
 #include <linux/backing-dev.h>
 #include <linux/sysctl.h>
 #include <linux/sysfs.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
 #include "internal.h"
 
 /*
@@ -37,6 +39,9 @@ struct compact_control {
 
 	unsigned int order;		/* order a direct compactor needs */
 	int migratetype;		/* MOVABLE, RECLAIMABLE etc */
+	bool sync;			/* Synchronous migration */
+	bool proactive;			/* kcompactd fragmentation run */
+	bool contended;			/* Async run hit isolation limit */
 	struct zone *zone;
 };
 
@@ -254,6 +259,12 @@ static unsigned long isolate_migratepages(struct zone *zone,
 	 * delay for some time until fewer pages are isolated
 	 */
 	while (unlikely(too_many_isolated(zone))) {
+		/* Asynchronous compaction must not stall, just give up */
+		if (!cc->sync) {
+			cc->contended = true;
+			return 0;
+		}
+
 		congestion_wait(BLK_RW_ASYNC, HZ/10);
 
 		if (fatal_signal_pending(current))
@@ -341,19 +352,68 @@ static void update_nr_listpages(struct compact_control *cc)
 	cc->nr_freepages = nr_freepages;
 }
 
+/*
+ * A value of 0 disables proactive compaction by kcompactd. Higher values
+ * lower the fragmentation score a node is compacted down to.
+ */
+int sysctl_compaction_proactiveness = 20;
+
+/*
+ * The fragmentation score of a node is the percentage of its free memory
+ * that cannot be used for a pageblock-sized allocation, weighted by the
+ * size of each zone. kcompactd starts proactive compaction when the score
+ * rises above the high watermark and stops once it falls below the low one.
+ */
+static unsigned int fragmentation_score_wmark(bool low)
+{
+	unsigned int wmark_low;
+
+	wmark_low = max(100U - sysctl_compaction_proactiveness, 5U);
+	return low ? wmark_low : min(wmark_low + 10, 100U);
+}
+
+static unsigned int fragmentation_score_node(pg_data_t *pgdat)
+{
+	unsigned long score = 0;
+	int zoneid;
+
+	if (!pgdat->node_present_pages)
+		return 0;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+
+		score += zone->present_pages *
+				extfrag_for_order(zone, pageblock_order);
+	}
+
+	return score / pgdat->node_present_pages;
+}
+
 static int compact_finished(struct zone *zone,
 						struct compact_control *cc)
 {
 	unsigned int order;
 	unsigned long watermark = low_wmark_pages(zone) + (1 << cc->order);
 
-	if (fatal_signal_pending(current))
+	if (fatal_signal_pending(current) || cc->contended)
 		return COMPACT_PARTIAL;
 
 	/* Compaction run completes if the migrate and free scanner meet */
 	if (cc->free_pfn <= cc->migrate_pfn)
 		return COMPACT_COMPLETE;
 
+	/* Proactive compaction stops once the zone is defragmented enough */
+	if (cc->proactive) {
+		if (extfrag_for_order(zone, pageblock_order) <=
+					fragmentation_score_wmark(true))
+			return COMPACT_PARTIAL;
+		return COMPACT_CONTINUE;
+	}
+
 	/* Compaction run is not finished if the watermark is not met */
 	if (!zone_watermark_ok(zone, cc->order, watermark, 0, 0))
 		return COMPACT_CONTINUE;
@@ -394,7 +454,7 @@ static int compact_zone(struct zone *zone, struct compact_control *cc)
 
 		nr_migrate = cc->nr_migratepages;
 		migrate_pages(&cc->migratepages, compaction_alloc,
-						(unsigned long)cc, 0);
+				(unsigned long)cc, false, cc->sync);
 		update_nr_listpages(cc);
 		nr_remaining = cc->nr_migratepages;
 
@@ -426,6 +486,7 @@ static unsigned long compact_zone_order(struct zone *zone,
 		.nr_migratepages = 0,
 		.order = order,
 		.migratetype = allocflags_to_migratetype(gfp_mask),
+		.sync = true,
 		.zone = zone,
 	};
 	INIT_LIST_HEAD(&cc.freepages);
@@ -436,6 +497,45 @@ static unsigned long compact_zone_order(struct zone *zone,
 
 int sysctl_extfrag_threshold = 500;
 
+/*
+ * Returns true if compacting a zone is likely to produce a free page of
+ * the given order: order-0 watermarks must be met so that migration has
+ * pages to copy into, and a failure to allocate must be due to external
+ * fragmentation rather than a lack of memory.
+ */
+static bool compaction_suitable(struct zone *zone, int order)
+{
+	unsigned long watermark;
+	int fragindex;
+
+	/*
+	 * Watermarks for order-0 must be met for compaction. Note
+	 * the 2UL. This is because during migration, copies of
+	 * pages need to be allocated and for a short time, the
+	 * footprint is higher
+	 */
+	watermark = low_wmark_pages(zone) + (2UL << order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return false;
+
+	/*
+	 * fragmentation index determines if allocation failures are
+	 * due to low memory or external fragmentation
+	 *
+	 * index of -1 implies allocations might succeed depending
+	 * 	on watermarks
+	 * index towards 0 implies failure is due to lack of memory
+	 * index towards 1000 implies failure is due to fragmentation
+	 *
+	 * Only compact if a failure would be due to fragmentation.
+	 */
+	fragindex = fragmentation_index(zone, order);
+	if (fragindex >= 0 && fragindex <= sysctl_extfrag_threshold)
+		return false;
+
+	return true;
+}
+
 /**
  * try_to_compact_pages - Direct compact to satisfy a high-order allocation
  * @zonelist: The zonelist used for the current allocation
@@ -469,35 +569,13 @@ unsigned long try_to_compact_pages(struct zonelist *zonelist,
 	/* Compact each zone in the list */
 	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
 								nodemask) {
-		int fragindex;
 		int status;
 
-		/*
-		 * Watermarks for order-0 must be met for compaction. Note
-		 * the 2UL. This is because during migration, copies of
-		 * pages need to be allocated and for a short time, the
-		 * footprint is higher
-		 */
-		watermark = low_wmark_pages(zone) + (2UL << order);
-		if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
-			continue;
-
-		/*
-		 * fragmentation index determines if allocation failures are
-		 * due to low memory or external fragmentation
-		 *
-		 * index of -1 implies allocations might succeed depending
-		 * 	on watermarks
-		 * index towards 0 implies failure is due to lack of memory
-		 * index towards 1000 implies failure is due to fragmentation
-		 *
-		 * Only compact if a failure would be due to fragmentation.
-		 */
-		fragindex = fragmentation_index(zone, order);
-		if (fragindex >= 0 && fragindex <= sysctl_extfrag_threshold)
+		if (!compaction_suitable(zone, order))
 			continue;
 
-		if (fragindex == -1 && zone_watermark_ok(zone, order, watermark, 0, 0)) {
+		watermark = low_wmark_pages(zone) + (2UL << order);
+		if (zone_watermark_ok(zone, order, watermark, 0, 0)) {
 			rc = COMPACT_PARTIAL;
 			break;
 		}
@@ -532,6 +610,7 @@ static int compact_node(int nid)
 			.nr_freepages = 0,
 			.nr_migratepages = 0,
 			.order = -1,
+			.sync = true,
 		};
 
 		zone = &pgdat->node_zones[zoneid];
@@ -583,6 +662,277 @@ int sysctl_extfrag_handler(struct ctl_table *table, int write,
 	return 0;
 }
 
+/* How often an idle kcompactd re-evaluates the node fragmentation score */
+#define KCOMPACTD_PROACTIVE_INTERVAL_MSEC	500
+
+static bool kcompactd_work_requested(pg_data_t *pgdat)
+{
+	return pgdat->kcompactd_max_order > 0 || kthread_should_stop();
+}
+
+/* Returns true if any zone kcompactd was asked to look at needs compacting */
+static bool kcompactd_node_suitable(pg_data_t *pgdat, int order,
+					enum zone_type classzone_idx)
+{
+	int zoneid;
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_suitable(zone, order))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Compact the zones of a node on behalf of an allocation that woke us.
+ * Migration is asynchronous so that kcompactd never blocks on page locks
+ * or writeback; anything it cannot move is left for direct compaction.
+ */
+static void kcompactd_do_work(pg_data_t *pgdat)
+{
+	int order = pgdat->kcompactd_max_order;
+	enum zone_type classzone_idx = pgdat->kcompactd_classzone_idx;
+	int zoneid;
+
+	for (zoneid = 0; zoneid <= classzone_idx; zoneid++) {
+		unsigned long watermark;
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = order,
+			.migratetype = MIGRATE_MOVABLE,
+			.sync = false,
+		};
+
+		if (!populated_zone(zone))
+			continue;
+
+		if (compaction_deferred(zone))
+			continue;
+
+		watermark = low_wmark_pages(zone);
+		if (zone_watermark_ok(zone, order, watermark, 0, 0))
+			continue;
+
+		if (!compaction_suitable(zone, order))
+			continue;
+
+		if (kthread_should_stop())
+			return;
+
+		cc.zone = zone;
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		compact_zone(zone, &cc);
+
+		/*
+		 * The zone could not satisfy an allocation of this order
+		 * before, so every success here is a direct compaction stall
+		 * that an allocating task no longer has to take.
+		 */
+		if (zone_watermark_ok(zone, order, watermark, 0, 0)) {
+			zone->compact_considered = 0;
+			zone->compact_defer_shift = 0;
+			count_vm_event(KCOMPACTD_STALL_AVOIDED);
+		} else if (!cc.contended) {
+			defer_compaction(zone);
+		}
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+	}
+
+	/* Leave requests that arrived while we were compacting in place */
+	if (pgdat->kcompactd_max_order <= order)
+		pgdat->kcompactd_max_order = 0;
+	if (pgdat->kcompactd_classzone_idx >= classzone_idx)
+		pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+}
+
+static bool should_proactive_compact_node(pg_data_t *pgdat)
+{
+	if (!sysctl_compaction_proactiveness)
+		return false;
+
+	return fragmentation_score_node(pgdat) > fragmentation_score_wmark(false);
+}
+
+/* Compact every zone of a node until its fragmentation score is low */
+static void proactive_compact_node(pg_data_t *pgdat)
+{
+	int zoneid;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		unsigned long watermark;
+		struct zone *zone = &pgdat->node_zones[zoneid];
+		struct compact_control cc = {
+			.nr_freepages = 0,
+			.nr_migratepages = 0,
+			.order = -1,
+			.migratetype = MIGRATE_MOVABLE,
+			.sync = false,
+			.proactive = true,
+		};
+
+		if (!populated_zone(zone))
+			continue;
+
+		/* Migration needs free order-0 pages to copy into */
+		watermark = low_wmark_pages(zone) + (2UL << pageblock_order);
+		if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+			continue;
+
+		if (kthread_should_stop())
+			return;
+
+		cc.zone = zone;
+		INIT_LIST_HEAD(&cc.freepages);
+		INIT_LIST_HEAD(&cc.migratepages);
+
+		compact_zone(zone, &cc);
+
+		VM_BUG_ON(!list_empty(&cc.freepages));
+		VM_BUG_ON(!list_empty(&cc.migratepages));
+	}
+}
+
+/*
+ * The background compaction daemon, started as one per node. It is woken
+ * by the page allocator when a high-order allocation misses its low
+ * watermark and otherwise wakes periodically to compact proactively.
+ */
+static int kcompactd(void *p)
+{
+	pg_data_t *pgdat = (pg_data_t *)p;
+	const struct cpumask *cpumask = cpumask_of_node(pgdat->node_id);
+	unsigned int proactive_defer = 0;
+
+	if (!cpumask_empty(cpumask))
+		set_cpus_allowed_ptr(current, cpumask);
+	set_freezable();
+
+	pgdat->kcompactd_max_order = 0;
+	pgdat->kcompactd_classzone_idx = pgdat->nr_zones - 1;
+
+	while (!kthread_should_stop()) {
+		unsigned int prev_score, score;
+
+		wait_event_freezable_timeout(pgdat->kcompactd_wait,
+			kcompactd_work_requested(pgdat),
+			msecs_to_jiffies(KCOMPACTD_PROACTIVE_INTERVAL_MSEC));
+
+		if (kthread_should_stop())
+			break;
+
+		if (kcompactd_work_requested(pgdat)) {
+			kcompactd_do_work(pgdat);
+			continue;
+		}
+
+		if (proactive_defer) {
+			proactive_defer--;
+			continue;
+		}
+
+		if (!should_proactive_compact_node(pgdat))
+			continue;
+
+		count_vm_event(KCOMPACTD_PROACTIVE);
+		prev_score = fragmentation_score_node(pgdat);
+		proactive_compact_node(pgdat);
+		score = fragmentation_score_node(pgdat);
+
+		/*
+		 * If the score did not improve the remaining fragmentation is
+		 * most likely due to unmovable pages, so back off for a while
+		 * rather than scanning the node every interval.
+		 */
+		if (score >= prev_score)
+			proactive_defer = 1 << COMPACT_MAX_DEFER_SHIFT;
+	}
+
+	return 0;
+}
+
+/**
+ * wakeup_kcompactd - Ask kcompactd to compact a node in the background
+ * @pgdat: The node to compact
+ * @order: The order of the allocation that missed its watermark
+ * @classzone_idx: The highest zone the allocation may use
+ */
+void wakeup_kcompactd(pg_data_t *pgdat, int order,
+			enum zone_type classzone_idx)
+{
+	if (!order)
+		return;
+
+	if (pgdat->kcompactd_max_order < order)
+		pgdat->kcompactd_max_order = order;
+
+	if (pgdat->kcompactd_classzone_idx > classzone_idx)
+		pgdat->kcompactd_classzone_idx = classzone_idx;
+
+	if (!waitqueue_active(&pgdat->kcompactd_wait))
+		return;
+
+	if (!kcompactd_node_suitable(pgdat, order, classzone_idx))
+		return;
+
+	count_vm_event(KCOMPACTD_WAKE);
+	wake_up_interruptible(&pgdat->kcompactd_wait);
+}
+
+/*
+ * This kcompactd start function will be called by init and node-hot-add.
+ */
+int kcompactd_run(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	int ret = 0;
+
+	if (pgdat->kcompactd)
+		return 0;
+
+	pgdat->kcompactd = kthread_run(kcompactd, pgdat, "kcompactd%d", nid);
+	if (IS_ERR(pgdat->kcompactd)) {
+		printk(KERN_ERR "Failed to start kcompactd on node %d\n", nid);
+		ret = PTR_ERR(pgdat->kcompactd);
+		pgdat->kcompactd = NULL;
+	}
+	return ret;
+}
+
+/*
+ * Called by memory hotplug when all memory in a node is offlined.
+ */
+void kcompactd_stop(int nid)
+{
+	struct task_struct *kcompactd = NODE_DATA(nid)->kcompactd;
+
+	if (kcompactd) {
+		kthread_stop(kcompactd);
+		NODE_DATA(nid)->kcompactd = NULL;
+	}
+}
+
+static int __init kcompactd_init(void)
+{
+	int nid;
+
+	for_each_node_state(nid, N_HIGH_MEMORY)
+		kcompactd_run(nid);
+	return 0;
+}
+module_init(kcompactd_init)
+
 #if defined(CONFIG_SYSFS) && defined(CONFIG_NUMA)
 ssize_t sysfs_compact_node(struct sys_device *dev,
 			struct sysdev_attribute *attr,
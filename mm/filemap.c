@@ -459,6 +459,118 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 }
 EXPORT_SYMBOL_GPL(add_to_page_cache_lru);
 
+/*
+ * Pages inserted per hold of ->tree_lock by add_to_page_cache_lru_list(),
+ * which bounds the time spent with interrupts disabled.
+ */
+#define PAGE_CACHE_INSERT_BATCH	16
+
+/**
+ * add_to_page_cache_lru_list - add a list of new pages to the page cache
+ * @pages:	new pages linked through ->lru, with ->index set
+ * @mapping:	the address_space to add them to
+ * @gfp_mask:	memory allocation mode
+ * @filler:	called for each page added
+ * @data:	first argument to @filler
+ *
+ * The batched form of add_to_page_cache_lru(), for readahead.  All pages
+ * are charged up front, then inserted into the radix tree in index order,
+ * several per acquisition of ->tree_lock and radix tree preload.
+ *
+ * Pages which cannot be added (usually because the index was instantiated
+ * in the meantime) are released.  Each page added is taken off @pages,
+ * queued for the LRU and passed to @filler locked, just as after
+ * add_to_page_cache_lru(); the caller's reference on it is dropped once
+ * @filler returns.  The list is walked from its tail, which is the lowest
+ * index in the order readahead builds it.  @pages is empty on return.
+ *
+ * Returns the number of pages passed to @filler.
+ */
+unsigned add_to_page_cache_lru_list(struct list_head *pages,
+		struct address_space *mapping, gfp_t gfp_mask,
+		filler_t *filler, void *data)
+{
+	struct page *page, *next;
+	LIST_HEAD(failed);
+	unsigned batch = 0;
+	unsigned nr = 0;
+	bool locked = false;
+	int error;
+
+	list_for_each_entry_safe_reverse(page, next, pages, lru) {
+		if (mapping_cap_swap_backed(mapping))
+			SetPageSwapBacked(page);
+		__set_page_locked(page);
+		if (mem_cgroup_cache_charge(page, current->mm,
+					    gfp_mask & GFP_RECLAIM_MASK)) {
+			list_del(&page->lru);
+			__clear_page_locked(page);
+			page_cache_release(page);
+		}
+	}
+
+	list_for_each_entry_safe_reverse(page, next, pages, lru) {
+		if (!locked) {
+			if (radix_tree_preload(gfp_mask & ~__GFP_HIGHMEM)) {
+				list_move(&page->lru, &failed);
+				continue;
+			}
+			spin_lock_irq(&mapping->tree_lock);
+			locked = true;
+		}
+
+		page_cache_get(page);
+		page->mapping = mapping;
+		error = radix_tree_insert(&mapping->page_tree, page->index, page);
+		if (likely(!error)) {
+			mapping->nrpages++;
+			__inc_zone_page_state(page, NR_FILE_PAGES);
+			if (PageSwapBacked(page))
+				__inc_zone_page_state(page, NR_SHMEM);
+			nr++;
+		} else {
+			page->mapping = NULL;
+			page_cache_release(page);
+			list_move(&page->lru, &failed);
+		}
+
+		/* Start over with a fresh preload after a failed allocation */
+		if (error == -ENOMEM || ++batch == PAGE_CACHE_INSERT_BATCH) {
+			spin_unlock_irq(&mapping->tree_lock);
+			radix_tree_preload_end();
+			locked = false;
+			batch = 0;
+		}
+	}
+	if (locked) {
+		spin_unlock_irq(&mapping->tree_lock);
+		radix_tree_preload_end();
+	}
+
+	list_for_each_entry_safe(page, next, &failed, lru) {
+		list_del(&page->lru);
+		mem_cgroup_uncharge_cache_page(page);
+		__clear_page_locked(page);
+		page_cache_release(page);
+	}
+
+	/*
+	 * ->lru is needed for the LRU, so take the page off @pages before
+	 * the pagevec can drain.
+	 */
+	list_for_each_entry_safe_reverse(page, next, pages, lru) {
+		list_del(&page->lru);
+		if (page_is_file_cache(page))
+			lru_cache_add_file(page);
+		else
+			lru_cache_add_anon(page);
+		filler(data, page);
+		page_cache_release(page);
+	}
+	return nr;
+}
+EXPORT_SYMBOL_GPL(add_to_page_cache_lru_list);
+
 #ifdef CONFIG_NUMA
 struct page *__page_cache_alloc(gfp_t gfp)
 {
@@ -983,6 +1095,7 @@ static void do_generic_file_read(struct file *filp, loff_t *ppos,
 	int error;
 
 	index = *ppos >> PAGE_CACHE_SHIFT;
+	ra_select_stream(ra, index);
 	prev_index = ra->prev_pos >> PAGE_CACHE_SHIFT;
 	prev_offset = ra->prev_pos & (PAGE_CACHE_SIZE-1);
 	last_index = (*ppos + desc->count + PAGE_CACHE_SIZE-1) >> PAGE_CACHE_SHIFT;
@@ -1529,6 +1642,8 @@ int filemap_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	if (offset >= size)
 		return VM_FAULT_SIGBUS;
 
+	ra_select_stream(ra, offset);
+
 	/*
 	 * Do we have something in the page cache already?
 	 */
@@ -57,6 +57,7 @@
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/migrate.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -3126,6 +3127,70 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * A NUMA hinting pte was hit: make the pte usable again, then record
+ * which node the access came from and move the page there if it is
+ * misplaced according to the vma policy.
+ */
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pte_t *ptep, pmd_t *pmd, pte_t entry)
+{
+	struct page *page;
+	spinlock_t *ptl;
+	int page_nid;
+	int target_nid;
+	bool local;
+
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (unlikely(!pte_same(*ptep, entry))) {
+		pte_unmap_unlock(ptep, ptl);
+		return 0;
+	}
+
+	entry = pte_mknonnuma(entry);
+	set_pte_at(mm, address, ptep, entry);
+	update_mmu_cache(vma, address, ptep);
+
+	page = vm_normal_page(vma, address, entry);
+	if (!page) {
+		pte_unmap_unlock(ptep, ptl);
+		return 0;
+	}
+
+	get_page(page);
+	page_nid = page_to_nid(page);
+	target_nid = mpol_misplaced(page, vma, address);
+	pte_unmap_unlock(ptep, ptl);
+
+	local = page_nid == numa_node_id();
+	count_vm_event(NUMA_HINT_FAULTS);
+	if (local)
+		count_vm_event(NUMA_HINT_FAULTS_LOCAL);
+
+	if (target_nid != -1) {
+		/* migrate_misplaced_page() drops our reference */
+		if (migrate_misplaced_page(page, target_nid)) {
+			page_nid = target_nid;
+			local = true;
+		}
+	} else
+		put_page(page);
+
+	task_numa_fault(page_nid, 1, local);
+	return 0;
+}
+#else
+static inline int do_numa_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pte_t *ptep, pmd_t *pmd, pte_t entry)
+{
+	BUG();
+	return 0;
+}
+#endif
+
 /*
  * These routines also need to handle stuff like marking pages dirty
  * and/or accessed for architectures that don't do it in hardware (most
@@ -3164,6 +3229,9 @@ static inline int handle_pte_fault(struct mm_struct *mm,
 					pte, pmd, flags, entry);
 	}
 
+	if (pte_numa(entry))
+		return do_numa_page(mm, vma, address, pte, pmd, entry);
+
 	ptl = pte_lockptr(mm, pmd);
 	spin_lock(ptl);
 	if (unlikely(!pte_same(*pte, entry)))
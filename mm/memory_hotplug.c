@@ -29,6 +29,7 @@
 #include <linux/suspend.h>
 #include <linux/mm_inline.h>
 #include <linux/firmware-map.h>
+#include <linux/compaction.h>
 
 #include <asm/tlbflush.h>
 
@@ -441,6 +442,7 @@ int online_pages(unsigned long pfn, unsigned long nr_pages)
 	calculate_zone_inactive_ratio(zone);
 	if (onlined_pages) {
 		kswapd_run(zone_to_nid(zone));
+		kcompactd_run(zone_to_nid(zone));
 		node_set_state(zone_to_nid(zone), N_HIGH_MEMORY);
 	}
 
@@ -730,7 +732,8 @@ do_migrate_range(unsigned long start_pfn, unsigned long end_pfn)
 	if (list_empty(&source))
 		goto out;
 	/* this function returns # of failed pages */
-	ret = migrate_pages(&source, hotremove_migrate_alloc, 0, 1);
+	ret = migrate_pages(&source, hotremove_migrate_alloc, 0,
+							true, true);
 
 out:
 	return ret;
@@ -888,6 +891,7 @@ repeat:
 	if (!node_present_pages(node)) {
 		node_clear_state(node, N_HIGH_MEMORY);
 		kswapd_stop(node);
+		kcompactd_stop(node);
 	}
 
 	vm_total_pages = nr_free_pagecache_pages();
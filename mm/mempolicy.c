@@ -90,6 +90,7 @@
 #include <linux/syscalls.h>
 #include <linux/ctype.h>
 #include <linux/mm_inline.h>
+#include <linux/mmu_notifier.h>
 
 #include <asm/tlbflush.h>
 #include <asm/uaccess.h>
@@ -932,7 +933,7 @@ static int migrate_to_node(struct mm_struct *mm, int source, int dest,
 			flags | MPOL_MF_DISCONTIG_OK, &pagelist);
 
 	if (!list_empty(&pagelist))
-		err = migrate_pages(&pagelist, new_node_page, dest, 0);
+		err = migrate_pages(&pagelist, new_node_page, dest, 0, true);
 
 	return err;
 }
@@ -1149,7 +1150,7 @@ static long do_mbind(unsigned long start, unsigned long len,
 
 		if (!list_empty(&pagelist))
 			nr_failed = migrate_pages(&pagelist, new_vma_page,
-						(unsigned long)vma, 0);
+						(unsigned long)vma, 0, true);
 
 		if (!err && nr_failed && (flags & MPOL_MF_STRICT))
 			err = -EIO;
@@ -1496,6 +1497,151 @@ static struct mempolicy *get_vma_policy(struct task_struct *task,
 	return pol;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+static unsigned long change_pte_numa(struct vm_area_struct *vma, pmd_t *pmd,
+		unsigned long addr, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long pages = 0;
+	pte_t *orig_pte;
+	pte_t *pte;
+	spinlock_t *ptl;
+
+	orig_pte = pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	arch_enter_lazy_mmu_mode();
+	do {
+		struct page *page;
+		pte_t ptent;
+
+		if (!pte_present(*pte) || pte_numa(*pte))
+			continue;
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page || PageReserved(page) || PageKsm(page))
+			continue;
+		/*
+		 * Only private pages are worth a hinting fault: a shared
+		 * page has no single task whose accesses say where it
+		 * belongs.
+		 */
+		if (page_mapcount(page) != 1)
+			continue;
+
+		ptent = ptep_modify_prot_start(mm, addr, pte);
+		ptep_modify_prot_commit(mm, addr, pte, pte_mknuma(ptent));
+		pages++;
+	} while (pte++, addr += PAGE_SIZE, addr != end);
+	arch_leave_lazy_mmu_mode();
+	pte_unmap_unlock(orig_pte, ptl);
+	return pages;
+}
+
+static unsigned long change_pmd_numa(struct vm_area_struct *vma, pud_t *pud,
+		unsigned long addr, unsigned long end)
+{
+	unsigned long pages = 0;
+	unsigned long next;
+	pmd_t *pmd;
+
+	pmd = pmd_offset(pud, addr);
+	do {
+		next = pmd_addr_end(addr, end);
+		if (pmd_none_or_clear_bad(pmd))
+			continue;
+		pages += change_pte_numa(vma, pmd, addr, next);
+	} while (pmd++, addr = next, addr != end);
+	return pages;
+}
+
+static unsigned long change_pud_numa(struct vm_area_struct *vma, pgd_t *pgd,
+		unsigned long addr, unsigned long end)
+{
+	unsigned long pages = 0;
+	unsigned long next;
+	pud_t *pud;
+
+	pud = pud_offset(pgd, addr);
+	do {
+		next = pud_addr_end(addr, end);
+		if (pud_none_or_clear_bad(pud))
+			continue;
+		pages += change_pmd_numa(vma, pud, addr, next);
+	} while (pud++, addr = next, addr != end);
+	return pages;
+}
+
+/*
+ * Turn the private, present ptes in [start, end) into NUMA hinting ptes,
+ * so that the next access to each page traps into do_numa_page() and
+ * tells us which node it is being used from.  Returns the number of
+ * ptes changed.  Caller holds mmap_sem for read.
+ */
+unsigned long change_prot_numa(struct vm_area_struct *vma,
+			unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr = start;
+	unsigned long pages = 0;
+	unsigned long next;
+	pgd_t *pgd;
+
+	if (is_vm_hugetlb_page(vma))
+		return 0;
+
+	mmu_notifier_invalidate_range_start(mm, start, end);
+	pgd = pgd_offset(mm, addr);
+	flush_cache_range(vma, addr, end);
+	do {
+		next = pgd_addr_end(addr, end);
+		if (pgd_none_or_clear_bad(pgd))
+			continue;
+		pages += change_pud_numa(vma, pgd, addr, next);
+	} while (pgd++, addr = next, addr != end);
+	if (pages)
+		flush_tlb_range(vma, start, end);
+	mmu_notifier_invalidate_range_end(mm, start, end);
+
+	count_vm_events(NUMA_PTE_UPDATES, pages);
+	return pages;
+}
+
+/*
+ * mpol_misplaced - check whether the current node is a better home for
+ * @page, which has just taken a NUMA hinting fault at @addr in @vma.
+ *
+ * Returns the node the page should be moved to, or -1 if it is fine
+ * where it is.  Only policies which would have placed the page locally
+ * had it been allocated now (the default local policy and MPOL_BIND
+ * including this node) allow it to follow the faulting task.
+ */
+int mpol_misplaced(struct page *page, struct vm_area_struct *vma,
+		   unsigned long addr)
+{
+	int thisnid = numa_node_id();
+	struct mempolicy *pol;
+	int target = -1;
+
+	if (page_to_nid(page) == thisnid)
+		return -1;
+
+	pol = get_vma_policy(current, vma, addr);
+	switch (pol->mode) {
+	case MPOL_PREFERRED:
+		if (pol->flags & MPOL_F_LOCAL)
+			target = thisnid;
+		break;
+	case MPOL_BIND:
+		if (node_isset(thisnid, pol->v.nodes))
+			target = thisnid;
+		break;
+	default:
+		break;
+	}
+	mpol_cond_put(pol);
+
+	return target;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /*
  * Return a nodemask representing a mempolicy for filtering nodes for
  * page allocation
@@ -547,7 +547,7 @@ static int move_to_new_page(struct page *newpage, struct page *page,
  * to the newly allocated page in newpage.
  */
 static int unmap_and_move(new_page_t get_new_page, unsigned long private,
-			struct page *page, int force, int offlining)
+			struct page *page, int force, bool offlining, bool sync)
 {
 	int rc = 0;
 	int *result = NULL;
@@ -570,7 +570,7 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	rc = -EAGAIN;
 
 	if (!trylock_page(page)) {
-		if (!force)
+		if (!force || !sync)
 			goto move_newpage;
 		lock_page(page);
 	}
@@ -598,7 +598,7 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 	BUG_ON(charge);
 
 	if (PageWriteback(page)) {
-		if (!force)
+		if (!force || !sync)
 			goto uncharge;
 		wait_on_page_writeback(page);
 	}
@@ -735,10 +735,15 @@ move_newpage:
  * or no retryable pages exist anymore. All pages will be
  * returned to the LRU or freed.
  *
+ * If @sync is false, migration never sleeps on a page lock or on
+ * writeback; such pages are simply left behind. This is used by
+ * asynchronous compaction which must not stall the caller.
+ *
  * Return: Number of pages not migrated or error code.
  */
 int migrate_pages(struct list_head *from,
-		new_page_t get_new_page, unsigned long private, int offlining)
+		new_page_t get_new_page, unsigned long private, bool offlining,
+		bool sync)
 {
 	int retry = 1;
 	int nr_failed = 0;
@@ -758,7 +763,8 @@ int migrate_pages(struct list_head *from,
 			cond_resched();
 
 			rc = unmap_and_move(get_new_page, private,
-						page, pass > 2, offlining);
+						page, pass > 2, offlining,
+						sync);
 
 			switch(rc) {
 			case -ENOMEM:
@@ -892,7 +898,7 @@ set_status:
 	err = 0;
 	if (!list_empty(&pagelist))
 		err = migrate_pages(&pagelist, new_page_node,
-				(unsigned long)pm, 0);
+				(unsigned long)pm, 0, true);
 
 	up_read(&mm->mmap_sem);
 	return err;
@@ -1151,4 +1157,49 @@ int migrate_vmas(struct mm_struct *mm, const nodemask_t *to,
  	}
  	return err;
 }
+
+#ifdef CONFIG_NUMA_BALANCING
+static struct page *alloc_misplaced_dst_page(struct page *page,
+					   unsigned long data, int **result)
+{
+	int nid = (int) data;
+
+	/*
+	 * Don't try hard: if the target node is short of memory the page
+	 * is better left where it is than reclaim started on its behalf.
+	 */
+	return alloc_pages_exact_node(nid,
+			(GFP_HIGHUSER_MOVABLE & ~__GFP_WAIT) |
+			__GFP_THISNODE | __GFP_NOMEMALLOC |
+			__GFP_NORETRY | __GFP_NOWARN, 0);
+}
+
+/*
+ * Move a page that took a NUMA hinting fault to @node.  The caller holds
+ * a reference on @page, which is dropped here.  Returns true if the page
+ * was migrated.
+ */
+bool migrate_misplaced_page(struct page *page, int node)
+{
+	LIST_HEAD(migratepages);
+	int nr_remaining;
+
+	if (isolate_lru_page(page)) {
+		put_page(page);
+		return false;
+	}
+	/* isolate_lru_page() took its own reference */
+	put_page(page);
+
+	list_add(&page->lru, &migratepages);
+	inc_zone_page_state(page, NR_ISOLATED_ANON + page_is_file_cache(page));
+	nr_remaining = migrate_pages(&migratepages, alloc_misplaced_dst_page,
+				     node, false, false);
+	if (nr_remaining)
+		return false;
+
+	count_vm_event(NUMA_PAGE_MIGRATE);
+	return true;
+}
+#endif /* CONFIG_NUMA_BALANCING */
 #endif
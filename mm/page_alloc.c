@@ -574,8 +574,9 @@ static inline int free_pages_check(struct page *page)
 
 /*
  * Frees a number of pages from the PCP lists
- * Assumes all pages on list are in same zone, and of same order.
- * count is the number of pages to free.
+ * Assumes all pages on list are in same zone.
+ * count is the number of base pages to free; as the lists hold pages of
+ * several orders, slightly more may be freed. pcp->count is updated.
  *
  * If the zone was previously in an "all pages pinned" state then look to
  * see if this freeing clears that state.
@@ -586,17 +587,19 @@ static inline int free_pages_check(struct page *page)
 static void free_pcppages_bulk(struct zone *zone, int count,
 					struct per_cpu_pages *pcp)
 {
-	int migratetype = 0;
+	int pindex = 0;
 	int batch_free = 0;
-	int to_free = count;
+	int to_free = min(count, pcp->count);
+	int freed = 0;
 
 	spin_lock(&zone->lock);
 	zone->all_unreclaimable = 0;
 	zone->pages_scanned = 0;
 
-	while (to_free) {
+	while (to_free > 0) {
 		struct page *page;
 		struct list_head *list;
+		unsigned int order;
 
 		/*
 		 * Remove pages from lists in a round-robin fashion. A
@@ -607,24 +610,65 @@ static void free_pcppages_bulk(struct zone *zone, int count,
 		 */
 		do {
 			batch_free++;
-			if (++migratetype == MIGRATE_PCPTYPES)
-				migratetype = 0;
-			list = &pcp->lists[migratetype];
+			if (++pindex == NR_PCP_LISTS)
+				pindex = 0;
+			list = &pcp->lists[pindex];
 		} while (list_empty(list));
 
+		order = pindex_to_order(pindex);
 		do {
 			page = list_entry(list->prev, struct page, lru);
 			/* must delete as __free_one_page list manipulates */
 			list_del(&page->lru);
 			/* MIGRATE_MOVABLE list may include MIGRATE_RESERVEs */
-			__free_one_page(page, zone, 0, page_private(page));
-			trace_mm_page_pcpu_drain(page, 0, page_private(page));
-		} while (--to_free && --batch_free && !list_empty(list));
+			__free_one_page(page, zone, order, page_private(page));
+			trace_mm_page_pcpu_drain(page, order, page_private(page));
+			freed += 1 << order;
+			to_free -= 1 << order;
+		} while (to_free > 0 && --batch_free && !list_empty(list));
 	}
-	__mod_zone_page_state(zone, NR_FREE_PAGES, count);
+	pcp->count -= freed;
+	__mod_zone_page_state(zone, NR_FREE_PAGES, freed);
 	spin_unlock(&zone->lock);
 }
 
+/*
+ * Number of base pages to move from the buddy lists to an empty pcp list
+ * of the given order. Each consecutive refill without a free in between
+ * doubles the batch, so a CPU allocating at a high rate takes zone->lock
+ * less often; the total is capped so the lists stay below pcp->high.
+ */
+static int nr_pcp_alloc(struct per_cpu_pages *pcp, unsigned int order)
+{
+	int batch = pcp->batch << pcp->alloc_factor;
+
+	batch = min(batch, max(pcp->high - pcp->count, pcp->batch));
+	if (pcp->alloc_factor < PCP_BATCH_SCALE_MAX &&
+	    batch < pcp->high / 2)
+		pcp->alloc_factor++;
+	pcp->free_factor >>= 1;
+
+	/* Always refill at least a couple of pages of a high order */
+	return max(batch >> order, 2);
+}
+
+/*
+ * Number of base pages to return to the buddy lists once pcp->high is
+ * reached, scaled up while a CPU frees without allocating in between.
+ */
+static int nr_pcp_free(struct per_cpu_pages *pcp)
+{
+	int batch = pcp->batch << pcp->free_factor;
+
+	batch = min(batch, pcp->count - pcp->batch);
+	if (pcp->free_factor < PCP_BATCH_SCALE_MAX &&
+	    batch < pcp->high / 2)
+		pcp->free_factor++;
+	pcp->alloc_factor >>= 1;
+
+	return max(batch, pcp->batch);
+}
+
 static void free_one_page(struct zone *zone, struct page *page, int order,
 				int migratetype)
 {
@@ -666,11 +710,19 @@ static bool free_pages_prepare(struct page *page, unsigned int order)
 	return true;
 }
 
+static void free_pcp_page(struct page *page, unsigned int order, int cold);
+
 static void __free_pages_ok(struct page *page, unsigned int order)
 {
 	unsigned long flags;
-	int wasMlocked = __TestClearPageMlocked(page);
+	int wasMlocked;
 
+	if (order <= PAGE_ALLOC_PCP_MAX_ORDER) {
+		free_pcp_page(page, order, 0);
+		return;
+	}
+
+	wasMlocked = __TestClearPageMlocked(page);
 	if (!free_pages_prepare(page, order))
 		return;
 
@@ -1064,7 +1116,6 @@ void drain_zone_pages(struct zone *zone, struct per_cpu_pages *pcp)
 	else
 		to_drain = pcp->count;
 	free_pcppages_bulk(zone, to_drain, pcp);
-	pcp->count -= to_drain;
 	local_irq_restore(flags);
 }
 #endif
@@ -1090,7 +1141,6 @@ static void drain_pages(unsigned int cpu)
 
 		pcp = &pset->pcp;
 		free_pcppages_bulk(zone, pcp->count, pcp);
-		pcp->count = 0;
 		local_irq_restore(flags);
 	}
 }
@@ -1148,18 +1198,19 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
+ * Free a page of order up to PAGE_ALLOC_PCP_MAX_ORDER to the per-cpu lists
  * cold == 1 ? free a cold page : free a hot page
  */
-void free_hot_cold_page(struct page *page, int cold)
+static void free_pcp_page(struct page *page, unsigned int order, int cold)
 {
 	struct zone *zone = page_zone(page);
 	struct per_cpu_pages *pcp;
+	struct list_head *list;
 	unsigned long flags;
 	int migratetype;
 	int wasMlocked = __TestClearPageMlocked(page);
 
-	if (!free_pages_prepare(page, 0))
+	if (!free_pages_prepare(page, order))
 		return;
 
 	migratetype = get_pageblock_migratetype(page);
@@ -1167,7 +1218,7 @@ void free_hot_cold_page(struct page *page, int cold)
 	local_irq_save(flags);
 	if (unlikely(wasMlocked))
 		free_page_mlock(page);
-	__count_vm_event(PGFREE);
+	__count_vm_events(PGFREE, 1 << order);
 
 	/*
 	 * We only track unmovable, reclaimable and movable on pcp lists.
@@ -1178,27 +1229,35 @@ void free_hot_cold_page(struct page *page, int cold)
 	 */
 	if (migratetype >= MIGRATE_PCPTYPES) {
 		if (unlikely(migratetype == MIGRATE_ISOLATE)) {
-			free_one_page(zone, page, 0, migratetype);
+			free_one_page(zone, page, order, migratetype);
 			goto out;
 		}
 		migratetype = MIGRATE_MOVABLE;
 	}
 
 	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = &pcp->lists[order_to_pindex(migratetype, order)];
 	if (cold)
-		list_add_tail(&page->lru, &pcp->lists[migratetype]);
+		list_add_tail(&page->lru, list);
 	else
-		list_add(&page->lru, &pcp->lists[migratetype]);
-	pcp->count++;
-	if (pcp->count >= pcp->high) {
-		free_pcppages_bulk(zone, pcp->batch, pcp);
-		pcp->count -= pcp->batch;
-	}
+		list_add(&page->lru, list);
+	pcp->count += 1 << order;
+	if (pcp->count >= pcp->high)
+		free_pcppages_bulk(zone, nr_pcp_free(pcp), pcp);
 
 out:
 	local_irq_restore(flags);
 }
 
+/*
+ * Free a 0-order page
+ * cold == 1 ? free a cold page : free a hot page
+ */
+void free_hot_cold_page(struct page *page, int cold)
+{
+	free_pcp_page(page, 0, cold);
+}
+
 /*
  * split_page takes a non-compound higher-order page, and splits it into
  * n (1<<order) sub-pages: page[0..n]
@@ -1287,17 +1346,17 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 	int cold = !!(gfp_flags & __GFP_COLD);
 
 again:
-	if (likely(order == 0)) {
+	if (likely(order <= PAGE_ALLOC_PCP_MAX_ORDER)) {
 		struct per_cpu_pages *pcp;
 		struct list_head *list;
 
 		local_irq_save(flags);
 		pcp = &this_cpu_ptr(zone->pageset)->pcp;
-		list = &pcp->lists[migratetype];
+		list = &pcp->lists[order_to_pindex(migratetype, order)];
 		if (list_empty(list)) {
-			pcp->count += rmqueue_bulk(zone, 0,
-					pcp->batch, list,
-					migratetype, cold);
+			pcp->count += rmqueue_bulk(zone, order,
+					nr_pcp_alloc(pcp, order), list,
+					migratetype, cold) << order;
 			if (unlikely(list_empty(list)))
 				goto failed;
 		}
@@ -1308,7 +1367,7 @@ again:
 			page = list_entry(list->next, struct page, lru);
 
 		list_del(&page->lru);
-		pcp->count--;
+		pcp->count -= 1 << order;
 	} else {
 		if (unlikely(gfp_flags & __GFP_NOFAIL)) {
 			/*
@@ -1918,9 +1977,21 @@ void wake_all_kswapd(unsigned int order, struct zonelist *zonelist,
 {
 	struct zoneref *z;
 	struct zone *zone;
+	pg_data_t *last_pgdat = NULL;
 
-	for_each_zone_zonelist(zone, z, zonelist, high_zoneidx)
+	for_each_zone_zonelist(zone, z, zonelist, high_zoneidx) {
 		wakeup_kswapd(zone, order);
+
+		/*
+		 * kcompactd keeps the lowest classzone it is woken for, so
+		 * wake it once per node with the classzone of the allocation
+		 * rather than with each zone in turn.
+		 */
+		if (zone->zone_pgdat == last_pgdat)
+			continue;
+		last_pgdat = zone->zone_pgdat;
+		wakeup_kcompactd(last_pgdat, order, high_zoneidx);
+	}
 }
 
 static inline int
@@ -3357,7 +3428,7 @@ static int zone_batchsize(struct zone *zone)
 static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 {
 	struct per_cpu_pages *pcp;
-	int migratetype;
+	int pindex;
 
 	memset(p, 0, sizeof(*p));
 
@@ -3365,8 +3436,8 @@ static void setup_pageset(struct per_cpu_pageset *p, unsigned long batch)
 	pcp->count = 0;
 	pcp->high = 6 * batch;
 	pcp->batch = max(1UL, 1 * batch);
-	for (migratetype = 0; migratetype < MIGRATE_PCPTYPES; migratetype++)
-		INIT_LIST_HEAD(&pcp->lists[migratetype]);
+	for (pindex = 0; pindex < NR_PCP_LISTS; pindex++)
+		INIT_LIST_HEAD(&pcp->lists[pindex]);
 }
 
 /*
@@ -4058,6 +4129,9 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat_resize_init(pgdat);
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
+#ifdef CONFIG_COMPACTION
+	init_waitqueue_head(&pgdat->kcompactd_wait);
+#endif
 	pgdat->kswapd_max_order = 0;
 	pgdat_page_cgroup_init(pgdat);
 	
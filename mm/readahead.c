@@ -25,8 +25,12 @@
 void
 file_ra_state_init(struct file_ra_state *ra, struct address_space *mapping)
 {
+	int i;
+
 	ra->ra_pages = mapping->backing_dev_info->ra_pages;
 	ra->prev_pos = -1;
+	for (i = 0; i < RA_SAVED_STREAMS; i++)
+		ra->streams[i].prev_pos = -1;
 }
 EXPORT_SYMBOL_GPL(file_ra_state_init);
 
@@ -109,9 +113,11 @@ EXPORT_SYMBOL(read_cache_pages);
 static int read_pages(struct address_space *mapping, struct file *filp,
 		struct list_head *pages, unsigned nr_pages)
 {
-	unsigned page_idx;
+	struct blk_plug plug;
 	int ret;
 
+	blk_start_plug(&plug);
+
 	if (mapping->a_ops->readpages) {
 		ret = mapping->a_ops->readpages(filp, mapping, pages, nr_pages);
 		/* Clean up the remaining pages */
@@ -119,17 +125,11 @@ static int read_pages(struct address_space *mapping, struct file *filp,
 		goto out;
 	}
 
-	for (page_idx = 0; page_idx < nr_pages; page_idx++) {
-		struct page *page = list_to_page(pages);
-		list_del(&page->lru);
-		if (!add_to_page_cache_lru(page, mapping,
-					page->index, GFP_KERNEL)) {
-			mapping->a_ops->readpage(filp, page);
-		}
-		page_cache_release(page);
-	}
+	add_to_page_cache_lru_list(pages, mapping, GFP_KERNEL,
+				   (filler_t *)mapping->a_ops->readpage, filp);
 	ret = 0;
 out:
+	blk_finish_plug(&plug);
 	return ret;
 }
 
@@ -328,7 +328,134 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  *
  * The code ramps up the readahead size aggressively at first, but slow down as
  * it approaches max_readhead.
+ *
+ * Several threads may read one file through the same struct file, e.g. a
+ * storage engine issuing pread()s at unrelated offsets. The fields above
+ * then describe the most recently used stream only, and up to
+ * RA_SAVED_STREAMS other streams are kept in ra->streams[]. A read that
+ * does not continue the current stream swaps in the saved stream it
+ * continues, see ra_select_stream().
+ *
+ * A stream that reads fixed size chunks with a fixed gap between them is
+ * detected through ra->stride, the distance from the last page of one read
+ * to the first page of the next. Once two reads in a row leave the same
+ * gap, the following chunks are read ahead individually.
+ *
+ * The maximum window is ra_pages, scaled by up to 1 << RA_MAX_SCALE when
+ * the reader keeps catching up with readahead I/O that is still in flight,
+ * which means the window does not cover the device latency at the rate the
+ * stream is consumed. Read congestion on the device scales it back down.
+ */
+
+#define RA_MAX_SCALE	2
+
+/*
+ * Returns true if a read at @offset continues the stream described by the
+ * readahead window @start/@size, the previous read position @prev_pos or
+ * the stride @stride.
+ */
+static bool ra_stream_match(pgoff_t start, unsigned int size,
+			    loff_t prev_pos, unsigned long stride,
+			    pgoff_t offset)
+{
+	pgoff_t prev_index = prev_pos >> PAGE_CACHE_SHIFT;
+
+	if (size && offset >= start && offset <= start + size)
+		return true;
+
+	if (prev_pos == -1)
+		return false;
+
+	if (offset - prev_index <= 1UL)
+		return true;
+
+	return stride && offset == prev_index + stride;
+}
+
+/*
+ * Make the stream that a read at @offset belongs to the current one in @ra.
+ * The current stream is only saved if it established a readahead window,
+ * so that small random reads do not push out the streams worth keeping.
+ *
+ * Readers call this before they use or update ra->prev_pos, including for
+ * reads served from the page cache, so that every stream keeps its own.
+ */
+void ra_select_stream(struct file_ra_state *ra, pgoff_t offset)
+{
+	struct file_ra_stream next;
+	bool found = false;
+	int i;
+
+	if (ra_stream_match(ra->start, ra->size, ra->prev_pos,
+			    ra->stride, offset))
+		return;
+
+	for (i = 0; i < RA_SAVED_STREAMS; i++) {
+		struct file_ra_stream *s = &ra->streams[i];
+
+		if (ra_stream_match(s->start, s->size, s->prev_pos,
+				    s->stride, offset)) {
+			found = true;
+			break;
+		}
+	}
+
+	if (!found) {
+		if (!ra->size)
+			return;
+		/* Evict the least recently used saved stream */
+		i = RA_SAVED_STREAMS - 1;
+	}
+
+	next = ra->streams[i];
+	memmove(&ra->streams[1], &ra->streams[0], i * sizeof(next));
+	ra->streams[0].start = ra->start;
+	ra->streams[0].size = ra->size;
+	ra->streams[0].async_size = ra->async_size;
+	ra->streams[0].prev_pos = ra->prev_pos;
+	ra->streams[0].stride = ra->stride;
+
+	if (found) {
+		ra->start = next.start;
+		ra->size = next.size;
+		ra->async_size = next.async_size;
+		ra->prev_pos = next.prev_pos;
+		ra->stride = next.stride;
+	} else {
+		ra->start = 0;
+		ra->size = 0;
+		ra->async_size = 0;
+		ra->prev_pos = -1;
+		ra->stride = 0;
+	}
+}
+
+/*
+ * Read the chunk at @offset and the following chunks of a strided stream,
+ * enough of them to fill one readahead window. The first page of the chunk
+ * in the middle is marked so that reaching it reads the next batch.
  */
+static unsigned long stride_readahead(struct address_space *mapping,
+				      struct file_ra_state *ra,
+				      struct file *filp, pgoff_t offset,
+				      unsigned long req_size, unsigned long max)
+{
+	unsigned long step = ra->stride + req_size - 1;
+	unsigned long nr_chunks = max(max / req_size, 2UL) & ~1UL;
+	unsigned long i, ret = 0;
+
+	for (i = 0; i < nr_chunks; i++)
+		ret += __do_page_cache_readahead(mapping, filp,
+				offset + i * step, req_size,
+				i == nr_chunks / 2 ? req_size : 0);
+
+	/* Describe the chunk just read as the window of this stream */
+	ra->start = offset;
+	ra->size = req_size;
+	ra->async_size = 0;
+
+	return ret;
+}
 
 /*
  * Count contiguously cached pages from @offset-1 to @offset-@max,
@@ -392,7 +519,10 @@ ondemand_readahead(struct address_space *mapping,
 		   bool hit_readahead_marker, pgoff_t offset,
 		   unsigned long req_size)
 {
-	unsigned long max = max_sane_readahead(ra->ra_pages);
+	unsigned long max;
+	pgoff_t prev_index;
+
+	max = max_sane_readahead((unsigned long)ra->ra_pages << ra->ra_scale);
 
 	/*
 	 * start of file
@@ -400,6 +530,18 @@ ondemand_readahead(struct address_space *mapping,
 	if (!offset)
 		goto initial_readahead;
 
+	ra_select_stream(ra, offset);
+	prev_index = ra->prev_pos >> PAGE_CACHE_SHIFT;
+
+	/*
+	 * The read leaves the same gap to the previous one as that did to
+	 * its predecessor: a strided stream.
+	 */
+	if (ra->stride && ra->prev_pos != -1 && req_size <= max &&
+	    offset == prev_index + ra->stride)
+		return stride_readahead(mapping, ra, filp, offset,
+					req_size, max);
+
 	/*
 	 * It's the expected callback offset, assume sequential access.
 	 * Ramp up sizes, and push forward the readahead window.
@@ -445,9 +587,18 @@ ondemand_readahead(struct address_space *mapping,
 	/*
 	 * sequential cache miss
 	 */
-	if (offset - (ra->prev_pos >> PAGE_CACHE_SHIFT) <= 1UL)
+	if (offset - prev_index <= 1UL)
 		goto initial_readahead;
 
+	/*
+	 * Remember the gap to the previous read, the next read confirms
+	 * a strided stream if it leaves the same gap.
+	 */
+	if (ra->prev_pos != -1 && offset > prev_index)
+		ra->stride = offset - prev_index;
+	else
+		ra->stride = 0;
+
 	/*
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
@@ -462,6 +613,7 @@ ondemand_readahead(struct address_space *mapping,
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
 initial_readahead:
+	ra->stride = 0;
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
@@ -547,10 +699,21 @@ page_cache_async_readahead(struct address_space *mapping,
 	ClearPageReadahead(page);
 
 	/*
-	 * Defer asynchronous read-ahead on IO congestion.
+	 * Defer asynchronous read-ahead on IO congestion, and do not let
+	 * the window grow past ra_pages while the device is saturated.
 	 */
-	if (bdi_read_congested(mapping->backing_dev_info))
+	if (bdi_read_congested(mapping->backing_dev_info)) {
+		if (ra->ra_scale)
+			ra->ra_scale--;
 		return;
+	}
+
+	/*
+	 * The reader caught up with readahead I/O that is still in flight,
+	 * so the window is too small for the latency of the device.
+	 */
+	if (!PageUptodate(page) && ra->ra_scale < RA_MAX_SCALE)
+		ra->ra_scale++;
 
 	/* do read-ahead */
 	ondemand_readahead(mapping, ra, filp, true, offset, req_size);
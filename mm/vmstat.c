@@ -470,6 +470,24 @@ int fragmentation_index(struct zone *zone, unsigned int order)
 	fill_contig_page_info(zone, order, &info);
 	return __fragmentation_index(order, &info);
 }
+
+/*
+ * Return the percentage of free memory in a zone that is held in blocks
+ * too small to satisfy an allocation of the given order. 0 means every
+ * free page could be used for such an allocation, 100 means none could.
+ */
+unsigned int extfrag_for_order(struct zone *zone, unsigned int order)
+{
+	struct contig_page_info info;
+
+	fill_contig_page_info(zone, order, &info);
+	if (!info.free_pages)
+		return 0;
+
+	return div_u64((u64)(info.free_pages -
+			(info.free_blocks_suitable << order)) * 100,
+			info.free_pages);
+}
 #endif
 
 #if defined(CONFIG_PROC_FS) || defined(CONFIG_COMPACTION)
@@ -789,6 +807,13 @@ static const char * const vmstat_text[] = {
 
 	"pgrotated",
 
+#ifdef CONFIG_NUMA_BALANCING
+	"numa_pte_updates",
+	"numa_hint_faults",
+	"numa_hint_faults_local",
+	"numa_pages_migrated",
+#endif
+
 #ifdef CONFIG_COMPACTION
 	"compact_blocks_moved",
 	"compact_pages_moved",
@@ -796,6 +821,9 @@ static const char * const vmstat_text[] = {
 	"compact_stall",
 	"compact_fail",
 	"compact_success",
+	"compact_daemon_wake",
+	"compact_daemon_proactive",
+	"compact_daemon_stall_avoided",
 #endif
 
 #ifdef CONFIG_HUGETLB_PAGE
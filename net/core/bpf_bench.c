@@ -0,0 +1,233 @@
+/*
+ * Socket filter benchmark
+ *
+ * Loading this module runs a few typical socket filters over a set of
+ * synthetic Ethernet/IPv4/UDP packets, checks that the JIT compiled
+ * code (if any) agrees with the interpreter on every packet and reports
+ * the cost per packet of both.  The JIT is only used when
+ * /proc/sys/net/core/bpf_jit_enable is set.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/ip.h>
+#include <linux/in.h>
+#include <linux/udp.h>
+#include <linux/ktime.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <net/sock.h>
+
+#define NR_PACKETS	64
+
+static unsigned int iterations = 100000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "number of passes over the packet set");
+
+/* tcpdump -dd "ip and udp dst port 53" */
+static struct sock_filter udp_dns_insns[] = {
+	{ 0x28, 0, 0, 0x0000000c },	/* ldh [12] */
+	{ 0x15, 0, 8, 0x00000800 },	/* jeq #0x800 */
+	{ 0x30, 0, 0, 0x00000017 },	/* ldb [23] */
+	{ 0x15, 0, 6, 0x00000011 },	/* jeq #17 */
+	{ 0x28, 0, 0, 0x00000014 },	/* ldh [20] */
+	{ 0x45, 4, 0, 0x00001fff },	/* jset #0x1fff */
+	{ 0xb1, 0, 0, 0x0000000e },	/* ldxb 4*([14]&0xf) */
+	{ 0x48, 0, 0, 0x00000010 },	/* ldh [x + 16] */
+	{ 0x15, 0, 1, 0x00000035 },	/* jeq #53 */
+	{ 0x06, 0, 0, 0x0000ffff },	/* ret #65535 */
+	{ 0x06, 0, 0, 0x00000000 },	/* ret #0 */
+};
+
+/* IPv4 packets of less than 1000 bytes sent to this host */
+static struct sock_filter host_small_insns[] = {
+	{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_PKTTYPE },
+	{ BPF_ST, 0, 0, 0 },				/* M[0] = pkt_type */
+	{ BPF_LD | BPF_H | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_PROTOCOL },
+	{ BPF_JMP | BPF_JEQ | BPF_K, 0, 5, ETH_P_IP },
+	{ BPF_LD | BPF_W | BPF_LEN, 0, 0, 0 },
+	{ BPF_JMP | BPF_JGT | BPF_K, 3, 0, 1000 },
+	{ BPF_LD | BPF_MEM, 0, 0, 0 },
+	{ BPF_JMP | BPF_JEQ | BPF_K, 0, 1, PACKET_HOST },
+	{ BPF_RET | BPF_K, 0, 0, 0xffff },
+	{ BPF_RET | BPF_K, 0, 0, 0 },
+};
+
+struct bpf_bench_filter {
+	const char		*name;
+	struct sock_filter	*insns;
+	unsigned int		len;
+};
+
+static struct bpf_bench_filter bpf_bench_filters[] = {
+	{ "ip and udp dst port 53", udp_dns_insns,
+	  ARRAY_SIZE(udp_dns_insns) },
+	{ "pkttype host, ipv4, len <= 1000", host_small_insns,
+	  ARRAY_SIZE(host_small_insns) },
+};
+
+static struct sk_buff *bpf_bench_skbs[NR_PACKETS];
+
+static struct sk_buff *bpf_bench_alloc_skb(unsigned int i)
+{
+	unsigned int payload = 32 + (i % 4) * 400;
+	struct sk_buff *skb;
+	struct ethhdr *eth;
+	struct iphdr *iph;
+	struct udphdr *uh;
+
+	skb = alloc_skb(ETH_HLEN + sizeof(*iph) + sizeof(*uh) + payload,
+			GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	eth = (struct ethhdr *)skb_put(skb, ETH_HLEN);
+	memset(eth, 0, ETH_HLEN);
+	eth->h_proto = htons(ETH_P_IP);
+
+	iph = (struct iphdr *)skb_put(skb, sizeof(*iph));
+	memset(iph, 0, sizeof(*iph));
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_UDP;
+	iph->tot_len = htons(sizeof(*iph) + sizeof(*uh) + payload);
+	iph->saddr = htonl(0x0a000001);
+	iph->daddr = htonl(0x0a000002 + i);
+
+	uh = (struct udphdr *)skb_put(skb, sizeof(*uh));
+	uh->source = htons(1024 + i);
+	uh->dest = htons(i % 2 ? 53 : 5353 + i);
+	uh->len = htons(sizeof(*uh) + payload);
+	uh->check = 0;
+
+	memset(skb_put(skb, payload), 0, payload);
+
+	skb->protocol = htons(ETH_P_IP);
+	skb->pkt_type = i % 3 ? PACKET_HOST : PACKET_OTHERHOST;
+	return skb;
+}
+
+static u64 bpf_bench_interp(struct sk_filter *fp, unsigned int *res)
+{
+	unsigned int n, i, sum = 0;
+	ktime_t start = ktime_get();
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < NR_PACKETS; i++)
+			sum += sk_run_filter(bpf_bench_skbs[i], fp->insns,
+					     fp->len);
+	*res = sum;
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static u64 bpf_bench_jit(struct sk_filter *fp, unsigned int *res)
+{
+	unsigned int n, i, sum = 0;
+	ktime_t start = ktime_get();
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < NR_PACKETS; i++)
+			sum += fp->bpf_func(bpf_bench_skbs[i], fp->insns);
+	*res = sum;
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+static int __init bpf_bench_one(const struct bpf_bench_filter *bf)
+{
+	u64 packets = (u64)iterations * NR_PACKETS;
+	unsigned int i, sum_interp, sum_jit;
+	struct sk_filter *fp;
+	u64 ns;
+	int err;
+
+	fp = kmalloc(sizeof(*fp) + bf->len * sizeof(struct sock_filter),
+		     GFP_KERNEL);
+	if (!fp)
+		return -ENOMEM;
+	memcpy(fp->insns, bf->insns, bf->len * sizeof(struct sock_filter));
+	atomic_set(&fp->refcnt, 1);
+	fp->len = bf->len;
+	fp->bpf_func = __sk_run_filter;
+
+	err = sk_chk_filter(fp->insns, fp->len);
+	if (err) {
+		pr_err("bpf_bench: %s: invalid filter (%d)\n", bf->name, err);
+		goto out;
+	}
+
+	bpf_jit_compile(fp);
+
+	for (i = 0; i < NR_PACKETS; i++) {
+		unsigned int want = sk_run_filter(bpf_bench_skbs[i],
+						  fp->insns, fp->len);
+		unsigned int got = fp->bpf_func(bpf_bench_skbs[i], fp->insns);
+
+		if (want != got) {
+			pr_err("bpf_bench: %s: packet %u: interpreter %u, "
+			       "jit %u\n", bf->name, i, want, got);
+			err = -EINVAL;
+			goto out;
+		}
+	}
+
+	ns = bpf_bench_interp(fp, &sum_interp);
+	pr_info("bpf_bench: %s: interpreter %llu ns/packet\n",
+		bf->name, (unsigned long long)div64_u64(ns, packets));
+
+	if (fp->bpf_func == __sk_run_filter) {
+		pr_info("bpf_bench: %s: not JIT compiled\n", bf->name);
+		goto out;
+	}
+
+	cond_resched();
+	ns = bpf_bench_jit(fp, &sum_jit);
+	pr_info("bpf_bench: %s: jit %llu ns/packet\n",
+		bf->name, (unsigned long long)div64_u64(ns, packets));
+	if (sum_jit != sum_interp)
+		pr_err("bpf_bench: %s: result mismatch\n", bf->name);
+out:
+	sk_filter_release(fp);
+	return err;
+}
+
+static int __init bpf_bench_init(void)
+{
+	unsigned int i;
+	int err = 0;
+
+	for (i = 0; i < NR_PACKETS; i++) {
+		bpf_bench_skbs[i] = bpf_bench_alloc_skb(i);
+		if (!bpf_bench_skbs[i]) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < ARRAY_SIZE(bpf_bench_filters) && !err; i++) {
+		err = bpf_bench_one(&bpf_bench_filters[i]);
+		cond_resched();
+	}
+out:
+	for (i = 0; i < NR_PACKETS; i++)
+		kfree_skb(bpf_bench_skbs[i]);
+	return err;
+}
+
+static void __exit bpf_bench_exit(void)
+{
+}
+
+module_init(bpf_bench_init);
+module_exit(bpf_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Socket filter interpreter/JIT benchmark");
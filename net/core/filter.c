@@ -89,8 +89,8 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	rcu_read_lock_bh();
 	filter = rcu_dereference_bh(sk->sk_filter);
 	if (filter) {
-		unsigned int pkt_len = sk_run_filter(skb, filter->insns,
-				filter->len);
+		unsigned int pkt_len = SK_RUN_FILTER(filter, skb);
+
 		err = pkt_len ? pskb_trim(skb, pkt_len) : -EPERM;
 	}
 	rcu_read_unlock_bh();
@@ -361,6 +361,25 @@ load_b:
 }
 EXPORT_SYMBOL(sk_run_filter);
 
+/**
+ *	__sk_run_filter - run the interpreter on an attached filter
+ *	@skb: buffer to run the filter on
+ *	@filter: the insns[] of a struct sk_filter
+ *
+ * Same as sk_run_filter(), with the calling convention of
+ * sk_filter->bpf_func: the filter length is taken from the sk_filter
+ * that @filter is embedded in.  This is what runs filters the JIT did
+ * not (or could not) compile.
+ */
+unsigned int __sk_run_filter(struct sk_buff *skb, struct sock_filter *filter)
+{
+	struct sk_filter *fp = (struct sk_filter *)
+		((char *)filter - offsetof(struct sk_filter, insns));
+
+	return sk_run_filter(skb, filter, fp->len);
+}
+EXPORT_SYMBOL(__sk_run_filter);
+
 /**
  *	sk_chk_filter - verify socket filter code
  *	@filter: filter to verify
@@ -631,6 +650,7 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+	fp->bpf_func = __sk_run_filter;
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
@@ -638,6 +658,8 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 		return err;
 	}
 
+	bpf_jit_compile(fp);
+
 	rcu_read_lock_bh();
 	old_fp = rcu_dereference_bh(sk->sk_filter);
 	rcu_assign_pointer(sk->sk_filter, fp);
@@ -153,6 +153,9 @@ void inet_sock_destruct(struct sock *sk)
 	WARN_ON(sk->sk_wmem_queued);
 	WARN_ON(sk->sk_forward_alloc);
 
+	if (sk->sk_type == SOCK_STREAM && sk->sk_protocol == IPPROTO_TCP)
+		kfree(inet_csk(sk)->icsk_accept_queue.fastopenq);
+
 	kfree(inet->opt);
 	dst_release(rcu_dereference_check(sk->sk_dst_cache, 1));
 	sk_refcnt_debug_dec(sk);
@@ -546,11 +549,12 @@ int inet_dgram_connect(struct socket *sock, struct sockaddr * uaddr,
 }
 EXPORT_SYMBOL(inet_dgram_connect);
 
-static long inet_wait_for_connect(struct sock *sk, long timeo)
+static long inet_wait_for_connect(struct sock *sk, long timeo, int writebias)
 {
 	DEFINE_WAIT(wait);
 
 	prepare_to_wait(sk_sleep(sk), &wait, TASK_INTERRUPTIBLE);
+	sk->sk_write_pending += writebias;
 
 	/* Basic assumption: if someone sets sk->sk_err, he _must_
 	 * change state of the socket from TCP_SYN_*.
@@ -566,6 +570,7 @@ static long inet_wait_for_connect(struct sock *sk, long timeo)
 		prepare_to_wait(sk_sleep(sk), &wait, TASK_INTERRUPTIBLE);
 	}
 	finish_wait(sk_sleep(sk), &wait);
+	sk->sk_write_pending -= writebias;
 	return timeo;
 }
 
@@ -573,8 +578,8 @@ static long inet_wait_for_connect(struct sock *sk, long timeo)
  *	Connect to a remote host. There is regrettably still a little
  *	TCP 'magic' in here.
  */
-int inet_stream_connect(struct socket *sock, struct sockaddr *uaddr,
-			int addr_len, int flags)
+int __inet_stream_connect(struct socket *sock, struct sockaddr *uaddr,
+			  int addr_len, int flags)
 {
 	struct sock *sk = sock->sk;
 	int err;
@@ -583,8 +588,6 @@ int inet_stream_connect(struct socket *sock, struct sockaddr *uaddr,
 	if (addr_len < sizeof(uaddr->sa_family))
 		return -EINVAL;
 
-	lock_sock(sk);
-
 	if (uaddr->sa_family == AF_UNSPEC) {
 		err = sk->sk_prot->disconnect(sk, flags);
 		sock->state = err ? SS_DISCONNECTING : SS_UNCONNECTED;
@@ -624,8 +627,16 @@ int inet_stream_connect(struct socket *sock, struct sockaddr *uaddr,
 	timeo = sock_sndtimeo(sk, flags & O_NONBLOCK);
 
 	if ((1 << sk->sk_state) & (TCPF_SYN_SENT | TCPF_SYN_RECV)) {
+		/* A Fast Open sendmsg() has more data to send once connected:
+		 * pretend a writer is waiting so the ACK of the SYN-ACK is
+		 * delayed and can go out with that data.
+		 */
+		int writebias = (sk->sk_protocol == IPPROTO_TCP) &&
+				tcp_sk(sk)->fastopen_req &&
+				tcp_sk(sk)->fastopen_req->data ? 1 : 0;
+
 		/* Error code is set above */
-		if (!timeo || !inet_wait_for_connect(sk, timeo))
+		if (!timeo || !inet_wait_for_connect(sk, timeo, writebias))
 			goto out;
 
 		err = sock_intr_errno(timeo);
@@ -647,7 +658,6 @@ int inet_stream_connect(struct socket *sock, struct sockaddr *uaddr,
 	sock->state = SS_CONNECTED;
 	err = 0;
 out:
-	release_sock(sk);
 	return err;
 
 sock_error:
@@ -657,6 +667,18 @@ sock_error:
 		sock->state = SS_DISCONNECTING;
 	goto out;
 }
+EXPORT_SYMBOL(__inet_stream_connect);
+
+int inet_stream_connect(struct socket *sock, struct sockaddr *uaddr,
+			int addr_len, int flags)
+{
+	int err;
+
+	lock_sock(sock->sk);
+	err = __inet_stream_connect(sock, uaddr, addr_len, flags);
+	release_sock(sock->sk);
+	return err;
+}
 EXPORT_SYMBOL(inet_stream_connect);
 
 /*
@@ -1243,6 +1265,8 @@ static struct sk_buff *inet_gso_segment(struct sk_buff *skb, int features)
 		       SKB_GSO_UDP |
 		       SKB_GSO_DODGY |
 		       SKB_GSO_TCP_ECN |
+		       SKB_GSO_GRE |
+		       SKB_GSO_IPIP |
 		       0)))
 		goto out;
 
@@ -1293,8 +1317,7 @@ out:
 	return segs;
 }
 
-static struct sk_buff **inet_gro_receive(struct sk_buff **head,
-					 struct sk_buff *skb)
+struct sk_buff **inet_gro_receive(struct sk_buff **head, struct sk_buff *skb)
 {
 	const struct net_protocol *ops;
 	struct sk_buff **pp = NULL;
@@ -1334,11 +1357,16 @@ static struct sk_buff **inet_gro_receive(struct sk_buff **head,
 
 	for (p = *head; p; p = p->next) {
 		struct iphdr *iph2;
+		u16 flush_id;
 
 		if (!NAPI_GRO_CB(p)->same_flow)
 			continue;
 
-		iph2 = ip_hdr(p);
+		/* The headers of p before this one matched, so this one
+		 * is at the same offset; ip_hdr(p) is the outer header
+		 * of a tunnelled packet.
+		 */
+		iph2 = (struct iphdr *)(p->data + off);
 
 		if ((iph->protocol ^ iph2->protocol) |
 		    (iph->tos ^ iph2->tos) |
@@ -1348,10 +1376,14 @@ static struct sk_buff **inet_gro_receive(struct sk_buff **head,
 			continue;
 		}
 
-		/* All fields must match except length and checksum. */
-		NAPI_GRO_CB(p)->flush |=
-			(iph->ttl ^ iph2->ttl) |
-			((u16)(ntohs(iph2->id) + NAPI_GRO_CB(p)->count) ^ id);
+		/* All fields must match except length and checksum.  The
+		 * ID must increment, or stay the same: tunnels send all
+		 * their packets (which have DF set here) with ID 0.
+		 */
+		flush_id = (u16)(ntohs(iph2->id) + NAPI_GRO_CB(p)->count) ^ id;
+		if (iph->id == iph2->id)
+			flush_id = 0;
+		NAPI_GRO_CB(p)->flush |= (iph->ttl ^ iph2->ttl) | flush_id;
 
 		NAPI_GRO_CB(p)->flush |= flush;
 	}
@@ -1370,8 +1402,9 @@ out:
 
 	return pp;
 }
+EXPORT_SYMBOL(inet_gro_receive);
 
-static int inet_gro_complete(struct sk_buff *skb)
+int inet_gro_complete(struct sk_buff *skb)
 {
 	const struct net_protocol *ops;
 	struct iphdr *iph = ip_hdr(skb);
@@ -1394,6 +1427,125 @@ out_unlock:
 
 	return err;
 }
+EXPORT_SYMBOL(inet_gro_complete);
+
+/**
+ *	inet_tunnel_gro_receive - merge a tunnelled IPv4 packet
+ *	@head: list of packets held by GRO
+ *	@skb: packet with its outer headers pulled
+ *	@th: tunnel header, at skb_gro_offset(skb)
+ *	@hlen: length of the tunnel header
+ *
+ *	For the gro_receive method of tunnel protocols.  The caller has
+ *	checked that the tunnel headers of the packets in @head that are
+ *	still of the same flow are equal to that of @skb.  Only one level
+ *	of encapsulation is merged.
+ */
+struct sk_buff **inet_tunnel_gro_receive(struct sk_buff **head,
+					 struct sk_buff *skb, const void *th,
+					 unsigned int hlen)
+{
+	struct sk_buff **pp;
+	__wsum csum;
+
+	if (NAPI_GRO_CB(skb)->encap_mark) {
+		NAPI_GRO_CB(skb)->flush = 1;
+		return NULL;
+	}
+	NAPI_GRO_CB(skb)->encap_mark = 1;
+
+	csum = skb->csum;
+	skb_postpull_rcsum(skb, th, hlen);
+	skb_gro_pull(skb, hlen);
+
+	pp = inet_gro_receive(head, skb);
+
+	skb->csum = csum;
+	return pp;
+}
+EXPORT_SYMBOL(inet_tunnel_gro_receive);
+
+/**
+ *	inet_tunnel_gro_complete - complete a tunnelled IPv4 packet
+ *	@skb: packet merged by inet_tunnel_gro_receive()
+ *	@hlen: length of the tunnel header after the outer IPv4 header
+ *	@gso_type: SKB_GSO_GRE or SKB_GSO_IPIP
+ */
+int inet_tunnel_gro_complete(struct sk_buff *skb, unsigned int hlen,
+			     int gso_type)
+{
+	int err;
+
+	skb_set_network_header(skb, skb_network_offset(skb) +
+				    ip_hdrlen(skb) + hlen);
+	err = inet_gro_complete(skb);
+	skb_shinfo(skb)->gso_type |= gso_type;
+
+	return err;
+}
+EXPORT_SYMBOL(inet_tunnel_gro_complete);
+
+/**
+ *	inet_tunnel_gso_segment - segment a tunnelled IPv4 packet
+ *	@skb: packet with its tunnel header at skb->data
+ *	@features: features of the output device
+ *	@hlen: length of the tunnel header
+ *
+ *	For the gso_segment method of tunnel protocols, which is only used
+ *	for packets merged by inet_tunnel_gro_receive() and then forwarded.
+ *	The encapsulated packet is segmented in software, checksums
+ *	included, and every segment gets a copy of the outer headers,
+ *	which inet_gso_segment() then fixes up.
+ */
+struct sk_buff *inet_tunnel_gso_segment(struct sk_buff *skb, int features,
+					unsigned int hlen)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	int gso_type = skb_shinfo(skb)->gso_type;
+	unsigned int mac_len = skb->mac_len;
+	__be16 protocol = skb->protocol;
+	int nhoff, thoff;
+
+	if (unlikely(!(gso_type & (SKB_GSO_GRE | SKB_GSO_IPIP)) ||
+		     !pskb_may_pull(skb, hlen + sizeof(struct iphdr))))
+		goto out;
+
+	nhoff = skb->network_header - skb->mac_header;
+	thoff = skb->transport_header - skb->mac_header;
+
+	/* Make the outer headers look like the link layer header of the
+	 * inner packet, which skb_segment() copies to every segment.
+	 */
+	__skb_pull(skb, hlen);
+	skb_reset_network_header(skb);
+	skb->mac_len = skb->network_header - skb->mac_header;
+	skb->protocol = htons(ETH_P_IP);
+	skb_shinfo(skb)->gso_type &= ~(SKB_GSO_GRE | SKB_GSO_IPIP);
+
+	segs = inet_gso_segment(skb, features & ~(NETIF_F_ALL_CSUM |
+						  NETIF_F_GSO_MASK));
+
+	skb_shinfo(skb)->gso_type = gso_type;
+	skb->protocol = protocol;
+	skb->mac_len = mac_len;
+	skb->network_header = skb->mac_header + nhoff;
+	skb->transport_header = skb->mac_header + thoff;
+	__skb_push(skb, skb->data - skb_transport_header(skb));
+
+	if (IS_ERR_OR_NULL(segs))
+		goto out;
+
+	for (skb = segs; skb; skb = skb->next) {
+		skb->protocol = protocol;
+		skb->mac_len = mac_len;
+		skb->network_header = skb->mac_header + nhoff;
+		skb->transport_header = skb->mac_header + thoff;
+	}
+
+out:
+	return segs;
+}
+EXPORT_SYMBOL(inet_tunnel_gso_segment);
 
 int inet_ctl_sock_create(struct sock **sk, unsigned short family,
 			 unsigned short type, unsigned char protocol,
@@ -983,9 +983,6 @@ static int fib_netdev_event(struct notifier_block *this, unsigned long event, vo
 	case NETDEV_CHANGE:
 		rt_cache_flush(dev_net(dev), 0);
 		break;
-	case NETDEV_UNREGISTER_BATCH:
-		rt_cache_flush_batch();
-		break;
 	}
 	return NOTIFY_DONE;
 }
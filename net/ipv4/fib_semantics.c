@@ -139,6 +139,22 @@ static const struct
 
 /* Release a nexthop info record */
 
+static void rt_fibinfo_free(struct rtable * __percpu *rtp)
+{
+	int cpu;
+
+	if (!rtp)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct rtable *rt = *per_cpu_ptr(rtp, cpu);
+
+		if (rt)
+			call_rcu_bh(&rt->dst.rcu_head, dst_rcu_free);
+	}
+	free_percpu(rtp);
+}
+
 void free_fib_info(struct fib_info *fi)
 {
 	if (fi->fib_dead == 0) {
@@ -149,6 +165,8 @@ void free_fib_info(struct fib_info *fi)
 		if (nexthop_nh->nh_dev)
 			dev_put(nexthop_nh->nh_dev);
 		nexthop_nh->nh_dev = NULL;
+		rt_fibinfo_free(nexthop_nh->nh_pcpu_rth_output);
+		rt_fibinfo_free(nexthop_nh->nh_pcpu_rth_input);
 	} endfor_nexthops(fi);
 	fib_info_cnt--;
 	release_net(fi->fib_net);
@@ -737,6 +755,11 @@ struct fib_info *fib_create_info(struct fib_config *cfg)
 	fi->fib_nhs = nhs;
 	change_nexthops(fi) {
 		nexthop_nh->nh_parent = fi;
+		nexthop_nh->nh_pcpu_rth_output = alloc_percpu(struct rtable *);
+		nexthop_nh->nh_pcpu_rth_input = alloc_percpu(struct rtable *);
+		if (!nexthop_nh->nh_pcpu_rth_output ||
+		    !nexthop_nh->nh_pcpu_rth_input)
+			goto failure;
 	} endfor_nexthops(fi)
 
 	if (cfg->fc_mx) {
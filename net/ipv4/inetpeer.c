@@ -431,6 +431,13 @@ struct inet_peer *inet_getpeer(__be32 daddr, int create)
 		return p;
 	}
 
+	/* Lookups that would not create the entry can miss one a concurrent
+	 * writer is linking, rather than all serializing on the lock: route
+	 * output binds peers that way each time a route is built.
+	 */
+	if (!create)
+		return NULL;
+
 	/* retry an exact lookup, taking the lock before.
 	 * At least, nodes should be hot in our cache.
 	 */
@@ -443,13 +450,19 @@ struct inet_peer *inet_getpeer(__be32 daddr, int create)
 		unlink_from_unused(p);
 		return p;
 	}
-	p = create ? kmem_cache_alloc(peer_cachep, GFP_ATOMIC) : NULL;
+	p = kmem_cache_alloc(peer_cachep, GFP_ATOMIC);
 	if (p) {
 		p->v4daddr = daddr;
 		atomic_set(&p->refcnt, 1);
 		atomic_set(&p->rid, 0);
 		atomic_set(&p->ip_id_count, secure_ip_id(daddr));
 		p->tcp_ts_stamp = 0;
+		p->redirect_learned = 0;
+		p->pmtu_learned = 0;
+		p->pmtu_expires = 0;
+		p->tcp_fastopen_mss = 0;
+		p->tcp_fastopen_cookie_len = 0;
+		p->tcp_fastopen_syn_loss = 0;
 		INIT_LIST_HEAD(&p->unused);
 
 
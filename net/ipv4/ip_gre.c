@@ -34,6 +34,7 @@
 #include <net/sock.h>
 #include <net/ip.h>
 #include <net/icmp.h>
+#include <net/inet_common.h>
 #include <net/protocol.h>
 #include <net/ipip.h>
 #include <net/arp.h>
@@ -604,7 +605,7 @@ static int ipgre_rcv(struct sk_buff *skb)
 #ifdef CONFIG_NET_IPGRE_BROADCAST
 		if (ipv4_is_multicast(iph->daddr)) {
 			/* Looped back packet, drop it! */
-			if (skb_rtable(skb)->fl.iif == 0)
+			if (rt_is_output_route(skb_rtable(skb)))
 				goto drop;
 			stats->multicast++;
 			skb->pkt_type = PACKET_BROADCAST;
@@ -1278,9 +1279,81 @@ static void ipgre_fb_tunnel_init(struct net_device *dev)
 }
 
 
+/* GRO merges TCP over IPv4 carried in GRE without checksum and sequence
+ * number, which would have to be checked for every packet.  The tunnels
+ * are told apart by their keys.
+ */
+static struct sk_buff **ipgre_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct sk_buff *p;
+	unsigned int grehlen = 4;
+	unsigned int hlen, off;
+	__be16 *greh;
+
+	off = skb_gro_offset(skb);
+	hlen = off + grehlen;
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto flush;
+	}
+
+	if ((greh[0] & ~GRE_KEY) || greh[1] != htons(ETH_P_IP))
+		goto flush;
+
+	if (greh[0] & GRE_KEY) {
+		grehlen += 4;
+		hlen += 4;
+		if (skb_gro_header_hard(skb, hlen)) {
+			greh = skb_gro_header_slow(skb, hlen, off);
+			if (unlikely(!greh))
+				goto flush;
+		}
+	}
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		if (memcmp(greh, p->data + off, grehlen))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	return inet_tunnel_gro_receive(head, skb, greh, grehlen);
+
+flush:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+
+static int ipgre_gro_complete(struct sk_buff *skb)
+{
+	__be16 *greh = (__be16 *)(skb_network_header(skb) + ip_hdrlen(skb));
+
+	return inet_tunnel_gro_complete(skb, greh[0] & GRE_KEY ? 8 : 4,
+					SKB_GSO_GRE);
+}
+
+static struct sk_buff *ipgre_gso_segment(struct sk_buff *skb, int features)
+{
+	__be16 *greh;
+
+	if (unlikely(!pskb_may_pull(skb, 4)))
+		return ERR_PTR(-EINVAL);
+
+	greh = (__be16 *)skb->data;
+	return inet_tunnel_gso_segment(skb, features,
+				       greh[0] & GRE_KEY ? 8 : 4);
+}
+
 static const struct net_protocol ipgre_protocol = {
 	.handler	=	ipgre_rcv,
 	.err_handler	=	ipgre_err,
+	.gso_segment	=	ipgre_gso_segment,
+	.gro_receive	=	ipgre_gro_receive,
+	.gro_complete	=	ipgre_gro_complete,
 	.netns_ok	=	1,
 };
 
@@ -436,6 +436,7 @@ int ip_rcv(struct sk_buff *skb, struct net_device *dev, struct packet_type *pt,
 
 	/* Remove any debris in the socket control block */
 	memset(IPCB(skb), 0, sizeof(struct inet_skb_parm));
+	IPCB(skb)->iif = dev->ifindex;
 
 	/* Must drop socket now because of tproxy. */
 	skb_orphan(skb);
@@ -62,8 +62,8 @@ static void ip_cmsg_recv_pktinfo(struct msghdr *msg, struct sk_buff *skb)
 
 	info.ipi_addr.s_addr = ip_hdr(skb)->daddr;
 	if (rt) {
-		info.ipi_ifindex = rt->rt_iif;
-		info.ipi_spec_dst.s_addr = rt->rt_spec_dst;
+		info.ipi_ifindex = inet_iif(skb);
+		info.ipi_spec_dst.s_addr = ip_rt_spec_dst(skb);
 	} else {
 		info.ipi_ifindex = 0;
 		info.ipi_spec_dst.s_addr = 0;
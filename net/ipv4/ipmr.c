@@ -301,6 +301,24 @@ static void __net_exit ipmr_rules_exit(struct net *net)
 }
 #endif
 
+/* Routes shared by a nexthop do not keep the keys of the packet */
+static int ipmr_rt_fib_lookup(struct net *net, struct sk_buff *skb,
+			      struct mr_table **mrt)
+{
+	struct rtable *rt = skb_rtable(skb);
+	struct iphdr *iph = ip_hdr(skb);
+	struct flowi fl = rt->fl;
+
+	if (rt_is_input_route(rt) && !rt->rt_iif) {
+		fl.fl4_dst = iph->daddr;
+		fl.fl4_src = iph->saddr;
+		fl.fl4_tos = iph->tos & IPTOS_RT_MASK;
+		fl.iif = inet_iif(skb);
+		fl.mark = skb->mark;
+	}
+	return ipmr_fib_lookup(net, &fl, mrt);
+}
+
 static struct mr_table *ipmr_new_table(struct net *net, u32 id)
 {
 	struct mr_table *mrt;
@@ -1642,7 +1660,7 @@ static int ip_mr_forward(struct net *net, struct mr_table *mrt,
 	if (mrt->vif_table[vif].dev != skb->dev) {
 		int true_vifi;
 
-		if (skb_rtable(skb)->fl.iif == 0) {
+		if (rt_is_output_route(skb_rtable(skb))) {
 			/* It is our own packet, looped back.
 			   Very complicated situation...
 
@@ -1729,7 +1747,7 @@ int ip_mr_input(struct sk_buff *skb)
 	if (IPCB(skb)->flags&IPSKB_FORWARDED)
 		goto dont_forward;
 
-	err = ipmr_fib_lookup(net, &skb_rtable(skb)->fl, &mrt);
+	err = ipmr_rt_fib_lookup(net, skb, &mrt);
 	if (err < 0) {
 		kfree_skb(skb);
 		return err;
@@ -1865,7 +1883,7 @@ int pim_rcv_v1(struct sk_buff * skb)
 
 	pim = igmp_hdr(skb);
 
-	if (ipmr_fib_lookup(net, &skb_rtable(skb)->fl, &mrt) < 0)
+	if (ipmr_rt_fib_lookup(net, skb, &mrt) < 0)
 		goto drop;
 
 	if (!mrt->mroute_do_pim ||
@@ -1897,7 +1915,7 @@ static int pim_rcv(struct sk_buff * skb)
 	     csum_fold(skb_checksum(skb, 0, skb->len, 0))))
 		goto drop;
 
-	if (ipmr_fib_lookup(net, &skb_rtable(skb)->fl, &mrt) < 0)
+	if (ipmr_rt_fib_lookup(net, skb, &mrt) < 0)
 		goto drop;
 
 	if (__pim_rcv(mrt, skb, sizeof(*pim))) {
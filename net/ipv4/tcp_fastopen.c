@@ -0,0 +1,170 @@
+/*
+ * TCP Fast Open (RFC 7413)
+ *
+ * A server hands out a cookie, a keyed hash of the addresses of both
+ * ends, in the SYN-ACK of a connection whose SYN asked for one.  The
+ * client keeps it in the inet_peer of the server and sends it with data
+ * in the SYN of later connections (sendto() with MSG_FASTOPEN); a server
+ * that finds the cookie valid delivers the data to accept() right away
+ * instead of one round trip later.
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/random.h>
+#include <linux/cryptohash.h>
+#include <linux/percpu.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <linux/tcp.h>
+#include <net/inetpeer.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly;
+
+static u32 tcp_fastopen_key[TCP_FASTOPEN_KEY_LENGTH / 4];
+static DEFINE_SEQLOCK(tcp_fastopen_key_lock);
+
+/* Protects the Fast Open fields of all inet_peers */
+static DEFINE_SEQLOCK(tcp_fastopen_cache_lock);
+
+static DEFINE_PER_CPU(__u32 [16 + 5 + SHA_WORKSPACE_WORDS],
+		      tcp_fastopen_scratch);
+
+static __init int tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_key, sizeof(tcp_fastopen_key));
+	return 0;
+}
+late_initcall(tcp_fastopen_init);
+
+void tcp_fastopen_set_key(const u32 *key)
+{
+	write_seqlock_bh(&tcp_fastopen_key_lock);
+	memcpy(tcp_fastopen_key, key, sizeof(tcp_fastopen_key));
+	write_sequnlock_bh(&tcp_fastopen_key_lock);
+}
+
+void tcp_fastopen_get_key(u32 *key)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&tcp_fastopen_key_lock);
+		memcpy(key, tcp_fastopen_key, sizeof(tcp_fastopen_key));
+	} while (read_seqretry(&tcp_fastopen_key_lock, seq));
+}
+
+/* The cookie of the client at saddr for the server at daddr: the first
+ * TCP_FASTOPEN_COOKIE_SIZE bytes of the SHA-1 digest of both addresses
+ * and the key.  Servers sharing the key (see tcp_fastopen_key in
+ * ip-sysctl.txt) accept each other's cookies.
+ */
+void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+			     struct tcp_fastopen_cookie *foc)
+{
+	__u32 *tmp = get_cpu_var(tcp_fastopen_scratch);
+
+	memset(tmp, 0, 16 * sizeof(__u32));
+	tmp[0] = (__force u32)saddr;
+	tmp[1] = (__force u32)daddr;
+	tcp_fastopen_get_key(tmp + 2);
+	sha_init(tmp + 16);
+	sha_transform(tmp + 16, (__u8 *)tmp, tmp + 16 + 5);
+
+	memcpy(foc->val, tmp + 16, TCP_FASTOPEN_COOKIE_SIZE);
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+	put_cpu_var(tcp_fastopen_scratch);
+}
+
+/* Client side: fetch what we know of the server sk connects to.  Without
+ * an entry the cookie is empty, which makes the SYN ask for one.  Only
+ * IPv4 peers are cached; other sockets send no Fast Open option at all.
+ */
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie,
+			    int *syn_loss, unsigned long *last_syn_loss)
+{
+	struct inet_peer *peer;
+	unsigned int seq;
+
+	*syn_loss = 0;
+	if (sk->sk_family != AF_INET) {
+		cookie->len = -1;
+		return;
+	}
+
+	cookie->len = 0;
+	peer = inet_getpeer(inet_sk(sk)->inet_daddr, 0);
+	if (!peer)
+		return;
+
+	do {
+		seq = read_seqbegin(&tcp_fastopen_cache_lock);
+		if (peer->tcp_fastopen_mss)
+			*mss = peer->tcp_fastopen_mss;
+		cookie->len = peer->tcp_fastopen_cookie_len;
+		memcpy(cookie->val, peer->tcp_fastopen_cookie,
+		       sizeof(peer->tcp_fastopen_cookie));
+		*syn_loss = peer->tcp_fastopen_syn_loss;
+		*last_syn_loss = *syn_loss ? peer->tcp_fastopen_syn_loss_ts : 0;
+	} while (read_seqretry(&tcp_fastopen_cache_lock, seq));
+	inet_putpeer(peer);
+}
+
+/* Client side: remember the MSS and cookie of a SYN-ACK, and whether the
+ * SYN carrying data seems to have been dropped on the way.
+ */
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie, bool syn_lost)
+{
+	struct inet_peer *peer;
+
+	if (sk->sk_family != AF_INET)
+		return;
+
+	peer = inet_getpeer(inet_sk(sk)->inet_daddr, 1);
+	if (!peer)
+		return;
+
+	write_seqlock_bh(&tcp_fastopen_cache_lock);
+	if (mss)
+		peer->tcp_fastopen_mss = mss;
+	if (cookie->len > 0) {
+		memcpy(peer->tcp_fastopen_cookie, cookie->val, cookie->len);
+		peer->tcp_fastopen_cookie_len = cookie->len;
+	}
+	if (syn_lost) {
+		if (peer->tcp_fastopen_syn_loss < 0xff)
+			peer->tcp_fastopen_syn_loss++;
+		peer->tcp_fastopen_syn_loss_ts = jiffies;
+	} else {
+		peer->tcp_fastopen_syn_loss = 0;
+	}
+	write_sequnlock_bh(&tcp_fastopen_cache_lock);
+	inet_putpeer(peer);
+}
+
+/* Server side: enable Fast Open on sk, with at most backlog children
+ * whose handshake is still pending.  Called with the socket locked,
+ * which keeps tcp_v4_conn_request() out.
+ */
+int tcp_fastopen_init_queue(struct sock *sk, int backlog)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+
+	if (queue->fastopenq == NULL) {
+		queue->fastopenq = kzalloc(sizeof(struct fastopen_queue),
+					   sk->sk_allocation);
+		if (queue->fastopenq == NULL)
+			return -ENOMEM;
+		spin_lock_init(&queue->fastopenq->lock);
+	}
+	queue->fastopenq->max_qlen = backlog;
+	return 0;
+}
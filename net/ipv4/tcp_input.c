@@ -352,7 +352,7 @@ static void tcp_fixup_rcvbuf(struct sock *sk)
 /* 4. Try to fixup all. It is made immediately after connection enters
  *    established state.
  */
-static void tcp_init_buffer_space(struct sock *sk)
+void tcp_init_buffer_space(struct sock *sk)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	int maxwin;
@@ -870,7 +870,7 @@ static void tcp_dsack_seen(struct tcp_sock *tp)
 
 /* Initialize metrics on socket. */
 
-static void tcp_init_metrics(struct sock *sk)
+void tcp_init_metrics(struct sock *sk)
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct dst_entry *dst = __sk_dst_get(sk);
@@ -3749,7 +3749,7 @@ old_ack:
  * the fast version below fails.
  */
 void tcp_parse_options(struct sk_buff *skb, struct tcp_options_received *opt_rx,
-		       u8 **hvpp, int estab)
+		       u8 **hvpp, int estab, struct tcp_fastopen_cookie *foc)
 {
 	unsigned char *ptr;
 	struct tcphdr *th = tcp_hdr(skb);
@@ -3857,6 +3857,24 @@ void tcp_parse_options(struct sk_buff *skb, struct tcp_options_received *opt_rx,
 					break;
 				}
 				break;
+
+			case TCPOPT_FASTOPEN:
+				/* An empty option asks for a cookie, anything
+				 * else out of the valid size range is ignored.
+				 */
+				if (foc == NULL || !th->syn)
+					break;
+				if (opsize == TCPOLEN_FASTOPEN_BASE) {
+					foc->len = 0;
+				} else if (opsize >= TCPOLEN_FASTOPEN_BASE +
+						    TCP_FASTOPEN_COOKIE_MIN &&
+					   opsize <= TCPOLEN_FASTOPEN_BASE +
+						     TCP_FASTOPEN_COOKIE_MAX &&
+					   !((opsize - TCPOLEN_FASTOPEN_BASE) & 1)) {
+					foc->len = opsize - TCPOLEN_FASTOPEN_BASE;
+					memcpy(foc->val, ptr, foc->len);
+				}
+				break;
 			}
 
 			ptr += opsize-2;
@@ -3899,7 +3917,7 @@ static int tcp_fast_parse_options(struct sk_buff *skb, struct tcphdr *th,
 		if (tcp_parse_aligned_timestamp(tp, th))
 			return 1;
 	}
-	tcp_parse_options(skb, &tp->rx_opt, hvpp, 1);
+	tcp_parse_options(skb, &tp->rx_opt, hvpp, 1, NULL);
 	return 1;
 }
 
@@ -4055,6 +4073,12 @@ static void tcp_reset(struct sock *sk)
 	if (!sock_flag(sk, SOCK_DEAD))
 		sk->sk_error_report(sk);
 
+	/* A Fast Open child reset before its handshake completed keeps
+	 * counting against the limit of its listener for a while.
+	 */
+	if (tcp_sk(sk)->fastopen_rsk)
+		reqsk_fastopen_remove(sk, tcp_sk(sk)->fastopen_rsk, true);
+
 	tcp_done(sk);
 }
 
@@ -5444,6 +5468,50 @@ discard:
 }
 EXPORT_SYMBOL(tcp_rcv_established);
 
+static int tcp_rcv_fastopen_synack(struct sock *sk, struct sk_buff *synack,
+				   struct tcp_fastopen_cookie *cookie)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	struct sk_buff *data = tp->syn_data ? tcp_write_queue_head(sk) : NULL;
+	u16 mss = tp->rx_opt.mss_clamp;
+	int syn_drop;
+
+	if (mss == tp->rx_opt.user_mss) {
+		struct tcp_options_received opt;
+		u8 *hash_location;
+
+		/* Get original SYNACK MSS value if user MSS sets mss_clamp */
+		tcp_clear_options(&opt);
+		opt.user_mss = opt.mss_clamp = 0;
+		tcp_parse_options(synack, &opt, &hash_location, 0, NULL);
+		mss = opt.mss_clamp;
+	}
+
+	if (!tp->syn_fastopen)  /* Ignore an unsolicited cookie */
+		cookie->len = -1;
+
+	/* The SYN-ACK neither has cookie nor acknowledges the data. Presumably
+	 * the remote receives only the retransmitted (regular) SYNs: either
+	 * the original SYN-data or the corresponding SYN-ACK is lost.
+	 */
+	syn_drop = (cookie->len <= 0 && data &&
+		    inet_csk(sk)->icsk_retransmits);
+
+	tcp_fastopen_cache_set(sk, mss, cookie, syn_drop);
+
+	if (data) { /* Retransmit unacked data in SYN */
+		tcp_for_write_queue_from(data, sk) {
+			if (data == tcp_send_head(sk) ||
+			    tcp_retransmit_skb(sk, data))
+				break;
+		}
+		tcp_rearm_rto(sk);
+		return 1;
+	}
+	tp->syn_data_acked = tp->syn_data;
+	return 0;
+}
+
 static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 					 struct tcphdr *th, unsigned len)
 {
@@ -5451,9 +5519,10 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 	struct inet_connection_sock *icsk = inet_csk(sk);
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct tcp_cookie_values *cvp = tp->cookie_values;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
 	int saved_clamp = tp->rx_opt.mss_clamp;
 
-	tcp_parse_options(skb, &tp->rx_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tp->rx_opt, &hash_location, 0, &foc);
 
 	if (th->ack) {
 		/* rfc793:
@@ -5464,10 +5533,11 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 		 *        a reset (unless the RST bit is set, if so drop
 		 *        the segment and return)"
 		 *
-		 *  We do not send data with SYN, so that RFC-correct
-		 *  test reduces to:
+		 *  A Fast Open SYN carries data, which the peer may or
+		 *  may not acknowledge along with the SYN.
 		 */
-		if (TCP_SKB_CB(skb)->ack_seq != tp->snd_nxt)
+		if (!after(TCP_SKB_CB(skb)->ack_seq, tp->snd_una) ||
+		    after(TCP_SKB_CB(skb)->ack_seq, tp->snd_nxt))
 			goto reset_and_undo;
 
 		if (tp->rx_opt.saw_tstamp && tp->rx_opt.rcv_tsecr &&
@@ -5607,6 +5677,10 @@ static int tcp_rcv_synsent_state_process(struct sock *sk, struct sk_buff *skb,
 			sk_wake_async(sk, SOCK_WAKE_IO, POLL_OUT);
 		}
 
+		if ((tp->syn_fastopen || tp->syn_data) &&
+		    tcp_rcv_fastopen_synack(sk, skb, &foc))
+			return -1;
+
 		if (sk->sk_write_pending ||
 		    icsk->icsk_accept_queue.rskq_defer_accept ||
 		    icsk->icsk_ack.pingpong) {
@@ -5726,6 +5800,7 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 {
 	struct tcp_sock *tp = tcp_sk(sk);
 	struct inet_connection_sock *icsk = inet_csk(sk);
+	struct request_sock *req;
 	int queued = 0;
 	int res;
 
@@ -5780,6 +5855,21 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 		return 0;
 	}
 
+	/* A Fast Open child still waiting for the ACK of its SYN-ACK: a
+	 * retransmitted SYN of the peer means the SYN-ACK got lost.
+	 */
+	req = tp->fastopen_rsk;
+	if (req != NULL) {
+		WARN_ON_ONCE(sk->sk_state != TCP_SYN_RECV &&
+			     sk->sk_state != TCP_FIN_WAIT1);
+
+		if (th->syn && !th->ack && !th->rst &&
+		    TCP_SKB_CB(skb)->seq == tcp_rsk(req)->rcv_isn) {
+			req->rsk_ops->rtx_syn_ack(sk, req, NULL);
+			goto discard;
+		}
+	}
+
 	res = tcp_validate_incoming(sk, skb, th, 0);
 	if (res <= 0)
 		return -res;
@@ -5791,7 +5881,13 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 		switch (sk->sk_state) {
 		case TCP_SYN_RECV:
 			if (acceptable) {
-				tp->copied_seq = tp->rcv_nxt;
+				if (req) {
+					/* The SYN data may still be unread */
+					tp->total_retrans = req->retrans;
+					reqsk_fastopen_remove(sk, req, false);
+				} else {
+					tp->copied_seq = tp->rcv_nxt;
+				}
 				smp_mb();
 				tcp_set_state(sk, TCP_ESTABLISHED);
 				sk->sk_state_change(sk);
@@ -5819,23 +5915,32 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 				if (tp->rx_opt.tstamp_ok)
 					tp->advmss -= TCPOLEN_TSTAMP_ALIGNED;
 
-				/* Make sure socket is routed, for
-				 * correct metrics.
-				 */
-				icsk->icsk_af_ops->rebuild_header(sk);
+				if (req) {
+					/* The rest was set up along with the
+					 * child, see tcp_v4_conn_req_fastopen().
+					 * Re-arm the timer for the data that
+					 * may have been sent meanwhile.
+					 */
+					tcp_rearm_rto(sk);
+				} else {
+					/* Make sure socket is routed, for
+					 * correct metrics.
+					 */
+					icsk->icsk_af_ops->rebuild_header(sk);
 
-				tcp_init_metrics(sk);
+					tcp_init_metrics(sk);
 
-				tcp_init_congestion_control(sk);
+					tcp_init_congestion_control(sk);
+					tcp_mtup_init(sk);
+					tcp_init_buffer_space(sk);
+				}
 
 				/* Prevent spurious tcp_cwnd_restart() on
 				 * first data packet.
 				 */
 				tp->lsndtime = tcp_time_stamp;
 
-				tcp_mtup_init(sk);
 				tcp_initialize_rcv_mss(sk);
-				tcp_init_buffer_space(sk);
 				tcp_fast_path_on(tp);
 			} else {
 				return 1;
@@ -5843,6 +5948,16 @@ int tcp_rcv_state_process(struct sock *sk, struct sk_buff *skb,
 			break;
 
 		case TCP_FIN_WAIT1:
+			/* A Fast Open child that was closed before its
+			 * handshake completed.
+			 */
+			if (req) {
+				if (!acceptable)
+					return 1;
+				tp->total_retrans = req->retrans;
+				reqsk_fastopen_remove(sk, req, false);
+				tcp_rearm_rto(sk);
+			}
 			if (tp->snd_una == tp->write_seq) {
 				tcp_set_state(sk, TCP_FIN_WAIT2);
 				sk->sk_shutdown |= SEND_SHUTDOWN;
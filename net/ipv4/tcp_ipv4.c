@@ -1218,10 +1218,162 @@ static struct timewait_sock_ops tcp_timewait_sock_ops = {
 	.twsk_destructor= tcp_twsk_destructor,
 };
 
+/* Decide whether the data in a Fast Open SYN can be delivered right away:
+ * Fast Open must be enabled on the listener, which must have room for one
+ * more child whose handshake is pending, and the SYN must carry a valid
+ * cookie.  When the SYN asked for a cookie, or had a wrong one, the right
+ * one is put in valid_foc for the SYN-ACK to carry.
+ */
+static bool tcp_fastopen_check(struct sock *sk, struct sk_buff *skb,
+			       struct tcp_fastopen_cookie *foc,
+			       struct tcp_fastopen_cookie *valid_foc)
+{
+	struct fastopen_queue *fastopenq =
+		inet_csk(sk)->icsk_accept_queue.fastopenq;
+
+	if (!(sysctl_tcp_fastopen & TFO_SERVER_ENABLE) ||
+	    fastopenq == NULL || fastopenq->max_qlen == 0)
+		return false;
+
+	if (fastopenq->qlen >= fastopenq->max_qlen) {
+		struct request_sock *req1;
+
+		/* Make room by expiring the oldest reset request, if any */
+		spin_lock(&fastopenq->lock);
+		req1 = fastopenq->rskq_rst_head;
+		if (req1 == NULL || time_after(req1->expires, jiffies)) {
+			spin_unlock(&fastopenq->lock);
+			NET_INC_STATS_BH(sock_net(sk),
+					 LINUX_MIB_TCPFASTOPENLISTENOVERFLOW);
+			return false;
+		}
+		fastopenq->rskq_rst_head = req1->dl_next;
+		fastopenq->qlen--;
+		spin_unlock(&fastopenq->lock);
+		reqsk_free(req1);
+	}
+
+	tcp_fastopen_cookie_gen(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr,
+				valid_foc);
+
+	if (foc->len == TCP_FASTOPEN_COOKIE_SIZE &&
+	    memcmp(foc->val, valid_foc->val, TCP_FASTOPEN_COOKIE_SIZE) == 0 &&
+	    !tcp_hdr(skb)->fin) {
+		/* The client has the cookie already */
+		valid_foc->len = -1;
+		return true;
+	}
+
+	if (foc->len > 0)
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+	else
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+	return false;
+}
+
+/* Create the child of a Fast Open SYN right away and queue it, with the
+ * data of the SYN, to the accept queue of the listener.  The request
+ * sock stays with the child, which retransmits the SYN-ACK until the
+ * handshake completes, see reqsk_fastopen_remove().
+ */
+static int tcp_v4_conn_req_fastopen(struct sock *sk, struct sk_buff *skb,
+				    struct request_sock *req,
+				    struct dst_entry *dst,
+				    struct request_values *rvp)
+{
+	struct fastopen_queue *fastopenq =
+		inet_csk(sk)->icsk_accept_queue.fastopenq;
+	const struct inet_request_sock *ireq = inet_rsk(req);
+	struct ip_options *opt = ireq->opt;
+	struct sk_buff *skb_synack;
+	struct tcp_sock *tp;
+	struct sock *child;
+
+	if (!dst && (dst = inet_csk_route_req(sk, req)) == NULL)
+		return -1;
+
+	/* The SYN-ACK acknowledges the data as well.  Build it before the
+	 * child, which takes its receive window from what the SYN-ACK
+	 * announces.
+	 */
+	tcp_rsk(req)->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+	skb_synack = tcp_make_synack(sk, dst, req, rvp);
+	if (skb_synack == NULL) {
+		dst_release(dst);
+		return -1;
+	}
+	__tcp_v4_send_check(skb_synack, ireq->loc_addr, ireq->rmt_addr);
+
+	req->retrans = 0;
+	req->sk = NULL;
+
+	/* Takes over dst and the IP options of req */
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req, dst);
+	if (child == NULL) {
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+		kfree_skb(skb_synack);
+		return -1;
+	}
+	/* Errors are not fatal: the SYN-ACK timer of the child retries */
+	ip_build_and_send_pkt(skb_synack, sk, ireq->loc_addr, ireq->rmt_addr,
+			      opt);
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+
+	spin_lock(&fastopenq->lock);
+	fastopenq->qlen++;
+	spin_unlock(&fastopenq->lock);
+
+	tp = tcp_sk(child);
+	tp->fastopen_rsk = req;
+	/* The child, once accepted, may outlive the listener, whose
+	 * fastopen queue it still has to update.
+	 */
+	sock_hold(sk);
+	tcp_rsk(req)->listener = sk;
+
+	/* RFC1323: The window in SYN & SYN/ACK segments is never scaled. */
+	tp->snd_wnd = ntohs(tcp_hdr(skb)->window);
+
+	/* The request sock is not in the SYN table of the listener, the
+	 * retransmit timer of the child takes care of the SYN-ACK.
+	 */
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	inet_csk_reqsk_queue_add(sk, req, child);
+
+	/* Now finish what tcp_rcv_state_process() does for other children
+	 * when the handshake completes.
+	 */
+	inet_csk(child)->icsk_af_ops->rebuild_header(child);
+	tcp_init_congestion_control(child);
+	tcp_mtup_init(child);
+	tcp_init_buffer_space(child);
+	tcp_init_metrics(child);
+
+	/* Queue the data carried in the SYN.  The caller frees skb, so
+	 * take a reference.
+	 */
+	if (TCP_SKB_CB(skb)->end_seq != TCP_SKB_CB(skb)->seq + 1) {
+		skb = skb_get(skb);
+		skb_dst_drop(skb);
+		__skb_pull(skb, tcp_hdr(skb)->doff * 4);
+		skb_set_owner_r(skb, child);
+		__skb_queue_tail(&child->sk_receive_queue, skb);
+		tp->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+		tp->syn_data_acked = 1;
+	}
+	sk->sk_data_ready(sk, 0);
+	bh_unlock_sock(child);
+	sock_put(child);
+	return 0;
+}
+
 int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 {
 	struct tcp_extend_values tmp_ext;
 	struct tcp_options_received tmp_opt;
+	struct tcp_fastopen_cookie foc = { .len = -1 };
 	u8 *hash_location;
 	struct request_sock *req;
 	struct inet_request_sock *ireq;
@@ -1274,7 +1426,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tcp_clear_options(&tmp_opt);
 	tmp_opt.mss_clamp = TCP_MSS_DEFAULT;
 	tmp_opt.user_mss  = tp->rx_opt.user_mss;
-	tcp_parse_options(skb, &tmp_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tmp_opt, &hash_location, 0, &foc);
 
 	if (tmp_opt.cookie_plus > 0 &&
 	    tmp_opt.saw_tstamp &&
@@ -1311,6 +1463,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 		goto drop_and_release;
 	}
 	tmp_ext.cookie_in_always = tp->rx_opt.cookie_in_always;
+	tmp_ext.fastopen_cookie.len = -1;
 
 	if (want_cookie && !tmp_opt.saw_tstamp)
 		tcp_clear_options(&tmp_opt);
@@ -1380,6 +1533,14 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	}
 	tcp_rsk(req)->snt_isn = isn;
 
+	if (!want_cookie && foc.len >= 0 &&
+	    tcp_fastopen_check(sk, skb, &foc, &tmp_ext.fastopen_cookie)) {
+		if (tcp_v4_conn_req_fastopen(sk, skb, req, dst,
+				(struct request_values *)&tmp_ext))
+			goto drop_and_free;
+		return 0;
+	}
+
 	if (tcp_v4_send_synack(sk, dst, req,
 			       (struct request_values *)&tmp_ext) ||
 	    want_cookie)
@@ -1741,6 +1902,7 @@ do_time_wait:
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(dev_net(skb->dev),
 							&tcp_hashinfo,
+							iph->saddr, th->source,
 							iph->daddr, th->dest,
 							inet_iif(skb));
 		if (sk2) {
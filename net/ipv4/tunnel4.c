@@ -10,6 +10,7 @@
 #include <linux/skbuff.h>
 #include <linux/slab.h>
 #include <net/icmp.h>
+#include <net/inet_common.h>
 #include <net/ip.h>
 #include <net/protocol.h>
 #include <net/xfrm.h>
@@ -131,9 +132,29 @@ static void tunnel64_err(struct sk_buff *skb, u32 info)
 }
 #endif
 
+/* GRO merges TCP over IPv4 in IPIP whichever handler receives it */
+static struct sk_buff **tunnel4_gro_receive(struct sk_buff **head,
+					    struct sk_buff *skb)
+{
+	return inet_tunnel_gro_receive(head, skb, NULL, 0);
+}
+
+static int tunnel4_gro_complete(struct sk_buff *skb)
+{
+	return inet_tunnel_gro_complete(skb, 0, SKB_GSO_IPIP);
+}
+
+static struct sk_buff *tunnel4_gso_segment(struct sk_buff *skb, int features)
+{
+	return inet_tunnel_gso_segment(skb, features, 0);
+}
+
 static const struct net_protocol tunnel4_protocol = {
 	.handler	=	tunnel4_rcv,
 	.err_handler	=	tunnel4_err,
+	.gso_segment	=	tunnel4_gso_segment,
+	.gro_receive	=	tunnel4_gro_receive,
+	.gro_complete	=	tunnel4_gro_complete,
 	.no_policy	=	1,
 	.netns_ok	=	1,
 };
@@ -0,0 +1,215 @@
+/*
+ * Connection tracking table benchmark
+ *
+ * Loading this module starts one thread per online cpu.  Every thread
+ * repeatedly inserts a batch of synthetic TCP conntracks into the
+ * init_net table and deletes them again, the way confirmed connections
+ * come and go under a high connection rate.  The insertion and deletion
+ * rates, summed over all cpus, are printed to the kernel log.
+ *
+ * The conntracks use addresses from the 198.18.0.0/15 benchmarking range
+ * so they cannot clash with real traffic, but they do count against
+ * nf_conntrack_max: keep nr_cpus * batch well below it.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; version 2
+ * of the License.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/ktime.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/in.h>
+#include <linux/socket.h>
+#include <net/net_namespace.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_core.h>
+#include <net/netfilter/nf_conntrack_zones.h>
+
+static unsigned int iterations = 1000;
+module_param(iterations, uint, 0444);
+MODULE_PARM_DESC(iterations, "number of batches inserted per cpu");
+
+static unsigned int batch = 256;
+module_param(batch, uint, 0444);
+MODULE_PARM_DESC(batch, "number of conntracks alive per cpu at a time");
+
+struct nf_ct_bench_thread {
+	unsigned int		cpu;
+	struct nf_conn		**cts;
+	u64			insert_ns;
+	u64			delete_ns;
+	unsigned int		inserted;
+	unsigned int		clashed;
+	int			err;
+	struct completion	done;
+};
+
+static DECLARE_COMPLETION(nf_ct_bench_start);
+
+static struct nf_conn *nf_ct_bench_alloc(unsigned int cpu)
+{
+	struct nf_conntrack_tuple orig, repl;
+
+	memset(&orig, 0, sizeof(orig));
+	orig.src.l3num = AF_INET;
+	orig.src.u3.ip = htonl(0xc6120000 | (random32() & 0xffff));
+	orig.src.u.tcp.port = htons(1024 + (random32() % 64512));
+	orig.dst.u3.ip = htonl(0xc6130000 | (cpu & 0xffff));
+	orig.dst.u.tcp.port = htons(random32() & 0xffff);
+	orig.dst.protonum = IPPROTO_TCP;
+	orig.dst.dir = IP_CT_DIR_ORIGINAL;
+
+	memset(&repl, 0, sizeof(repl));
+	repl.src.l3num = AF_INET;
+	repl.src.u3.ip = orig.dst.u3.ip;
+	repl.src.u.tcp.port = orig.dst.u.tcp.port;
+	repl.dst.u3.ip = orig.src.u3.ip;
+	repl.dst.u.tcp.port = orig.src.u.tcp.port;
+	repl.dst.protonum = IPPROTO_TCP;
+	repl.dst.dir = IP_CT_DIR_REPLY;
+
+	return nf_conntrack_alloc(&init_net, NF_CT_DEFAULT_ZONE, &orig, &repl,
+				  GFP_KERNEL);
+}
+
+static int nf_ct_bench_thread(void *data)
+{
+	struct nf_ct_bench_thread *t = data;
+	unsigned int n, i, live;
+	struct nf_conn *ct;
+	ktime_t start;
+
+	wait_for_completion(&nf_ct_bench_start);
+
+	for (n = 0; n < iterations && !t->err; n++) {
+		start = ktime_get();
+		for (live = 0, i = 0; i < batch; i++) {
+			ct = nf_ct_bench_alloc(t->cpu);
+			if (IS_ERR(ct)) {
+				t->err = PTR_ERR(ct);
+				break;
+			}
+			ct->timeout.expires = jiffies + 3600 * HZ;
+			if (nf_conntrack_hash_check_insert(ct) < 0) {
+				nf_conntrack_free(ct);
+				t->clashed++;
+				continue;
+			}
+			t->cts[live++] = ct;
+		}
+		t->insert_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		t->inserted += live;
+
+		start = ktime_get();
+		for (i = 0; i < live; i++) {
+			ct = t->cts[i];
+			/* drops the reference of the table ... */
+			nf_ct_kill(ct);
+			/* ... and the one returned by the insertion */
+			nf_ct_put(ct);
+		}
+		t->delete_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		cond_resched();
+	}
+
+	complete(&t->done);
+	return 0;
+}
+
+static u64 nf_ct_bench_rate(u64 count, u64 ns)
+{
+	return ns ? div64_u64(count * NSEC_PER_SEC, ns) : 0;
+}
+
+static int __init nf_ct_bench_init(void)
+{
+	struct nf_ct_bench_thread *threads;
+	u64 inserted = 0, clashed = 0, insert_ns = 0, delete_ns = 0;
+	unsigned int nr = 0, i, cpu;
+	struct task_struct *task;
+	int err = 0;
+
+	if (!batch || !iterations)
+		return -EINVAL;
+
+	/* Size the array while the set of online cpus can't change */
+	get_online_cpus();
+	threads = kcalloc(num_online_cpus(), sizeof(*threads), GFP_KERNEL);
+	if (!threads) {
+		put_online_cpus();
+		return -ENOMEM;
+	}
+
+	for_each_online_cpu(cpu) {
+		struct nf_ct_bench_thread *t = &threads[nr];
+
+		t->cpu = cpu;
+		init_completion(&t->done);
+		t->cts = kcalloc(batch, sizeof(*t->cts), GFP_KERNEL);
+		if (!t->cts) {
+			err = -ENOMEM;
+			break;
+		}
+		task = kthread_create(nf_ct_bench_thread, t,
+				      "nf_ct_bench/%u", cpu);
+		if (IS_ERR(task)) {
+			kfree(t->cts);
+			err = PTR_ERR(task);
+			break;
+		}
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+		nr++;
+	}
+	put_online_cpus();
+
+	/* Threads that were started run even if starting the others
+	 * failed; there is no way to tell a thread to quit early.
+	 */
+	complete_all(&nf_ct_bench_start);
+	for (i = 0; i < nr; i++) {
+		struct nf_ct_bench_thread *t = &threads[i];
+
+		wait_for_completion(&t->done);
+		if (t->err && !err)
+			err = t->err;
+		inserted += t->inserted;
+		clashed += t->clashed;
+		/* The threads run concurrently: the slowest sets the pace */
+		insert_ns = max(insert_ns, t->insert_ns);
+		delete_ns = max(delete_ns, t->delete_ns);
+		kfree(t->cts);
+	}
+	kfree(threads);
+
+	if (err) {
+		pr_err("nf_ct_bench: failed (%d)\n", err);
+		return err;
+	}
+
+	pr_info("nf_ct_bench: %u cpus, %llu conntracks (%llu clashes)\n",
+		nr, (unsigned long long)inserted, (unsigned long long)clashed);
+	pr_info("nf_ct_bench: %llu insertions/s, %llu deletions/s\n",
+		(unsigned long long)nf_ct_bench_rate(inserted, insert_ns),
+		(unsigned long long)nf_ct_bench_rate(inserted, delete_ns));
+	return 0;
+}
+
+static void __exit nf_ct_bench_exit(void)
+{
+}
+
+module_init(nf_ct_bench_init);
+module_exit(nf_ct_bench_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Connection tracking table insertion/deletion benchmark");
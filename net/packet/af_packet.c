@@ -160,9 +160,52 @@ struct packet_mreq_max {
 	unsigned char	mr_address[MAX_ADDR_LEN];
 };
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring);
 
+#define V3_ALIGNMENT	(8)
+
+#define BLK_HDR_LEN	(ALIGN(sizeof(struct tpacket_block_desc), V3_ALIGNMENT))
+
+#define BLK_PLUS_PRIV(sz_of_priv) \
+	(BLK_HDR_LEN + ALIGN((sz_of_priv), V3_ALIGNMENT))
+
+/* retire timeout used when user space asked for none */
+#define PRB_RETIRE_TOV_DEFAULT	8	/* msecs */
+
+/*
+ * Kernel side state of a TPACKET_V3 rx ring: packets are copied back to
+ * back into the active block, which is handed over to user space when
+ * the next packet does not fit, or when the retire timer fires.
+ * Protected by sk_receive_queue.lock.
+ */
+struct tpacket_kbdq_core {
+	char		**pkbdq;	/* the blocks (rx_ring.pg_vec) */
+	unsigned int	feature_req_word;
+	unsigned int	hdrlen;
+	unsigned int	knum_blocks;
+	unsigned int	kactive_blk_num;
+	/* kactive_blk_num when the retire timer was last armed */
+	unsigned int	last_kactive_blk_num;
+	unsigned int	blk_sizeof_priv;
+
+	/* the queue is frozen until user space returns the active block */
+	unsigned char	reset_pending_on_curr_blk;
+	unsigned char	delete_blk_timer;
+
+	int		kblk_size;
+	u64		knxt_seq_num;
+	char		*prev;		/* last packet in the active block */
+	char		*nxt_offset;	/* where the next packet goes */
+
+	/* packets being copied into the active block outside the lock */
+	atomic_t	blk_fill_in_prog;
+
+	unsigned int	retire_blk_tov;	/* msecs */
+	unsigned long	tov_in_jiffies;
+	struct timer_list retire_blk_timer;
+};
+
 struct packet_ring_buffer {
 	char			**pg_vec;
 	unsigned int		head;
@@ -174,6 +217,7 @@ struct packet_ring_buffer {
 	unsigned int		pg_vec_pages;
 	unsigned int		pg_vec_len;
 
+	struct tpacket_kbdq_core	prb_bdqc;
 	atomic_t		pending;
 };
 
@@ -185,7 +229,7 @@ static void packet_flush_mclist(struct sock *sk);
 struct packet_sock {
 	/* struct sock has to be the first member of packet_sock */
 	struct sock		sk;
-	struct tpacket_stats	stats;
+	struct tpacket_stats_v3	stats;
 	struct packet_ring_buffer	rx_ring;
 	struct packet_ring_buffer	tx_ring;
 	int			copy_thresh;
@@ -235,6 +279,7 @@ static void __packet_set_status(struct packet_sock *po, void *frame, int status)
 		h.h2->tp_status = status;
 		flush_dcache_page(virt_to_page(&h.h2->tp_status));
 		break;
+	case TPACKET_V3:
 	default:
 		pr_err("TPACKET version not supported\n");
 		BUG();
@@ -261,6 +306,7 @@ static int __packet_get_status(struct packet_sock *po, void *frame)
 	case TPACKET_V2:
 		flush_dcache_page(virt_to_page(&h.h2->tp_status));
 		return h.h2->tp_status;
+	case TPACKET_V3:
 	default:
 		pr_err("TPACKET version not supported\n");
 		BUG();
@@ -316,6 +362,302 @@ static inline struct packet_sock *pkt_sk(struct sock *sk)
 	return (struct packet_sock *)sk;
 }
 
+/*
+ * TPACKET_V3 block handling.  All of it runs under sk_receive_queue.lock,
+ * except the copy of the packet data itself, see tpacket_rcv().
+ */
+
+static inline struct tpacket_block_desc *prb_block(
+		struct tpacket_kbdq_core *pkc, unsigned int idx)
+{
+	return (struct tpacket_block_desc *)pkc->pkbdq[idx];
+}
+
+static inline struct tpacket_block_desc *prb_curr_block(
+		struct tpacket_kbdq_core *pkc)
+{
+	return prb_block(pkc, pkc->kactive_blk_num);
+}
+
+static inline unsigned int prb_next_blk_num(struct tpacket_kbdq_core *pkc)
+{
+	return pkc->kactive_blk_num < pkc->knum_blocks - 1 ?
+		pkc->kactive_blk_num + 1 : 0;
+}
+
+static inline unsigned int prb_previous_blk_num(struct tpacket_kbdq_core *pkc)
+{
+	return pkc->kactive_blk_num ?
+		pkc->kactive_blk_num - 1 : pkc->knum_blocks - 1;
+}
+
+static inline unsigned int prb_block_status(struct tpacket_block_desc *pbd)
+{
+	smp_rmb();
+	flush_dcache_page(virt_to_page(&pbd->hdr.bh1.block_status));
+	return pbd->hdr.bh1.block_status;
+}
+
+static inline int prb_curr_blk_in_use(struct tpacket_block_desc *pbd)
+{
+	return prb_block_status(pbd) & TP_STATUS_USER;
+}
+
+static inline int prb_queue_frozen(struct tpacket_kbdq_core *pkc)
+{
+	return pkc->reset_pending_on_curr_blk;
+}
+
+static void prb_refresh_retire_blk_timer(struct tpacket_kbdq_core *pkc)
+{
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+	pkc->last_kactive_blk_num = pkc->kactive_blk_num;
+}
+
+static void prb_open_block(struct tpacket_kbdq_core *pkc,
+		struct tpacket_block_desc *pbd)
+{
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+	struct timespec ts;
+
+	pbd->version = TPACKET_V3;
+	pbd->offset_to_priv = BLK_HDR_LEN;
+	h1->seq_num = pkc->knxt_seq_num++;
+	h1->num_pkts = 0;
+	h1->offset_to_first_pkt = BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	h1->blk_len = h1->offset_to_first_pkt;
+
+	getnstimeofday(&ts);
+	h1->ts_first_pkt.ts_sec = ts.tv_sec;
+	h1->ts_first_pkt.ts_nsec = ts.tv_nsec;
+	h1->ts_last_pkt = h1->ts_first_pkt;
+
+	pkc->nxt_offset = (char *)pbd + h1->offset_to_first_pkt;
+	pkc->prev = pkc->nxt_offset;
+	pkc->reset_pending_on_curr_blk = 0;
+
+	prb_refresh_retire_blk_timer(pkc);
+}
+
+/* Hand the active block over to user space and move to the next one. */
+static void prb_close_block(struct tpacket_kbdq_core *pkc,
+		struct tpacket_block_desc *pbd, struct packet_sock *po,
+		unsigned int status)
+{
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+	struct sock *sk = &po->sk;
+
+	if (po->stats.tp_drops)
+		status |= TP_STATUS_LOSING;
+
+	if (h1->num_pkts) {
+		struct tpacket3_hdr *last_pkt = (struct tpacket3_hdr *)pkc->prev;
+
+		last_pkt->tp_next_offset = 0;
+		h1->ts_last_pkt.ts_sec = last_pkt->tp_sec;
+		h1->ts_last_pkt.ts_nsec = last_pkt->tp_nsec;
+	} else {
+		struct timespec ts;
+
+		getnstimeofday(&ts);
+		h1->ts_last_pkt.ts_sec = ts.tv_sec;
+		h1->ts_last_pkt.ts_nsec = ts.tv_nsec;
+	}
+
+	/* the block contents must be visible before its status */
+	smp_wmb();
+	h1->block_status = TP_STATUS_USER | status;
+	flush_dcache_page(virt_to_page(&h1->block_status));
+	smp_wmb();
+
+	sk->sk_data_ready(sk, 0);
+
+	pkc->kactive_blk_num = prb_next_blk_num(pkc);
+}
+
+static void prb_retire_current_block(struct tpacket_kbdq_core *pkc,
+		struct packet_sock *po, unsigned int status)
+{
+	struct tpacket_block_desc *pbd = prb_curr_block(pkc);
+
+	if (prb_block_status(pbd) != TP_STATUS_KERNEL)
+		return;
+
+	/*
+	 * tpacket_rcv() on another cpu may still be copying a packet into
+	 * this block; it must finish before user space sees the block.
+	 */
+	while (atomic_read(&pkc->blk_fill_in_prog))
+		cpu_relax();
+
+	prb_close_block(pkc, pbd, po, status);
+}
+
+/*
+ * Open the next block, or freeze the queue if user space still holds
+ * it: packets are then dropped until the block comes back.
+ */
+static char *prb_dispatch_next_block(struct tpacket_kbdq_core *pkc,
+		struct packet_sock *po)
+{
+	struct tpacket_block_desc *pbd = prb_curr_block(pkc);
+
+	if (prb_curr_blk_in_use(pbd)) {
+		pkc->reset_pending_on_curr_blk = 1;
+		po->stats.tp_freeze_q_cnt++;
+		return NULL;
+	}
+
+	prb_open_block(pkc, pbd);
+	return pkc->nxt_offset;
+}
+
+/*
+ * Retire a partially filled block when no packet arrived to fill it
+ * within retire_blk_tov, so that user space never waits too long on a
+ * slow link.
+ */
+static void prb_retire_rx_blk_timer_expired(unsigned long data)
+{
+	struct packet_sock *po = (struct packet_sock *)data;
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	struct tpacket_block_desc *pbd;
+
+	spin_lock(&po->sk.sk_receive_queue.lock);
+
+	if (unlikely(pkc->delete_blk_timer))
+		goto out;
+
+	pbd = prb_curr_block(pkc);
+
+	/* nothing to do if the block was retired since the timer was armed */
+	if (pkc->last_kactive_blk_num == pkc->kactive_blk_num) {
+		if (!prb_queue_frozen(pkc)) {
+			if (pbd->hdr.bh1.num_pkts) {
+				prb_retire_current_block(pkc, po,
+							 TP_STATUS_BLK_TMO);
+				/* opening the next block rearms the timer */
+				if (prb_dispatch_next_block(pkc, po))
+					goto out;
+			}
+		} else if (!prb_curr_blk_in_use(pbd)) {
+			/* user space caught up while the link was idle */
+			prb_open_block(pkc, pbd);
+			goto out;
+		}
+	}
+	prb_refresh_retire_blk_timer(pkc);
+out:
+	spin_unlock(&po->sk.sk_receive_queue.lock);
+}
+
+static void prb_fill_curr_block(char *curr, struct tpacket_kbdq_core *pkc,
+		struct tpacket_block_desc *pbd, struct sk_buff *skb,
+		unsigned int len)
+{
+	struct tpacket3_hdr *ppd = (struct tpacket3_hdr *)curr;
+	unsigned int total = ALIGN(len, V3_ALIGNMENT);
+
+	ppd->tp_next_offset = total;
+	if (pkc->feature_req_word & TP_FT_REQ_FILL_RXHASH)
+		ppd->hv1.tp_rxhash = skb->rxhash;
+	else
+		ppd->hv1.tp_rxhash = 0;
+	ppd->hv1.tp_vlan_tci = vlan_tx_tag_get(skb);
+
+	pkc->prev = curr;
+	pkc->nxt_offset += total;
+	pbd->hdr.bh1.blk_len += total;
+	pbd->hdr.bh1.num_pkts++;
+	atomic_inc(&pkc->blk_fill_in_prog);
+}
+
+/* Reserve room for a len bytes packet in the active block. */
+static void *__packet_lookup_frame_in_block(struct packet_sock *po,
+		struct sk_buff *skb, unsigned int len)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	struct tpacket_block_desc *pbd = prb_curr_block(pkc);
+	char *curr, *end;
+
+	if (prb_queue_frozen(pkc)) {
+		if (prb_curr_blk_in_use(pbd))
+			return NULL;
+		/* the block came back: reopening it thaws the queue */
+		prb_open_block(pkc, pbd);
+	}
+
+	curr = pkc->nxt_offset;
+	end = (char *)pbd + pkc->kblk_size;
+
+	if (curr + ALIGN(len, V3_ALIGNMENT) > end) {
+		prb_retire_current_block(pkc, po, 0);
+		curr = prb_dispatch_next_block(pkc, po);
+		if (!curr)
+			return NULL;
+		pbd = prb_curr_block(pkc);
+	}
+
+	prb_fill_curr_block(curr, pkc, pbd, skb, len);
+	return curr;
+}
+
+static void *packet_current_rx_frame(struct packet_sock *po,
+		struct sk_buff *skb, int status, unsigned int len)
+{
+	if (po->tp_version <= TPACKET_V2)
+		return packet_current_frame(po, &po->rx_ring, status);
+	return __packet_lookup_frame_in_block(po, skb, len);
+}
+
+static void *packet_previous_rx_frame(struct packet_sock *po,
+		struct packet_ring_buffer *rb, int status)
+{
+	struct tpacket_block_desc *pbd;
+
+	if (po->tp_version <= TPACKET_V2)
+		return packet_previous_frame(po, rb, status);
+
+	pbd = prb_block(&rb->prb_bdqc, prb_previous_blk_num(&rb->prb_bdqc));
+	if (prb_block_status(pbd) != status)
+		return NULL;
+	return pbd;
+}
+
+static void init_prb_bdqc(struct packet_sock *po,
+		struct packet_ring_buffer *rb, struct tpacket_req3 *req3)
+{
+	struct tpacket_kbdq_core *pkc = &rb->prb_bdqc;
+
+	memset(pkc, 0, sizeof(*pkc));
+	pkc->pkbdq = rb->pg_vec;
+	pkc->knum_blocks = req3->tp_block_nr;
+	pkc->kblk_size = req3->tp_block_size;
+	pkc->hdrlen = po->tp_hdrlen;
+	pkc->knxt_seq_num = 1;
+	pkc->blk_sizeof_priv = req3->tp_sizeof_priv;
+	pkc->feature_req_word = req3->tp_feature_req_word;
+	pkc->retire_blk_tov = req3->tp_retire_blk_tov ? :
+			      PRB_RETIRE_TOV_DEFAULT;
+	pkc->tov_in_jiffies = msecs_to_jiffies(pkc->retire_blk_tov) ? : 1;
+	setup_timer(&pkc->retire_blk_timer, prb_retire_rx_blk_timer_expired,
+		    (unsigned long)po);
+
+	prb_open_block(pkc, prb_curr_block(pkc));
+}
+
+static void prb_shutdown_retire_blk_timer(struct packet_sock *po,
+		struct sk_buff_head *rb_queue)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+
+	spin_lock_bh(&rb_queue->lock);
+	pkc->delete_blk_timer = 1;
+	spin_unlock_bh(&rb_queue->lock);
+
+	del_timer_sync(&pkc->retire_blk_timer);
+}
+
 static void packet_sock_destruct(struct sock *sk)
 {
 	skb_queue_purge(&sk->sk_error_queue);
@@ -511,7 +853,7 @@ static inline unsigned int run_filter(struct sk_buff *skb, struct sock *sk,
 	rcu_read_lock_bh();
 	filter = rcu_dereference_bh(sk->sk_filter);
 	if (filter != NULL)
-		res = sk_run_filter(skb, filter->insns, filter->len);
+		res = SK_RUN_FILTER(filter, skb);
 	rcu_read_unlock_bh();
 
 	return res;
@@ -648,6 +990,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} h;
 	u8 *skb_head = skb->data;
@@ -719,10 +1062,12 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	}
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h.raw = packet_current_frame(po, &po->rx_ring, TP_STATUS_KERNEL);
+	h.raw = packet_current_rx_frame(po, skb, TP_STATUS_KERNEL,
+					macoff + snaplen);
 	if (!h.raw)
 		goto ring_is_full;
-	packet_increment_head(&po->rx_ring);
+	if (po->tp_version <= TPACKET_V2)
+		packet_increment_head(&po->rx_ring);
 	po->stats.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
@@ -774,6 +1119,27 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		h.h2->tp_vlan_tci = vlan_tx_tag_get(skb);
 		hdrlen = sizeof(*h.h2);
 		break;
+	case TPACKET_V3:
+		/* tp_next_offset and hv1 were set up with the block */
+		h.h3->tp_status = status;
+		h.h3->tp_len = skb->len;
+		h.h3->tp_snaplen = snaplen;
+		h.h3->tp_mac = macoff;
+		h.h3->tp_net = netoff;
+		if ((po->tp_tstamp & SOF_TIMESTAMPING_SYS_HARDWARE)
+				&& shhwtstamps->syststamp.tv64)
+			ts = ktime_to_timespec(shhwtstamps->syststamp);
+		else if ((po->tp_tstamp & SOF_TIMESTAMPING_RAW_HARDWARE)
+				&& shhwtstamps->hwtstamp.tv64)
+			ts = ktime_to_timespec(shhwtstamps->hwtstamp);
+		else if (skb->tstamp.tv64)
+			ts = ktime_to_timespec(skb->tstamp);
+		else
+			getnstimeofday(&ts);
+		h.h3->tp_sec = ts.tv_sec;
+		h.h3->tp_nsec = ts.tv_nsec;
+		hdrlen = sizeof(*h.h3);
+		break;
 	default:
 		BUG();
 	}
@@ -789,7 +1155,8 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	else
 		sll->sll_ifindex = dev->ifindex;
 
-	__packet_set_status(po, h.raw, status);
+	if (po->tp_version <= TPACKET_V2)
+		__packet_set_status(po, h.raw, status);
 	smp_mb();
 	{
 		struct page *p_start, *p_end;
@@ -803,7 +1170,11 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		}
 	}
 
-	sk->sk_data_ready(sk, 0);
+	/* V3 wakes user space up when the block is retired */
+	if (po->tp_version <= TPACKET_V2)
+		sk->sk_data_ready(sk, 0);
+	else
+		atomic_dec(&po->rx_ring.prb_bdqc.blk_fill_in_prog);
 
 drop_n_restore:
 	if (skb_head != skb->data && skb_shared(skb)) {
@@ -1279,7 +1650,7 @@ static int packet_release(struct socket *sock)
 	struct sock *sk = sock->sk;
 	struct packet_sock *po;
 	struct net *net;
-	struct tpacket_req req;
+	union tpacket_req_u req_u;
 
 	if (!sk)
 		return 0;
@@ -1306,13 +1677,13 @@ static int packet_release(struct socket *sock)
 
 	packet_flush_mclist(sk);
 
-	memset(&req, 0, sizeof(req));
+	memset(&req_u, 0, sizeof(req_u));
 
 	if (po->rx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 0);
+		packet_set_ring(sk, &req_u, 1, 0);
 
 	if (po->tx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 1);
+		packet_set_ring(sk, &req_u, 1, 1);
 
 	synchronize_net();
 	/*
@@ -1619,7 +1990,9 @@ static int packet_recvmsg(struct kiocb *iocb, struct socket *sock,
 			/* This is a hint as to how much should be linear. */
 			vnet_hdr.hdr_len = skb_headlen(skb);
 			vnet_hdr.gso_size = sinfo->gso_size;
-			if (sinfo->gso_type & SKB_GSO_TCPV4)
+			if (sinfo->gso_type & (SKB_GSO_GRE | SKB_GSO_IPIP))
+				goto out_free;
+			else if (sinfo->gso_type & SKB_GSO_TCPV4)
 				vnet_hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
 			else if (sinfo->gso_type & SKB_GSO_TCPV6)
 				vnet_hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
@@ -1935,15 +2308,27 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 	case PACKET_RX_RING:
 	case PACKET_TX_RING:
 	{
-		struct tpacket_req req;
+		union tpacket_req_u req_u;
+		int len;
 
-		if (optlen < sizeof(req))
+		switch (po->tp_version) {
+		case TPACKET_V1:
+		case TPACKET_V2:
+			len = sizeof(req_u.req);
+			break;
+		case TPACKET_V3:
+		default:
+			len = sizeof(req_u.req3);
+			break;
+		}
+		if (optlen < len)
 			return -EINVAL;
 		if (pkt_sk(sk)->has_vnet_hdr)
 			return -EINVAL;
-		if (copy_from_user(&req, optval, sizeof(req)))
+		if (copy_from_user(&req_u.req, optval, len))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
+		return packet_set_ring(sk, &req_u, 0,
+				       optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -1970,6 +2355,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		switch (val) {
 		case TPACKET_V1:
 		case TPACKET_V2:
+		case TPACKET_V3:
 			po->tp_version = val;
 			return 0;
 		default:
@@ -2067,7 +2453,7 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	struct sock *sk = sock->sk;
 	struct packet_sock *po = pkt_sk(sk);
 	void *data;
-	struct tpacket_stats st;
+	struct tpacket_stats_v3 st;
 
 	if (level != SOL_PACKET)
 		return -ENOPROTOOPT;
@@ -2080,7 +2466,10 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 
 	switch (optname) {
 	case PACKET_STATISTICS:
-		if (len > sizeof(struct tpacket_stats))
+		if (po->tp_version == TPACKET_V3) {
+			if (len > sizeof(struct tpacket_stats_v3))
+				len = sizeof(struct tpacket_stats_v3);
+		} else if (len > sizeof(struct tpacket_stats))
 			len = sizeof(struct tpacket_stats);
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		st = po->stats;
@@ -2129,6 +2518,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		case TPACKET_V2:
 			val = sizeof(struct tpacket2_hdr);
 			break;
+		case TPACKET_V3:
+			val = sizeof(struct tpacket3_hdr);
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -2279,7 +2671,8 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
 	if (po->rx_ring.pg_vec) {
-		if (!packet_previous_frame(po, &po->rx_ring, TP_STATUS_KERNEL))
+		if (!packet_previous_rx_frame(po, &po->rx_ring,
+					      TP_STATUS_KERNEL))
 			mask |= POLLIN | POLLRDNORM;
 	}
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
@@ -2365,9 +2758,10 @@ out_free_pgvec:
 	goto out;
 }
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
+	struct tpacket_req *req = &req_u->req;
 	char **pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
 	int was_running, order = 0;
@@ -2400,6 +2794,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		case TPACKET_V2:
 			po->tp_hdrlen = TPACKET2_HDRLEN;
 			break;
+		case TPACKET_V3:
+			po->tp_hdrlen = TPACKET3_HDRLEN;
+			break;
 		}
 
 		err = -EINVAL;
@@ -2419,6 +2816,14 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		if (unlikely((rb->frames_per_block * req->tp_block_nr) !=
 					req->tp_frame_nr))
 			goto out;
+		if (po->tp_version == TPACKET_V3) {
+			/* V3 has no tx ring; a whole frame must fit a block */
+			if (unlikely(tx_ring))
+				goto out;
+			if (unlikely(BLK_PLUS_PRIV((u64)req_u->req3.tp_sizeof_priv) +
+				     req->tp_frame_size > req->tp_block_size))
+				goto out;
+		}
 
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
@@ -2453,12 +2858,16 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	mutex_lock(&po->pg_vec_lock);
 	if (closing || atomic_read(&po->mapped) == 0) {
 		err = 0;
+		if (po->tp_version == TPACKET_V3 && !tx_ring && rb->pg_vec)
+			prb_shutdown_retire_blk_timer(po, rb_queue);
 #define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
 		spin_lock_bh(&rb_queue->lock);
 		pg_vec = XC(rb->pg_vec, pg_vec);
 		rb->frame_max = (req->tp_frame_nr - 1);
 		rb->head = 0;
 		rb->frame_size = req->tp_frame_size;
+		if (po->tp_version == TPACKET_V3 && !tx_ring && rb->pg_vec)
+			init_prb_bdqc(po, rb, &req_u->req3);
 		spin_unlock_bh(&rb_queue->lock);
 
 		order = XC(rb->pg_vec_order, order);
@@ -145,7 +145,7 @@ static int route4_classify(struct sk_buff *skb, struct tcf_proto *tp,
 	if (head == NULL)
 		goto old_method;
 
-	iif = ((struct rtable*)dst)->fl.iif;
+	iif = rt_is_input_route((struct rtable *)dst) ? inet_iif(skb) : 0;
 
 	h = route4_fastmap_hash(id, iif);
 	if (id == head->fastmap[h].id &&
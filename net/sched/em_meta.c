@@ -261,8 +261,10 @@ META_COLLECTOR(int_rtiif)
 {
 	if (unlikely(skb_rtable(skb) == NULL))
 		*err = -1;
+	else if (rt_is_input_route(skb_rtable(skb)))
+		dst->value = inet_iif(skb);
 	else
-		dst->value = skb_rtable(skb)->fl.iif;
+		dst->value = 0;
 }
 
 /**************************************************************************